@@ -0,0 +1,318 @@
+//*********************************************************
+//
+// Copyright 2020 Intel Corporation 
+//
+// Permission is hereby granted, free of charge, to any 
+// person obtaining a copy of this software and associated 
+// documentation files(the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights 
+// to use, copy, modify, merge, publish, distribute, sublicense, 
+// and/or sell copies of the Software, and to permit persons to 
+// whom the Software is furnished to do so, subject to the 
+// following conditions :
+// The above copyright notice and this permission notice shall 
+// be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+// DEALINGS IN THE SOFTWARE.
+//
+//*********************************************************
+#include <cassert>
+#include <cfloat> // for FLT_MAX
+#include <algorithm> // for std::min()
+#include <fstream>
+
+#include "d3dx12.h"
+#include "DXSampleHelper.h"
+#include "defines.h"
+
+#include "AdapterProbe.h"
+#include "PipelineCache.h"
+
+namespace
+{
+    // bump when the measurements change, so cached results are measured again
+    constexpr UINT ProbeVersion = 1;
+
+    // the compute dispatch doubles its iterations until it takes at least this long
+    constexpr double MinComputeTime = 0.002;
+    constexpr UINT MaxComputeIterations = 1 << 16;
+    constexpr UINT ComputeNumGroups = 4096;
+    constexpr float FlopsPerIteration = 8.0f; // see AdapterProbeCS.hlsl
+
+    // the positions of the most particles, a float4 each
+    constexpr UINT64 CopySize = UINT64(MAX_NUM_PARTICLES) * 4 * sizeof(float);
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+bool AdapterProbe::GetSupported(const DXGI_ADAPTER_DESC1& in_desc)
+{
+    return (0 == (in_desc.Flags & DXGI_ADAPTER_FLAG_SOFTWARE)) && (m_VENDOR_ID_MICROSOFT != in_desc.VendorId);
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+AdapterProbe::Capabilities AdapterProbe::Probe(IDXGIAdapter1* in_pAdapter)
+{
+    const std::wstring path = PipelineCache::GetCacheDirectory() + L"probe_" + PipelineCache::GetAdapterKey(in_pAdapter) + L".txt";
+
+    Capabilities capabilities = {};
+    if (!Load(path, capabilities))
+    {
+        Measure(in_pAdapter, capabilities);
+        Save(path, capabilities);
+    }
+    return capabilities;
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+bool AdapterProbe::Load(const std::wstring& in_path, Capabilities& out_capabilities)
+{
+    std::ifstream file(in_path);
+    UINT version = 0;
+    file >> version >> out_capabilities.m_uma >> out_capabilities.m_crossAdapterRowMajorTexture
+        >> out_capabilities.m_dedicatedVideoMemory >> out_capabilities.m_computeRate >> out_capabilities.m_copyBandwidth;
+    return bool(file) && (ProbeVersion == version) && (out_capabilities.m_computeRate > 0);
+}
+
+//-----------------------------------------------------------------------------
+// a cache that can't be written is not an error
+//-----------------------------------------------------------------------------
+void AdapterProbe::Save(const std::wstring& in_path, const Capabilities& in_capabilities)
+{
+    std::ofstream file(in_path, std::ios::trunc);
+    file << ProbeVersion << ' ' << in_capabilities.m_uma << ' ' << in_capabilities.m_crossAdapterRowMajorTexture
+        << ' ' << in_capabilities.m_dedicatedVideoMemory << ' ' << in_capabilities.m_computeRate
+        << ' ' << in_capabilities.m_copyBandwidth << '\n';
+}
+
+//-----------------------------------------------------------------------------
+// a throwaway device with one compute queue. the work is timed with timestamps around it
+//-----------------------------------------------------------------------------
+void AdapterProbe::Measure(IDXGIAdapter1* in_pAdapter, Capabilities& out_capabilities)
+{
+    DXGI_ADAPTER_DESC1 desc = {};
+    ThrowIfFailed(in_pAdapter->GetDesc1(&desc));
+    out_capabilities.m_dedicatedVideoMemory = desc.DedicatedVideoMemory;
+
+    ComPtr<ID3D12Device> device;
+    ThrowIfFailed(::D3D12CreateDevice(in_pAdapter, MINIMUM_D3D_FEATURE_LEVEL, IID_PPV_ARGS(&device)));
+
+    D3D12_FEATURE_DATA_ARCHITECTURE architecture = {};
+    out_capabilities.m_uma = SUCCEEDED(device->CheckFeatureSupport(D3D12_FEATURE_ARCHITECTURE, &architecture, sizeof(architecture)))
+        && architecture.UMA;
+
+    D3D12_FEATURE_DATA_D3D12_OPTIONS options = {};
+    out_capabilities.m_crossAdapterRowMajorTexture = SUCCEEDED(device->CheckFeatureSupport(D3D12_FEATURE_D3D12_OPTIONS, &options, sizeof(options)))
+        && options.CrossAdapterRowMajorTextureSupported;
+
+    //-------------------------------------------------------------------------
+    // queue and timestamps
+    //-------------------------------------------------------------------------
+    const D3D12_COMMAND_QUEUE_DESC queueDesc = { D3D12_COMMAND_LIST_TYPE_COMPUTE, 0, D3D12_COMMAND_QUEUE_FLAG_NONE, 0 };
+    ComPtr<ID3D12CommandQueue> commandQueue;
+    ThrowIfFailed(device->CreateCommandQueue(&queueDesc, IID_PPV_ARGS(&commandQueue)));
+
+    ComPtr<ID3D12CommandAllocator> commandAllocator;
+    ThrowIfFailed(device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_COMPUTE, IID_PPV_ARGS(&commandAllocator)));
+    ComPtr<ID3D12GraphicsCommandList> commandList;
+    ThrowIfFailed(device->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_COMPUTE, commandAllocator.Get(), nullptr, IID_PPV_ARGS(&commandList)));
+    ThrowIfFailed(commandList->Close());
+
+    ComPtr<ID3D12Fence> fence;
+    UINT64 fenceValue = 0;
+    ThrowIfFailed(device->CreateFence(fenceValue, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&fence)));
+    const HANDLE fenceEvent = ::CreateEvent(nullptr, FALSE, FALSE, nullptr);
+
+    const D3D12_QUERY_HEAP_DESC queryHeapDesc = { D3D12_QUERY_HEAP_TYPE_TIMESTAMP, 2, 0 };
+    ComPtr<ID3D12QueryHeap> queryHeap;
+    ThrowIfFailed(device->CreateQueryHeap(&queryHeapDesc, IID_PPV_ARGS(&queryHeap)));
+
+    const D3D12_HEAP_PROPERTIES readbackHeapProperties = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_READBACK);
+    const D3D12_RESOURCE_DESC readbackDesc = CD3DX12_RESOURCE_DESC::Buffer(2 * sizeof(UINT64));
+    ComPtr<ID3D12Resource> readbackBuffer;
+    ThrowIfFailed(device->CreateCommittedResource(&readbackHeapProperties, D3D12_HEAP_FLAG_NONE, &readbackDesc,
+        D3D12_RESOURCE_STATE_COPY_DEST, nullptr, IID_PPV_ARGS(&readbackBuffer)));
+
+    UINT64 timestampFrequency = 0;
+    ThrowIfFailed(commandQueue->GetTimestampFrequency(&timestampFrequency));
+
+    // records the commands between two timestamps, submits and waits. returns the gpu time in seconds
+    auto Time = [&](auto in_record)
+    {
+        ThrowIfFailed(commandAllocator->Reset());
+        ThrowIfFailed(commandList->Reset(commandAllocator.Get(), nullptr));
+        commandList->EndQuery(queryHeap.Get(), D3D12_QUERY_TYPE_TIMESTAMP, 0);
+        in_record(commandList.Get());
+        commandList->EndQuery(queryHeap.Get(), D3D12_QUERY_TYPE_TIMESTAMP, 1);
+        commandList->ResolveQueryData(queryHeap.Get(), D3D12_QUERY_TYPE_TIMESTAMP, 0, 2, readbackBuffer.Get(), 0);
+        ThrowIfFailed(commandList->Close());
+
+        ID3D12CommandList* ppCommandLists[] = { commandList.Get() };
+        commandQueue->ExecuteCommandLists(1, ppCommandLists);
+
+        fenceValue++;
+        ThrowIfFailed(commandQueue->Signal(fence.Get(), fenceValue));
+        ThrowIfFailed(fence->SetEventOnCompletion(fenceValue, fenceEvent));
+        const DWORD rv = ::WaitForSingleObject(fenceEvent, INFINITE);
+        assert(rv == WAIT_OBJECT_0);
+
+        const D3D12_RANGE readRange = { 0, 2 * sizeof(UINT64) };
+        const D3D12_RANGE writeRange = { 0, 0 };
+        UINT64* pTimestamps = nullptr;
+        ThrowIfFailed(readbackBuffer->Map(0, &readRange, reinterpret_cast<void**>(&pTimestamps)));
+        const double time = double(pTimestamps[1] - pTimestamps[0]) / double(timestampFrequency);
+        readbackBuffer->Unmap(0, &writeRange);
+        return time;
+    };
+
+    //-------------------------------------------------------------------------
+    // compute rate
+    //-------------------------------------------------------------------------
+    {
+        CD3DX12_ROOT_PARAMETER rootParameters[2];
+        rootParameters[0].InitAsConstants(1, 0);
+        rootParameters[1].InitAsUnorderedAccessView(0);
+        const CD3DX12_ROOT_SIGNATURE_DESC rootSignatureDesc(_countof(rootParameters), rootParameters);
+
+        ComPtr<ID3DBlob> signature;
+        ComPtr<ID3DBlob> error;
+        ThrowIfFailed(::D3D12SerializeRootSignature(&rootSignatureDesc, D3D_ROOT_SIGNATURE_VERSION_1, &signature, &error));
+        ComPtr<ID3D12RootSignature> rootSignature;
+        ThrowIfFailed(device->CreateRootSignature(0, signature->GetBufferPointer(), signature->GetBufferSize(), IID_PPV_ARGS(&rootSignature)));
+
+        const ComPtr<ID3DBlob> computeShader = PipelineCache::CompileShader(L"AdapterProbeCS.hlsl", nullptr, "CSProbe", "cs_5_0", 0);
+
+        D3D12_COMPUTE_PIPELINE_STATE_DESC pipelineDesc = {};
+        pipelineDesc.pRootSignature = rootSignature.Get();
+        pipelineDesc.CS = CD3DX12_SHADER_BYTECODE(computeShader.Get());
+        ComPtr<ID3D12PipelineState> pipelineState;
+        ThrowIfFailed(device->CreateComputePipelineState(&pipelineDesc, IID_PPV_ARGS(&pipelineState)));
+
+        const UINT numThreads = ComputeNumGroups * BLOCK_SIZE;
+        const D3D12_HEAP_PROPERTIES defaultHeapProperties = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT);
+        const D3D12_RESOURCE_DESC outputDesc = CD3DX12_RESOURCE_DESC::Buffer(UINT64(numThreads) * 4 * sizeof(float), D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS);
+        ComPtr<ID3D12Resource> outputBuffer;
+        ThrowIfFailed(device->CreateCommittedResource(&defaultHeapProperties, D3D12_HEAP_FLAG_NONE, &outputDesc,
+            D3D12_RESOURCE_STATE_UNORDERED_ACCESS, nullptr, IID_PPV_ARGS(&outputBuffer)));
+
+        // the first dispatches also warm up the clocks
+        UINT numIterations = 64;
+        double time = 0;
+        for (;;)
+        {
+            time = Time([&](ID3D12GraphicsCommandList* in_pCommandList)
+            {
+                in_pCommandList->SetPipelineState(pipelineState.Get());
+                in_pCommandList->SetComputeRootSignature(rootSignature.Get());
+                in_pCommandList->SetComputeRoot32BitConstant(0, numIterations, 0);
+                in_pCommandList->SetComputeRootUnorderedAccessView(1, outputBuffer->GetGPUVirtualAddress());
+                in_pCommandList->Dispatch(ComputeNumGroups, 1, 1);
+            });
+            if ((time >= MinComputeTime) || (numIterations >= MaxComputeIterations))
+            {
+                break;
+            }
+            numIterations *= 2;
+        }
+        out_capabilities.m_computeRate = (time > 0) ? float(double(numThreads) * numIterations * FlopsPerIteration / time * 1e-9) : 0.0f;
+    }
+
+    //-------------------------------------------------------------------------
+    // copy bandwidth into a cross-adapter heap
+    //-------------------------------------------------------------------------
+    {
+        const D3D12_HEAP_PROPERTIES defaultHeapProperties = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT);
+        const D3D12_RESOURCE_DESC localDesc = CD3DX12_RESOURCE_DESC::Buffer(CopySize);
+        ComPtr<ID3D12Resource> localBuffer;
+        ThrowIfFailed(device->CreateCommittedResource(&defaultHeapProperties, D3D12_HEAP_FLAG_NONE, &localDesc,
+            D3D12_RESOURCE_STATE_COPY_SOURCE, nullptr, IID_PPV_ARGS(&localBuffer)));
+
+        const D3D12_RESOURCE_DESC crossAdapterDesc = CD3DX12_RESOURCE_DESC::Buffer(CopySize, D3D12_RESOURCE_FLAG_ALLOW_CROSS_ADAPTER);
+        const CD3DX12_HEAP_DESC heapDesc(
+            device->GetResourceAllocationInfo(0, 1, &crossAdapterDesc).SizeInBytes,
+            D3D12_HEAP_TYPE_DEFAULT, 0,
+            D3D12_HEAP_FLAG_SHARED | D3D12_HEAP_FLAG_SHARED_CROSS_ADAPTER);
+
+        ComPtr<ID3D12Heap> crossAdapterHeap;
+        ComPtr<ID3D12Resource> crossAdapterBuffer;
+        if (SUCCEEDED(device->CreateHeap(&heapDesc, IID_PPV_ARGS(&crossAdapterHeap))) &&
+            SUCCEEDED(device->CreatePlacedResource(crossAdapterHeap.Get(), 0, &crossAdapterDesc,
+                D3D12_RESOURCE_STATE_COPY_DEST, nullptr, IID_PPV_ARGS(&crossAdapterBuffer))))
+        {
+            // the first copy pages the heap in
+            double time = 0;
+            for (UINT i = 0; i < 2; i++)
+            {
+                time = Time([&](ID3D12GraphicsCommandList* in_pCommandList)
+                {
+                    in_pCommandList->CopyBufferRegion(crossAdapterBuffer.Get(), 0, localBuffer.Get(), 0, CopySize);
+                });
+            }
+            out_capabilities.m_copyBandwidth = (time > 0) ? float(double(CopySize) / time * 1e-9) : 0.0f;
+        }
+    }
+
+    ::CloseHandle(fenceEvent);
+}
+
+//-----------------------------------------------------------------------------
+// Amdahl: splitting the frame across adapters only helps as much as the slowest stage allows
+//-----------------------------------------------------------------------------
+AdapterProbe::Roles AdapterProbe::AssignRoles(const std::vector<Capabilities>& in_capabilities, UINT in_numParticles)
+{
+    const float simulateWork = float(in_numParticles) * m_SIMULATE_FLOPS_PER_PARTICLE * 1e-9f; // GFLOP
+    const float drawWork = float(in_numParticles) * m_DRAW_FLOPS_PER_PARTICLE * 1e-9f;
+    const float transferSize = float(in_numParticles) * 4 * sizeof(float) * 1e-9f;             // GB
+
+    const int numAdapters = int(in_capabilities.size());
+
+    // one adapter renders and simulates, async compute mode
+    Roles single = { 0, 0 };
+    float singleTime = FLT_MAX;
+    for (int i = 0; i < numAdapters; i++)
+    {
+        const float rate = in_capabilities[i].m_computeRate;
+        const float time = (rate > 0) ? ((simulateWork + drawWork) / rate) : FLT_MAX;
+        if (time < singleTime)
+        {
+            singleTime = time;
+            single = { i, i };
+        }
+    }
+
+    // the stages overlap, the slowest of them sets the frame time
+    // the simulation results are written to the cross-adapter heap by one adapter and read by the other
+    Roles multi = single;
+    float multiTime = FLT_MAX;
+    for (int render = 0; render < numAdapters; render++)
+    {
+        for (int compute = 0; compute < numAdapters; compute++)
+        {
+            const Capabilities& r = in_capabilities[render];
+            const Capabilities& c = in_capabilities[compute];
+            const float bandwidth = std::min(r.m_copyBandwidth, c.m_copyBandwidth);
+            if ((render == compute) || (r.m_computeRate <= 0) || (c.m_computeRate <= 0) || (bandwidth <= 0))
+            {
+                continue;
+            }
+
+            const float time = std::max(std::max(simulateWork / c.m_computeRate, drawWork / r.m_computeRate), transferSize / bandwidth);
+            if (time < multiTime)
+            {
+                multiTime = time;
+                multi = { render, compute };
+            }
+        }
+    }
+
+    return (multiTime < (singleTime * m_MULTI_ADAPTER_MARGIN)) ? multi : single;
+}
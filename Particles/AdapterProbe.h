@@ -0,0 +1,89 @@
+//*********************************************************
+//
+// Copyright 2020 Intel Corporation 
+//
+// Permission is hereby granted, free of charge, to any 
+// person obtaining a copy of this software and associated 
+// documentation files(the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights 
+// to use, copy, modify, merge, publish, distribute, sublicense, 
+// and/or sell copies of the Software, and to permit persons to 
+// whom the Software is furnished to do so, subject to the 
+// following conditions :
+// The above copyright notice and this permission notice shall 
+// be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+// DEALINGS IN THE SOFTWARE.
+//
+//*********************************************************
+#pragma once
+
+#include <dxgi1_6.h>
+#include <d3d12.h>
+#include <wrl.h>
+#include <string>
+#include <vector>
+
+using Microsoft::WRL::ComPtr;
+
+/*======================================================
+AdapterProbe
+
+Measures what each adapter is good at, to assign the render and compute roles:
+- compute rate: a dispatch of dependent multiply-adds, calibrated to run a few ms
+- copy bandwidth: from a local buffer into a cross-adapter heap, the path of the simulation results
+- UMA, CrossAdapterRowMajorTextureSupported and the dedicated video memory
+
+Probing takes a few submissions per adapter, so the results are cached in the Cache directory,
+keyed like the pipeline libraries, see PipelineCache::GetAdapterKey(). The LUID changes every boot.
+
+Usage: Probe() every adapter, then AssignRoles()
+======================================================*/
+class AdapterProbe
+{
+public:
+    struct Capabilities
+    {
+        bool m_uma;
+        bool m_crossAdapterRowMajorTexture;
+        UINT64 m_dedicatedVideoMemory;
+        float m_computeRate;   // GFLOP/s
+        float m_copyBandwidth; // GB/s. 0 if cross-adapter heaps are not supported
+    };
+
+    // the Microsoft Basic Render Driver, and software adapters, are not worth a role
+    static bool GetSupported(const DXGI_ADAPTER_DESC1& in_desc);
+
+    // from the cache, or measured and cached. throws if the device can't be created
+    static Capabilities Probe(IDXGIAdapter1* in_pAdapter);
+
+    // the role assignment with the least estimated frame time for in_numParticles
+    // simulation, copy and draw overlap across adapters, so the slowest of them sets the frame time
+    // if a single adapter (async compute mode) is estimated about as fast, render and compute are equal
+    struct Roles
+    {
+        int m_renderAdapterIndex;
+        int m_computeAdapterIndex;
+    };
+    static Roles AssignRoles(const std::vector<Capabilities>& in_capabilities, UINT in_numParticles);
+
+private:
+    static constexpr UINT m_VENDOR_ID_MICROSOFT = 0x1414; // the basic render driver
+
+    // rough cost per particle per frame, only their ratio and the compute rates matter
+    static constexpr float m_SIMULATE_FLOPS_PER_PARTICLE = 40.0f;
+    static constexpr float m_DRAW_FLOPS_PER_PARTICLE = 400.0f; // the quads are fill bound
+    // multi-adapter must win by this much over a single adapter, for the cross-adapter synchronization
+    static constexpr float m_MULTI_ADAPTER_MARGIN = 0.9f;
+
+    static bool Load(const std::wstring& in_path, Capabilities& out_capabilities);
+    static void Save(const std::wstring& in_path, const Capabilities& in_capabilities);
+    static void Measure(IDXGIAdapter1* in_pAdapter, Capabilities& out_capabilities);
+};
@@ -0,0 +1,50 @@
+//*********************************************************
+//
+// Copyright 2020 Intel Corporation 
+//
+// Permission is hereby granted, free of charge, to any 
+// person obtaining a copy of this software and associated 
+// documentation files(the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights 
+// to use, copy, modify, merge, publish, distribute, sublicense, 
+// and/or sell copies of the Software, and to permit persons to 
+// whom the Software is furnished to do so, subject to the 
+// following conditions :
+// The above copyright notice and this permission notice shall 
+// be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+// DEALINGS IN THE SOFTWARE.
+//
+//*********************************************************
+
+#include "ShaderDefines.hlsl"
+
+// compute microbenchmark of AdapterProbe: a chain of dependent multiply-adds per thread
+// the iterations are a constant, so the compiler can't shorten the loop
+cbuffer cbProbe : register(b0)
+{
+    uint g_numIterations;
+};
+
+RWStructuredBuffer<float4> g_output : register(u0);
+
+[numthreads(blocksize, 1, 1)]
+void CSProbe(uint3 DTid : SV_DispatchThreadID)
+{
+    float4 a = float4(DTid.x, 1, 2, 3) * 1e-6f;
+    const float4 b = float4(0.999f, 0.998f, 0.997f, 0.996f);
+
+    for (uint i = 0; i < g_numIterations; i++)
+    {
+        a = a * b + 0.001f; // 4 multiply-adds, 8 flops
+    }
+
+    g_output[DTid.x] = a;
+}
@@ -34,6 +34,9 @@
 #include <sstream>
 
 #include "D3D12GpuTimer.h"
+#include "ExtensionHelper.h"
+#include "PipelineCache.h"
+#include "HeapAllocator.h"
 
 using Microsoft::WRL::ComPtr;
 
@@ -49,9 +52,13 @@ public:
     AdapterShared& operator=(AdapterShared&&) = delete;
 
     const auto& GetGpuTimes() const { return m_pTimer->GetTimes(); }
+    const auto& GetLastGpuTimes() const { return m_pTimer->GetLastTimes(); }
+    const auto& GetLastGpuIntervals() const { return m_pTimer->GetLastIntervals(); }
 
     // return if this adapter is using the intel command queue throttle extension
     bool GetUsingIntelCommandQueueExtension() const { return m_usingIntelCommandQueueExtension; }
+    // of the queues created with the extension
+    ThrottlePolicy GetThrottlePolicy() const { return m_throttlePolicy; }
 
     // stalls until adapter is idle
     virtual void WaitForGpu() = 0;
@@ -59,25 +66,51 @@ public:
     // returns if this adapter uses unified memory (system memory is treated as local adapter memory)
     bool GetIsUMA() const { return m_isUMA; }
 
+    // highest shader model supported by the device, and whether it supports mesh shaders
+    D3D_SHADER_MODEL GetShaderModel() const { return m_shaderModel; }
+    bool GetMeshShaderSupported() const { return m_meshShaderSupported; }
+    // whether row-major textures can be placed in cross-adapter heaps, otherwise only buffers can be shared
+    bool GetCrossAdapterRowMajorTextureSupported() const { return m_crossAdapterRowMajorTextureSupported; }
+
 protected:
     // create a device with the highest feature support
-    void CreateDevice(IDXGIAdapter1* in_pAdapter, ComPtr<ID3D12Device>& in_device);
+    // also creates the pipeline cache, in_pCacheName distinguishes the users of the same adapter
+    void CreateDevice(IDXGIAdapter1* in_pAdapter, ComPtr<ID3D12Device>& in_device, const wchar_t* in_pCacheName);
 
     std::wstring GetAssetFullPath(const wchar_t* const in_filename);
 
+    // placed in the heaps of the device, see HeapAllocator.h. freed with this object
+    void CreateBuffer(D3D12_HEAP_TYPE in_heapType, UINT64 in_size, D3D12_RESOURCE_FLAGS in_flags,
+        D3D12_RESOURCE_STATES in_initialState, ComPtr<ID3D12Resource>& out_resource)
+    {
+        m_pHeapAllocator->CreateBuffer(this, in_heapType, in_size, in_flags, in_initialState, out_resource);
+    }
+
     D3D12GpuTimer* m_pTimer;
+    PipelineCache* m_pPipelineCache;
     bool m_usingIntelCommandQueueExtension;
+    ThrottlePolicy m_throttlePolicy;
 
 private:
     bool m_isUMA;
+    D3D_SHADER_MODEL m_shaderModel;
+    bool m_meshShaderSupported;
+    bool m_crossAdapterRowMajorTextureSupported;
+    HeapAllocator* m_pHeapAllocator;
 };
 
 //-----------------------------------------------------------------------------
 //-----------------------------------------------------------------------------
 inline AdapterShared::AdapterShared()
     : m_pTimer(nullptr)
+    , m_pPipelineCache(nullptr)
     , m_usingIntelCommandQueueExtension(false)
+    , m_throttlePolicy(ThrottlePolicy::MaxPerformance)
     , m_isUMA(false)
+    , m_shaderModel(D3D_SHADER_MODEL_5_1)
+    , m_meshShaderSupported(false)
+    , m_crossAdapterRowMajorTextureSupported(false)
+    , m_pHeapAllocator(nullptr)
 {
 }
 
@@ -86,18 +119,53 @@ inline AdapterShared::AdapterShared()
 inline AdapterShared::~AdapterShared()
 {
     delete m_pTimer;
+    delete m_pPipelineCache;
+
+    // the buffers of the derived class have been released by now
+    if (m_pHeapAllocator)
+    {
+        m_pHeapAllocator->Free(this);
+    }
 }
 
 //-----------------------------------------------------------------------------
 //-----------------------------------------------------------------------------
-inline void AdapterShared::CreateDevice(IDXGIAdapter1* in_pAdapter, ComPtr<ID3D12Device>& out_device)
+inline void AdapterShared::CreateDevice(IDXGIAdapter1* in_pAdapter, ComPtr<ID3D12Device>& out_device, const wchar_t* in_pCacheName)
 {
     ThrowIfFailed(::D3D12CreateDevice(in_pAdapter, MINIMUM_D3D_FEATURE_LEVEL, IID_PPV_ARGS(&out_device)));
 
+    delete m_pPipelineCache;
+    m_pPipelineCache = new PipelineCache(out_device.Get(), in_pAdapter, in_pCacheName);
+
+    m_pHeapAllocator = HeapAllocator::Get(out_device.Get());
+
     // check for UMA support (uses system memory as local memory)
     D3D12_FEATURE_DATA_ARCHITECTURE featureData = {};
     const HRESULT hr = out_device->CheckFeatureSupport(D3D12_FEATURE_ARCHITECTURE, &featureData, sizeof(featureData));
     m_isUMA = SUCCEEDED(hr) && featureData.UMA;
+
+    // check for the highest shader model. the query fails for models the runtime does not know
+    m_shaderModel = D3D_SHADER_MODEL_5_1;
+    for (int shaderModel = D3D_SHADER_MODEL_6_5; shaderModel >= D3D_SHADER_MODEL_6_0; shaderModel--)
+    {
+        D3D12_FEATURE_DATA_SHADER_MODEL shaderModelData = { D3D_SHADER_MODEL(shaderModel) };
+        if (SUCCEEDED(out_device->CheckFeatureSupport(D3D12_FEATURE_SHADER_MODEL, &shaderModelData, sizeof(shaderModelData))))
+        {
+            m_shaderModel = shaderModelData.HighestShaderModel;
+            break;
+        }
+    }
+
+    // check for mesh shader support
+    D3D12_FEATURE_DATA_D3D12_OPTIONS7 options7 = {};
+    m_meshShaderSupported = (m_shaderModel >= D3D_SHADER_MODEL_6_5)
+        && SUCCEEDED(out_device->CheckFeatureSupport(D3D12_FEATURE_D3D12_OPTIONS7, &options7, sizeof(options7)))
+        && (options7.MeshShaderTier != D3D12_MESH_SHADER_TIER_NOT_SUPPORTED);
+
+    // check for row-major textures in cross-adapter heaps
+    D3D12_FEATURE_DATA_D3D12_OPTIONS options = {};
+    m_crossAdapterRowMajorTextureSupported = SUCCEEDED(out_device->CheckFeatureSupport(D3D12_FEATURE_D3D12_OPTIONS, &options, sizeof(options)))
+        && options.CrossAdapterRowMajorTextureSupported;
 }
 
 //-----------------------------------------------------------------------------
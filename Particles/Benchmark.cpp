@@ -0,0 +1,275 @@
+//*********************************************************
+//
+// Copyright 2020 Intel Corporation 
+//
+// Permission is hereby granted, free of charge, to any 
+// person obtaining a copy of this software and associated 
+// documentation files(the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights 
+// to use, copy, modify, merge, publish, distribute, sublicense, 
+// and/or sell copies of the Software, and to permit persons to 
+// whom the Software is furnished to do so, subject to the 
+// following conditions :
+// The above copyright notice and this permission notice shall 
+// be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+// DEALINGS IN THE SOFTWARE.
+//
+//*********************************************************
+#include <algorithm>
+#include <cctype>
+#include <cmath>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+#include "Benchmark.h"
+#include "Json.h"
+
+//-----------------------------------------------------------------------------
+// key of the script, see Benchmark.h. returns false for an unknown key
+//-----------------------------------------------------------------------------
+static bool SetValue(Benchmark::Configuration& out_configuration, const std::string& in_key, int in_value)
+{
+    if ("numparticles" == in_key) { out_configuration.m_numParticles = in_value; }
+    else if ("render" == in_key) { out_configuration.m_renderAdapterIndex = in_value; }
+    else if ("compute" == in_key) { out_configuration.m_computeAdapterIndex = in_value; }
+    else if ("async" == in_key) { out_configuration.m_async = (0 != in_value); }
+    else if ("ext" == in_key) { out_configuration.m_queueExtension = (0 != in_value); }
+    else if ("throttle" == in_key) { out_configuration.m_throttleMode = in_value; }
+    else if ("priority" == in_key) { out_configuration.m_queuePriority = in_value; }
+    else if ("latency" == in_key) { out_configuration.m_simulationLatency = in_value; }
+    else if ("framelatency" == in_key) { out_configuration.m_frameLatency = in_value; }
+    else if ("lowlatency" == in_key) { out_configuration.m_lowLatency = (0 != in_value); }
+    else if ("lod" == in_key) { out_configuration.m_lod = (0 != in_value); }
+    else if ("density" == in_key) { out_configuration.m_densityField = (0 != in_value); }
+    else if ("zerocopy" == in_key) { out_configuration.m_zeroCopy = (0 != in_value); }
+    else if ("warmup" == in_key) { out_configuration.m_numWarmupFrames = UINT(std::max(0, in_value)); }
+    else if ("frames" == in_key) { out_configuration.m_numFrames = UINT(std::max(1, in_value)); }
+    else { return false; }
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+// nearest-rank percentile of sorted values
+//-----------------------------------------------------------------------------
+static float GetPercentile(const std::vector<float>& in_sorted, float in_percentile)
+{
+    const size_t rank = size_t(std::ceil(in_percentile * 0.01f * in_sorted.size()));
+    return in_sorted[std::min(std::max(rank, size_t(1)), in_sorted.size()) - 1];
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+Benchmark::Benchmark()
+    : m_configurationIndex(0)
+    , m_frameIndex(0)
+{
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+bool Benchmark::Load(const std::wstring& in_scriptPath, const Configuration& in_defaults)
+{
+    std::ifstream file(in_scriptPath);
+    if (!file)
+    {
+        return false;
+    }
+
+    Configuration previous = in_defaults;
+    std::string line;
+    while (std::getline(file, line))
+    {
+        line = line.substr(0, line.find('#'));
+
+        // every key has a list of values
+        std::vector<std::pair<std::string, std::vector<int>>> keys;
+        std::istringstream tokens(line);
+        std::string token;
+        while (tokens >> token)
+        {
+            const size_t equals = token.find('=');
+            std::string key = token.substr(0, equals);
+            std::transform(key.begin(), key.end(), key.begin(), [](char c) { return char(::tolower(c)); });
+
+            std::vector<int> values;
+            if (std::string::npos != equals)
+            {
+                std::istringstream list(token.substr(equals + 1));
+                std::string value;
+                while (std::getline(list, value, ','))
+                {
+                    values.push_back(std::atoi(value.c_str()));
+                }
+            }
+
+            Configuration unused = previous;
+            if (values.empty() || !SetValue(unused, key, 0))
+            {
+                ::OutputDebugStringA(("benchmark: ignoring " + token + "\n").c_str());
+                continue;
+            }
+            keys.emplace_back(key, values);
+        }
+        if (keys.empty())
+        {
+            continue;
+        }
+
+        // every combination of the values, the last key varies fastest
+        size_t numCombinations = 1;
+        for (const auto& k : keys)
+        {
+            numCombinations *= k.second.size();
+        }
+        for (size_t c = 0; c < numCombinations; c++)
+        {
+            Configuration configuration = previous;
+            size_t remainder = c;
+            for (size_t k = keys.size(); k-- > 0;)
+            {
+                const std::vector<int>& values = keys[k].second;
+                SetValue(configuration, keys[k].first, values[remainder % values.size()]);
+                remainder /= values.size();
+            }
+            m_configurations.push_back(configuration);
+        }
+        previous = m_configurations.back();
+    }
+
+    m_appliedConfigurations = m_configurations;
+    m_results.resize(m_configurations.size());
+    return !m_configurations.empty();
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+bool Benchmark::Update(const TimeArray& in_times, bool in_settling)
+{
+    if (GetDone())
+    {
+        return false;
+    }
+
+    if (in_settling)
+    {
+        m_frameIndex = 0;
+        return false;
+    }
+
+    const Configuration& configuration = GetConfiguration();
+    if (m_frameIndex >= configuration.m_numWarmupFrames)
+    {
+        Result& result = m_results[m_configurationIndex];
+        if (result.m_names.empty())
+        {
+            for (const auto& t : in_times)
+            {
+                result.m_names.push_back(t.second);
+            }
+        }
+
+        std::vector<float> frame(result.m_names.size(), 0.0f);
+        for (const auto& t : in_times)
+        {
+            const auto i = std::find(result.m_names.begin(), result.m_names.end(), t.second);
+            if (i != result.m_names.end())
+            {
+                frame[i - result.m_names.begin()] = t.first * 1000.0f;
+            }
+        }
+        result.m_frames.push_back(frame);
+    }
+
+    m_frameIndex++;
+    if (m_frameIndex >= (configuration.m_numWarmupFrames + configuration.m_numFrames))
+    {
+        m_frameIndex = 0;
+        m_configurationIndex++;
+        return true;
+    }
+    return false;
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void Benchmark::Write(const std::wstring& in_outputPath, const std::vector<std::string>& in_adapterDescriptions) const
+{
+    auto GetAdapterDescription = [&](int in_index)
+    {
+        return ((in_index >= 0) && (size_t(in_index) < in_adapterDescriptions.size())) ? EscapeJson(in_adapterDescriptions[in_index]) : std::string();
+    };
+
+    std::ofstream csv(in_outputPath + L".csv", std::ios::trunc);
+    csv << "configuration,frame,timer,ms\n";
+
+    std::ofstream json(in_outputPath + L".json", std::ios::trunc);
+    json << "{\n  \"configurations\": [";
+
+    for (size_t c = 0; c < m_configurations.size(); c++)
+    {
+        const Configuration& configuration = m_appliedConfigurations[c];
+        const Result& result = m_results[c];
+
+        for (size_t f = 0; f < result.m_frames.size(); f++)
+        {
+            for (size_t t = 0; t < result.m_names.size(); t++)
+            {
+                csv << c << ',' << f << ',' << result.m_names[t] << ',' << result.m_frames[f][t] << '\n';
+            }
+        }
+
+        json << ((0 == c) ? "\n" : ",\n");
+        json << "    {\n";
+        json << "      \"numParticles\": " << configuration.m_numParticles << ",\n";
+        json << "      \"renderAdapter\": \"" << GetAdapterDescription(configuration.m_renderAdapterIndex) << "\",\n";
+        json << "      \"computeAdapter\": \"" << GetAdapterDescription(configuration.m_computeAdapterIndex) << "\",\n";
+        json << "      \"async\": " << (configuration.m_async ? "true" : "false") << ",\n";
+        json << "      \"queueExtension\": " << (configuration.m_queueExtension ? "true" : "false") << ",\n";
+        json << "      \"throttle\": " << configuration.m_throttleMode << ",\n";
+        json << "      \"priority\": " << configuration.m_queuePriority << ",\n";
+        json << "      \"latency\": " << configuration.m_simulationLatency << ",\n";
+        json << "      \"frameLatency\": " << configuration.m_frameLatency << ",\n";
+        json << "      \"lowLatency\": " << (configuration.m_lowLatency ? "true" : "false") << ",\n";
+        json << "      \"lod\": " << (configuration.m_lod ? "true" : "false") << ",\n";
+        json << "      \"densityField\": " << (configuration.m_densityField ? "true" : "false") << ",\n";
+        json << "      \"zeroCopy\": " << (configuration.m_zeroCopy ? "true" : "false") << ",\n";
+        json << "      \"numWarmupFrames\": " << configuration.m_numWarmupFrames << ",\n";
+        json << "      \"numFrames\": " << result.m_frames.size() << ",\n";
+        json << "      \"timers\": {";
+        for (size_t t = 0; t < result.m_names.size(); t++)
+        {
+            std::vector<float> sorted;
+            for (const auto& frame : result.m_frames)
+            {
+                sorted.push_back(frame[t]);
+            }
+            std::sort(sorted.begin(), sorted.end());
+
+            float sum = 0;
+            for (const float v : sorted)
+            {
+                sum += v;
+            }
+
+            json << ((0 == t) ? "\n" : ",\n");
+            json << "        \"" << EscapeJson(result.m_names[t]) << "\": { "
+                << "\"mean\": " << (sum / sorted.size()) << ", "
+                << "\"p50\": " << GetPercentile(sorted, 50) << ", "
+                << "\"p95\": " << GetPercentile(sorted, 95) << ", "
+                << "\"p99\": " << GetPercentile(sorted, 99) << ", "
+                << "\"min\": " << sorted.front() << ", "
+                << "\"max\": " << sorted.back() << " }";
+        }
+        json << "\n      }\n    }";
+    }
+    json << "\n  ]\n}\n";
+}
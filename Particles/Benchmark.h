@@ -0,0 +1,132 @@
+//*********************************************************
+//
+// Copyright 2020 Intel Corporation 
+//
+// Permission is hereby granted, free of charge, to any 
+// person obtaining a copy of this software and associated 
+// documentation files(the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights 
+// to use, copy, modify, merge, publish, distribute, sublicense, 
+// and/or sell copies of the Software, and to permit persons to 
+// whom the Software is furnished to do so, subject to the 
+// following conditions :
+// The above copyright notice and this permission notice shall 
+// be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+// DEALINGS IN THE SOFTWARE.
+//
+//*********************************************************
+#pragma once
+
+#include <Windows.h>
+#include <string>
+#include <utility>
+#include <vector>
+
+/*======================================================
+Benchmark
+
+Runs a script of configurations without UI, writes the results, then quits.
+
+Script: one configuration per line, # starts a comment
+keys that are not given keep their value from the previous line
+a value can be a comma-separated list, the line then runs every combination, e.g.
+    numparticles=262144,1048576,4194304 render=1 compute=0,1 ext=0,1 warmup=60 frames=300
+keys:
+    numparticles  particles rendered, copied and simulated, at most -numparticles
+    render        render adapter index
+    compute       compute adapter index
+    async         1: compute on the render adapter (async compute), overrides compute
+    ext           Intel command queue extension
+    throttle      throttle policy of the extension's queues, 0: dynamic, 1: max performance, 2: auto
+    priority      compute queue priority, 0: normal, 1: high, 2: global realtime
+    latency       async compute mode: frames from the simulation to its draw, 0 to 2
+    framelatency  frames queued for display, 1 to 3
+    lowlatency    1: submit the simulation after the frame latency wait
+    lod           1: temporal level of detail, particles with little acceleration are stepped less often
+    density       1: transfer a density field and the near particles instead of every particle
+    zerocopy      1: the render adapter draws straight from the shared buffers instead of copying them
+    warmup        frames discarded after the configuration is applied
+    frames        frames measured
+
+Output:
+    <out>.csv:  every measured frame, one row per timer
+    <out>.json: every configuration with the mean, p50, p95 and p99 of every timer
+
+Usage: Load() the script, apply GetConfiguration() and report the clamped values with SetAppliedConfiguration()
+then call Update() once per frame. when it returns true, apply the next configuration, or Write() when GetDone()
+======================================================*/
+class Benchmark
+{
+public:
+    struct Configuration
+    {
+        int m_numParticles;
+        int m_renderAdapterIndex;
+        int m_computeAdapterIndex;
+        bool m_async;
+        bool m_queueExtension;
+        int m_throttleMode;
+        int m_queuePriority;
+        int m_simulationLatency;
+        int m_frameLatency;
+        bool m_lowLatency;
+        bool m_lod;
+        bool m_densityField;
+        bool m_zeroCopy;
+        UINT m_numWarmupFrames;
+        UINT m_numFrames;
+    };
+
+    // values of keys that are not given by the script or the command line
+    static constexpr UINT DEFAULT_NUM_WARMUP_FRAMES = 60;
+    static constexpr UINT DEFAULT_NUM_FRAMES = 300;
+
+    Benchmark();
+
+    // in_defaults are the values before the first line of the script
+    // returns false if the script can't be read or has no configurations
+    bool Load(const std::wstring& in_scriptPath, const Configuration& in_defaults);
+
+    bool GetDone() const { return m_configurationIndex >= m_configurations.size(); }
+    const Configuration& GetConfiguration() const { return m_configurations[m_configurationIndex]; }
+    // the values actually run, e.g. with the adapter indices and the number of particles clamped. written by Write()
+    void SetAppliedConfiguration(const Configuration& in_configuration) { m_appliedConfigurations[m_configurationIndex] = in_configuration; }
+
+    // named times of one frame, in seconds
+    typedef std::vector<std::pair<float, std::string>> TimeArray;
+
+    // in_settling: the configuration is still being applied, e.g. a compute adapter is built in the background
+    // restarts the warm-up. returns true when the configuration changes, including to done
+    bool Update(const TimeArray& in_times, bool in_settling);
+
+    // writes in_outputPath + .csv and .json
+    void Write(const std::wstring& in_outputPath, const std::vector<std::string>& in_adapterDescriptions) const;
+
+private:
+    Benchmark(const Benchmark&) = delete;
+    Benchmark(Benchmark&&) = delete;
+    Benchmark& operator=(const Benchmark&) = delete;
+    Benchmark& operator=(Benchmark&&) = delete;
+
+    std::vector<Configuration> m_configurations;
+    std::vector<Configuration> m_appliedConfigurations;
+    size_t m_configurationIndex;
+    UINT m_frameIndex; // within the current configuration, including the warm-up
+
+    // measured frames of a configuration, in milliseconds
+    // timers are named by the first measured frame, later frames without a timer record 0
+    struct Result
+    {
+        std::vector<std::string> m_names;
+        std::vector<std::vector<float>> m_frames;
+    };
+    std::vector<Result> m_results;
+};
@@ -25,6 +25,7 @@
 //*********************************************************
 
 #include <cassert>
+#include <algorithm> // for std::min()
 #include <random>
 #include <string>
 #include <sstream>
@@ -33,34 +34,114 @@
 
 #include "Compute.h"
 #include "Render.h" // for struct Particle
+#include "Profiler.h"
+#include "Markers.h"
+#include "MemoryBudget.h"
 #include "ExtensionHelper.h" // Intel extensions
 
+bool Compute::m_velocitySoa = (0 != VELOCITY_SOA);
+bool Compute::m_initializeOnGpu = (0 != INITIALIZE_PARTICLES_ON_GPU);
+
 enum ComputeRootParameters : UINT32
 {
     ComputeRootCBV = 0,
     ComputeRootUAVTable,
+    ComputeRootGridUAVTable,
+    ComputeRootPassConstants,
+    ComputeRootPackedUAVTable,
+    ComputeRootLodParticlesUAV,
+    ComputeRootLodArgsUAV,
+    ComputeRootDensityUAVTable,
     ComputeRootParametersCount
 };
 
+// padded to the constant buffer alignment, so the buffers of the ring can be bound one at a time
 struct ConstantBufferCS
 {
     UINT param[4];
     float paramf[4];
+    float initf[4];
+    float lodf[4];
+    DirectX::XMFLOAT4X4 densityViewProjection;
+    float densityf[4];
+    UINT padding[64 - 4 - 4 - 4 - 4 - 16 - 4];
+};
+static_assert(sizeof(ConstantBufferCS) == D3D12_CONSTANT_BUFFER_DATA_PLACEMENT_ALIGNMENT, "ConstantBufferCS must be aligned");
+
+// a simulate table is u0 through u4:
+// new position, old position, old position (unused), new velocity, old velocity
+constexpr UINT NumSimulateTableDescriptors = 5;
+
+// the position buffers a step writes and reads: the previous and current buffers of the ring, or the substep buffer
+// the steps of a Simulate() alternate between the current buffer and the substep buffer, so the last writes the ring
+enum SimulateStep : UINT
+{
+    StepPreviousToCurrent = 0,
+    StepPreviousToSubstep,
+    StepSubstepToCurrent,
+    StepCurrentToSubstep,
+    NumSimulateSteps
 };
 
+// the kind of step in_step of a Simulate() with in_numSteps steps
+static SimulateStep GetSimulateStep(UINT in_step, UINT in_numSteps)
+{
+    const bool writeCurrent = (0 == ((in_numSteps - 1 - in_step) & 1));
+    if (0 == in_step)
+    {
+        return writeCurrent ? StepPreviousToCurrent : StepPreviousToSubstep;
+    }
+    return writeCurrent ? StepSubstepToCurrent : StepCurrentToSubstep;
+}
+
 // Indices of shader resources in the descriptor heap.
 enum DescriptorHeapIndex : UINT32
 {
-    UavParticlePos0 = 0, // u0
-    UavParticlePos1,
-    UavParticlePos0Copy, // so we can ping-pong just by moving the heap base
+    // one simulate table per kind of step, position buffer and velocity buffer written, see GetSimulateTable()
+    UavSimulateTable0 = 0, // u0
+
+    UavGridCellCount = UavSimulateTable0 + (NumSimulateTableDescriptors * NumSimulateSteps * MAX_NUM_BUFFERS * Compute::NUM_VELOCITY_BUFFERS), // u5
+    UavGridCellStart,
+    UavGridParticleSlot,
+    UavGridSortedPosition,
+    UavGridCellMass,
+
+    UavPackedPos0, // u10, one per position buffer
 
-    UavParticleVel0, // u3
-    UavParticleVel1,
-    UavParticleVel0Copy, // so we can ping-pong just by moving the heap base
+    UavDensityField = UavPackedPos0 + MAX_NUM_BUFFERS, // u13
+    UavNearParticles,
+    UavNearCounter,
     DescriptorCount
 };
 
+// grid acceleration structure sizes, see GRID_DIM in defines.h
+constexpr UINT GetNumGridCells(UINT in_level)
+{
+    return (GRID_DIM >> in_level) * (GRID_DIM >> in_level) * (GRID_DIM >> in_level);
+}
+
+constexpr UINT GetNumGridCellsAllLevels()
+{
+    UINT numCells = 0;
+    for (UINT i = 0; i < GRID_LEVELS; i++)
+    {
+        numCells += GetNumGridCells(i);
+    }
+    return numCells;
+}
+
+// CSPrefixSum scans the grid with a single group of 1024 threads
+static_assert(0 == (GetNumGridCells(0) % 1024), "GRID_DIM^3 must be a multiple of the prefix sum group size");
+static_assert(0 == (GetNumGridCells(0) % BLOCK_SIZE), "GRID_DIM^3 must be a multiple of BLOCK_SIZE");
+static_assert((GRID_DIM >> (GRID_LEVELS - 1)) >= 4, "coarsest grid level must be at least 4^3 cells");
+
+// CSPackPositions reduces the bounds of a block with a single group
+static_assert(0 == (PACK_BLOCK_SIZE & (PACK_BLOCK_SIZE - 1)), "PACK_BLOCK_SIZE must be a power of 2");
+static_assert(0 == (PACK_BLOCK_SIZE % BLOCK_SIZE), "PACK_BLOCK_SIZE must be a multiple of BLOCK_SIZE");
+
+// the render adapter may read a row-major density field as a buffer, with the footprint of a copy
+static_assert(0 == ((DENSITY_WIDTH * sizeof(UINT)) % D3D12_TEXTURE_DATA_PITCH_ALIGNMENT), "density field rows must be aligned for copies");
+
 enum class GpuTimers
 {
     Simulate,
@@ -69,27 +150,49 @@ enum class GpuTimers
 
 //-----------------------------------------------------------------------------
 //-----------------------------------------------------------------------------
-Compute::Compute(UINT in_numParticles,
+Compute::Compute(UINT in_numParticles, UINT in_numBuffers,
     IDXGIAdapter1* in_pAdapter,
     bool in_useIntelCommandQueueExtension,
-    Compute* in_pCompute)
-    : m_numParticles(in_numParticles)
+    ThrottlePolicy in_throttlePolicy,
+    D3D12_COMMAND_QUEUE_PRIORITY in_queuePriority,
+    Compute* in_pCompute,
+    bool in_initializeParticles)
+    : m_numBuffers(std::max(UINT(MIN_NUM_BUFFERS), std::min(in_numBuffers, UINT(MAX_NUM_BUFFERS))))
+    , m_numParticles(in_numParticles)
     , m_pExtensionHelper(nullptr)
     , m_srvUavDescriptorSize(0)
+    , m_pConstantBufferCSData(nullptr)
     , m_fenceEvent(nullptr)
     , m_bufferIndex(0)
+    , m_velocityIndex(0)
+    , m_simulatedSteps(0)
+    , m_simulationMode(SimulationMode::GravityWell)
+    , m_simulationParameters{ SIMULATION_TIMESTEP, SIMULATION_DAMPING, SIMULATION_MASS, SIMULATION_SOFTENING, 0.0f }
+    , m_firstParticle(0)
+    , m_numParticlesInRange(in_numParticles)
+    , m_packedTransfer(false)
+    , m_numChunks(1)
+    , m_densityField(false)
+    , m_densityViewProjection{} // nothing is splatted until SetDensityView()
+    , m_densityNearDistance(DENSITY_NEAR_DISTANCE)
+    , m_packedResident(true)
+    , m_densityResident(true)
     , m_frameFenceValues{}
     , m_fenceValue(0)
+    , m_copyStateFenceValue(0)
+    , m_simulationLatency(1)
+    , m_queuePriority(in_queuePriority)
 {
     m_usingIntelCommandQueueExtension = in_useIntelCommandQueueExtension;
+    m_throttlePolicy = in_throttlePolicy;
 
     Initialize(in_pAdapter);
 
     if (in_pCompute)
     {
-        CopyState(in_pCompute);
+        CopyState(in_pCompute, 0, m_numParticles);
     }
-    else
+    else if (in_initializeParticles)
     {
         InitializeParticles();
     }
@@ -103,6 +206,12 @@ Compute::~Compute()
 {
     WaitForGpu();
 
+    if (m_pConstantBufferCSData)
+    {
+        m_constantBufferCS->Unmap(0, nullptr);
+        m_pConstantBufferCSData = nullptr;
+    }
+
     delete m_pExtensionHelper;
 
     if (m_usingIntelCommandQueueExtension)
@@ -115,6 +224,12 @@ Compute::~Compute()
     BOOL rv = ::CloseHandle(m_sharedHandles.m_heap);
     assert(rv != FALSE);
 
+    rv = ::CloseHandle(m_sharedHandles.m_packedHeap);
+    assert(rv != FALSE);
+
+    rv = ::CloseHandle(m_sharedHandles.m_densityHeap);
+    assert(rv != FALSE);
+
     rv = ::CloseHandle(m_sharedHandles.m_fence);
     assert(rv != FALSE);
 
@@ -124,32 +239,50 @@ Compute::~Compute()
 
 //-----------------------------------------------------------------------------
 // creates a command queue with the intel extension if available
+// and the timer on it, the timer signals and calibrates on its queue
 //-----------------------------------------------------------------------------
 void Compute::CreateCommandQueue()
 {
     D3D12_COMMAND_QUEUE_DESC desc = {};
     desc.Type = D3D12_COMMAND_LIST_TYPE_COMPUTE;
     desc.Flags = D3D12_COMMAND_QUEUE_FLAG_NONE;
+    desc.Priority = m_queuePriority;
+
+    // global realtime fails without the privilege
+    if (D3D12_COMMAND_QUEUE_PRIORITY_GLOBAL_REALTIME == m_queuePriority)
+    {
+        ComPtr<ID3D12CommandQueue> realtimeQueue;
+        if (FAILED(m_device->CreateCommandQueue(&desc, IID_PPV_ARGS(&realtimeQueue))))
+        {
+            desc.Priority = D3D12_COMMAND_QUEUE_PRIORITY_HIGH;
+        }
+    }
 
     if (m_usingIntelCommandQueueExtension)
     {
-        m_commandQueue = m_pExtensionHelper->CreateCommandQueue(desc);
+        m_commandQueue = m_pExtensionHelper->CreateCommandQueue(desc, m_throttlePolicy);
     }
     else
     {
         ThrowIfFailed(m_device->CreateCommandQueue(&desc, IID_PPV_ARGS(&m_commandQueue)));
     }
+
+    delete m_pTimer;
+    m_pTimer = new D3D12GpuTimer(m_device.Get(), m_commandQueue.Get(), static_cast<UINT>(GpuTimers::NumTimers));
+    m_pTimer->SetTimerName(static_cast<UINT>(GpuTimers::Simulate), "simulate ms");
 }
 
 //-----------------------------------------------------------------------------
 // Creates a command queue optionally using the intel throttle extension
 // NOTE: the GPU must be idle at this point
 //-----------------------------------------------------------------------------
-void Compute::SetUseIntelCommandQueueExtension(bool in_desiredSetting)
+void Compute::SetUseIntelCommandQueueExtension(bool in_desiredSetting, ThrottlePolicy in_throttlePolicy)
 {
     WaitForGpu();
     in_desiredSetting = in_desiredSetting && m_pExtensionHelper->GetEnabled();
-    if (m_usingIntelCommandQueueExtension != in_desiredSetting)
+    const bool changePolicy = in_desiredSetting && (m_throttlePolicy != in_throttlePolicy);
+    m_throttlePolicy = in_throttlePolicy;
+    if ((m_usingIntelCommandQueueExtension != in_desiredSetting) || changePolicy)
     {
         m_usingIntelCommandQueueExtension = in_desiredSetting;
         CreateCommandQueue();
@@ -157,8 +290,21 @@ void Compute::SetUseIntelCommandQueueExtension(bool in_desiredSetting)
 }
 
 //-----------------------------------------------------------------------------
-// Create two buffers in the GPU, each with a copy of the particles data
-// The compute shader reads from one and writes to the other
+// NOTE: the GPU must be idle at this point
+//-----------------------------------------------------------------------------
+void Compute::SetQueuePriority(D3D12_COMMAND_QUEUE_PRIORITY in_priority)
+{
+    WaitForGpu();
+    if (m_queuePriority != in_priority)
+    {
+        m_queuePriority = in_priority;
+        CreateCommandQueue();
+    }
+}
+
+//-----------------------------------------------------------------------------
+// Create a ring of buffers in the GPU, each with a copy of the particles data
+// The compute shader reads from the most recent and writes to the next
 //-----------------------------------------------------------------------------
 void Compute::CreateSharedBuffers()
 {
@@ -187,19 +333,167 @@ void Compute::CreateSharedBuffers()
 
     const UINT64 alignedDataSize = textureInfo.SizeInBytes;
 
+    // quantized copies of the positions, see PACK_BLOCK_SIZE
+    const D3D12_RESOURCE_DESC packedDesc = CD3DX12_RESOURCE_DESC::Buffer(GetPackedSize(m_numParticles),
+        D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS |
+        D3D12_RESOURCE_FLAG_ALLOW_CROSS_ADAPTER);
+
+    const UINT64 alignedPackedSize = m_device->GetResourceAllocationInfo(0, 1, &packedDesc).SizeInBytes;
+
+    // the simulation keeps its velocities in local memory, CopyState() stages them in a heap of its own
+    const UINT64 velocitySize = UINT64(m_numParticles) * GetVelocityNumStreams() * GetVelocityStride();
+
+    // density fields and near particle lists, see SplatDensity()
+    // a row-major texture can be copied to and from textures, a buffer only with a footprint
+    const bool densityRowMajor = GetCrossAdapterRowMajorTextureSupported();
+    const D3D12_RESOURCE_DESC sharedDensityDesc = densityRowMajor
+        ? CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_R32_UINT, DENSITY_WIDTH, DENSITY_HEIGHT, 1, 1, 1, 0,
+            D3D12_RESOURCE_FLAG_ALLOW_CROSS_ADAPTER, D3D12_TEXTURE_LAYOUT_ROW_MAJOR)
+        : CD3DX12_RESOURCE_DESC::Buffer(UINT64(DENSITY_WIDTH) * DENSITY_HEIGHT * sizeof(UINT), D3D12_RESOURCE_FLAG_ALLOW_CROSS_ADAPTER);
+    const UINT64 alignedDensitySize = m_device->GetResourceAllocationInfo(0, 1, &sharedDensityDesc).SizeInBytes;
+
+    const D3D12_RESOURCE_DESC sharedNearDesc = CD3DX12_RESOURCE_DESC::Buffer(UINT64(DENSITY_NEAR_PARTICLES) * sizeof(Render::Particle), D3D12_RESOURCE_FLAG_ALLOW_CROSS_ADAPTER);
+    const UINT64 alignedNearSize = m_device->GetResourceAllocationInfo(0, 1, &sharedNearDesc).SizeInBytes;
+
+    // the optional regions are in heaps of their own, heaps are the smallest unit of residency of placed resources
+    CreateSharedHeap(m_numBuffers * alignedDataSize, m_sharedHeap, m_sharedHandles.m_heap);
+    CreateSharedHeap(m_numBuffers * alignedPackedSize, m_packedHeap, m_sharedHandles.m_packedHeap);
+    CreateSharedHeap(m_numBuffers * (alignedDensitySize + alignedNearSize), m_densityHeap, m_sharedHandles.m_densityHeap);
+
+    m_sharedHandles.m_alignedDataSize = alignedDataSize;
+    m_sharedHandles.m_numBuffers = m_numBuffers;
+    m_sharedHandles.m_alignedPackedSize = alignedPackedSize;
+    m_sharedHandles.m_packed = false;
+    m_sharedHandles.m_alignedDensitySize = alignedDensitySize;
+    m_sharedHandles.m_alignedNearSize = alignedNearSize;
+    m_sharedHandles.m_densityRowMajor = densityRowMajor;
+    m_sharedHandles.m_density = false;
+    m_sharedHandles.m_numChunks = 1;
+
+    D3D12_UNORDERED_ACCESS_VIEW_DESC packedUavDesc = {};
+    packedUavDesc.Format = DXGI_FORMAT_R32_TYPELESS;
+    packedUavDesc.ViewDimension = D3D12_UAV_DIMENSION_BUFFER;
+    packedUavDesc.Buffer.FirstElement = 0;
+    packedUavDesc.Buffer.NumElements = UINT(GetPackedSize(m_numParticles) / sizeof(UINT));
+    packedUavDesc.Buffer.Flags = D3D12_BUFFER_UAV_FLAG_RAW;
+
+    for (UINT i = 0; i < m_numBuffers; i++)
+    {
+        ThrowIfFailed(m_device->CreatePlacedResource(
+            m_sharedHeap.Get(),
+            i * alignedDataSize,
+            &crossAdapterDesc,
+            D3D12_RESOURCE_STATE_UNORDERED_ACCESS,
+            nullptr,
+            IID_PPV_ARGS(&m_positionBuffers[i])));
+
+        ThrowIfFailed(m_device->CreatePlacedResource(
+            m_packedHeap.Get(),
+            i * alignedPackedSize,
+            &packedDesc,
+            D3D12_RESOURCE_STATE_UNORDERED_ACCESS,
+            nullptr,
+            IID_PPV_ARGS(&m_packedBuffers[i])));
+
+        const CD3DX12_CPU_DESCRIPTOR_HANDLE packedHeapHandle(
+            m_srvHeap->GetCPUDescriptorHandleForHeapStart(),
+            UavPackedPos0 + i,
+            m_srvUavDescriptorSize);
+        m_device->CreateUnorderedAccessView(m_packedBuffers[i].Get(), nullptr, &packedUavDesc, packedHeapHandle);
+    }
+
+    for (UINT i = 0; i < NUM_VELOCITY_BUFFERS; i++)
+    {
+        CreateBuffer(D3D12_HEAP_TYPE_DEFAULT, velocitySize, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS,
+            D3D12_RESOURCE_STATE_UNORDERED_ACCESS, m_velocityBuffers[i]);
+    }
+
+    for (UINT i = 0; i < m_numBuffers; i++)
+    {
+        // only ever the destination of copies on this adapter
+        ThrowIfFailed(m_device->CreatePlacedResource(
+            m_densityHeap.Get(),
+            i * alignedDensitySize,
+            &sharedDensityDesc,
+            D3D12_RESOURCE_STATE_COPY_DEST,
+            nullptr,
+            IID_PPV_ARGS(&m_sharedDensity[i])));
+
+        ThrowIfFailed(m_device->CreatePlacedResource(
+            m_densityHeap.Get(),
+            m_numBuffers * alignedDensitySize + i * alignedNearSize,
+            &sharedNearDesc,
+            D3D12_RESOURCE_STATE_COPY_DEST,
+            nullptr,
+            IID_PPV_ARGS(&m_sharedNearParticles[i])));
+    }
+
+    // never shared, see SimulateStep
+    CreateBuffer(D3D12_HEAP_TYPE_DEFAULT, dataSize, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS,
+        D3D12_RESOURCE_STATE_UNORDERED_ACCESS, m_substepBuffer);
+    NAME_D3D12_OBJECT(m_substepBuffer);
+
+    CreateSimulateTables();
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void Compute::CreateSharedHeap(UINT64 in_size, ComPtr<ID3D12Heap>& out_heap, HANDLE& out_handle)
+{
     const CD3DX12_HEAP_DESC heapDesc(
-        m_NUM_BUFFERS * alignedDataSize,
+        in_size,
         D3D12_HEAP_TYPE_DEFAULT,
         0, // An alias for 64KB. See documentation for D3D12_HEAP_DESC
         D3D12_HEAP_FLAG_SHARED | D3D12_HEAP_FLAG_SHARED_CROSS_ADAPTER);
 
-    ThrowIfFailed(m_device->CreateHeap(&heapDesc, IID_PPV_ARGS(&m_sharedHeap)));
+    ThrowIfFailed(m_device->CreateHeap(&heapDesc, IID_PPV_ARGS(&out_heap)));
 
-    ThrowIfFailed(m_device->CreateSharedHandle(m_sharedHeap.Get(), nullptr,
-        GENERIC_ALL, 0/*L"SHARED_HEAP"*/, &m_sharedHandles.m_heap));
+    ThrowIfFailed(m_device->CreateSharedHandle(out_heap.Get(), nullptr,
+        GENERIC_ALL, 0/*L"SHARED_HEAP"*/, &out_handle));
+}
 
-    m_sharedHandles.m_alignedDataSize = alignedDataSize;
+//-----------------------------------------------------------------------------
+// see CreateSharedBuffers(), CreateGridBuffers(), CreateLodBuffers(), CreateDensityResources() and InitializeParticles()
+// the grid cells do not depend on the number of particles, and are left out
+//-----------------------------------------------------------------------------
+UINT64 Compute::GetMemoryFootprint(UINT in_numParticles, UINT in_numBuffers, bool in_packed, bool in_density)
+{
+    const UINT64 dataSize = MemoryBudget::GetAllocationSize(UINT64(in_numParticles) * sizeof(Render::Particle));
+    const UINT64 packedSize = MemoryBudget::GetAllocationSize(GetPackedSize(in_numParticles));
+    const UINT64 velocitySize = MemoryBudget::GetAllocationSize(UINT64(in_numParticles) * GetVelocityNumStreams() * GetVelocityStride());
+    const UINT64 gridSize = MemoryBudget::GetAllocationSize(UINT64(in_numParticles) * sizeof(UINT))
+        + MemoryBudget::GetAllocationSize(UINT64(in_numParticles) * sizeof(DirectX::XMFLOAT4));
+    const UINT64 lodSize = MemoryBudget::GetAllocationSize(UINT64(in_numParticles) * sizeof(UINT));
+    const UINT64 densitySize = MemoryBudget::GetAllocationSize(UINT64(DENSITY_WIDTH) * DENSITY_HEIGHT * sizeof(UINT))
+        + MemoryBudget::GetAllocationSize(UINT64(DENSITY_NEAR_PARTICLES) * sizeof(Render::Particle));
+
+    // shared heaps. the velocities are only staged for the duration of a CopyState()
+    UINT64 footprint = in_numBuffers * dataSize;
+    if (in_packed)
+    {
+        footprint += in_numBuffers * packedSize;
+    }
+    if (in_density)
+    {
+        footprint += in_numBuffers * densitySize;
+    }
+    // local velocities, substep, grid, lod and density
+    footprint += NUM_VELOCITY_BUFFERS * velocitySize + dataSize + gridSize + lodSize;
+    if (in_density)
+    {
+        footprint += densitySize;
+    }
+    // upload of the initial state, released after initialization
+    footprint += dataSize + velocitySize;
+    return footprint;
+}
 
+//-----------------------------------------------------------------------------
+// the simulation reads the position buffer before the one it writes,
+// so the tables replace the ping-pong "copy" descriptors, and support more than 2 buffers
+//-----------------------------------------------------------------------------
+void Compute::CreateSimulateTables()
+{
     D3D12_UNORDERED_ACCESS_VIEW_DESC uavDesc = {};
     uavDesc.Format = DXGI_FORMAT_UNKNOWN;
     uavDesc.ViewDimension = D3D12_UAV_DIMENSION_BUFFER;
@@ -209,45 +503,223 @@ void Compute::CreateSharedBuffers()
     uavDesc.Buffer.CounterOffsetInBytes = 0;
     uavDesc.Buffer.Flags = D3D12_BUFFER_UAV_FLAG_NONE;
 
+    // all of the streams of the structure-of-arrays layout are in one view
     D3D12_UNORDERED_ACCESS_VIEW_DESC velocityDesc = uavDesc;
-    velocityDesc.Buffer.StructureByteStride = sizeof(ParticleVelocity);
+    velocityDesc.Buffer.NumElements = m_numParticles * GetVelocityNumStreams();
+    velocityDesc.Buffer.StructureByteStride = GetVelocityStride();
 
-    for (UINT i = 0; i < m_NUM_BUFFERS; i++)
+    for (UINT s = 0; s < NumSimulateSteps; s++)
     {
-        ThrowIfFailed(m_device->CreatePlacedResource(
-            m_sharedHeap.Get(),
-            i * alignedDataSize,
-            &crossAdapterDesc,
-            D3D12_RESOURCE_STATE_UNORDERED_ACCESS,
-            nullptr,
-            IID_PPV_ARGS(&m_positionBuffers[i])));
+        for (UINT i = 0; i < m_numBuffers; i++)
+        {
+            ID3D12Resource* pPrevious = m_positionBuffers[GetPreviousBufferIndex(i)].Get();
+            ID3D12Resource* pCurrent = m_positionBuffers[i].Get();
+            ID3D12Resource* pSubstep = m_substepBuffer.Get();
+
+            struct StepBuffers
+            {
+                ID3D12Resource* m_pNew;
+                ID3D12Resource* m_pOld;
+            };
+            const StepBuffers stepBuffers[NumSimulateSteps] =
+            {
+                { pCurrent, pPrevious }, // StepPreviousToCurrent
+                { pSubstep, pPrevious }, // StepPreviousToSubstep
+                { pCurrent, pSubstep },  // StepSubstepToCurrent
+                { pSubstep, pCurrent }   // StepCurrentToSubstep
+            };
+            ID3D12Resource* pNewPosition = stepBuffers[s].m_pNew;
+            ID3D12Resource* pOldPosition = stepBuffers[s].m_pOld;
+
+            for (UINT v = 0; v < NUM_VELOCITY_BUFFERS; v++)
+            {
+                struct TableEntry
+                {
+                    ID3D12Resource* m_pResource;
+                    const D3D12_UNORDERED_ACCESS_VIEW_DESC* m_pDesc;
+                };
+                const TableEntry tableEntries[NumSimulateTableDescriptors] =
+                {
+                    { pNewPosition, &uavDesc },
+                    { pOldPosition, &uavDesc },
+                    { pOldPosition, &uavDesc }, // u2 is not used
+                    { m_velocityBuffers[v].Get(), &velocityDesc },
+                    { m_velocityBuffers[1 - v].Get(), &velocityDesc }
+                };
+
+                for (UINT d = 0; d < NumSimulateTableDescriptors; d++)
+                {
+                    const CD3DX12_CPU_DESCRIPTOR_HANDLE heapHandle(
+                        m_srvHeap->GetCPUDescriptorHandleForHeapStart(),
+                        GetSimulateTable(i, v, s) + d,
+                        m_srvUavDescriptorSize);
+                    m_device->CreateUnorderedAccessView(tableEntries[d].m_pResource, nullptr, tableEntries[d].m_pDesc, heapHandle);
+                }
+            }
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+UINT Compute::GetSimulateTable(UINT in_bufferIndex, UINT in_velocityIndex, UINT in_step) const
+{
+    const UINT table = (((in_step * MAX_NUM_BUFFERS) + in_bufferIndex) * NUM_VELOCITY_BUFFERS) + in_velocityIndex;
+    return UavSimulateTable0 + table * NumSimulateTableDescriptors;
+}
+
+//-----------------------------------------------------------------------------
+// grid acceleration structure for SimulationMode::NBodyGrid
+// local to this adapter, rebuilt every step, so there is no state to share or copy
+//-----------------------------------------------------------------------------
+void Compute::CreateGridBuffers()
+{
+    struct GridBufferDesc
+    {
+        UINT m_numElements;
+        UINT m_stride;
+        const wchar_t* m_pName;
+    };
+    const GridBufferDesc gridBufferDescs[m_NUM_GRID_BUFFERS] =
+    {
+        { GetNumGridCells(0), sizeof(UINT), L"GridCellCount" },
+        { GetNumGridCells(0), sizeof(UINT), L"GridCellStart" },
+        { m_numParticles, sizeof(UINT), L"GridParticleSlot" },
+        { m_numParticles, sizeof(DirectX::XMFLOAT4), L"GridSortedPosition" },
+        { GetNumGridCellsAllLevels(), sizeof(DirectX::XMFLOAT4), L"GridCellMass" }
+    };
+
+    for (UINT i = 0; i < m_NUM_GRID_BUFFERS; i++)
+    {
+        const GridBufferDesc& desc = gridBufferDescs[i];
+
+        CreateBuffer(D3D12_HEAP_TYPE_DEFAULT, UINT64(desc.m_numElements) * desc.m_stride, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS,
+            D3D12_RESOURCE_STATE_UNORDERED_ACCESS, m_gridBuffers[i]);
+        m_gridBuffers[i]->SetName(desc.m_pName);
+
+        D3D12_UNORDERED_ACCESS_VIEW_DESC uavDesc = {};
+        uavDesc.Format = DXGI_FORMAT_UNKNOWN;
+        uavDesc.ViewDimension = D3D12_UAV_DIMENSION_BUFFER;
+        uavDesc.Buffer.FirstElement = 0;
+        uavDesc.Buffer.NumElements = desc.m_numElements;
+        uavDesc.Buffer.StructureByteStride = desc.m_stride;
+        uavDesc.Buffer.CounterOffsetInBytes = 0;
+        uavDesc.Buffer.Flags = D3D12_BUFFER_UAV_FLAG_NONE;
 
         const CD3DX12_CPU_DESCRIPTOR_HANDLE heapHandle(
             m_srvHeap->GetCPUDescriptorHandleForHeapStart(),
-            UavParticlePos0 + i,
+            UavGridCellCount + i,
             m_srvUavDescriptorSize);
-        m_device->CreateUnorderedAccessView(m_positionBuffers[i].Get(), nullptr, &uavDesc, heapHandle);
+        m_device->CreateUnorderedAccessView(m_gridBuffers[i].Get(), nullptr, &uavDesc, heapHandle);
+    }
+}
 
-        ThrowIfFailed(m_device->CreateCommittedResource(
-            &CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
-            D3D12_HEAP_FLAG_NONE,
-            &CD3DX12_RESOURCE_DESC::Buffer(m_numParticles * sizeof(ParticleVelocity), D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS),
-            D3D12_RESOURCE_STATE_UNORDERED_ACCESS,
-            nullptr,
-            IID_PPV_ARGS(&m_velocityBuffers[i])));
+//-----------------------------------------------------------------------------
+// temporal level of detail, see RecordLodStep()
+// the list and the arguments are bound as root descriptors, so they need no views
+//-----------------------------------------------------------------------------
+void Compute::CreateLodBuffers()
+{
+    CreateBuffer(D3D12_HEAP_TYPE_DEFAULT, UINT64(m_numParticles) * sizeof(UINT), D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS,
+        D3D12_RESOURCE_STATE_UNORDERED_ACCESS, m_lodParticles);
+    NAME_D3D12_OBJECT(m_lodParticles);
+
+    // the dispatch arguments, then the number of particles stepped, see LOD_NUM_PARTICLES_OFFSET in the shader
+    const UINT resetArguments[4] = { 0, 1, 1, 0 };
+
+    CreateBuffer(D3D12_HEAP_TYPE_DEFAULT, sizeof(resetArguments), D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS,
+        D3D12_RESOURCE_STATE_UNORDERED_ACCESS, m_lodArgs);
+    NAME_D3D12_OBJECT(m_lodArgs);
+
+    CreateBuffer(D3D12_HEAP_TYPE_UPLOAD, sizeof(resetArguments), D3D12_RESOURCE_FLAG_NONE,
+        D3D12_RESOURCE_STATE_GENERIC_READ, m_lodArgsReset);
+    NAME_D3D12_OBJECT(m_lodArgsReset);
+
+    void* pData = nullptr;
+    const CD3DX12_RANGE readRange(0, 0);
+    ThrowIfFailed(m_lodArgsReset->Map(0, &readRange, &pData));
+    memcpy(pData, resetArguments, sizeof(resetArguments));
+    m_lodArgsReset->Unmap(0, nullptr);
+
+    D3D12_INDIRECT_ARGUMENT_DESC argumentDesc = {};
+    argumentDesc.Type = D3D12_INDIRECT_ARGUMENT_TYPE_DISPATCH;
+
+    D3D12_COMMAND_SIGNATURE_DESC signatureDesc = {};
+    signatureDesc.ByteStride = sizeof(resetArguments);
+    signatureDesc.NumArgumentDescs = 1;
+    signatureDesc.pArgumentDescs = &argumentDesc;
+    ThrowIfFailed(m_device->CreateCommandSignature(&signatureDesc, nullptr, IID_PPV_ARGS(&m_lodCommandSignature)));
+    NAME_D3D12_OBJECT(m_lodCommandSignature);
+}
+
+//-----------------------------------------------------------------------------
+// density field transfer, see SplatDensity()
+// local to this adapter and rewritten every simulation, the shared heap only receives copies
+//-----------------------------------------------------------------------------
+void Compute::CreateDensityResources()
+{
+    const D3D12_RESOURCE_DESC densityDesc = CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_R32_UINT, DENSITY_WIDTH, DENSITY_HEIGHT, 1, 1, 1, 0,
+        D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS);
+    ThrowIfFailed(m_device->CreateCommittedResource(
+        &CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+        D3D12_HEAP_FLAG_NONE,
+        &densityDesc,
+        D3D12_RESOURCE_STATE_UNORDERED_ACCESS,
+        nullptr,
+        IID_PPV_ARGS(&m_densityTexture)));
+    NAME_D3D12_OBJECT(m_densityTexture);
+
+    // committed rather than placed, like the field, so both can be evicted. see UpdateResidency()
+    ThrowIfFailed(m_device->CreateCommittedResource(
+        &CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+        D3D12_HEAP_FLAG_NONE,
+        &CD3DX12_RESOURCE_DESC::Buffer(UINT64(DENSITY_NEAR_PARTICLES) * sizeof(Render::Particle), D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS),
+        D3D12_RESOURCE_STATE_UNORDERED_ACCESS,
+        nullptr,
+        IID_PPV_ARGS(&m_nearParticles)));
+    NAME_D3D12_OBJECT(m_nearParticles);
+
+    CreateBuffer(D3D12_HEAP_TYPE_DEFAULT, sizeof(UINT), D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS,
+        D3D12_RESOURCE_STATE_UNORDERED_ACCESS, m_nearCounter);
+    NAME_D3D12_OBJECT(m_nearCounter);
+
+    D3D12_UNORDERED_ACCESS_VIEW_DESC densityUavDesc = {};
+    densityUavDesc.Format = DXGI_FORMAT_R32_UINT;
+    densityUavDesc.ViewDimension = D3D12_UAV_DIMENSION_TEXTURE2D;
+
+    D3D12_UNORDERED_ACCESS_VIEW_DESC nearUavDesc = {};
+    nearUavDesc.Format = DXGI_FORMAT_UNKNOWN;
+    nearUavDesc.ViewDimension = D3D12_UAV_DIMENSION_BUFFER;
+    nearUavDesc.Buffer.NumElements = DENSITY_NEAR_PARTICLES;
+    nearUavDesc.Buffer.StructureByteStride = sizeof(Render::Particle);
+    nearUavDesc.Buffer.Flags = D3D12_BUFFER_UAV_FLAG_NONE;
+
+    D3D12_UNORDERED_ACCESS_VIEW_DESC counterUavDesc = {};
+    counterUavDesc.Format = DXGI_FORMAT_R32_TYPELESS;
+    counterUavDesc.ViewDimension = D3D12_UAV_DIMENSION_BUFFER;
+    counterUavDesc.Buffer.NumElements = 1;
+    counterUavDesc.Buffer.Flags = D3D12_BUFFER_UAV_FLAG_RAW;
+
+    struct TableEntry
+    {
+        ID3D12Resource* m_pResource;
+        const D3D12_UNORDERED_ACCESS_VIEW_DESC* m_pDesc;
+    };
+    const TableEntry tableEntries[] =
+    {
+        { m_densityTexture.Get(), &densityUavDesc },
+        { m_nearParticles.Get(), &nearUavDesc },
+        { m_nearCounter.Get(), &counterUavDesc }
+    };
 
-        const CD3DX12_CPU_DESCRIPTOR_HANDLE velHeapHandle(
+    for (UINT i = 0; i < _countof(tableEntries); i++)
+    {
+        const CD3DX12_CPU_DESCRIPTOR_HANDLE heapHandle(
             m_srvHeap->GetCPUDescriptorHandleForHeapStart(),
-            UavParticleVel0 + i,
+            UavDensityField + i,
             m_srvUavDescriptorSize);
-        m_device->CreateUnorderedAccessView(m_velocityBuffers[i].Get(), nullptr, &velocityDesc, velHeapHandle);
+        m_device->CreateUnorderedAccessView(tableEntries[i].m_pResource, nullptr, tableEntries[i].m_pDesc, heapHandle);
     }
-
-    const CD3DX12_CPU_DESCRIPTOR_HANDLE copyPosHandle(m_srvHeap->GetCPUDescriptorHandleForHeapStart(), UavParticlePos0Copy, m_srvUavDescriptorSize);
-    m_device->CreateUnorderedAccessView(m_positionBuffers[0].Get(), nullptr, &uavDesc, copyPosHandle);
-
-    const CD3DX12_CPU_DESCRIPTOR_HANDLE copyVelHandle(m_srvHeap->GetCPUDescriptorHandleForHeapStart(), UavParticleVel0Copy, m_srvUavDescriptorSize);
-    m_device->CreateUnorderedAccessView(m_velocityBuffers[0].Get(), nullptr, &velocityDesc, copyVelHandle);
 }
 
 //-----------------------------------------------------------------------------
@@ -269,7 +741,7 @@ void Compute::ResetFromAsyncHelper()
     ThrowIfFailed(m_commandAllocators[m_bufferIndex]->Reset());
     ThrowIfFailed(m_commandList->Reset(m_commandAllocators[m_bufferIndex].Get(), m_computeState.Get()));
 
-    for (UINT i = 0; i < m_NUM_BUFFERS; i++)
+    for (UINT i = 0; i < m_numBuffers; i++)
     {
         auto src = m_positionBuffers[i].Get();
         auto dst = m_sharedComputeBuffersReference[i].Get();
@@ -293,134 +765,457 @@ void Compute::ResetFromAsyncHelper()
 
     WaitForGpu();
 
-    // reset the old references
-    SetAsync(m_sharedRenderFence, m_sharedComputeBuffersReference, m_bufferIndex);
+    // reset the old references. the index of the next buffer written does not change
+    SetAsync(m_sharedRenderFence, m_sharedComputeBuffersReference, GetPreviousBufferIndex(m_bufferIndex));
 }
 
 //-----------------------------------------------------------------------------
-// cross-adapter copy from other compute object into this one
 //-----------------------------------------------------------------------------
-void Compute::CopyState(Compute* in_pCompute)
+void Compute::CopyState(Compute* in_pCompute, UINT in_firstParticle, UINT in_numParticles)
 {
-    in_pCompute->ResetFromAsyncHelper();
+    CopyStateAsync(in_pCompute, in_firstParticle, in_numParticles);
+    WaitForGpu();
+    m_copyStateResources.clear();
+}
 
-    //---------------------------------------------------------------
-    // open shared buffers
-    //---------------------------------------------------------------
-    ComPtr<ID3D12Heap> sharedHeap;
-    ThrowIfFailed(m_device->OpenSharedHandle(in_pCompute->m_sharedHandles.m_heap, IID_PPV_ARGS(&sharedHeap)));
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void Compute::WaitForCopyState()
+{
+    if (!GetCopyStateComplete())
+    {
+        ThrowIfFailed(m_fence->SetEventOnCompletion(m_copyStateFenceValue, m_fenceEvent));
+        const DWORD rv = ::WaitForSingleObject(m_fenceEvent, INFINITE);
+        assert(rv == WAIT_OBJECT_0);
+    }
+    m_copyStateResources.clear();
+}
 
-    const D3D12_RESOURCE_DESC crossAdapterDesc = CD3DX12_RESOURCE_DESC::Buffer(
-        in_pCompute->m_sharedHandles.m_alignedDataSize,
-        D3D12_RESOURCE_FLAG_ALLOW_CROSS_ADAPTER);
+//-----------------------------------------------------------------------------
+// cross-adapter copy of a range of particles from other compute object into this one
+// buffers are matched by age, so the most recent results of the other compute
+// become the most recent results of this one
+// the other adapter stages its velocities in a shared heap of their own and signals its fence,
+// this adapter waits for the fence on the gpu, then copies both in one submission
+// both queue behind the simulations in flight, so neither cpu waits for them
+//-----------------------------------------------------------------------------
+UINT64 Compute::CopyStateAsync(Compute* in_pCompute, UINT in_firstParticle, UINT in_numParticles)
+{
+    in_pCompute->ResetFromAsyncHelper();
 
-    ComPtr<ID3D12Resource> srcBuffer[m_NUM_BUFFERS];
+    const UINT64 positionOffset = UINT64(in_firstParticle) * sizeof(Render::Particle);
+    const UINT64 positionSize = UINT64(in_numParticles) * sizeof(Render::Particle);
 
-    for (UINT i = 0; i < m_NUM_BUFFERS; i++)
-    {
-        ThrowIfFailed(m_device->CreatePlacedResource(
-            sharedHeap.Get(),
-            i * in_pCompute->m_sharedHandles.m_alignedDataSize,
-            &crossAdapterDesc,
-            D3D12_RESOURCE_STATE_COPY_SOURCE,
-            nullptr,
-            IID_PPV_ARGS(&srcBuffer[i])));
-    }
+    // the range of each velocity stream
+    const UINT64 velocityOffset = UINT64(in_firstParticle) * GetVelocityStride();
+    const UINT64 velocitySize = UINT64(in_numParticles) * GetVelocityStride();
+    const UINT64 velocityStreamSize = UINT64(m_numParticles) * GetVelocityStride();
 
     //---------------------------------------------------------------
-    // copy the position data from the other compute device
+    // within the other adapter, stage the velocities of the range in a shared heap
+    // created for this copy only, so it does not take memory between copies
     //---------------------------------------------------------------
+    const D3D12_RESOURCE_DESC stagingDesc = CD3DX12_RESOURCE_DESC::Buffer(
+        velocityStreamSize * GetVelocityNumStreams(),
+        D3D12_RESOURCE_FLAG_ALLOW_CROSS_ADAPTER);
+    const UINT64 alignedStagingSize = in_pCompute->m_device->GetResourceAllocationInfo(0, 1, &stagingDesc).SizeInBytes;
+    HANDLE stagingHandle = nullptr;
+
+    UINT64 stagedFenceValue = 0;
     {
-        ThrowIfFailed(m_commandAllocators[m_bufferIndex]->Reset());
-        ThrowIfFailed(m_commandList->Reset(m_commandAllocators[m_bufferIndex].Get(), m_computeState.Get()));
+        in_pCompute->WaitForCopyState();
+        ThrowIfFailed(in_pCompute->m_copyStateAllocator->Reset());
+        ThrowIfFailed(in_pCompute->m_commandList->Reset(in_pCompute->m_copyStateAllocator.Get(), in_pCompute->m_computeState.Get()));
+
+        ComPtr<ID3D12Heap> stagingHeap;
+        in_pCompute->CreateSharedHeap(NUM_VELOCITY_BUFFERS * alignedStagingSize, stagingHeap, stagingHandle);
+
+        ComPtr<ID3D12Resource> stagingBuffers[NUM_VELOCITY_BUFFERS];
+        for (UINT i = 0; i < NUM_VELOCITY_BUFFERS; i++)
+        {
+            ThrowIfFailed(in_pCompute->m_device->CreatePlacedResource(
+                stagingHeap.Get(),
+                i * alignedStagingSize,
+                &stagingDesc,
+                D3D12_RESOURCE_STATE_COPY_DEST,
+                nullptr,
+                IID_PPV_ARGS(&stagingBuffers[i])));
+        }
 
-        for (UINT i = 0; i < m_NUM_BUFFERS; i++)
+        std::vector<CD3DX12_RESOURCE_BARRIER> barriers;
+        for (UINT i = 0; i < NUM_VELOCITY_BUFFERS; i++)
         {
-            m_commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(m_positionBuffers[i].Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_DEST));
+            barriers.push_back(CD3DX12_RESOURCE_BARRIER::Transition(in_pCompute->m_velocityBuffers[i].Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_SOURCE));
+        }
+        in_pCompute->m_commandList->ResourceBarrier((UINT)barriers.size(), barriers.data());
 
-            m_commandList->CopyBufferRegion(
-                m_positionBuffers[i].Get(), 0,
-                srcBuffer[i].Get(), 0,
-                m_numParticles * sizeof(Render::Particle));
+        for (UINT i = 0; i < NUM_VELOCITY_BUFFERS; i++)
+        {
+            for (UINT s = 0; s < GetVelocityNumStreams(); s++)
+            {
+                const UINT64 offset = s * velocityStreamSize + velocityOffset;
+                in_pCompute->m_commandList->CopyBufferRegion(
+                    stagingBuffers[i].Get(), offset,
+                    in_pCompute->m_velocityBuffers[i].Get(), offset,
+                    velocitySize);
+            }
+        }
 
-            m_commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(m_positionBuffers[i].Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_COPY_SOURCE));
+        for (auto& barrier : barriers)
+        {
+            std::swap(barrier.Transition.StateBefore, barrier.Transition.StateAfter);
         }
+        in_pCompute->m_commandList->ResourceBarrier((UINT)barriers.size(), barriers.data());
 
-        ThrowIfFailed(m_commandList->Close());
+        ThrowIfFailed(in_pCompute->m_commandList->Close());
 
-        ID3D12CommandList* ppCommandLists[] = { m_commandList.Get() };
-        m_commandQueue->ExecuteCommandLists(1, ppCommandLists);
+        ID3D12CommandList* ppCommandLists[] = { in_pCompute->m_commandList.Get() };
+        in_pCompute->m_commandQueue->ExecuteCommandLists(1, ppCommandLists);
 
-        WaitForGpu();
+        // also orders any simulation still in flight before the copy on this adapter
+        stagedFenceValue = in_pCompute->m_fenceValue;
+        ThrowIfFailed(Markers::Signal(in_pCompute->m_commandQueue.Get(), in_pCompute->m_fence.Get(), stagedFenceValue, L"compute fence"));
+        in_pCompute->m_fenceValue++;
+        in_pCompute->m_copyStateFenceValue = stagedFenceValue;
+
+        // written by the staging until it completes
+        in_pCompute->m_copyStateResources.push_back(stagingHeap);
+        for (UINT i = 0; i < NUM_VELOCITY_BUFFERS; i++)
+        {
+            in_pCompute->m_copyStateResources.push_back(stagingBuffers[i]);
+        }
     }
 
     //---------------------------------------------------------------
-    // within the other adapter, copy the velocity buffers into the shared position buffers
-    // WARNING: the size of the velocity data better be <= the size of the position data
+    // open shared buffers
     //---------------------------------------------------------------
-    {
-        in_pCompute->m_commandAllocators[m_bufferIndex]->Reset();
-        ThrowIfFailed(in_pCompute->m_commandList->Reset(in_pCompute->m_commandAllocators[m_bufferIndex].Get(), in_pCompute->m_computeState.Get()));
+    const SharedHandles& sharedHandles = in_pCompute->m_sharedHandles;
 
-        for (UINT i = 0; i < m_NUM_BUFFERS; i++)
-        {
-            in_pCompute->m_commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(in_pCompute->m_positionBuffers[i].Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_DEST));
-            in_pCompute->m_commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(in_pCompute->m_velocityBuffers[i].Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_SOURCE));
+    ComPtr<ID3D12Heap> sharedHeap;
+    ThrowIfFailed(m_device->OpenSharedHandle(sharedHandles.m_heap, IID_PPV_ARGS(&sharedHeap)));
 
-            in_pCompute->m_commandList->CopyBufferRegion(
-                in_pCompute->m_positionBuffers[i].Get(), 0,
-                in_pCompute->m_velocityBuffers[i].Get(), 0,
-                m_numParticles * sizeof(ParticleVelocity));
-        }
+    ComPtr<ID3D12Fence> sharedFence;
+    ThrowIfFailed(m_device->OpenSharedHandle(sharedHandles.m_fence, IID_PPV_ARGS(&sharedFence)));
 
-        ThrowIfFailed(in_pCompute->m_commandList->Close());
+    // the opened heap keeps the staging alive
+    ComPtr<ID3D12Heap> stagingHeap;
+    ThrowIfFailed(m_device->OpenSharedHandle(stagingHandle, IID_PPV_ARGS(&stagingHeap)));
+    BOOL rv = ::CloseHandle(stagingHandle);
+    assert(rv != FALSE);
 
-        ID3D12CommandList* ppCommandLists[] = { in_pCompute->m_commandList.Get() };
-        in_pCompute->m_commandQueue->ExecuteCommandLists(1, ppCommandLists);
+    const D3D12_RESOURCE_DESC crossAdapterDesc = CD3DX12_RESOURCE_DESC::Buffer(
+        sharedHandles.m_alignedDataSize,
+        D3D12_RESOURCE_FLAG_ALLOW_CROSS_ADAPTER);
 
-        in_pCompute->WaitForGpu();
+    const D3D12_RESOURCE_DESC velocityDesc = CD3DX12_RESOURCE_DESC::Buffer(
+        alignedStagingSize,
+        D3D12_RESOURCE_FLAG_ALLOW_CROSS_ADAPTER);
+
+    assert(in_pCompute->m_numBuffers == m_numBuffers);
+    ComPtr<ID3D12Resource> srcBuffer[MAX_NUM_BUFFERS];
+    ComPtr<ID3D12Resource> srcVelocityBuffer[NUM_VELOCITY_BUFFERS];
+
+    for (UINT i = 0; i < m_numBuffers; i++)
+    {
+        ThrowIfFailed(m_device->CreatePlacedResource(
+            sharedHeap.Get(),
+            i * sharedHandles.m_alignedDataSize,
+            &crossAdapterDesc,
+            D3D12_RESOURCE_STATE_COPY_SOURCE,
+            nullptr,
+            IID_PPV_ARGS(&srcBuffer[i])));
+    }
+
+    for (UINT i = 0; i < NUM_VELOCITY_BUFFERS; i++)
+    {
+        ThrowIfFailed(m_device->CreatePlacedResource(
+            stagingHeap.Get(),
+            i * alignedStagingSize,
+            &velocityDesc,
+            D3D12_RESOURCE_STATE_COPY_SOURCE,
+            nullptr,
+            IID_PPV_ARGS(&srcVelocityBuffer[i])));
     }
 
     //---------------------------------------------------------------
-    // now copy the velocity data from the other compute device
+    // copy the positions and velocities from the other compute device
     //---------------------------------------------------------------
     {
-        ThrowIfFailed(m_commandAllocators[m_bufferIndex]->Reset());
-        ThrowIfFailed(m_commandList->Reset(m_commandAllocators[m_bufferIndex].Get(), m_computeState.Get()));
+        WaitForCopyState();
+        ThrowIfFailed(m_copyStateAllocator->Reset());
+        ThrowIfFailed(m_commandList->Reset(m_copyStateAllocator.Get(), m_computeState.Get()));
+
+        std::vector<CD3DX12_RESOURCE_BARRIER> barriers;
+        for (UINT i = 0; i < m_numBuffers; i++)
+        {
+            barriers.push_back(CD3DX12_RESOURCE_BARRIER::Transition(m_positionBuffers[i].Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_DEST));
+        }
+        for (UINT i = 0; i < NUM_VELOCITY_BUFFERS; i++)
+        {
+            barriers.push_back(CD3DX12_RESOURCE_BARRIER::Transition(m_velocityBuffers[i].Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_DEST));
+        }
+        m_commandList->ResourceBarrier((UINT)barriers.size(), barriers.data());
 
-        for (UINT i = 0; i < m_NUM_BUFFERS; i++)
+        for (UINT i = 0; i < m_numBuffers; i++)
         {
-            m_commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(m_velocityBuffers[i].Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_DEST));
+            ID3D12Resource* pDst = m_positionBuffers[(i + m_bufferIndex) % m_numBuffers].Get();
+            ID3D12Resource* pSrc = srcBuffer[(i + in_pCompute->m_bufferIndex) % m_numBuffers].Get();
+            m_commandList->CopyBufferRegion(pDst, positionOffset, pSrc, positionOffset, positionSize);
+        }
 
-            m_commandList->CopyBufferRegion(
-                m_velocityBuffers[i].Get(), 0,
-                srcBuffer[i].Get(), 0,
-                m_numParticles * sizeof(ParticleVelocity));
+        for (UINT i = 0; i < NUM_VELOCITY_BUFFERS; i++)
+        {
+            ID3D12Resource* pDst = m_velocityBuffers[(i + m_velocityIndex) % NUM_VELOCITY_BUFFERS].Get();
+            ID3D12Resource* pSrc = srcVelocityBuffer[(i + in_pCompute->m_velocityIndex) % NUM_VELOCITY_BUFFERS].Get();
+            for (UINT s = 0; s < GetVelocityNumStreams(); s++)
+            {
+                const UINT64 offset = s * velocityStreamSize + velocityOffset;
+                m_commandList->CopyBufferRegion(pDst, offset, pSrc, offset, velocitySize);
+            }
+        }
 
-            m_commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(m_velocityBuffers[i].Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_UNORDERED_ACCESS));
+        for (auto& barrier : barriers)
+        {
+            std::swap(barrier.Transition.StateBefore, barrier.Transition.StateAfter);
         }
+        m_commandList->ResourceBarrier((UINT)barriers.size(), barriers.data());
 
         ThrowIfFailed(m_commandList->Close());
 
+        // the single handoff between the adapters
+        ThrowIfFailed(Markers::Wait(m_commandQueue.Get(), sharedFence.Get(), stagedFenceValue, L"staged compute fence"));
+
         ID3D12CommandList* ppCommandLists[] = { m_commandList.Get() };
         m_commandQueue->ExecuteCommandLists(1, ppCommandLists);
     }
 
-    WaitForGpu();
-}
-
+    // the render adapter waits for these like for the chunks of a simulation
+    const UINT64 copiedFenceValue = m_fenceValue;
+    for (UINT chunk = 0; chunk < m_numChunks; chunk++)
+    {
+        ThrowIfFailed(Markers::Signal(m_commandQueue.Get(), m_fence.Get(), m_fenceValue, L"compute fence"));
+        m_fenceValue++;
+    }
+    m_copyStateFenceValue = copiedFenceValue;
+
+    // read by the copy until it completes
+    m_copyStateResources.push_back(sharedHeap);
+    m_copyStateResources.push_back(stagingHeap);
+    m_copyStateResources.push_back(sharedFence);
+    for (UINT i = 0; i < m_numBuffers; i++)
+    {
+        m_copyStateResources.push_back(srcBuffer[i]);
+    }
+    for (UINT i = 0; i < NUM_VELOCITY_BUFFERS; i++)
+    {
+        m_copyStateResources.push_back(srcVelocityBuffer[i]);
+    }
+
+    m_simulatedSteps = in_pCompute->m_simulatedSteps;
+    return copiedFenceValue;
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+Snapshot::Header Compute::GetSnapshotLayout(UINT in_numParticles, UINT64 in_step)
+{
+    Snapshot::Header layout = {};
+    layout.m_numParticles = in_numParticles;
+    layout.m_positionStride = sizeof(Render::Particle);
+    layout.m_velocityNumStreams = GetVelocityNumStreams();
+    layout.m_velocityStride = GetVelocityStride();
+    layout.m_step = in_step;
+    return layout;
+}
+
+//-----------------------------------------------------------------------------
+// copies the range from the most recent position and velocity buffers into a readback buffer
+// works in async mode too, the position buffers are then the render adapter's, see GetPositionBufferState()
+//-----------------------------------------------------------------------------
+void Compute::ReadState(Snapshot& out_snapshot)
+{
+    assert(Snapshot::GetSameLayout(out_snapshot.GetHeader(), GetSnapshotLayout(m_numParticles, 0)));
+
+    if (0 == m_numParticlesInRange)
+    {
+        return;
+    }
+
+    const UINT64 positionOffset = UINT64(m_firstParticle) * sizeof(Render::Particle);
+    const UINT64 positionSize = UINT64(m_numParticlesInRange) * sizeof(Render::Particle);
+    const UINT64 velocityOffset = UINT64(m_firstParticle) * GetVelocityStride();
+    const UINT64 velocitySize = UINT64(m_numParticlesInRange) * GetVelocityStride();
+    const UINT64 velocityStreamSize = UINT64(m_numParticles) * GetVelocityStride();
+
+    // the readback buffer holds the arrays like the snapshot, only the range is written
+    const UINT64 readbackPositionsSize = out_snapshot.GetPositionsSize();
+    const UINT64 readbackSize = readbackPositionsSize + out_snapshot.GetVelocitiesSize();
+
+    const D3D12_HEAP_PROPERTIES readbackHeapProperties = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_READBACK);
+    const D3D12_RESOURCE_DESC readbackBufferDesc = CD3DX12_RESOURCE_DESC::Buffer(readbackSize);
+
+    ComPtr<ID3D12Resource> readbackBuffer;
+    ThrowIfFailed(m_device->CreateCommittedResource(
+        &readbackHeapProperties,
+        D3D12_HEAP_FLAG_NONE,
+        &readbackBufferDesc,
+        D3D12_RESOURCE_STATE_COPY_DEST,
+        nullptr,
+        IID_PPV_ARGS(&readbackBuffer)));
+
+    // the adapter must be idle before the allocator is reset
+    WaitForGpu();
+
+    ThrowIfFailed(m_commandAllocators[m_bufferIndex]->Reset());
+    ThrowIfFailed(m_commandList->Reset(m_commandAllocators[m_bufferIndex].Get(), m_computeState.Get()));
+
+    ID3D12Resource* pPositions = m_positionBuffers[GetPreviousBufferIndex(m_bufferIndex)].Get();
+    ID3D12Resource* pVelocities = m_velocityBuffers[1 - m_velocityIndex].Get();
+
+    D3D12_RESOURCE_BARRIER barriers[] = {
+        CD3DX12_RESOURCE_BARRIER::Transition(pPositions, GetPositionBufferState(), D3D12_RESOURCE_STATE_COPY_SOURCE),
+        CD3DX12_RESOURCE_BARRIER::Transition(pVelocities, D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_SOURCE) };
+    m_commandList->ResourceBarrier(_countof(barriers), barriers);
+
+    m_commandList->CopyBufferRegion(readbackBuffer.Get(), positionOffset, pPositions, positionOffset, positionSize);
+    for (UINT s = 0; s < GetVelocityNumStreams(); s++)
+    {
+        const UINT64 offset = s * velocityStreamSize + velocityOffset;
+        m_commandList->CopyBufferRegion(readbackBuffer.Get(), readbackPositionsSize + offset, pVelocities, offset, velocitySize);
+    }
+
+    for (auto& barrier : barriers)
+    {
+        std::swap(barrier.Transition.StateBefore, barrier.Transition.StateAfter);
+    }
+    m_commandList->ResourceBarrier(_countof(barriers), barriers);
+
+    ThrowIfFailed(m_commandList->Close());
+
+    ID3D12CommandList* ppCommandLists[] = { m_commandList.Get() };
+    m_commandQueue->ExecuteCommandLists(1, ppCommandLists);
+
+    WaitForGpu();
+
+    const D3D12_RANGE readRange = { SIZE_T(positionOffset), SIZE_T(readbackSize) };
+    UINT8* pData = nullptr;
+    ThrowIfFailed(readbackBuffer->Map(0, &readRange, reinterpret_cast<void**>(&pData)));
+
+    memcpy(out_snapshot.GetPositions() + positionOffset, pData + positionOffset, size_t(positionSize));
+    for (UINT s = 0; s < GetVelocityNumStreams(); s++)
+    {
+        const UINT64 offset = s * velocityStreamSize + velocityOffset;
+        memcpy(out_snapshot.GetVelocities() + offset, pData + readbackPositionsSize + offset, size_t(velocitySize));
+    }
+
+    const D3D12_RANGE writeRange = { 0, 0 };
+    readbackBuffer->Unmap(0, &writeRange);
+}
+
+//-----------------------------------------------------------------------------
+// the snapshot is already in the layout of the GPU buffers, so one memcpy from the
+// (memory-mapped) snapshot fills the upload buffer, then every buffer is copied from it
+// in async mode, that includes the position buffers of the render adapter
+//-----------------------------------------------------------------------------
+void Compute::LoadState(const Snapshot& in_snapshot)
+{
+    assert(Snapshot::GetSameLayout(in_snapshot.GetHeader(), GetSnapshotLayout(m_numParticles, 0)));
+
+    const UINT64 positionsSize = in_snapshot.GetPositionsSize();
+    const UINT64 velocitiesSize = in_snapshot.GetVelocitiesSize();
+
+    const D3D12_HEAP_PROPERTIES uploadHeapProperties = CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD);
+    const D3D12_RESOURCE_DESC uploadBufferDesc = CD3DX12_RESOURCE_DESC::Buffer(positionsSize + velocitiesSize);
+
+    ComPtr<ID3D12Resource> uploadBuffer;
+    ThrowIfFailed(m_device->CreateCommittedResource(
+        &uploadHeapProperties,
+        D3D12_HEAP_FLAG_NONE,
+        &uploadBufferDesc,
+        D3D12_RESOURCE_STATE_GENERIC_READ,
+        nullptr,
+        IID_PPV_ARGS(&uploadBuffer)));
+
+    const D3D12_RANGE readRange = { 0, 0 };
+    UINT8* pData = nullptr;
+    ThrowIfFailed(uploadBuffer->Map(0, &readRange, reinterpret_cast<void**>(&pData)));
+    memcpy(pData, in_snapshot.GetPositions(), size_t(positionsSize));
+    memcpy(pData + positionsSize, in_snapshot.GetVelocities(), size_t(velocitiesSize));
+    uploadBuffer->Unmap(0, nullptr);
+
+    // the adapter must be idle before the allocator is reset
+    WaitForGpu();
+
+    ThrowIfFailed(m_commandAllocators[m_bufferIndex]->Reset());
+    ThrowIfFailed(m_commandList->Reset(m_commandAllocators[m_bufferIndex].Get(), m_computeState.Get()));
+
+    std::vector<CD3DX12_RESOURCE_BARRIER> barriers;
+    for (UINT i = 0; i < m_numBuffers; i++)
+    {
+        barriers.push_back(CD3DX12_RESOURCE_BARRIER::Transition(m_positionBuffers[i].Get(), GetPositionBufferState(), D3D12_RESOURCE_STATE_COPY_DEST));
+    }
+    for (UINT i = 0; i < NUM_VELOCITY_BUFFERS; i++)
+    {
+        barriers.push_back(CD3DX12_RESOURCE_BARRIER::Transition(m_velocityBuffers[i].Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_DEST));
+    }
+    m_commandList->ResourceBarrier((UINT)barriers.size(), barriers.data());
+
+    for (UINT i = 0; i < m_numBuffers; i++)
+    {
+        m_commandList->CopyBufferRegion(m_positionBuffers[i].Get(), 0, uploadBuffer.Get(), 0, positionsSize);
+    }
+    for (UINT i = 0; i < NUM_VELOCITY_BUFFERS; i++)
+    {
+        m_commandList->CopyBufferRegion(m_velocityBuffers[i].Get(), 0, uploadBuffer.Get(), positionsSize, velocitiesSize);
+    }
+
+    for (auto& barrier : barriers)
+    {
+        std::swap(barrier.Transition.StateBefore, barrier.Transition.StateAfter);
+    }
+    m_commandList->ResourceBarrier((UINT)barriers.size(), barriers.data());
+
+    ThrowIfFailed(m_commandList->Close());
+
+    ID3D12CommandList* ppCommandLists[] = { m_commandList.Get() };
+    m_commandQueue->ExecuteCommandLists(1, ppCommandLists);
+
+    WaitForGpu();
+
+    m_simulatedSteps = in_snapshot.GetHeader().m_step;
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void Compute::SetParticleRange(UINT in_firstParticle, UINT in_numParticles)
+{
+    assert((in_firstParticle + in_numParticles) <= m_numParticles);
+    // blocks of the packed format must not span ranges
+    assert((0 == (in_firstParticle % PACK_BLOCK_SIZE)) || (in_firstParticle == m_numParticles));
+
+    m_firstParticle = in_firstParticle;
+    m_numParticlesInRange = in_numParticles;
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void Compute::SetNumChunks(UINT in_numChunks)
+{
+    m_numChunks = std::max(1u, std::min(in_numChunks, UINT(MAX_SIMULATION_CHUNKS)));
+}
+
 //-----------------------------------------------------------------------------
 // create root sig, pipeline state, descriptor heap, srv uav cbv
 //-----------------------------------------------------------------------------
 void Compute::Initialize(IDXGIAdapter1* in_pAdapter)
 {
-    CreateDevice(in_pAdapter, m_device);
+    CreateDevice(in_pAdapter, m_device, L"Compute");
 
     m_pExtensionHelper = new ExtensionHelper(m_device.Get());
     m_usingIntelCommandQueueExtension = m_usingIntelCommandQueueExtension && m_pExtensionHelper->GetEnabled();
     CreateCommandQueue();
 
-    for (UINT i = 0; i < m_NUM_BUFFERS; i++)
+    for (UINT i = 0; i < m_numBuffers; i++)
     {
         ThrowIfFailed(m_device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_COMPUTE, IID_PPV_ARGS(&m_commandAllocators[i])));
         std::wostringstream cmdAllocName;
@@ -428,6 +1223,9 @@ void Compute::Initialize(IDXGIAdapter1* in_pAdapter)
         m_commandAllocators[i]->SetName(cmdAllocName.str().c_str());
     }
 
+    ThrowIfFailed(m_device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_COMPUTE, IID_PPV_ARGS(&m_copyStateAllocator)));
+    m_copyStateAllocator->SetName(L"Compute CopyState CmdAlloc");
+
     ThrowIfFailed(m_device->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_COMPUTE, m_commandAllocators[0].Get(), nullptr, IID_PPV_ARGS(&m_commandList)));
     m_commandList->SetName(L"ComputeCommandList");
 
@@ -441,10 +1239,6 @@ void Compute::Initialize(IDXGIAdapter1* in_pAdapter)
         ThrowIfFailed(HRESULT_FROM_WIN32(GetLastError()));
     }
 
-    // create timer on the command queue
-    m_pTimer = new D3D12GpuTimer(m_device.Get(), m_commandQueue.Get(), static_cast<UINT>(GpuTimers::NumTimers));
-    m_pTimer->SetTimerName(static_cast<UINT>(GpuTimers::Simulate), "simulate ms");
-
     m_srvUavDescriptorSize = m_device->GetDescriptorHandleIncrementSize(D3D12_DESCRIPTOR_HEAP_TYPE_CBV_SRV_UAV);
 
     // Compute root signature.
@@ -454,9 +1248,31 @@ void Compute::Initialize(IDXGIAdapter1* in_pAdapter)
             CD3DX12_DESCRIPTOR_RANGE1(D3D12_DESCRIPTOR_RANGE_TYPE_UAV, 5, 0, 0, D3D12_DESCRIPTOR_RANGE_FLAG_DATA_VOLATILE)
         };
 
+        // grid acceleration structure, u5 through u9
+        const CD3DX12_DESCRIPTOR_RANGE1 gridUavRanges[] = {
+            CD3DX12_DESCRIPTOR_RANGE1(D3D12_DESCRIPTOR_RANGE_TYPE_UAV, m_NUM_GRID_BUFFERS, 5, 0, D3D12_DESCRIPTOR_RANGE_FLAG_DATA_VOLATILE)
+        };
+
+        // packed transfer buffer, u10
+        const CD3DX12_DESCRIPTOR_RANGE1 packedUavRanges[] = {
+            CD3DX12_DESCRIPTOR_RANGE1(D3D12_DESCRIPTOR_RANGE_TYPE_UAV, 1, 10, 0, D3D12_DESCRIPTOR_RANGE_FLAG_DATA_VOLATILE)
+        };
+
+        // density field, near particles and their counter, u13 through u15
+        const CD3DX12_DESCRIPTOR_RANGE1 densityUavRanges[] = {
+            CD3DX12_DESCRIPTOR_RANGE1(D3D12_DESCRIPTOR_RANGE_TYPE_UAV, 3, 13, 0, D3D12_DESCRIPTOR_RANGE_FLAG_DATA_VOLATILE)
+        };
+
         CD3DX12_ROOT_PARAMETER1 rootParameters[ComputeRootParametersCount] = {};
-        rootParameters[ComputeRootCBV].InitAsConstantBufferView(0, 0, D3D12_ROOT_DESCRIPTOR_FLAG_DATA_STATIC, D3D12_SHADER_VISIBILITY_ALL);
+        rootParameters[ComputeRootCBV].InitAsConstantBufferView(0, 0, D3D12_ROOT_DESCRIPTOR_FLAG_DATA_STATIC_WHILE_SET_AT_EXECUTE, D3D12_SHADER_VISIBILITY_ALL);
         rootParameters[ComputeRootUAVTable].InitAsDescriptorTable(_countof(uavRanges), uavRanges, D3D12_SHADER_VISIBILITY_ALL);
+        rootParameters[ComputeRootGridUAVTable].InitAsDescriptorTable(_countof(gridUavRanges), gridUavRanges, D3D12_SHADER_VISIBILITY_ALL);
+        rootParameters[ComputeRootPassConstants].InitAsConstants(4, 1, 0, D3D12_SHADER_VISIBILITY_ALL);
+        rootParameters[ComputeRootPackedUAVTable].InitAsDescriptorTable(_countof(packedUavRanges), packedUavRanges, D3D12_SHADER_VISIBILITY_ALL);
+        // temporal level of detail, u11 and u12
+        rootParameters[ComputeRootLodParticlesUAV].InitAsUnorderedAccessView(11, 0, D3D12_ROOT_DESCRIPTOR_FLAG_DATA_VOLATILE, D3D12_SHADER_VISIBILITY_ALL);
+        rootParameters[ComputeRootLodArgsUAV].InitAsUnorderedAccessView(12, 0, D3D12_ROOT_DESCRIPTOR_FLAG_DATA_VOLATILE, D3D12_SHADER_VISIBILITY_ALL);
+        rootParameters[ComputeRootDensityUAVTable].InitAsDescriptorTable(_countof(densityUavRanges), densityUavRanges, D3D12_SHADER_VISIBILITY_ALL);
 
         CD3DX12_VERSIONED_ROOT_SIGNATURE_DESC computeRootSignatureDesc;
         computeRootSignatureDesc.Init_1_1(_countof(rootParameters), rootParameters, 0, nullptr);
@@ -475,9 +1291,6 @@ void Compute::Initialize(IDXGIAdapter1* in_pAdapter)
     // Create the pipeline states, which includes compiling and loading shaders.
     {
         // Load and compile shaders.
-        ID3DBlob* pErrorMsgs = nullptr;
-        ComPtr<ID3DBlob> computeShader;
-
 #if defined(_DEBUG)
         // Enable better shader debugging with the graphics debugging tools.
         const UINT compileFlags = D3DCOMPILE_DEBUG | D3DCOMPILE_SKIP_OPTIMIZATION;
@@ -485,73 +1298,96 @@ void Compute::Initialize(IDXGIAdapter1* in_pAdapter)
         const UINT compileFlags = 0;
 #endif
 
-        const D3D_SHADER_MACRO macros[] = { { "blocksize", STRINGIFY(BLOCK_SIZE) }, { nullptr, nullptr} };
+        // the values of defines.h are included by the shader, see ShaderDefines.hlsl
+        // the macros only select permutations, which Shaders.targets also compiles offline
+        const D3D_SHADER_MACRO macros[] = {
+            { "lod", "0" },
+            { "velocitysoa", m_velocitySoa ? "1" : "0" },
+            { nullptr, nullptr} };
+
+        // the simulate kernels again, for the particles listed by CSLodClassify
+        D3D_SHADER_MACRO lodMacros[_countof(macros)];
+        std::copy(std::begin(macros), std::end(macros), lodMacros);
+        lodMacros[0].Definition = "1";
 
         const wchar_t* pShaderName = L"NBodyGravityCS.hlsl";
         const std::wstring fullShaderPath = GetAssetFullPath(pShaderName);
 
-        const HRESULT hr = ::D3DCompileFromFile(fullShaderPath.c_str(), macros, nullptr, "CSMain", "cs_5_0", compileFlags, 0, &computeShader, &pErrorMsgs);
-        if (FAILED(hr))
+        auto CreatePipelineStateWithMacros = [&](const D3D_SHADER_MACRO* in_pMacros, const char* in_pEntryPoint, const std::wstring& in_name, ComPtr<ID3D12PipelineState>& out_pipelineState)
         {
-            if (pErrorMsgs != nullptr)
-            {
-                const char* pMessage = (const char*)pErrorMsgs->GetBufferPointer();
-                ::OutputDebugStringA(pMessage);
-                pErrorMsgs->Release();
-            }            
-            ThrowIfFailed(hr);
-        }
+            const ComPtr<ID3DBlob> computeShader = PipelineCache::CompileShader(fullShaderPath, in_pMacros, in_pEntryPoint, "cs_5_0", compileFlags);
+
+            // Describe and create the compute pipeline state object (PSO).
+            D3D12_COMPUTE_PIPELINE_STATE_DESC computePsoDesc = {};
+            computePsoDesc.pRootSignature = m_rootSignature.Get();
+            computePsoDesc.CS = CD3DX12_SHADER_BYTECODE(computeShader.Get());
+
+            m_pPipelineCache->CreateComputePipelineState(in_name.c_str(), computePsoDesc, out_pipelineState);
+        };
 
-        // Describe and create the compute pipeline state object (PSO).
-        D3D12_COMPUTE_PIPELINE_STATE_DESC computePsoDesc = {};
-        computePsoDesc.pRootSignature = m_rootSignature.Get();
-        computePsoDesc.CS = CD3DX12_SHADER_BYTECODE(computeShader.Get());
+        auto CreatePipelineState = [&](const char* in_pEntryPoint, ComPtr<ID3D12PipelineState>& out_pipelineState)
+        {
+            CreatePipelineStateWithMacros(macros, in_pEntryPoint, std::wstring(in_pEntryPoint, in_pEntryPoint + strlen(in_pEntryPoint)), out_pipelineState);
+        };
 
-        ThrowIfFailed(m_device->CreateComputePipelineState(&computePsoDesc, IID_PPV_ARGS(&m_computeState)));
+        CreatePipelineState("CSMain", m_computeState);
         NAME_D3D12_OBJECT(m_computeState);
-    }
 
-    // Note: ComPtrs are CPU objects but this resource needs to stay in scope until
-    // the command list that references it has finished executing on the GPU.
-    // We will flush the GPU at the end of this method to ensure the resource is not
-    // prematurely destroyed.
-    ComPtr<ID3D12Resource> constantBufferCSUpload;
+        CreatePipelineState("CSMainNBody", m_nBodyState);
+        NAME_D3D12_OBJECT(m_nBodyState);
 
-    // Create the compute shader's constant buffer.
-    {
-        const UINT bufferSize = sizeof(ConstantBufferCS);
+        CreatePipelineState("CSMainNBodyGrid", m_nBodyGridState);
+        NAME_D3D12_OBJECT(m_nBodyGridState);
 
-        ThrowIfFailed(m_device->CreateCommittedResource(
-            &CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
-            D3D12_HEAP_FLAG_NONE,
-            &CD3DX12_RESOURCE_DESC::Buffer(bufferSize),
-            D3D12_RESOURCE_STATE_COPY_DEST,
-            nullptr,
-            IID_PPV_ARGS(&m_constantBufferCS)));
+        CreatePipelineState("CSPackPositions", m_packState);
+        NAME_D3D12_OBJECT(m_packState);
 
-        ThrowIfFailed(m_device->CreateCommittedResource(
-            &CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD),
-            D3D12_HEAP_FLAG_NONE,
-            &CD3DX12_RESOURCE_DESC::Buffer(bufferSize),
-            D3D12_RESOURCE_STATE_GENERIC_READ,
-            nullptr,
-            IID_PPV_ARGS(&constantBufferCSUpload)));
+        CreatePipelineState("CSInitParticles", m_initState);
+        NAME_D3D12_OBJECT(m_initState);
 
-        NAME_D3D12_OBJECT(m_constantBufferCS);
+        const char* gridEntryPoints[GridPassNumPasses] = {
+            "CSClearGrid", "CSCountParticles", "CSPrefixSum", "CSScatterParticles", "CSCellMass", "CSReduceGrid" };
+        for (UINT i = 0; i < GridPassNumPasses; i++)
+        {
+            CreatePipelineState(gridEntryPoints[i], m_gridStates[i]);
+            NAME_D3D12_OBJECT_INDEXED(m_gridStates, i);
+        }
+
+        CreatePipelineState("CSLodClassify", m_lodClassifyState);
+        NAME_D3D12_OBJECT(m_lodClassifyState);
+
+        CreatePipelineState("CSLodArguments", m_lodArgumentsState);
+        NAME_D3D12_OBJECT(m_lodArgumentsState);
+
+        CreatePipelineState("CSClearDensity", m_clearDensityState);
+        NAME_D3D12_OBJECT(m_clearDensityState);
 
-        ConstantBufferCS constantBufferCS = {};
-        constantBufferCS.param[0] = m_numParticles;
-        constantBufferCS.param[1] = int(ceil(m_numParticles / float(BLOCK_SIZE)));
-        constantBufferCS.paramf[0] = 0.1f;
-        constantBufferCS.paramf[1] = 1.0f;
+        CreatePipelineState("CSSplatDensity", m_splatDensityState);
+        NAME_D3D12_OBJECT(m_splatDensityState);
 
-        D3D12_SUBRESOURCE_DATA computeCBData = {};
-        computeCBData.pData = reinterpret_cast<UINT8*>(&constantBufferCS);
-        computeCBData.RowPitch = bufferSize;
-        computeCBData.SlicePitch = computeCBData.RowPitch;
+        const char* simulateEntryPoints[UINT(SimulationMode::Count)] = { "CSMain", "CSMainNBody", "CSMainNBodyGrid" };
+        for (UINT i = 0; i < UINT(SimulationMode::Count); i++)
+        {
+            const char* pEntryPoint = simulateEntryPoints[i];
+            CreatePipelineStateWithMacros(lodMacros, pEntryPoint, std::wstring(pEntryPoint, pEntryPoint + strlen(pEntryPoint)) + L" lod", m_lodStates[i]);
+            NAME_D3D12_OBJECT_INDEXED(m_lodStates, i);
+        }
+
+        m_pPipelineCache->Save();
+    }
+
+    // Create the compute shader's constant buffers, see UpdateConstants()
+    {
+        const UINT bufferSize = sizeof(ConstantBufferCS) * MAX_NUM_BUFFERS;
+
+        CreateBuffer(D3D12_HEAP_TYPE_UPLOAD, bufferSize, D3D12_RESOURCE_FLAG_NONE,
+            D3D12_RESOURCE_STATE_GENERIC_READ, m_constantBufferCS);
 
-        UpdateSubresources<1>(m_commandList.Get(), m_constantBufferCS.Get(), constantBufferCSUpload.Get(), 0, 0, 1, &computeCBData);
-        m_commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(m_constantBufferCS.Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER));
+        NAME_D3D12_OBJECT(m_constantBufferCS);
+
+        const CD3DX12_RANGE readRange(0, 0); // We do not intend to read from this resource on the CPU.
+        ThrowIfFailed(m_constantBufferCS->Map(0, &readRange, reinterpret_cast<void**>(&m_pConstantBufferCSData)));
+        ZeroMemory(m_pConstantBufferCSData, bufferSize);
     }
 
     // close command buffer & execute to initialize gpu resources
@@ -569,20 +1405,24 @@ void Compute::Initialize(IDXGIAdapter1* in_pAdapter)
     ThrowIfFailed(m_device->CreateDescriptorHeap(&srvUavHeapDesc, IID_PPV_ARGS(&m_srvHeap)));
 
     CreateSharedBuffers();
+    CreateGridBuffers();
+    CreateLodBuffers();
+    CreateDensityResources();
 
     // shenanigans to simplify transitioning /out/ of async compute mode:
     // keep a 2nd reference to these shared resources so we can copy stuff through them to a new compute object
-    for (UINT i = 0; i < m_NUM_BUFFERS; i++)
+    for (UINT i = 0; i < m_numBuffers; i++)
     {
         m_sharedComputeBuffersReference[i] = m_positionBuffers[i];
     }
 }
 
-#define USE_ORIG 1
+#define USE_ORIG 0
 #define USE_SCALAR_OPTIMIZED 0
 #define USE_SIMD_OPTIMIZED 0
+#define USE_SIMD_PHILOX 1
 
-#if (USE_ORIG + USE_SCALAR_OPTIMIZED + USE_SIMD_OPTIMIZED) != 1
+#if (USE_ORIG + USE_SCALAR_OPTIMIZED + USE_SIMD_OPTIMIZED + USE_SIMD_PHILOX) != 1
 #error "use one of the options"
 #endif
 
@@ -660,20 +1500,164 @@ inline __m128i __vectorcall  rand_sse()
 #endif
 }
 
+//-----------------------------------------------------------------------------
+// counter-based SIMD rand: Philox4x32-10, one counter per lane
+// see Salmon et al., "Parallel Random Numbers: As Easy as 1, 2, 3"
+// the output only depends on the key and the counter, so any thread can generate any particle
+//-----------------------------------------------------------------------------
+
+// 32x32 -> 64 bit products of every lane of a with m
+inline void __vectorcall mulhilo_sse(__m128i a, __m128i m, __m128i& out_hi, __m128i& out_lo)
+{
+    // products of lanes 0 and 2, then of lanes 1 and 3, as [lo, lo, hi, hi]
+    const __m128i even = _mm_shuffle_epi32(_mm_mul_epu32(a, m), _MM_SHUFFLE(3, 1, 2, 0));
+    const __m128i odd = _mm_shuffle_epi32(_mm_mul_epu32(_mm_srli_epi64(a, 32), m), _MM_SHUFFLE(3, 1, 2, 0));
+    out_lo = _mm_unpacklo_epi32(even, odd);
+    out_hi = _mm_unpackhi_epi32(even, odd);
+}
+
+// replaces the 4 counter words with 4 random words
+inline void philox_sse(__m128i (&io_c)[4], unsigned int key0, unsigned int key1)
+{
+    const __m128i m0 = _mm_set1_epi32(int(0xD2511F53));
+    const __m128i m1 = _mm_set1_epi32(int(0xCD9E8D57));
+    const __m128i w0 = _mm_set1_epi32(int(0x9E3779B9));
+    const __m128i w1 = _mm_set1_epi32(int(0xBB67AE85));
+    __m128i k0 = _mm_set1_epi32(int(key0));
+    __m128i k1 = _mm_set1_epi32(int(key1));
+
+    for (UINT round = 0; round < 10; round++)
+    {
+        __m128i hi0, lo0, hi1, lo1;
+        mulhilo_sse(io_c[0], m0, hi0, lo0);
+        mulhilo_sse(io_c[2], m1, hi1, lo1);
+        io_c[0] = _mm_xor_si128(_mm_xor_si128(hi1, io_c[1]), k0);
+        io_c[1] = lo1;
+        io_c[2] = _mm_xor_si128(_mm_xor_si128(hi0, io_c[3]), k1);
+        io_c[3] = lo0;
+        k0 = _mm_add_epi32(k0, w0);
+        k1 = _mm_add_epi32(k1, w1);
+    }
+}
+
+// random words to floats in [-1, 1). the top 24 bits convert exactly
+inline __m128 __vectorcall philox_to_signed_unit(__m128i bits)
+{
+    const __m128 f = _mm_cvtepi32_ps(_mm_srli_epi32(bits, 8));
+    return _mm_sub_ps(_mm_mul_ps(f, _mm_set1_ps(2.0f / 16777216.0f)), _mm_set1_ps(1.0f));
+}
+
+inline __m128 __vectorcall length_sq_sse(__m128 x, __m128 y, __m128 z)
+{
+    return _mm_add_ps(_mm_add_ps(_mm_mul_ps(x, x), _mm_mul_ps(y, y)), _mm_mul_ps(z, z));
+}
+
+//-----------------------------------------------------------------------------
+// 4 particles per iteration in structure-of-arrays form, SSE2 is the x64 baseline
+// draw d of particle firstIndex + i uses the counter (firstIndex + i, d, 0, 0),
+// so the particles only depend on INITIAL_PARTICLE_SEED, not on the threads that generate them
+// only exact sqrt and div, so results are the same on every CPU
+//-----------------------------------------------------------------------------
+void LoadParticlesPhilox(
+    _Out_writes_(numParticles) Render::Particle* out_pParticles,
+    _Out_writes_(numParticles) Compute::ParticleVelocity* out_pVelocities,
+    const XMFLOAT3& center, const float initialSpeed, float spread, UINT numParticles, UINT firstIndex)
+{
+    constexpr UINT numLanes = 4;
+    constexpr UINT batchSize = 4096; // particles per task
+    const UINT numBatches = (numParticles + batchSize - 1) / batchSize;
+
+    concurrency::parallel_for(UINT(0), numBatches, [&](UINT batch)
+        {
+            const UINT batchEnd = std::min(numParticles, (batch + 1) * batchSize);
+            for (UINT i = batch * batchSize; i < batchEnd; i += numLanes)
+            {
+                const __m128i index = _mm_add_epi32(_mm_set1_epi32(int(firstIndex + i)), _mm_set_epi32(3, 2, 1, 0));
+
+                // random walk until the length squared reaches 10, as the original version
+                const __m128 limit = _mm_set1_ps(10.f);
+                __m128 active = _mm_castsi128_ps(_mm_set1_epi32(-1));
+                __m128 dx = _mm_setzero_ps();
+                __m128 dy = _mm_setzero_ps();
+                __m128 dz = _mm_setzero_ps();
+                __m128 lengthSq;
+                UINT draw = 0;
+                do
+                {
+                    __m128i c[4] = { index, _mm_set1_epi32(int(draw)), _mm_setzero_si128(), _mm_setzero_si128() };
+                    philox_sse(c, INITIAL_PARTICLE_SEED, 0);
+                    draw++;
+
+                    dx = _mm_add_ps(dx, _mm_and_ps(active, philox_to_signed_unit(c[0])));
+                    dy = _mm_add_ps(dy, _mm_and_ps(active, philox_to_signed_unit(c[1])));
+                    dz = _mm_add_ps(dz, _mm_and_ps(active, philox_to_signed_unit(c[2])));
+
+                    lengthSq = length_sq_sse(dx, dy, dz);
+                    active = _mm_cmplt_ps(lengthSq, limit);
+                } while (_mm_movemask_ps(active));
+
+                const __m128 scale = _mm_div_ps(_mm_set1_ps(spread), _mm_sqrt_ps(lengthSq));
+                const __m128 px = _mm_add_ps(_mm_set1_ps(center.x), _mm_mul_ps(dx, scale));
+                const __m128 py = _mm_add_ps(_mm_set1_ps(center.y), _mm_mul_ps(dy, scale));
+                const __m128 pz = _mm_add_ps(_mm_set1_ps(center.z), _mm_mul_ps(dz, scale));
+
+                // create a velocity perpindicular-ish to the direction to the center of gravity
+                const __m128 one = _mm_set1_ps(1.f);
+                const __m128 invLength = _mm_div_ps(one, _mm_sqrt_ps(length_sq_sse(px, py, pz)));
+                const __m128 dirx = _mm_mul_ps(px, invLength);
+                const __m128 diry = _mm_mul_ps(py, invLength);
+                const __m128 dirz = _mm_mul_ps(pz, invLength);
+
+                __m128 perpx = _mm_sub_ps(one, dirx);
+                __m128 perpy = _mm_sub_ps(one, diry);
+                __m128 perpz = _mm_sub_ps(one, dirz);
+                const __m128 invPerpLength = _mm_div_ps(one, _mm_sqrt_ps(length_sq_sse(perpx, perpy, perpz)));
+                perpx = _mm_mul_ps(perpx, invPerpLength);
+                perpy = _mm_mul_ps(perpy, invPerpLength);
+                perpz = _mm_mul_ps(perpz, invPerpLength);
+
+                const __m128 speed = _mm_set1_ps(initialSpeed);
+                __m128 vx = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(diry, perpz), _mm_mul_ps(dirz, perpy)), speed);
+                __m128 vy = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(dirz, perpx), _mm_mul_ps(dirx, perpz)), speed);
+                __m128 vz = _mm_mul_ps(_mm_sub_ps(_mm_mul_ps(dirx, perpy), _mm_mul_ps(diry, perpx)), speed);
+
+                // one particle per register
+                __m128 positions[numLanes] = { px, py, pz, _mm_setzero_ps() };
+                _MM_TRANSPOSE4_PS(positions[0], positions[1], positions[2], positions[3]);
+                __m128 velocities[numLanes] = { vx, vy, vz, _mm_setzero_ps() };
+                _MM_TRANSPOSE4_PS(velocities[0], velocities[1], velocities[2], velocities[3]);
+
+                const UINT numValid = std::min(numLanes, batchEnd - i);
+                for (UINT lane = 0; lane < numValid; lane++)
+                {
+                    _mm_storeu_ps(&out_pParticles[i + lane].position.x, positions[lane]);
+                    XMStoreFloat3(&out_pVelocities[i + lane].velocity, velocities[lane]);
+                }
+            }
+        });
+}
+
 #include "Timer.h"
 
 //-----------------------------------------------------------------------------
+// firstIndex is the index of the first particle within all of the particles,
+// so each call of the deterministic versions generates different particles
 //-----------------------------------------------------------------------------
 void LoadParticles(
     _Out_writes_(numParticles) Render::Particle* out_pParticles,
     _Out_writes_(numParticles) Compute::ParticleVelocity* out_pVelocities,
-    const XMFLOAT3& center, const float initialSpeed, float spread, UINT numParticles)
+    const XMFLOAT3& center, const float initialSpeed, float spread, UINT numParticles, UINT firstIndex)
 {
 #ifdef BENCHMARK
     Timer t;
     t.Start();
 #endif
 
+#if USE_SIMD_PHILOX == 1
+    LoadParticlesPhilox(out_pParticles, out_pVelocities, center, initialSpeed, spread, numParticles, firstIndex);
+#else
+    UNREFERENCED_PARAMETER(firstIndex);
+
 #if USE_ORIG == 1
     // those are not thread safe
     std::random_device randomDevice;  //Will be used to obtain a seed for the random number engine
@@ -792,6 +1776,7 @@ void LoadParticles(
 
 #endif
     });
+#endif // USE_SIMD_PHILOX
 
 #ifdef BENCHMARK
     t.Stop();
@@ -804,6 +1789,8 @@ void LoadParticles(
         "USE_SCALAR_OPTIMIZED",
 #elif USE_SIMD_OPTIMIZED == 1
         "USE_SIMD_OPTIMIZED",
+#elif USE_SIMD_PHILOX == 1
+        "USE_SIMD_PHILOX",
 #endif
         t.GetTime());
 
@@ -821,6 +1808,12 @@ void Compute::InitializeParticles()
 {
     assert(m_numParticles != 0);
 
+    if (m_initializeOnGpu)
+    {
+        GenerateParticles();
+        return;
+    }
+
     // Initialize the data in the buffers.
     std::vector<Render::Particle> positions;
     positions.resize(m_numParticles);
@@ -835,13 +1828,13 @@ void Compute::InitializeParticles()
         XMFLOAT3(centerSpread, 0, 0),
         INITIAL_PARTICLE_SPEED,
         ParticleSpread,
-        m_numParticles / 2);
+        m_numParticles / 2, 0);
     LoadParticles(
         &positions[m_numParticles / 2], &velocities[m_numParticles / 2],
         XMFLOAT3(-centerSpread, 0, 0),
         INITIAL_PARTICLE_SPEED,
         ParticleSpread,
-        m_numParticles / 2);
+        m_numParticles / 2, m_numParticles / 2);
 
     //-------------------------------------------------------------------------
     // upload positions
@@ -867,24 +1860,45 @@ void Compute::InitializeParticles()
     ThrowIfFailed(m_commandAllocators[m_bufferIndex]->Reset());
     ThrowIfFailed(m_commandList->Reset(m_commandAllocators[m_bufferIndex].Get(), m_computeState.Get()));
 
+    std::vector<CD3DX12_RESOURCE_BARRIER> barriers;
+    for (UINT i = 0; i < m_numBuffers; i++)
     {
-        const CD3DX12_RESOURCE_BARRIER barriers[] =
-        {
-            CD3DX12_RESOURCE_BARRIER::Transition(m_positionBuffers[0].Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_DEST),
-            CD3DX12_RESOURCE_BARRIER::Transition(m_positionBuffers[1].Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_DEST),
-            CD3DX12_RESOURCE_BARRIER::Transition(m_velocityBuffers[0].Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_DEST),
-            CD3DX12_RESOURCE_BARRIER::Transition(m_velocityBuffers[1].Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_DEST)
-        };
-        m_commandList->ResourceBarrier(_countof(barriers), barriers);
+        barriers.push_back(CD3DX12_RESOURCE_BARRIER::Transition(m_positionBuffers[i].Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_DEST));
     }
+    for (UINT i = 0; i < NUM_VELOCITY_BUFFERS; i++)
+    {
+        barriers.push_back(CD3DX12_RESOURCE_BARRIER::Transition(m_velocityBuffers[i].Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_DEST));
+    }
+    m_commandList->ResourceBarrier((UINT)barriers.size(), barriers.data());
 
-    UpdateSubresources<1>(m_commandList.Get(), m_positionBuffers[0].Get(), particleBufferUpload.Get(), 0, 0, 1, &particleData);
-    UpdateSubresources<1>(m_commandList.Get(), m_positionBuffers[1].Get(), particleBufferUpload.Get(), 0, 0, 1, &particleData);
+    for (UINT i = 0; i < m_numBuffers; i++)
+    {
+        UpdateSubresources<1>(m_commandList.Get(), m_positionBuffers[i].Get(), particleBufferUpload.Get(), 0, 0, 1, &particleData);
+    }
 
     //-------------------------------------------------------------------------
     // upload velocities
     //-------------------------------------------------------------------------
-    const UINT64 velocityBufferSize = m_numParticles * sizeof(ParticleVelocity);
+    // convert to the GPU layout, see SetVelocitySoa()
+    const UINT64 velocityBufferSize = UINT64(m_numParticles) * GetVelocityNumStreams() * GetVelocityStride();
+    std::vector<float> gpuVelocities(size_t(velocityBufferSize / sizeof(float)));
+    for (UINT i = 0; i < m_numParticles; i++)
+    {
+        const XMFLOAT3& v = velocities[i].velocity;
+        if (m_velocitySoa)
+        {
+            gpuVelocities[i] = v.x;
+            gpuVelocities[m_numParticles + i] = v.y;
+            gpuVelocities[2 * m_numParticles + i] = v.z;
+        }
+        else
+        {
+            gpuVelocities[4 * i] = v.x;
+            gpuVelocities[4 * i + 1] = v.y;
+            gpuVelocities[4 * i + 2] = v.z;
+        }
+    }
+
     const D3D12_RESOURCE_DESC velocityBufferDesc = CD3DX12_RESOURCE_DESC::Buffer(velocityBufferSize);
 
     ComPtr<ID3D12Resource> velocityBufferUpload;
@@ -896,24 +1910,70 @@ void Compute::InitializeParticles()
         nullptr,
         IID_PPV_ARGS(&velocityBufferUpload)));
 
-    particleData.pData = reinterpret_cast<UINT8*>(&velocities[0]);
+    particleData.pData = reinterpret_cast<UINT8*>(&gpuVelocities[0]);
     particleData.RowPitch = velocityBufferSize;
     particleData.SlicePitch = particleData.RowPitch;
 
-    UpdateSubresources<1>(m_commandList.Get(), m_velocityBuffers[0].Get(), velocityBufferUpload.Get(), 0, 0, 1, &particleData);
-    UpdateSubresources<1>(m_commandList.Get(), m_velocityBuffers[1].Get(), velocityBufferUpload.Get(), 0, 0, 1, &particleData);
+    for (UINT i = 0; i < NUM_VELOCITY_BUFFERS; i++)
+    {
+        UpdateSubresources<1>(m_commandList.Get(), m_velocityBuffers[i].Get(), velocityBufferUpload.Get(), 0, 0, 1, &particleData);
+    }
 
+    barriers.clear();
+    for (UINT i = 0; i < m_numBuffers; i++)
     {
-        const CD3DX12_RESOURCE_BARRIER barriers[] =
-        {
-            CD3DX12_RESOURCE_BARRIER::Transition(m_positionBuffers[0].Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_COPY_SOURCE),
-            CD3DX12_RESOURCE_BARRIER::Transition(m_positionBuffers[1].Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_COPY_SOURCE),
-            CD3DX12_RESOURCE_BARRIER::Transition(m_velocityBuffers[0].Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_UNORDERED_ACCESS),
-            CD3DX12_RESOURCE_BARRIER::Transition(m_velocityBuffers[1].Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_UNORDERED_ACCESS)
-        };
-        m_commandList->ResourceBarrier(_countof(barriers), barriers);
+        barriers.push_back(CD3DX12_RESOURCE_BARRIER::Transition(m_positionBuffers[i].Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_COPY_SOURCE));
+    }
+    for (UINT i = 0; i < NUM_VELOCITY_BUFFERS; i++)
+    {
+        barriers.push_back(CD3DX12_RESOURCE_BARRIER::Transition(m_velocityBuffers[i].Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_UNORDERED_ACCESS));
+    }
+    m_commandList->ResourceBarrier((UINT)barriers.size(), barriers.data());
+
+    ThrowIfFailed(m_commandList->Close());
+
+    ID3D12CommandList* ppCommandLists[] = { m_commandList.Get() };
+    m_commandQueue->ExecuteCommandLists(1, ppCommandLists);
+
+    WaitForGpu();
+}
+
+//-----------------------------------------------------------------------------
+// the distribution of LoadParticles(), written by CSInitParticles straight into the GPU buffers
+// nothing is staged in system memory. the kernel only depends on the particle index and seed,
+// so it runs once per position buffer. every velocity buffer is written with at least one of them
+//-----------------------------------------------------------------------------
+void Compute::GenerateParticles()
+{
+    ThrowIfFailed(m_commandAllocators[m_bufferIndex]->Reset());
+    ThrowIfFailed(m_commandList->Reset(m_commandAllocators[m_bufferIndex].Get(), m_initState.Get()));
+
+    ID3D12DescriptorHeap* ppHeaps[] = { m_srvHeap.Get() };
+    m_commandList->SetDescriptorHeaps(_countof(ppHeaps), ppHeaps);
+    m_commandList->SetComputeRootSignature(m_rootSignature.Get());
+    m_commandList->SetComputeRootConstantBufferView(ComputeRootCBV, UpdateConstants(m_numParticles));
+
+    const UINT passConstants[4] = { 0, m_numParticles, 0, m_numParticles };
+    m_commandList->SetComputeRoot32BitConstants(ComputeRootPassConstants, _countof(passConstants), passConstants, 0);
+
+    static_assert(MIN_NUM_BUFFERS >= NUM_VELOCITY_BUFFERS, "some velocity buffers would not be initialized");
+    for (UINT i = 0; i < m_numBuffers; i++)
+    {
+        // the kernel writes u0 and u3
+        const CD3DX12_GPU_DESCRIPTOR_HANDLE tableHandle(m_srvHeap->GetGPUDescriptorHandleForHeapStart(), GetSimulateTable(i, i % NUM_VELOCITY_BUFFERS), m_srvUavDescriptorSize);
+        m_commandList->SetComputeRootDescriptorTable(ComputeRootUAVTable, tableHandle);
+        m_commandList->Dispatch((m_numParticles + BLOCK_SIZE - 1) / BLOCK_SIZE, 1, 1);
     }
 
+    // same states as after the upload of InitializeParticles()
+    std::vector<CD3DX12_RESOURCE_BARRIER> barriers;
+    for (UINT i = 0; i < m_numBuffers; i++)
+    {
+        barriers.push_back(CD3DX12_RESOURCE_BARRIER::Transition(m_positionBuffers[i].Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_SOURCE));
+    }
+    barriers.push_back(CD3DX12_RESOURCE_BARRIER::UAV(nullptr));
+    m_commandList->ResourceBarrier((UINT)barriers.size(), barriers.data());
+
     ThrowIfFailed(m_commandList->Close());
 
     ID3D12CommandList* ppCommandLists[] = { m_commandList.Get() };
@@ -946,9 +2006,68 @@ const Compute::SharedHandles& Compute::GetSharedHandles(HANDLE in_fenceHandle)
     ThrowIfFailed(m_device->OpenSharedHandle(in_fenceHandle, IID_PPV_ARGS(&m_sharedRenderFence)));
 
     m_sharedHandles.m_bufferIndex = m_bufferIndex;
+    m_sharedHandles.m_firstParticle = m_firstParticle;
+    m_sharedHandles.m_numParticles = m_numParticlesInRange;
+    m_sharedHandles.m_packed = m_packedTransfer;
+    m_sharedHandles.m_numChunks = m_numChunks;
+    m_sharedHandles.m_density = m_densityField;
+
+    UpdateResidency();
+
+    if (m_packedTransfer)
+    {
+        PackAllPositions();
+    }
+
+    if (m_densityField)
+    {
+        SplatAllDensity();
+    }
+
     return m_sharedHandles;
 }
 
+//-----------------------------------------------------------------------------
+// the packed and density heaps are only written while their transfer is on
+// evicting them lets the OS page them out when the adapter is over its memory budget
+//-----------------------------------------------------------------------------
+void Compute::UpdateResidency()
+{
+    if ((m_packedTransfer == m_packedResident) && (m_densityField == m_densityResident))
+    {
+        return;
+    }
+
+    // nothing in flight may use what is evicted
+    WaitForGpu();
+
+    std::vector<ID3D12Pageable*> resident;
+    std::vector<ID3D12Pageable*> evicted;
+    if (m_packedTransfer != m_packedResident)
+    {
+        (m_packedTransfer ? resident : evicted).push_back(m_packedHeap.Get());
+        m_packedResident = m_packedTransfer;
+    }
+    if (m_densityField != m_densityResident)
+    {
+        std::vector<ID3D12Pageable*>& pageables = m_densityField ? resident : evicted;
+        pageables.push_back(m_densityHeap.Get());
+        pageables.push_back(m_densityTexture.Get());
+        pageables.push_back(m_nearParticles.Get());
+        m_densityResident = m_densityField;
+    }
+
+    if (resident.size())
+    {
+        // blocks until the heaps are resident
+        ThrowIfFailed(m_device->MakeResident(UINT(resident.size()), resident.data()));
+    }
+    if (evicted.size())
+    {
+        ThrowIfFailed(m_device->Evict(UINT(evicted.size()), evicted.data()));
+    }
+}
+
 //-----------------------------------------------------------------------------
 // async does things differently
 // release shared, placed resources and replace with render device resources.
@@ -956,39 +2075,22 @@ const Compute::SharedHandles& Compute::GetSharedHandles(HANDLE in_fenceHandle)
 void Compute::SetAsync(
     ComPtr<ID3D12Fence> in_fence,
     ComPtr<ID3D12Resource>* in_buffers,
-    UINT in_bufferIndex)
+    UINT in_bufferIndex, UINT in_simulationLatency)
 {
     m_sharedRenderFence = in_fence;
-    m_bufferIndex = 1-in_bufferIndex;
-
-    D3D12_UNORDERED_ACCESS_VIEW_DESC uavDesc = {};
-    uavDesc.Format = DXGI_FORMAT_UNKNOWN;
-    uavDesc.ViewDimension = D3D12_UAV_DIMENSION_BUFFER;
-    uavDesc.Buffer.FirstElement = 0;
-    uavDesc.Buffer.NumElements = m_numParticles;
-    uavDesc.Buffer.StructureByteStride = sizeof(Render::Particle);
-    uavDesc.Buffer.CounterOffsetInBytes = 0;
-    uavDesc.Buffer.Flags = D3D12_BUFFER_UAV_FLAG_NONE;
+    m_simulationLatency = std::min(in_simulationLatency, m_numBuffers - 1);
+    m_bufferIndex = (in_bufferIndex + m_simulationLatency) % m_numBuffers;
 
-    for (UINT i = 0; i < m_NUM_BUFFERS; i++)
+    for (UINT i = 0; i < m_numBuffers; i++)
     {
         // replace "my" shared resources with the resources from the render adapter
         m_positionBuffers[i] = in_buffers[i];
-
-        const CD3DX12_CPU_DESCRIPTOR_HANDLE heapHandle(
-            m_srvHeap->GetCPUDescriptorHandleForHeapStart(),
-            UavParticlePos0 + i,
-            m_srvUavDescriptorSize);
-        m_device->CreateUnorderedAccessView(m_positionBuffers[i].Get(), nullptr, &uavDesc, heapHandle);
     }
-    // setting heap[2] = heap[0]
-    const CD3DX12_CPU_DESCRIPTOR_HANDLE copyPosHandle(m_srvHeap->GetCPUDescriptorHandleForHeapStart(), UavParticlePos0Copy, m_srvUavDescriptorSize);
-    m_device->CreateUnorderedAccessView(m_positionBuffers[0].Get(), nullptr, &uavDesc, copyPosHandle);
+    CreateSimulateTables();
 }
 
 //-----------------------------------------------------------------------------
 // signal frame is complete, move to next fence value
-// FIXME: expects there to only be 2 buffers
 //-----------------------------------------------------------------------------
 void Compute::MoveToNextFrame()
 {
@@ -996,60 +2098,473 @@ void Compute::MoveToNextFrame()
     m_frameFenceValues[m_bufferIndex] = m_fenceValue;
 
     // Signal and increment the fence value.
-    ThrowIfFailed(m_commandQueue->Signal(m_fence.Get(), m_fenceValue));
+    ThrowIfFailed(Markers::Signal(m_commandQueue.Get(), m_fence.Get(), m_fenceValue, L"compute fence"));
     m_fenceValue++;
 
     // Update the frame index.
-    m_bufferIndex = 1 - m_bufferIndex;
+    m_bufferIndex = (m_bufferIndex + 1) % m_numBuffers;
 }
 
 //-----------------------------------------------------------------------------
-// Run the particle simulation using the compute shader.
 //-----------------------------------------------------------------------------
-void Compute::Simulate(int in_numActiveParticles, UINT64 in_sharedFenceValue)
+void Compute::WaitForFrame()
+{
+    if (m_fence->GetCompletedValue() < m_frameFenceValues[m_bufferIndex])
+    {
+        Profiler::Scope waitScope("allocator wait");
+        ThrowIfFailed(m_fence->SetEventOnCompletion(m_frameFenceValues[m_bufferIndex], m_fenceEvent));
+        const DWORD rv = ::WaitForSingleObject(m_fenceEvent, INFINITE);
+        assert(rv == WAIT_OBJECT_0);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// bin particles into the finest grid level with a count/prefix sum/scatter,
+// then build each coarser level from the one below
+//-----------------------------------------------------------------------------
+void Compute::BuildGrid(UINT in_numActiveParticles)
 {
-    // /previous/ copy must complete before overwriting the old state
-    ThrowIfFailed(m_commandQueue->Wait(m_sharedRenderFence.Get(), in_sharedFenceValue-1));
+    // every pass depends on the results of the previous pass
+    const CD3DX12_RESOURCE_BARRIER uavBarrier = CD3DX12_RESOURCE_BARRIER::UAV(nullptr);
+
+    const UINT numParticleGroups = (in_numActiveParticles + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    const UINT numCellGroups = GetNumGridCells(0) / BLOCK_SIZE;
 
-    const UINT oldIndex = m_bufferIndex; // 0 or 1. Old corresponds to the surface the render device is currently using
-    const UINT newIndex = 1 - oldIndex;  // 1 or 0. New corresponds to the surface the render device is NOT using
+    m_commandList->SetPipelineState(m_gridStates[GridPassClear].Get());
+    m_commandList->Dispatch(numCellGroups, 1, 1);
+    m_commandList->ResourceBarrier(1, &uavBarrier);
+
+    m_commandList->SetPipelineState(m_gridStates[GridPassCount].Get());
+    m_commandList->Dispatch(numParticleGroups, 1, 1);
+    m_commandList->ResourceBarrier(1, &uavBarrier);
+
+    m_commandList->SetPipelineState(m_gridStates[GridPassPrefixSum].Get());
+    m_commandList->Dispatch(1, 1, 1);
+    m_commandList->ResourceBarrier(1, &uavBarrier);
+
+    m_commandList->SetPipelineState(m_gridStates[GridPassScatter].Get());
+    m_commandList->Dispatch(numParticleGroups, 1, 1);
+    m_commandList->ResourceBarrier(1, &uavBarrier);
+
+    m_commandList->SetPipelineState(m_gridStates[GridPassCellMass].Get());
+    m_commandList->Dispatch(numCellGroups, 1, 1);
+    m_commandList->ResourceBarrier(1, &uavBarrier);
+
+    m_commandList->SetPipelineState(m_gridStates[GridPassReduce].Get());
+    for (UINT level = 1; level < GRID_LEVELS; level++)
+    {
+        m_commandList->SetComputeRoot32BitConstant(ComputeRootPassConstants, level, 0);
+        m_commandList->Dispatch((GetNumGridCells(level) + BLOCK_SIZE - 1) / BLOCK_SIZE, 1, 1);
+        m_commandList->ResourceBarrier(1, &uavBarrier);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// quantize the positions of this object's range into the packed format
+//-----------------------------------------------------------------------------
+void Compute::PackPositions(UINT in_bufferIndex, UINT in_numParticles)
+{
+    ID3D12Resource* pPackedBuffer = m_packedBuffers[in_bufferIndex].Get();
+
+    const CD3DX12_GPU_DESCRIPTOR_HANDLE packedHeapHandle(m_srvHeap->GetGPUDescriptorHandleForHeapStart(), UavPackedPos0 + in_bufferIndex, m_srvUavDescriptorSize);
+    m_commandList->SetComputeRootDescriptorTable(ComputeRootPackedUAVTable, packedHeapHandle);
+
+    m_commandList->SetPipelineState(m_packState.Get());
+    m_commandList->Dispatch((in_numParticles + PACK_BLOCK_SIZE - 1) / PACK_BLOCK_SIZE, 1, 1);
+
+    m_commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::UAV(pPackedBuffer));
+}
+
+//-----------------------------------------------------------------------------
+// Simulate() only packs the buffer it writes, but the render adapter
+// initially copies both buffers
+//-----------------------------------------------------------------------------
+void Compute::PackAllPositions()
+{
+    if (0 == m_numParticlesInRange)
+    {
+        return;
+    }
+
+    // e.g. when the packed transfer is enabled, the simulation of a recent frame may still be running
+    WaitForFrame();
 
     ThrowIfFailed(m_commandAllocators[m_bufferIndex]->Reset());
-    ThrowIfFailed(m_commandList->Reset(m_commandAllocators[m_bufferIndex].Get(), m_computeState.Get()));
+    ThrowIfFailed(m_commandList->Reset(m_commandAllocators[m_bufferIndex].Get(), m_packState.Get()));
+
+    ID3D12DescriptorHeap* ppHeaps[] = { m_srvHeap.Get() };
+    m_commandList->SetDescriptorHeaps(_countof(ppHeaps), ppHeaps);
+    m_commandList->SetComputeRootSignature(m_rootSignature.Get());
+    m_commandList->SetComputeRootConstantBufferView(ComputeRootCBV, UpdateConstants(m_numParticles));
+
+    const UINT lastParticle = m_firstParticle + m_numParticlesInRange;
+    const UINT passConstants[4] = { 0, m_numParticles, m_firstParticle, lastParticle };
+    m_commandList->SetComputeRoot32BitConstants(ComputeRootPassConstants, _countof(passConstants), passConstants, 0);
+
+    for (UINT i = 0; i < m_numBuffers; i++)
+    {
+        // the pack kernel reads u0
+        const CD3DX12_GPU_DESCRIPTOR_HANDLE srcHeapHandle(m_srvHeap->GetGPUDescriptorHandleForHeapStart(), GetSimulateTable(i, m_velocityIndex), m_srvUavDescriptorSize);
+        m_commandList->SetComputeRootDescriptorTable(ComputeRootUAVTable, srcHeapHandle);
+
+        PackPositions(i, m_numParticlesInRange);
+    }
+
+    ThrowIfFailed(m_commandList->Close());
+
+    ID3D12CommandList* ppCommandLists[] = { m_commandList.Get() };
+    m_commandQueue->ExecuteCommandLists(1, ppCommandLists);
+
+    WaitForGpu();
+}
+
+//-----------------------------------------------------------------------------
+// count the particles of this object's range per texel of the density field, as seen by the camera of the render adapter
+// the particles near the camera are listed instead, then both are copied into the shared heap
+//-----------------------------------------------------------------------------
+void Compute::SplatDensity(UINT in_bufferIndex, UINT in_numActiveParticles)
+{
+    const CD3DX12_RESOURCE_BARRIER uavBarrier = CD3DX12_RESOURCE_BARRIER::UAV(nullptr);
+
+    // the splat kernel reads u0
+    const CD3DX12_GPU_DESCRIPTOR_HANDLE srcHeapHandle(m_srvHeap->GetGPUDescriptorHandleForHeapStart(), GetSimulateTable(in_bufferIndex, m_velocityIndex), m_srvUavDescriptorSize);
+    m_commandList->SetComputeRootDescriptorTable(ComputeRootUAVTable, srcHeapHandle);
+
+    const CD3DX12_GPU_DESCRIPTOR_HANDLE densityHeapHandle(m_srvHeap->GetGPUDescriptorHandleForHeapStart(), UavDensityField, m_srvUavDescriptorSize);
+    m_commandList->SetComputeRootDescriptorTable(ComputeRootDensityUAVTable, densityHeapHandle);
+
+    const UINT lastParticle = std::min(m_firstParticle + m_numParticlesInRange, in_numActiveParticles);
+    const UINT passConstants[4] = { 0, in_numActiveParticles, m_firstParticle, lastParticle };
+    m_commandList->SetComputeRoot32BitConstants(ComputeRootPassConstants, _countof(passConstants), passConstants, 0);
+
+    // the clear covers the texels and the near particle slots
+    const UINT numClearElements = std::max(UINT(DENSITY_WIDTH * DENSITY_HEIGHT), UINT(DENSITY_NEAR_PARTICLES));
+    m_commandList->SetPipelineState(m_clearDensityState.Get());
+    m_commandList->Dispatch((numClearElements + BLOCK_SIZE - 1) / BLOCK_SIZE, 1, 1);
+    m_commandList->ResourceBarrier(1, &uavBarrier);
+
+    const UINT numParticles = (lastParticle > m_firstParticle) ? (lastParticle - m_firstParticle) : 0;
+    if (numParticles > 0)
+    {
+        m_commandList->SetPipelineState(m_splatDensityState.Get());
+        m_commandList->Dispatch((numParticles + BLOCK_SIZE - 1) / BLOCK_SIZE, 1, 1);
+    }
+
+    {
+        const D3D12_RESOURCE_BARRIER barriers[] = {
+            CD3DX12_RESOURCE_BARRIER::Transition(m_densityTexture.Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_SOURCE),
+            CD3DX12_RESOURCE_BARRIER::Transition(m_nearParticles.Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_SOURCE) };
+        m_commandList->ResourceBarrier(_countof(barriers), barriers);
+    }
+
+    // without row-major texture support the shared density field is a buffer, with the rows of a copy footprint
+    const CD3DX12_TEXTURE_COPY_LOCATION src(m_densityTexture.Get(), 0);
+    if (m_sharedHandles.m_densityRowMajor)
+    {
+        const CD3DX12_TEXTURE_COPY_LOCATION dst(m_sharedDensity[in_bufferIndex].Get(), 0);
+        m_commandList->CopyTextureRegion(&dst, 0, 0, 0, &src, nullptr);
+    }
+    else
+    {
+        const D3D12_PLACED_SUBRESOURCE_FOOTPRINT footprint = { 0, { DXGI_FORMAT_R32_UINT, DENSITY_WIDTH, DENSITY_HEIGHT, 1, DENSITY_WIDTH * sizeof(UINT) } };
+        const CD3DX12_TEXTURE_COPY_LOCATION dst(m_sharedDensity[in_bufferIndex].Get(), footprint);
+        m_commandList->CopyTextureRegion(&dst, 0, 0, 0, &src, nullptr);
+    }
+    m_commandList->CopyBufferRegion(m_sharedNearParticles[in_bufferIndex].Get(), 0, m_nearParticles.Get(), 0, UINT64(DENSITY_NEAR_PARTICLES) * sizeof(Render::Particle));
+
+    {
+        const D3D12_RESOURCE_BARRIER barriers[] = {
+            CD3DX12_RESOURCE_BARRIER::Transition(m_densityTexture.Get(), D3D12_RESOURCE_STATE_COPY_SOURCE, D3D12_RESOURCE_STATE_UNORDERED_ACCESS),
+            CD3DX12_RESOURCE_BARRIER::Transition(m_nearParticles.Get(), D3D12_RESOURCE_STATE_COPY_SOURCE, D3D12_RESOURCE_STATE_UNORDERED_ACCESS) };
+        m_commandList->ResourceBarrier(_countof(barriers), barriers);
+    }
+}
 
-    m_pTimer->BeginTimer(m_commandList.Get(), static_cast<std::uint32_t>(GpuTimers::Simulate));
+//-----------------------------------------------------------------------------
+// Simulate() only splats the buffer it writes, but the render adapter
+// initially copies every buffer. the sources with no particles still clear theirs
+//-----------------------------------------------------------------------------
+void Compute::SplatAllDensity()
+{
+    WaitForFrame();
 
-    const UINT srcHeapIndex = UavParticlePos0 + oldIndex; // 0 or 1
+    ThrowIfFailed(m_commandAllocators[m_bufferIndex]->Reset());
+    ThrowIfFailed(m_commandList->Reset(m_commandAllocators[m_bufferIndex].Get(), m_clearDensityState.Get()));
 
     ID3D12DescriptorHeap* ppHeaps[] = { m_srvHeap.Get() };
     m_commandList->SetDescriptorHeaps(_countof(ppHeaps), ppHeaps);
-    m_commandList->SetPipelineState(m_computeState.Get());
     m_commandList->SetComputeRootSignature(m_rootSignature.Get());
-    m_commandList->SetComputeRootConstantBufferView(ComputeRootCBV, m_constantBufferCS->GetGPUVirtualAddress());
+    m_commandList->SetComputeRootConstantBufferView(ComputeRootCBV, UpdateConstants(m_numParticles));
 
-    //-------------------------------------------------
-    // set heap base to point at previous simulation results
-    // note that descriptor heap[2] is a copy of heap[0], so when the base is heap[1] the dest is heap[2]==heap[0]
-    //-------------------------------------------------
-    const CD3DX12_GPU_DESCRIPTOR_HANDLE srcHeapHandle(m_srvHeap->GetGPUDescriptorHandleForHeapStart(), srcHeapIndex, m_srvUavDescriptorSize);
+    for (UINT i = 0; i < m_numBuffers; i++)
+    {
+        SplatDensity(i, m_numParticles);
+    }
+
+    ThrowIfFailed(m_commandList->Close());
+
+    ID3D12CommandList* ppCommandLists[] = { m_commandList.Get() };
+    m_commandQueue->ExecuteCommandLists(1, ppCommandLists);
+
+    WaitForGpu();
+}
+
+//-----------------------------------------------------------------------------
+// the particles of the range that skip this step are copied forward by the classification,
+// the bound simulate kernel then only runs for the listed particles
+//-----------------------------------------------------------------------------
+void Compute::RecordLodStep(UINT in_numParticles)
+{
+    const CD3DX12_RESOURCE_BARRIER uavBarrier = CD3DX12_RESOURCE_BARRIER::UAV(nullptr);
+
+    m_commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(m_lodArgs.Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_COPY_DEST));
+    m_commandList->CopyResource(m_lodArgs.Get(), m_lodArgsReset.Get());
+    m_commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(m_lodArgs.Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_UNORDERED_ACCESS));
+
+    m_commandList->SetPipelineState(m_lodClassifyState.Get());
+    m_commandList->Dispatch((in_numParticles + BLOCK_SIZE - 1) / BLOCK_SIZE, 1, 1);
+    m_commandList->ResourceBarrier(1, &uavBarrier);
+
+    m_commandList->SetPipelineState(m_lodArgumentsState.Get());
+    m_commandList->Dispatch(1, 1, 1);
+    m_commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(m_lodArgs.Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT));
+
+    m_commandList->SetPipelineState(m_lodStates[UINT(m_simulationMode)].Get());
+    m_commandList->ExecuteIndirect(m_lodCommandSignature.Get(), 1, m_lodArgs.Get(), 0, nullptr, 0);
+
+    // the next classification, e.g. of the next chunk, overwrites the list
+    const D3D12_RESOURCE_BARRIER barriers[] = {
+        CD3DX12_RESOURCE_BARRIER::Transition(m_lodArgs.Get(), D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT, D3D12_RESOURCE_STATE_UNORDERED_ACCESS),
+        CD3DX12_RESOURCE_BARRIER::UAV(m_lodParticles.Get()) };
+    m_commandList->ResourceBarrier(_countof(barriers), barriers);
+}
+
+//-----------------------------------------------------------------------------
+// one step of the particles [in_firstParticle, in_lastParticle) with the simulate table in_tableIndex
+// with in_buildGrid, first rebuilds the grid from the old positions of the table
+//-----------------------------------------------------------------------------
+void Compute::RecordStep(UINT in_tableIndex, UINT in_numActiveParticles, UINT in_firstParticle, UINT in_lastParticle, bool in_buildGrid, UINT in_step)
+{
+    const CD3DX12_GPU_DESCRIPTOR_HANDLE srcHeapHandle(m_srvHeap->GetGPUDescriptorHandleForHeapStart(), in_tableIndex, m_srvUavDescriptorSize);
     m_commandList->SetComputeRootDescriptorTable(ComputeRootUAVTable, srcHeapHandle);
 
+    const UINT passConstants[4] = { in_step, in_numActiveParticles, in_firstParticle, in_lastParticle };
+    m_commandList->SetComputeRoot32BitConstants(ComputeRootPassConstants, _countof(passConstants), passConstants, 0);
+
+    switch (m_simulationMode)
+    {
+    case SimulationMode::NBody:
+        m_commandList->SetPipelineState(m_nBodyState.Get());
+        break;
+    case SimulationMode::NBodyGrid:
+        if (in_buildGrid)
+        {
+            BuildGrid(in_numActiveParticles);
+            // the grid passes overwrite the step with the level
+            m_commandList->SetComputeRoot32BitConstant(ComputeRootPassConstants, in_step, 0);
+        }
+        m_commandList->SetPipelineState(m_nBodyGridState.Get());
+        break;
+    default:
+        m_commandList->SetPipelineState(m_computeState.Get());
+    }
+
     //-------------------------------------------------
     // dispatch reads from src and writes to dest
     //-------------------------------------------------
-    ID3D12Resource* pSharedResource = m_positionBuffers[newIndex].Get();
-    m_commandList->Dispatch(static_cast<UINT>(ceil(in_numActiveParticles / float(BLOCK_SIZE))), 1, 1);
+    const UINT numParticles = (in_lastParticle > in_firstParticle) ? (in_lastParticle - in_firstParticle) : 0;
+    if ((numParticles > 0) && (m_simulationParameters.m_lodAcceleration > 0))
+    {
+        RecordLodStep(numParticles);
+    }
+    else if (numParticles > 0)
+    {
+        m_commandList->Dispatch(static_cast<UINT>(ceil(numParticles / float(BLOCK_SIZE))), 1, 1);
+    }
+}
 
-    // a resource barrier gives maximum information to the runtime that may help other adapters with cache sync
-    m_commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::UAV(pSharedResource));
+//-----------------------------------------------------------------------------
+// writes the constants of the simulation into the constant buffer of m_bufferIndex
+//-----------------------------------------------------------------------------
+D3D12_GPU_VIRTUAL_ADDRESS Compute::UpdateConstants(UINT in_numActiveParticles)
+{
+    ConstantBufferCS constantBufferCS = {};
+    constantBufferCS.param[0] = m_numParticles;
+    constantBufferCS.param[1] = (in_numActiveParticles + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    constantBufferCS.paramf[0] = m_simulationParameters.m_timestep;
+    constantBufferCS.paramf[1] = m_simulationParameters.m_damping;
+    constantBufferCS.paramf[2] = m_simulationParameters.m_mass;
+    constantBufferCS.paramf[3] = m_simulationParameters.m_softening * m_simulationParameters.m_softening;
+
+    // initial particles, see GenerateParticles()
+    constantBufferCS.param[2] = m_numParticles / 2;
+    constantBufferCS.param[3] = INITIAL_PARTICLE_SEED;
+    constantBufferCS.initf[0] = ParticleSpread * 0.750f;
+    constantBufferCS.initf[1] = ParticleSpread;
+    constantBufferCS.initf[2] = INITIAL_PARTICLE_SPEED;
+
+    constantBufferCS.lodf[0] = m_simulationParameters.m_lodAcceleration;
+
+    constantBufferCS.densityViewProjection = m_densityViewProjection;
+    constantBufferCS.densityf[0] = m_densityNearDistance;
+
+    UINT8* destination = m_pConstantBufferCSData + sizeof(ConstantBufferCS) * m_bufferIndex;
+    memcpy(destination, &constantBufferCS, sizeof(ConstantBufferCS));
+
+    return m_constantBufferCS->GetGPUVirtualAddress() + sizeof(ConstantBufferCS) * m_bufferIndex;
+}
+
+//-----------------------------------------------------------------------------
+// Run the particle simulation using the compute shader.
+// the range of particles is dispatched in m_numChunks command lists. each but the last
+// signals the fence, the last signals it in MoveToNextFrame()
+// only the last of in_numSteps steps is chunked, the render adapter copies just its results
+//-----------------------------------------------------------------------------
+void Compute::Simulate(int in_numActiveParticles, UINT64 in_sharedFenceValue, UINT in_numSteps)
+{
+    Profiler::Scope scope("simulate");
 
-    m_pTimer->EndTimer(m_commandList.Get(), static_cast<std::uint32_t>(GpuTimers::Simulate));
-    m_pTimer->ResolveAllTimers(m_commandList.Get());
+    // the copy (or draw, in async mode) that last read the buffer we are about to write
+    // must complete before overwriting it. that was m_numBuffers - m_simulationLatency frames ago
+    const UINT64 reuseDistance = m_numBuffers - m_simulationLatency;
+    const UINT64 waitValue = (in_sharedFenceValue > reuseDistance) ? (in_sharedFenceValue - reuseDistance) : 0;
+    ThrowIfFailed(Markers::Wait(m_commandQueue.Get(), m_sharedRenderFence.Get(), waitValue, L"copy fence"));
 
-    ThrowIfFailed(m_commandList->Close());
+    // the copy of the first chunk no longer waits for the whole simulation,
+    // so the render adapter does not guarantee this allocator is idle
+    WaitForFrame();
 
-    ID3D12CommandList* ppCommandLists[] = { m_commandList.Get() };
-    m_commandQueue->ExecuteCommandLists(1, ppCommandLists);
+    ThrowIfFailed(m_commandAllocators[m_bufferIndex]->Reset());
+    const D3D12_GPU_VIRTUAL_ADDRESS constantBufferAddress = UpdateConstants(UINT(in_numActiveParticles));
+
+    //-------------------------------------------------
+    // simulate the active particles within this object's range
+    //-------------------------------------------------
+    const UINT lastParticle = std::min(m_firstParticle + m_numParticlesInRange, UINT(in_numActiveParticles));
+    const UINT chunkSize = GetChunkSize(m_numParticlesInRange, m_numChunks);
+
+    for (UINT chunk = 0; chunk < m_numChunks; chunk++)
+    {
+        const bool firstChunk = (0 == chunk);
+        const bool lastChunk = ((m_numChunks - 1) == chunk);
+
+        // the allocator holds the commands of all the chunks
+        ThrowIfFailed(m_commandList->Reset(m_commandAllocators[m_bufferIndex].Get(), m_computeState.Get()));
+        Markers::BeginEvent(m_commandList.Get(), L"simulate");
+
+        if (firstChunk)
+        {
+            m_pTimer->BeginTimer(m_commandList.Get(), static_cast<std::uint32_t>(GpuTimers::Simulate));
+        }
+
+        ID3D12DescriptorHeap* ppHeaps[] = { m_srvHeap.Get() };
+        m_commandList->SetDescriptorHeaps(_countof(ppHeaps), ppHeaps);
+        m_commandList->SetComputeRootSignature(m_rootSignature.Get());
+        m_commandList->SetComputeRootConstantBufferView(ComputeRootCBV, constantBufferAddress);
+
+        const CD3DX12_GPU_DESCRIPTOR_HANDLE gridHeapHandle(m_srvHeap->GetGPUDescriptorHandleForHeapStart(), UavGridCellCount, m_srvUavDescriptorSize);
+        m_commandList->SetComputeRootDescriptorTable(ComputeRootGridUAVTable, gridHeapHandle);
+        m_commandList->SetComputeRootUnorderedAccessView(ComputeRootLodParticlesUAV, m_lodParticles->GetGPUVirtualAddress());
+        m_commandList->SetComputeRootUnorderedAccessView(ComputeRootLodArgsUAV, m_lodArgs->GetGPUVirtualAddress());
+
+        //-------------------------------------------------
+        // all but the last step simulate the whole range before the first chunk
+        // they alternate through the substep buffer, see SimulateStep
+        //-------------------------------------------------
+        if (firstChunk)
+        {
+            for (UINT step = 0; (step + 1) < in_numSteps; step++)
+            {
+                const UINT stepTable = GetSimulateTable(m_bufferIndex, m_velocityIndex, GetSimulateStep(step, in_numSteps));
+                RecordStep(stepTable, UINT(in_numActiveParticles), m_firstParticle, lastParticle, true, UINT(m_simulatedSteps) + step);
+
+                // the next step reads the results of this one
+                m_commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::UAV(nullptr));
+                m_velocityIndex = 1 - m_velocityIndex;
+            }
+        }
+
+        const UINT chunkFirst = m_firstParticle + chunk * chunkSize;
+        const UINT chunkLast = std::min(chunkFirst + chunkSize, lastParticle);
+        const UINT numParticles = (chunkLast > chunkFirst) ? (chunkLast - chunkFirst) : 0;
+
+        //-------------------------------------------------
+        // the last step writes the next buffer of the ring, chunk by chunk
+        // without a step, the chunk of the previous results is carried forward
+        //-------------------------------------------------
+        const UINT tableIndex = GetSimulateTable(m_bufferIndex, m_velocityIndex, (in_numSteps > 0) ? GetSimulateStep(in_numSteps - 1, in_numSteps) : StepPreviousToCurrent);
+        ID3D12Resource* pSharedResource = m_positionBuffers[m_bufferIndex].Get();
+        if (in_numSteps > 0)
+        {
+            // the grid of the old positions is shared by all the chunks
+            RecordStep(tableIndex, UINT(in_numActiveParticles), chunkFirst, chunkLast, firstChunk, UINT(m_simulatedSteps) + in_numSteps - 1);
+        }
+        else if (numParticles > 0)
+        {
+            // in async mode both are the render adapter's, see GetPositionBufferState()
+            ID3D12Resource* pPrevious = m_positionBuffers[GetPreviousBufferIndex(m_bufferIndex)].Get();
+            const D3D12_RESOURCE_STATES positionState = GetPositionBufferState();
+            const D3D12_RESOURCE_BARRIER barriers[] = {
+                CD3DX12_RESOURCE_BARRIER::Transition(pPrevious, positionState, D3D12_RESOURCE_STATE_COPY_SOURCE),
+                CD3DX12_RESOURCE_BARRIER::Transition(pSharedResource, positionState, D3D12_RESOURCE_STATE_COPY_DEST) };
+            m_commandList->ResourceBarrier(_countof(barriers), barriers);
+
+            const UINT64 offset = UINT64(chunkFirst) * sizeof(Render::Particle);
+            m_commandList->CopyBufferRegion(pSharedResource, offset, pPrevious, offset, UINT64(numParticles) * sizeof(Render::Particle));
+
+            const D3D12_RESOURCE_BARRIER restoreBarriers[] = {
+                CD3DX12_RESOURCE_BARRIER::Transition(pPrevious, D3D12_RESOURCE_STATE_COPY_SOURCE, positionState),
+                CD3DX12_RESOURCE_BARRIER::Transition(pSharedResource, D3D12_RESOURCE_STATE_COPY_DEST, positionState) };
+            m_commandList->ResourceBarrier(_countof(restoreBarriers), restoreBarriers);
+
+            // the pack kernel reads u0
+            const CD3DX12_GPU_DESCRIPTOR_HANDLE srcHeapHandle(m_srvHeap->GetGPUDescriptorHandleForHeapStart(), tableIndex, m_srvUavDescriptorSize);
+            m_commandList->SetComputeRootDescriptorTable(ComputeRootUAVTable, srcHeapHandle);
+            const UINT passConstants[4] = { 0, UINT(in_numActiveParticles), chunkFirst, chunkLast };
+            m_commandList->SetComputeRoot32BitConstants(ComputeRootPassConstants, _countof(passConstants), passConstants, 0);
+        }
+
+        // a resource barrier gives maximum information to the runtime that may help other adapters with cache sync
+        m_commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::UAV(pSharedResource));
+
+        // the render adapter copies the packed positions instead
+        if (m_packedTransfer && (numParticles > 0))
+        {
+            PackPositions(m_bufferIndex, numParticles);
+        }
+
+        // the render adapter copies the density field instead. after the last chunk, it covers the whole range
+        if (m_densityField && lastChunk)
+        {
+            SplatDensity(m_bufferIndex, UINT(in_numActiveParticles));
+        }
+
+        if (lastChunk)
+        {
+            m_pTimer->EndTimer(m_commandList.Get(), static_cast<std::uint32_t>(GpuTimers::Simulate));
+            m_pTimer->ResolveAllTimers(m_commandList.Get());
+        }
+
+        Markers::EndEvent(m_commandList.Get());
+        ThrowIfFailed(m_commandList->Close());
+
+        ID3D12CommandList* ppCommandLists[] = { m_commandList.Get() };
+        m_commandQueue->ExecuteCommandLists(1, ppCommandLists);
+
+        // this chunk can be copied
+        if (!lastChunk)
+        {
+            ThrowIfFailed(Markers::Signal(m_commandQueue.Get(), m_fence.Get(), m_fenceValue, L"compute fence"));
+            m_fenceValue++;
+        }
+    }
+
+    // the velocities were only written by a step
+    if (in_numSteps > 0)
+    {
+        m_velocityIndex = 1 - m_velocityIndex;
+    }
+    m_simulatedSteps += in_numSteps;
 
     MoveToNextFrame();
 }
@@ -26,17 +26,25 @@
 #pragma once
 
 #include "AdapterShared.h"
+#include "Snapshot.h"
 #include <DirectXMath.h>
+#include <vector>
 
 class ExtensionHelper;
 
 class Compute : public AdapterShared
 {
 public:
-    Compute(UINT in_numParticles,
+    // in_numBuffers position buffers are shared with the render adapter, see MAX_NUM_BUFFERS
+    // copies the particles from in_pCompute, or initializes them. with in_initializeParticles false,
+    // the particles are undefined until CopyState(), e.g. to build the object on another thread
+    Compute(UINT in_numParticles, UINT in_numBuffers,
         IDXGIAdapter1* in_pAdapter,
         bool in_useIntelCommandQueueExtension,
-        Compute* in_pCompute = 0);
+        ThrottlePolicy in_throttlePolicy,
+        D3D12_COMMAND_QUEUE_PRIORITY in_queuePriority,
+        Compute* in_pCompute = 0,
+        bool in_initializeParticles = true);
     virtual ~Compute();
 
     Compute(const Compute&) = delete;
@@ -45,10 +53,103 @@ public:
     Compute& operator=(Compute&&) = delete;
 
     // input is fence value of other adapter. waits to overwrite shared buffer.
-    void Simulate(int in_numActiveParticles, UINT64 in_sharedFenceValue);
+    // advances in_numSteps fixed timesteps, see SIMULATION_TIMESTEP. with 0 steps the previous results are copied,
+    // so the ring of position buffers still advances once per call
+    void Simulate(int in_numActiveParticles, UINT64 in_sharedFenceValue, UINT in_numSteps = 1);
+
+    // simulate only a range of the particles, e.g. to split the simulation across adapters
+    // particles must not depend on each other, so a partial range only makes sense for SimulationMode::GravityWell
+    void SetParticleRange(UINT in_firstParticle, UINT in_numParticles);
+    UINT GetFirstParticle() const { return m_firstParticle; }
+    UINT GetNumParticlesInRange() const { return m_numParticlesInRange; }
+
+    // cross-adapter copy of a range of particles from other compute object into this one
+    // the other compute object's positions in the range are overwritten, so it must give up the range
+    // blocks until the copy is complete
+    void CopyState(Compute* in_pCompute, UINT in_firstParticle, UINT in_numParticles);
+    // CopyState() without waiting on the cpu: follows the work already submitted to either adapter,
+    // and precedes the next Simulate(). after the copy, this object signals the returned fence value, then
+    // one more per chunk, like a simulation. in_pCompute must live until GetCopyStateComplete()
+    UINT64 CopyStateAsync(Compute* in_pCompute, UINT in_firstParticle, UINT in_numParticles);
+    bool GetCopyStateComplete() const { return m_fence->GetCompletedValue() >= m_copyStateFenceValue; }
+    // blocks only if a state copy is in flight
+    void WaitForCopyState();
+
+    // snapshots hold the most recent positions and velocities of all the particles, see Snapshot.h
+    static Snapshot::Header GetSnapshotLayout(UINT in_numParticles, UINT64 in_step);
+    // reads back this object's range of particles into the snapshot. blocks until the adapter is idle
+    void ReadState(Snapshot& out_snapshot);
+    // overwrites all the particles. the layout must match GetSnapshotLayout(), e.g. instead of in_initializeParticles
+    void LoadState(const Snapshot& in_snapshot);
+    // steps simulated since the particles were generated, carried by CopyState() and snapshots
+    UINT64 GetSimulatedSteps() const { return m_simulatedSteps; }
+
+    // the force model used by Simulate()
+    enum class SimulationMode
+    {
+        GravityWell, // every particle is attracted to a single point at the origin
+        NBody,       // every particle is attracted to every other particle, O(N^2)
+        NBodyGrid,   // n-body approximated with a uniform grid rebuilt every step
+        Count
+    };
+    void SetSimulationMode(SimulationMode in_mode) { m_simulationMode = in_mode; }
+
+    // tunables of the force model, they reach the kernels with the next Simulate()
+    struct SimulationParameters
+    {
+        float m_timestep;  // simulated time per step
+        float m_damping;   // velocities are scaled by this every step
+        float m_mass;      // of the gravity well. the n-body modes spread it across the active particles
+        float m_softening; // distance added to every interaction, so close particles do not explode
+        // temporal level of detail, see LOD_LEVELS in defines.h. below this acceleration particles are stepped less often
+        // 0 steps every particle every step
+        float m_lodAcceleration;
+    };
+    void SetSimulationParameters(const SimulationParameters& in_parameters) { m_simulationParameters = in_parameters; }
+
+    // also write quantized positions to the shared heap, see PACK_BLOCK_SIZE in defines.h
+    // takes effect at the next GetSharedHandles(). the first particle of the range must be a multiple of PACK_BLOCK_SIZE
+    void SetPackedTransfer(bool in_enable) { m_packedTransfer = in_enable; }
+
+    // write a density field and the particles near the camera to the shared heap instead, see DENSITY_WIDTH in defines.h
+    // takes effect at the next GetSharedHandles(). the transfer no longer depends on the number of particles
+    void SetDensityField(bool in_enable) { m_densityField = in_enable; }
+    // camera of the render adapter the density field is splatted with, reaches the kernels with the next Simulate()
+    // in_viewProjection transforms row vectors, as in the draw. particles nearer than in_nearDistance are listed instead
+    void SetDensityView(const DirectX::XMFLOAT4X4& in_viewProjection, float in_nearDistance)
+    {
+        m_densityViewProjection = in_viewProjection;
+        m_densityNearDistance = in_nearDistance;
+    }
+
+    // size of the packed buffer: one header per block, then the particles
+    static UINT64 GetPackedHeadersSize(UINT in_numParticles) { return UINT64((in_numParticles + PACK_BLOCK_SIZE - 1) / PACK_BLOCK_SIZE) * PACK_HEADER_SIZE; }
+    static UINT64 GetPackedSize(UINT in_numParticles) { return GetPackedHeadersSize(in_numParticles) + UINT64(in_numParticles) * PACK_PARTICLE_SIZE; }
+
+    // estimated video memory of a compute object, including the shared heaps and the upload of the initial state
+    // only counts the resources of the transfers that are on, the others are evicted. see UpdateResidency()
+    static UINT64 GetMemoryFootprint(UINT in_numParticles, UINT in_numBuffers, bool in_packed, bool in_density);
+
+    // dispatch Simulate() in chunks, signalling the fence after each one, so the render adapter can copy finished chunks
+    // takes effect at the next GetSharedHandles(). the chunks of a simulation signal GetFenceValue() + [0, in_numChunks)
+    void SetNumChunks(UINT in_numChunks);
+
+    // particles per chunk. a multiple of PACK_BLOCK_SIZE, so each chunk can be copied on its own in either format
+    static UINT GetChunkSize(UINT in_numParticles, UINT in_numChunks)
+    {
+        const UINT numBlocks = (in_numParticles + PACK_BLOCK_SIZE - 1) / PACK_BLOCK_SIZE;
+        return ((numBlocks + in_numChunks - 1) / in_numChunks) * PACK_BLOCK_SIZE;
+    }
 
     // changes extension setting only if different from current setting
-    void SetUseIntelCommandQueueExtension(bool in_desiredSetting);
+    // the throttle policy only applies with the extension
+    void SetUseIntelCommandQueueExtension(bool in_desiredSetting, ThrottlePolicy in_throttlePolicy);
+
+    // recreates the command queue if the priority changes
+    // global realtime requires the privilege to create such queues, e.g. running as administrator, otherwise high is used
+    void SetQueuePriority(D3D12_COMMAND_QUEUE_PRIORITY in_priority);
+    // of the queue, may differ from the requested priority
+    INT GetQueuePriority() const { return m_commandQueue->GetDesc().Priority; }
 
     // provide cross-adapter shared handles to copy particle buffers to
     struct SharedHandles
@@ -57,27 +158,75 @@ public:
         HANDLE m_fence;
 
         UINT64 m_alignedDataSize;
-        UINT m_bufferIndex;
+        UINT m_numBuffers;
+        UINT m_bufferIndex; // the buffer the next simulation writes. the previous buffer holds the most recent results
+
+        // the packed buffers are in a heap of their own, evicted while m_packed is false
+        HANDLE m_packedHeap;
+        UINT64 m_alignedPackedSize;
+        bool m_packed;
+
+        // the density heap holds m_numBuffers density fields, then m_numBuffers near particle lists. evicted while m_density is false
+        // a density field is a row-major R32_UINT texture if m_densityRowMajor, otherwise a buffer with the same rows
+        // the near particle lists hold DENSITY_NEAR_PARTICLES particles, unused ones are beyond the far plane
+        HANDLE m_densityHeap;
+        UINT64 m_alignedDensitySize;
+        UINT64 m_alignedNearSize;
+        bool m_densityRowMajor;
+        bool m_density;
+
+        // see SetNumChunks()
+        UINT m_numChunks;
+
+        // range of particles simulated by this compute object
+        UINT m_firstParticle;
+        UINT m_numParticles;
     };
     const SharedHandles& GetSharedHandles(HANDLE in_fenceHandle);
 
     UINT64 GetFenceValue() const { return m_fenceValue; }
 
+    // initial velocity of a particle. stored on the GPU in the layout selected by SetVelocitySoa()
     struct ParticleVelocity
     {
         DirectX::XMFLOAT3 velocity;
     };
 
+    // GPU velocity layout: GetVelocityNumStreams() arrays of m_numParticles elements of GetVelocityStride() bytes
+    // selected before the first compute object is created, e.g. with -velocitysoa. VELOCITY_SOA is the default
+    // the positions stay one float4 per particle, the render adapter reads them
+    static void SetVelocitySoa(bool in_soa) { m_velocitySoa = in_soa; }
+    static bool GetVelocitySoa() { return m_velocitySoa; }
+    static UINT GetVelocityNumStreams() { return m_velocitySoa ? 3 : 1; }
+    static UINT GetVelocityStride() { return m_velocitySoa ? sizeof(float) : sizeof(DirectX::XMFLOAT4); }
+
+    // generate the initial particles with CSInitParticles, or on the CPU with LoadParticles() and upload them
+    // selected before the first compute object is created, e.g. with -gpuinit 0. INITIALIZE_PARTICLES_ON_GPU is the default
+    // the CPU path is the reference for the kernel: both draw the same seeded distribution
+    static void SetInitializeOnGpu(bool in_gpu) { m_initializeOnGpu = in_gpu; }
+    static bool GetInitializeOnGpu() { return m_initializeOnGpu; }
+
+    // velocities are not shared, so they only ping-pong
+    static constexpr UINT NUM_VELOCITY_BUFFERS = 2;
+
     // stalls until adapter is idle
     virtual void WaitForGpu() override;
 
+    // in_bufferIndex is the render buffer drawn next. the simulation writes the one in_simulationLatency after it,
+    // that is, the results are drawn in_simulationLatency frames after they are simulated. at most m_numBuffers - 1
+    // changing the latency repeats or skips a few frames of positions
     void SetAsync(
         ComPtr<ID3D12Fence> in_fence,
         ComPtr<ID3D12Resource>* in_buffers,
-        UINT in_bufferIndex);
+        UINT in_bufferIndex, UINT in_simulationLatency = 1);
     void ResetFromAsyncHelper();
 private:
-    static constexpr UINT m_NUM_BUFFERS = 2;
+    static bool m_velocitySoa;
+    static bool m_initializeOnGpu;
+
+    // ring of position buffers
+    const UINT m_numBuffers;
+    UINT GetPreviousBufferIndex(UINT in_bufferIndex) const { return (in_bufferIndex + m_numBuffers - 1) % m_numBuffers; }
 
     static constexpr float ParticleSpread = PARTICLE_SPREAD;
     const UINT m_numParticles;
@@ -89,11 +238,31 @@ private:
     // compute command queue
     ComPtr<ID3D12CommandQueue> m_commandQueue;
     ComPtr<ID3D12GraphicsCommandList> m_commandList;
-    ComPtr<ID3D12CommandAllocator> m_commandAllocators[m_NUM_BUFFERS];
+    ComPtr<ID3D12CommandAllocator> m_commandAllocators[MAX_NUM_BUFFERS];
+
+    // the copies of CopyStateAsync(), on either side, are not tied to a position buffer
+    // the allocator and the resources of the other adapter are held until this object's fence reaches m_copyStateFenceValue
+    ComPtr<ID3D12CommandAllocator> m_copyStateAllocator;
+    UINT64 m_copyStateFenceValue;
+    std::vector<ComPtr<ID3D12Pageable>> m_copyStateResources;
 
     ComPtr<ID3D12RootSignature> m_rootSignature;
     ComPtr<ID3D12PipelineState> m_computeState;
+    ComPtr<ID3D12PipelineState> m_nBodyState;
+    ComPtr<ID3D12PipelineState> m_nBodyGridState;
+    ComPtr<ID3D12PipelineState> m_packState;
+    ComPtr<ID3D12PipelineState> m_initState;
+    // the simulate kernels of each SimulationMode for the particles listed by the lod classification
+    ComPtr<ID3D12PipelineState> m_lodStates[UINT(SimulationMode::Count)];
+    ComPtr<ID3D12PipelineState> m_lodClassifyState;
+    ComPtr<ID3D12PipelineState> m_lodArgumentsState;
+
+    // one constant buffer per position buffer, rewritten by the Simulate() that writes the position buffer
+    // the allocator with the same index is idle by then, so is the constant buffer
     ComPtr<ID3D12Resource> m_constantBufferCS;
+    UINT8* m_pConstantBufferCSData;
+    // returns the address to bind
+    D3D12_GPU_VIRTUAL_ADDRESS UpdateConstants(UINT in_numActiveParticles);
 
     ComPtr<ID3D12DescriptorHeap> m_srvHeap;
     UINT m_srvUavDescriptorSize;
@@ -101,31 +270,138 @@ private:
     ComPtr<ID3D12Fence> m_fence;
     HANDLE m_fenceEvent;
 
-    UINT m_bufferIndex;
+    UINT m_bufferIndex;   // position buffer written by the next simulation
+    UINT m_velocityIndex; // velocity buffer written by the next simulation
+    UINT64 m_simulatedSteps;
+
+    SimulationMode m_simulationMode;
+    SimulationParameters m_simulationParameters;
+
+    UINT m_firstParticle;
+    UINT m_numParticlesInRange;
+
+    bool m_packedTransfer;
+    UINT m_numChunks;
+
+    bool m_densityField;
+    DirectX::XMFLOAT4X4 m_densityViewProjection;
+    float m_densityNearDistance;
 
     ComPtr<ID3D12Heap> m_sharedHeap;
-    ComPtr<ID3D12Resource> m_velocityBuffers[m_NUM_BUFFERS];
-    ComPtr<ID3D12Resource> m_positionBuffers[m_NUM_BUFFERS];
+    ComPtr<ID3D12Heap> m_packedHeap;
+    ComPtr<ID3D12Heap> m_densityHeap;
+    // the optional heaps, and the local density resources, are evicted while their transfer is off
+    bool m_packedResident;
+    bool m_densityResident;
+    void UpdateResidency();
+    ComPtr<ID3D12Resource> m_velocityBuffers[NUM_VELOCITY_BUFFERS];
+    ComPtr<ID3D12Resource> m_positionBuffers[MAX_NUM_BUFFERS];
+    ComPtr<ID3D12Resource> m_packedBuffers[MAX_NUM_BUFFERS];
+    // the density fields and the near particle lists, only ever the destination of copies on this adapter
+    ComPtr<ID3D12Resource> m_sharedDensity[MAX_NUM_BUFFERS];
+    ComPtr<ID3D12Resource> m_sharedNearParticles[MAX_NUM_BUFFERS];
     SharedHandles m_sharedHandles;
 
+    // local positions between the steps of a Simulate() with more than one step
+    ComPtr<ID3D12Resource> m_substepBuffer;
+
     void Initialize(IDXGIAdapter1* in_pAdapter);
     void CreateCommandQueue();
     void CreateSharedBuffers();
+    // a cross-adapter heap, and its handle for the other adapter
+    void CreateSharedHeap(UINT64 in_size, ComPtr<ID3D12Heap>& out_heap, HANDLE& out_handle);
+
+    // descriptor tables for the simulation, one per kind of step, position buffer and velocity buffer written
+    // re-created when SetAsync() replaces the position buffers
+    // in_step is a SimulateStep, see Compute.cpp. the default reads the previous buffer and writes in_bufferIndex
+    void CreateSimulateTables();
+    UINT GetSimulateTable(UINT in_bufferIndex, UINT in_velocityIndex, UINT in_step = 0) const;
+
+    // passes that rebuild the grid acceleration structure, in order
+    enum GridPass
+    {
+        GridPassClear = 0,
+        GridPassCount,
+        GridPassPrefixSum,
+        GridPassScatter,
+        GridPassCellMass,
+        GridPassReduce,
+        GridPassNumPasses
+    };
+    ComPtr<ID3D12PipelineState> m_gridStates[GridPassNumPasses];
+    static constexpr UINT m_NUM_GRID_BUFFERS = 5;
+    ComPtr<ID3D12Resource> m_gridBuffers[m_NUM_GRID_BUFFERS];
+    void CreateGridBuffers();
+
+    // records the grid build into the command list
+    // requires the root signature, descriptor tables and pass constants to be set
+    void BuildGrid(UINT in_numActiveParticles);
+
+    // temporal level of detail: the list of particles stepped and the indirect dispatch arguments
+    // local to this adapter and rewritten every step, like the grid
+    ComPtr<ID3D12Resource> m_lodParticles;
+    ComPtr<ID3D12Resource> m_lodArgs;      // D3D12_DISPATCH_ARGUMENTS, then the number of particles stepped
+    ComPtr<ID3D12Resource> m_lodArgsReset; // upload, copied over m_lodArgs before each classification
+    ComPtr<ID3D12CommandSignature> m_lodCommandSignature;
+    void CreateLodBuffers();
+
+    // records the classification of a range of particles, then the indirect dispatch of the bound simulate kernel
+    // requires the root signature, descriptor tables and pass constants to be set
+    void RecordLodStep(UINT in_numParticles);
+
+    // records one simulation step of a range of particles, see Simulate()
+    // requires the root signature and grid descriptor table to be set
+    // in_step counts the steps since the particles were generated, it selects the particles stepped with lod
+    void RecordStep(UINT in_tableIndex, UINT in_numActiveParticles, UINT in_firstParticle, UINT in_lastParticle, bool in_buildGrid, UINT in_step);
+
+    // records packing of position buffer in_bufferIndex into the packed buffer with the same index
+    // requires the root signature, descriptor tables and pass constants to be set
+    void PackPositions(UINT in_bufferIndex, UINT in_numParticles);
+
+    // packs every position buffer, so the initial copy by the render adapter is complete
+    void PackAllPositions();
+
+    // density field transfer: the splat targets are local, the atomics do not cross the bus
+    // each simulation splats the buffer it writes, then copies the results into the shared heap
+    ComPtr<ID3D12PipelineState> m_clearDensityState;
+    ComPtr<ID3D12PipelineState> m_splatDensityState;
+    ComPtr<ID3D12Resource> m_densityTexture;
+    ComPtr<ID3D12Resource> m_nearParticles;
+    ComPtr<ID3D12Resource> m_nearCounter; // slots of m_nearParticles taken
+    void CreateDensityResources();
+
+    // records the splat of the particles of this object's range in position buffer in_bufferIndex, and the copy to the shared heap
+    // requires the root signature to be set
+    void SplatDensity(UINT in_bufferIndex, UINT in_numActiveParticles);
+
+    // splats every position buffer, so the initial copy by the render adapter is complete
+    void SplatAllDensity();
 
     // initialize particle positions. Only need to do this once.
     // on subsequent compute destroy/create, can copy old state from render object
     void InitializeParticles();
+    // InitializeParticles() on the GPU, see SetInitializeOnGpu()
+    void GenerateParticles();
 
-    UINT64 m_frameFenceValues[m_NUM_BUFFERS];
+    UINT64 m_frameFenceValues[MAX_NUM_BUFFERS];
     UINT64 m_fenceValue;
 
     // sample code waited in this method
     // this version returns a handle, so the calling function can WaitOn/Multiple/
+    // advances the position ring. the velocity ping-pong flips with every step, see Simulate()
     void MoveToNextFrame();
+    // the allocator and the constants of m_bufferIndex are reused once the frame that last recorded them completes
+    void WaitForFrame();
     ComPtr<ID3D12Fence> m_sharedRenderFence;
+    // frames from the simulation to the draw (or copy) that reads it, see SetAsync()
+    UINT m_simulationLatency;
 
-    void CopyState(Compute* in_pCompute);
+    D3D12_COMMAND_QUEUE_PRIORITY m_queuePriority; // requested
 
     // shenanigans to simplify transitioning /out/ of async compute mode
-    ComPtr<ID3D12Resource> m_sharedComputeBuffersReference[m_NUM_BUFFERS];
+    ComPtr<ID3D12Resource> m_sharedComputeBuffersReference[MAX_NUM_BUFFERS];
+    // in async mode the position buffers are the render adapter's, created for its draw
+    // this queue only writes them through promotion from the common state, which they decay to between submissions
+    bool GetAsyncMode() const { return m_positionBuffers[0] != m_sharedComputeBuffersReference[0]; }
+    D3D12_RESOURCE_STATES GetPositionBufferState() const { return GetAsyncMode() ? D3D12_RESOURCE_STATE_COMMON : D3D12_RESOURCE_STATE_UNORDERED_ACCESS; }
 };
@@ -0,0 +1,212 @@
+//*********************************************************
+//
+// Copyright 2020 Intel Corporation 
+//
+// Permission is hereby granted, free of charge, to any 
+// person obtaining a copy of this software and associated 
+// documentation files(the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights 
+// to use, copy, modify, merge, publish, distribute, sublicense, 
+// and/or sell copies of the Software, and to permit persons to 
+// whom the Software is furnished to do so, subject to the 
+// following conditions :
+// The above copyright notice and this permission notice shall 
+// be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+// DEALINGS IN THE SOFTWARE.
+//
+//*********************************************************
+#include <algorithm>
+#include <cassert>
+
+#include "HeapAllocator.h"
+#include "d3dx12.h"
+#include "DXSampleHelper.h"
+
+std::mutex HeapAllocator::m_mutex;
+std::map<ID3D12Device*, HeapAllocator*> HeapAllocator::m_allocators;
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+HeapAllocator::HeapAllocator(ID3D12Device* in_pDevice)
+    : m_pDevice(in_pDevice)
+{
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+HeapAllocator* HeapAllocator::Get(ID3D12Device* in_pDevice)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    HeapAllocator*& pAllocator = m_allocators[in_pDevice];
+    if (nullptr == pAllocator)
+    {
+        pAllocator = new HeapAllocator(in_pDevice);
+    }
+    return pAllocator;
+}
+
+//-----------------------------------------------------------------------------
+// the allocators stay, an owner may still refer to one without allocations
+//-----------------------------------------------------------------------------
+void HeapAllocator::ReleaseUnusedHeaps()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    for (auto& a : m_allocators)
+    {
+        auto& heaps = a.second->m_heaps;
+        heaps.erase(std::remove_if(heaps.begin(), heaps.end(), [](const Heap& in_heap)
+        {
+            return (1 == in_heap.m_freeRanges.size()) && (in_heap.m_size == in_heap.m_freeRanges[0].m_size);
+        }), heaps.end());
+    }
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void HeapAllocator::Shutdown()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    for (auto& a : m_allocators)
+    {
+        assert(a.second->m_allocations.empty());
+        delete a.second;
+    }
+    m_allocators.clear();
+}
+
+//-----------------------------------------------------------------------------
+// first fit in the heaps of the type, or a new heap
+//-----------------------------------------------------------------------------
+void HeapAllocator::CreateBuffer(const void* in_pOwner, D3D12_HEAP_TYPE in_heapType, UINT64 in_size,
+    D3D12_RESOURCE_FLAGS in_flags, D3D12_RESOURCE_STATES in_initialState,
+    Microsoft::WRL::ComPtr<ID3D12Resource>& out_resource)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    const D3D12_RESOURCE_DESC desc = CD3DX12_RESOURCE_DESC::Buffer(in_size, in_flags);
+    const D3D12_RESOURCE_ALLOCATION_INFO info = m_pDevice->GetResourceAllocationInfo(0, 1, &desc);
+
+    Heap* pHeap = nullptr;
+    Range range = {};
+    for (auto& heap : m_heaps)
+    {
+        if ((heap.m_type == in_heapType) && Allocate(heap, info.SizeInBytes, range))
+        {
+            pHeap = &heap;
+            break;
+        }
+    }
+
+    if (nullptr == pHeap)
+    {
+        const UINT64 minHeapSize = (D3D12_HEAP_TYPE_DEFAULT == in_heapType) ? m_DEFAULT_HEAP_SIZE : m_HEAP_SIZE;
+
+        Heap heap = {};
+        heap.m_type = in_heapType;
+        heap.m_size = std::max(minHeapSize, info.SizeInBytes);
+        heap.m_freeRanges.push_back({ 0, heap.m_size });
+
+        const CD3DX12_HEAP_DESC heapDesc(heap.m_size, in_heapType, 0, D3D12_HEAP_FLAG_ALLOW_ONLY_BUFFERS);
+        ThrowIfFailed(m_pDevice->CreateHeap(&heapDesc, IID_PPV_ARGS(&heap.m_heap)));
+
+        m_heaps.push_back(heap);
+        pHeap = &m_heaps.back();
+        const bool allocated = Allocate(*pHeap, info.SizeInBytes, range);
+        assert(allocated);
+    }
+
+    ThrowIfFailed(m_pDevice->CreatePlacedResource(pHeap->m_heap.Get(), range.m_offset, &desc,
+        in_initialState, nullptr, IID_PPV_ARGS(&out_resource)));
+
+    m_allocations.push_back({ in_pOwner, pHeap->m_heap.Get(), range });
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void HeapAllocator::Free(const void* in_pOwner)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    for (const auto& allocation : m_allocations)
+    {
+        if (in_pOwner != allocation.m_pOwner)
+        {
+            continue;
+        }
+        for (auto& heap : m_heaps)
+        {
+            if (heap.m_heap.Get() == allocation.m_pHeap)
+            {
+                Insert(heap, allocation.m_range);
+                break;
+            }
+        }
+    }
+
+    m_allocations.erase(std::remove_if(m_allocations.begin(), m_allocations.end(),
+        [&](const Allocation& in_allocation) { return in_pOwner == in_allocation.m_pOwner; }),
+        m_allocations.end());
+}
+
+//-----------------------------------------------------------------------------
+// sizes are multiples of the placement alignment, so every offset is aligned
+//-----------------------------------------------------------------------------
+bool HeapAllocator::Allocate(Heap& in_heap, UINT64 in_size, Range& out_range)
+{
+    for (auto i = in_heap.m_freeRanges.begin(); i != in_heap.m_freeRanges.end(); i++)
+    {
+        if (i->m_size >= in_size)
+        {
+            out_range = { i->m_offset, in_size };
+            i->m_offset += in_size;
+            i->m_size -= in_size;
+            if (0 == i->m_size)
+            {
+                in_heap.m_freeRanges.erase(i);
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+//-----------------------------------------------------------------------------
+// returns a range to the free list, merged with its neighbors
+//-----------------------------------------------------------------------------
+void HeapAllocator::Insert(Heap& in_heap, const Range& in_range)
+{
+    auto& ranges = in_heap.m_freeRanges;
+    auto next = std::upper_bound(ranges.begin(), ranges.end(), in_range.m_offset,
+        [](UINT64 in_offset, const Range& in_r) { return in_offset < in_r.m_offset; });
+    next = ranges.insert(next, in_range);
+
+    // merge with the following range
+    auto following = next + 1;
+    if ((following != ranges.end()) && ((next->m_offset + next->m_size) == following->m_offset))
+    {
+        next->m_size += following->m_size;
+        next = ranges.erase(following) - 1;
+    }
+
+    // merge with the preceding range
+    if (next != ranges.begin())
+    {
+        auto preceding = next - 1;
+        if ((preceding->m_offset + preceding->m_size) == next->m_offset)
+        {
+            preceding->m_size += next->m_size;
+            ranges.erase(next);
+        }
+    }
+}
@@ -0,0 +1,117 @@
+//*********************************************************
+//
+// Copyright 2020 Intel Corporation 
+//
+// Permission is hereby granted, free of charge, to any 
+// person obtaining a copy of this software and associated 
+// documentation files(the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights 
+// to use, copy, modify, merge, publish, distribute, sublicense, 
+// and/or sell copies of the Software, and to permit persons to 
+// whom the Software is furnished to do so, subject to the 
+// following conditions :
+// The above copyright notice and this permission notice shall 
+// be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+// DEALINGS IN THE SOFTWARE.
+//
+//*********************************************************
+#pragma once
+
+#include <d3d12.h>
+#include <wrl.h>
+
+#include <map>
+#include <mutex>
+#include <vector>
+
+/*======================================================
+HeapAllocator
+
+Sub-allocates buffers from a few large heaps per device, as placed resources
+
+Render and Compute are rebuilt on every adapter or extension change.
+With committed resources, every rebuild releases and re-creates each buffer,
+which means a kernel allocation per buffer. The heaps of an allocator instead
+outlive the objects that allocate from them: a rebuild on the same device
+places its buffers in the memory of the previous object.
+
+Buffers are freed per owner. The owner releases its resources, then calls Free().
+The contents of a reused range are undefined, so each buffer must be written before it is read.
+
+The heaps keep the device alive. D3D12 has one device per adapter, so the next D3D12CreateDevice()
+on the adapter finds the same device and its allocator. ReleaseUnusedHeaps() after a rebuild
+releases the heaps left empty, e.g. on the previous adapter.
+
+Thread safe: compute objects are built on a worker thread during a hot-swap
+======================================================*/
+class HeapAllocator
+{
+public:
+    // the allocator of in_pDevice, created on first use
+    static HeapAllocator* Get(ID3D12Device* in_pDevice);
+    // releases the heaps without allocations, on every device
+    static void ReleaseUnusedHeaps();
+    // releases every allocator. every owner must have called Free()
+    static void Shutdown();
+
+    // placed in a heap of in_heapType. upload heaps require D3D12_RESOURCE_STATE_GENERIC_READ
+    void CreateBuffer(const void* in_pOwner, D3D12_HEAP_TYPE in_heapType, UINT64 in_size,
+        D3D12_RESOURCE_FLAGS in_flags, D3D12_RESOURCE_STATES in_initialState,
+        Microsoft::WRL::ComPtr<ID3D12Resource>& out_resource);
+
+    // returns the ranges of every buffer of in_pOwner. the buffers must have been released
+    void Free(const void* in_pOwner);
+
+    HeapAllocator(const HeapAllocator&) = delete;
+    HeapAllocator(HeapAllocator&&) = delete;
+    HeapAllocator& operator=(const HeapAllocator&) = delete;
+    HeapAllocator& operator=(HeapAllocator&&) = delete;
+
+private:
+    explicit HeapAllocator(ID3D12Device* in_pDevice);
+
+    // default heaps hold a few of the largest particle buffers, the others only hold constant buffers
+    // larger buffers get a heap of their own size
+    static constexpr UINT64 m_DEFAULT_HEAP_SIZE = 64 * 1024 * 1024;
+    static constexpr UINT64 m_HEAP_SIZE = 4 * 1024 * 1024;
+
+    struct Range
+    {
+        UINT64 m_offset;
+        UINT64 m_size;
+    };
+
+    struct Heap
+    {
+        Microsoft::WRL::ComPtr<ID3D12Heap> m_heap;
+        D3D12_HEAP_TYPE m_type;
+        UINT64 m_size;
+        std::vector<Range> m_freeRanges; // sorted by offset, never adjacent
+    };
+
+    struct Allocation
+    {
+        const void* m_pOwner;
+        ID3D12Heap* m_pHeap;
+        Range m_range;
+    };
+
+    // the key of the allocator. only used while an owner on the device is alive
+    ID3D12Device* m_pDevice;
+    std::vector<Heap> m_heaps;
+    std::vector<Allocation> m_allocations;
+
+    bool Allocate(Heap& in_heap, UINT64 in_size, Range& out_range);
+    static void Insert(Heap& in_heap, const Range& in_range);
+
+    static std::mutex m_mutex;
+    static std::map<ID3D12Device*, HeapAllocator*> m_allocators;
+};
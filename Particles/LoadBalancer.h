@@ -0,0 +1,180 @@
+//*********************************************************
+//
+// Copyright 2020 Intel Corporation 
+//
+// Permission is hereby granted, free of charge, to any 
+// person obtaining a copy of this software and associated 
+// documentation files(the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights 
+// to use, copy, modify, merge, publish, distribute, sublicense, 
+// and/or sell copies of the Software, and to permit persons to 
+// whom the Software is furnished to do so, subject to the 
+// following conditions :
+// The above copyright notice and this permission notice shall 
+// be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+// DEALINGS IN THE SOFTWARE.
+//
+//*********************************************************
+#pragma once
+
+#include <Windows.h>
+#include <algorithm>
+#include <cmath>
+
+/*======================================================
+LoadBalancer
+
+Chooses the fraction of the particles simulated by the compute adapter
+when the simulation is split across the compute and render adapters.
+
+Model: the compute adapter only simulates, the render adapter renders and simulates the rest:
+    computeTime = computeCost * n
+    renderAdapterTime = renderTime + secondaryCost * (N - n)
+both finish at the same time when
+    n = (renderTime + secondaryCost * N) / (computeCost + secondaryCost)
+
+Usage: call Update() once per frame with the latest (averaged) gpu times
+if it returns true, apply GetRatio()
+
+The gpu timers are running averages, so after a change the measurements
+lag behind for a while. Changes are rate-limited by a cooldown,
+and small changes are ignored (hysteresis) because each change stalls to move particles.
+======================================================*/
+class LoadBalancer
+{
+public:
+    LoadBalancer(float in_initialRatio = 0.5f);
+
+    // times in seconds, particle counts are the particles simulated by each adapter
+    // returns true if the ratio changed
+    bool Update(float in_computeTime, UINT in_numComputeParticles,
+        float in_secondaryTime, UINT in_numSecondaryParticles,
+        float in_renderTime);
+
+    float GetRatio() const { return m_ratio; }
+
+    // e.g. user override. restarts the cooldown
+    void SetRatio(float in_ratio);
+
+    // estimated time for each adapter at the current ratio, in seconds
+    float GetComputeAdapterTime() const { return m_computeAdapterTime; }
+    float GetRenderAdapterTime() const { return m_renderAdapterTime; }
+
+private:
+    // frames to wait after a change. must exceed the gpu timer averaging window
+    static constexpr UINT m_COOLDOWN_FRAMES = 60;
+    // ignore imbalance smaller than this fraction of the longer time
+    static constexpr float m_IMBALANCE_THRESHOLD = 0.1f;
+    // ignore ratio changes smaller than this
+    static constexpr float m_MIN_RATIO_CHANGE = 0.02f;
+    // largest change per step, in case the estimates are off
+    static constexpr float m_MAX_RATIO_CHANGE = 0.2f;
+    // weight of a new per-particle cost measurement
+    static constexpr float m_COST_SMOOTHING = 0.25f;
+
+    float m_ratio;
+    UINT m_cooldown;
+
+    // estimated seconds per particle simulated on each adapter
+    float m_computeCost;
+    float m_secondaryCost;
+
+    float m_computeAdapterTime;
+    float m_renderAdapterTime;
+
+    static void UpdateCost(float& inout_cost, float in_time, UINT in_numParticles);
+};
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+inline LoadBalancer::LoadBalancer(float in_initialRatio)
+    : m_ratio(in_initialRatio)
+    , m_cooldown(m_COOLDOWN_FRAMES)
+    , m_computeCost(0)
+    , m_secondaryCost(0)
+    , m_computeAdapterTime(0)
+    , m_renderAdapterTime(0)
+{
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+inline void LoadBalancer::SetRatio(float in_ratio)
+{
+    m_ratio = std::min(std::max(in_ratio, 0.0f), 1.0f);
+    m_cooldown = m_COOLDOWN_FRAMES;
+}
+
+//-----------------------------------------------------------------------------
+// exponential moving average of the per-particle cost
+// with no particles there is nothing to measure, keep the previous estimate
+//-----------------------------------------------------------------------------
+inline void LoadBalancer::UpdateCost(float& inout_cost, float in_time, UINT in_numParticles)
+{
+    if (in_numParticles > 0)
+    {
+        const float cost = in_time / float(in_numParticles);
+        inout_cost = (0 == inout_cost) ? cost : inout_cost + m_COST_SMOOTHING * (cost - inout_cost);
+    }
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+inline bool LoadBalancer::Update(float in_computeTime, UINT in_numComputeParticles,
+    float in_secondaryTime, UINT in_numSecondaryParticles,
+    float in_renderTime)
+{
+    m_computeAdapterTime = in_computeTime;
+    m_renderAdapterTime = in_renderTime + in_secondaryTime;
+
+    // wait for the timers to reflect the current ratio
+    if (m_cooldown > 0)
+    {
+        m_cooldown--;
+        return false;
+    }
+
+    UpdateCost(m_computeCost, in_computeTime, in_numComputeParticles);
+    UpdateCost(m_secondaryCost, in_secondaryTime, in_numSecondaryParticles);
+
+    // until both adapters have simulated something, assume they are equally fast
+    const float computeCost = (0 == m_computeCost) ? m_secondaryCost : m_computeCost;
+    const float secondaryCost = (0 == m_secondaryCost) ? m_computeCost : m_secondaryCost;
+    if ((0 == computeCost) || (0 == secondaryCost))
+    {
+        return false;
+    }
+
+    // hysteresis: balanced enough?
+    const float longest = std::max(m_computeAdapterTime, m_renderAdapterTime);
+    if (std::abs(m_computeAdapterTime - m_renderAdapterTime) <= m_IMBALANCE_THRESHOLD * longest)
+    {
+        return false;
+    }
+
+    const float numParticles = float(in_numComputeParticles + in_numSecondaryParticles);
+    if (0 == numParticles)
+    {
+        return false;
+    }
+
+    const float numComputeParticles = (in_renderTime + secondaryCost * numParticles) / (computeCost + secondaryCost);
+    const float target = std::min(std::max(numComputeParticles / numParticles, 0.0f), 1.0f);
+
+    const float delta = std::min(std::max(target - m_ratio, -m_MAX_RATIO_CHANGE), m_MAX_RATIO_CHANGE);
+    if (std::abs(delta) < m_MIN_RATIO_CHANGE)
+    {
+        return false;
+    }
+
+    SetRatio(m_ratio + delta);
+    return true;
+}
@@ -0,0 +1,65 @@
+//*********************************************************
+//
+// Copyright 2020 Intel Corporation 
+//
+// Permission is hereby granted, free of charge, to any 
+// person obtaining a copy of this software and associated 
+// documentation files(the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights 
+// to use, copy, modify, merge, publish, distribute, sublicense, 
+// and/or sell copies of the Software, and to permit persons to 
+// whom the Software is furnished to do so, subject to the 
+// following conditions :
+// The above copyright notice and this permission notice shall 
+// be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+// DEALINGS IN THE SOFTWARE.
+//
+//*********************************************************
+#include <Windows.h>
+#include <TraceLoggingProvider.h>
+
+#include "Markers.h"
+
+// {1c4e1a2b-7d35-4f0b-9a7e-2f1f5a8c6e3d}
+TRACELOGGING_DEFINE_PROVIDER(g_markersProvider, "Intel.MultiAdapterParticles",
+    (0x1c4e1a2b, 0x7d35, 0x4f0b, 0x9a, 0x7e, 0x2f, 0x1f, 0x5a, 0x8c, 0x6e, 0x3d));
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void Markers::Register()
+{
+    ::TraceLoggingRegister(g_markersProvider);
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void Markers::Unregister()
+{
+    ::TraceLoggingUnregister(g_markersProvider);
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void Markers::Frame(std::uint64_t in_frameNumber)
+{
+    TraceLoggingWrite(g_markersProvider, "Frame",
+        TraceLoggingUInt64(in_frameNumber, "FrameNumber"));
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void Markers::AdapterSwitch(const char* in_pRole, int in_adapterIndex, const std::string& in_description)
+{
+    TraceLoggingWrite(g_markersProvider, "AdapterSwitch",
+        TraceLoggingString(in_pRole, "Role"),
+        TraceLoggingInt32(in_adapterIndex, "AdapterIndex"),
+        TraceLoggingString(in_description.c_str(), "Description"));
+}
@@ -0,0 +1,90 @@
+//*********************************************************
+//
+// Copyright 2020 Intel Corporation 
+//
+// Permission is hereby granted, free of charge, to any 
+// person obtaining a copy of this software and associated 
+// documentation files(the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights 
+// to use, copy, modify, merge, publish, distribute, sublicense, 
+// and/or sell copies of the Software, and to permit persons to 
+// whom the Software is furnished to do so, subject to the 
+// following conditions :
+// The above copyright notice and this permission notice shall 
+// be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+// DEALINGS IN THE SOFTWARE.
+//
+//*********************************************************
+#pragma once
+
+#include <d3d12.h>
+#include <cstdint>
+#include <cwchar>
+#include <string>
+
+/*======================================================
+Markers
+
+Events for external profilers, so their captures line up with what the app did
+- PIX markers on command lists and queues, also shown by GPUView
+  the legacy unicode format, read without WinPixEventRuntime
+- an ETW (TraceLogging) provider for frame boundaries and adapter switches
+  provider "Intel.MultiAdapterParticles" {1c4e1a2b-7d35-4f0b-9a7e-2f1f5a8c6e3d}
+  e.g. xperf -start particles -on 1c4e1a2b-7d35-4f0b-9a7e-2f1f5a8c6e3d
+
+Usage: BeginEvent()...EndEvent() around the commands of a command list or queue
+Signal() and Wait() in place of the queue methods annotate the fence operation
+======================================================*/
+class Markers
+{
+public:
+    // ETW provider, for the lifetime of the app
+    static void Register();
+    static void Unregister();
+
+    static void Frame(std::uint64_t in_frameNumber);
+    // in_pRole e.g. "render"
+    static void AdapterSwitch(const char* in_pRole, int in_adapterIndex, const std::string& in_description);
+
+    // ID3D12GraphicsCommandList or ID3D12CommandQueue
+    template<typename T> static void BeginEvent(T* in_pTarget, const wchar_t* in_pName)
+    {
+        in_pTarget->BeginEvent(m_PIX_UNICODE_METADATA, in_pName, UINT((::wcslen(in_pName) + 1) * sizeof(wchar_t)));
+    }
+    template<typename T> static void EndEvent(T* in_pTarget) { in_pTarget->EndEvent(); }
+    template<typename T> static void SetMarker(T* in_pTarget, const wchar_t* in_pName)
+    {
+        in_pTarget->SetMarker(m_PIX_UNICODE_METADATA, in_pName, UINT((::wcslen(in_pName) + 1) * sizeof(wchar_t)));
+    }
+
+    // in_pFenceName e.g. L"copy fence", the marker reads "signal copy fence 12"
+    static HRESULT Signal(ID3D12CommandQueue* in_pQueue, ID3D12Fence* in_pFence, UINT64 in_value, const wchar_t* in_pFenceName)
+    {
+        SetFenceMarker(in_pQueue, L"signal", in_pFenceName, in_value);
+        return in_pQueue->Signal(in_pFence, in_value);
+    }
+    static HRESULT Wait(ID3D12CommandQueue* in_pQueue, ID3D12Fence* in_pFence, UINT64 in_value, const wchar_t* in_pFenceName)
+    {
+        SetFenceMarker(in_pQueue, L"wait", in_pFenceName, in_value);
+        return in_pQueue->Wait(in_pFence, in_value);
+    }
+
+private:
+    // metadata of the legacy PIX event format, see pix.h
+    static constexpr UINT m_PIX_UNICODE_METADATA = 0;
+
+    static void SetFenceMarker(ID3D12CommandQueue* in_pQueue, const wchar_t* in_pOperation, const wchar_t* in_pFenceName, UINT64 in_value)
+    {
+        wchar_t name[128];
+        ::swprintf_s(name, L"%s %s %llu", in_pOperation, in_pFenceName, in_value);
+        SetMarker(in_pQueue, name);
+    }
+};
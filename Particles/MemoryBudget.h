@@ -0,0 +1,123 @@
+//*********************************************************
+//
+// Copyright 2020 Intel Corporation 
+//
+// Permission is hereby granted, free of charge, to any 
+// person obtaining a copy of this software and associated 
+// documentation files(the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights 
+// to use, copy, modify, merge, publish, distribute, sublicense, 
+// and/or sell copies of the Software, and to permit persons to 
+// whom the Software is furnished to do so, subject to the 
+// following conditions :
+// The above copyright notice and this permission notice shall 
+// be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+// DEALINGS IN THE SOFTWARE.
+//
+//*********************************************************
+#pragma once
+
+#include <dxgi1_6.h>
+#include <d3d12.h>
+#include <wrl.h>
+
+/*======================================================
+MemoryBudget
+
+Video memory budget and usage of an adapter, from IDXGIAdapter3::QueryVideoMemoryInfo
+
+The local segment group is the memory of a discrete adapter, or all of the memory
+the OS lets a UMA adapter use. The non-local segment group is system memory
+seen across the bus by a discrete adapter, e.g. cross-adapter heaps.
+
+Exceeding the budget does not fail: the OS pages resources in and out,
+which is far more expensive than what the usage report suggests,
+especially on UMA adapters that share the memory with the CPU.
+
+Usage: call Update() before reading the numbers, e.g. once per frame
+======================================================*/
+class MemoryBudget
+{
+public:
+    explicit MemoryBudget(IDXGIAdapter1* in_pAdapter);
+
+    void Update();
+
+    // false if the adapter does not report its budget (pre-IDXGIAdapter3)
+    bool GetSupported() const { return nullptr != m_adapter.Get(); }
+
+    const DXGI_QUERY_VIDEO_MEMORY_INFO& GetLocal() const { return m_local; }
+    const DXGI_QUERY_VIDEO_MEMORY_INFO& GetNonLocal() const { return m_nonLocal; }
+
+    // local budget not used by this or any other process yet. unlimited if unsupported
+    UINT64 GetAvailable() const;
+    bool GetOverBudget() const;
+
+    // size of a buffer rounded up to the placement alignment, for footprint estimates
+    static UINT64 GetAllocationSize(UINT64 in_size)
+    {
+        const UINT64 alignment = D3D12_DEFAULT_RESOURCE_PLACEMENT_ALIGNMENT;
+        return ((in_size + alignment - 1) / alignment) * alignment;
+    }
+
+private:
+    Microsoft::WRL::ComPtr<IDXGIAdapter3> m_adapter;
+    DXGI_QUERY_VIDEO_MEMORY_INFO m_local;
+    DXGI_QUERY_VIDEO_MEMORY_INFO m_nonLocal;
+};
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+inline MemoryBudget::MemoryBudget(IDXGIAdapter1* in_pAdapter)
+    : m_local{}
+    , m_nonLocal{}
+{
+    if (FAILED(in_pAdapter->QueryInterface(IID_PPV_ARGS(&m_adapter))))
+    {
+        m_adapter.Reset();
+    }
+    Update();
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+inline void MemoryBudget::Update()
+{
+    if (GetSupported())
+    {
+        if (FAILED(m_adapter->QueryVideoMemoryInfo(0, DXGI_MEMORY_SEGMENT_GROUP_LOCAL, &m_local)))
+        {
+            m_local = {};
+        }
+        if (FAILED(m_adapter->QueryVideoMemoryInfo(0, DXGI_MEMORY_SEGMENT_GROUP_NON_LOCAL, &m_nonLocal)))
+        {
+            m_nonLocal = {};
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+inline UINT64 MemoryBudget::GetAvailable() const
+{
+    if ((!GetSupported()) || (0 == m_local.Budget))
+    {
+        return UINT64(-1);
+    }
+    return (m_local.Budget > m_local.CurrentUsage) ? (m_local.Budget - m_local.CurrentUsage) : 0;
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+inline bool MemoryBudget::GetOverBudget() const
+{
+    return (m_local.CurrentUsage > m_local.Budget) || (m_nonLocal.CurrentUsage > m_nonLocal.Budget);
+}
@@ -0,0 +1,94 @@
+//*********************************************************
+//
+// Copyright 2020 Intel Corporation 
+//
+// Permission is hereby granted, free of charge, to any 
+// person obtaining a copy of this software and associated 
+// documentation files(the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights 
+// to use, copy, modify, merge, publish, distribute, sublicense, 
+// and/or sell copies of the Software, and to permit persons to 
+// whom the Software is furnished to do so, subject to the 
+// following conditions :
+// The above copyright notice and this permission notice shall 
+// be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+// DEALINGS IN THE SOFTWARE.
+//
+//*********************************************************
+
+// frustum culling of the particles before the draw
+// cullpacked selects the packed transfer format
+#include "ParticleDraw.hlsl"
+
+RWStructuredBuffer<uint> g_visibleParticlesOut : register(u0);
+
+// Render::CullDrawArguments: the point draw counts vertices at byte 0, the quad draw counts instances at byte 20
+RWByteAddressBuffer g_cullArgs : register(u1);
+
+groupshared uint g_groupNumVisible;
+groupshared uint g_groupFirstVisible;
+
+//
+// compacts the indices of the visible particles into g_visibleParticlesOut, from g_firstParticle
+// each list of Render::Draw() culls its own range of the particles, counted in its own arguments
+// one atomic on the arguments per group, the group allocates its range of the list in groupshared memory
+//
+[numthreads(cullblocksize, 1, 1)]
+void CSCullParticles(uint3 DTid : SV_DispatchThreadID, uint GI : SV_GroupIndex)
+{
+    if (0 == GI)
+    {
+        g_groupNumVisible = 0;
+    }
+    GroupMemoryBarrierWithGroupSync();
+
+    const uint id = g_firstParticle + DTid.x;
+    bool visible = false;
+    if (DTid.x < g_numParticles)
+    {
+        // only one of the position buffers may be referenced, the draw binds a single table
+#if cullpacked
+        const float3 pos = LoadPackedPosition(id).xyz;
+#else
+        const float3 pos = LoadPosition(id).xyz;
+#endif
+
+        // bounding sphere of the camera-facing quad
+        const float radius = g_fParticleRad * 1.41421356f;
+
+        visible = true;
+        [unroll] for (uint i = 0; i < 6; i++)
+        {
+            visible = visible && ((dot(g_frustumPlanes[i].xyz, pos) + g_frustumPlanes[i].w) >= -radius);
+        }
+    }
+
+    uint groupIndex = 0;
+    if (visible)
+    {
+        InterlockedAdd(g_groupNumVisible, 1, groupIndex);
+    }
+    GroupMemoryBarrierWithGroupSync();
+
+    if ((0 == GI) && (0 != g_groupNumVisible))
+    {
+        uint firstVisible;
+        g_cullArgs.InterlockedAdd(0, g_groupNumVisible, firstVisible);
+        g_cullArgs.InterlockedAdd(20, g_groupNumVisible);
+        g_groupFirstVisible = firstVisible;
+    }
+    GroupMemoryBarrierWithGroupSync();
+
+    if (visible)
+    {
+        g_visibleParticlesOut[g_firstParticle + g_groupFirstVisible + groupIndex] = id;
+    }
+}
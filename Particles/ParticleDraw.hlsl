@@ -35,12 +35,20 @@
 //
 //*********************************************************
 
+#include "ShaderDefines.hlsl"
+
 struct VSParticleIn
 {
-    float4 color    : COLOR;
     uint id         : SV_VERTEXID;
 };
 
+// instanced quad path: one instance per particle, one vertex per corner
+struct VSParticleQuadIn
+{
+    uint corner     : SV_VERTEXID;
+    uint instance   : SV_INSTANCEID;
+};
+
 struct VSParticleDrawOut
 {
     float3 pos      : POSITION;
@@ -67,12 +75,34 @@ struct Position
 
 StructuredBuffer<Position> g_bufPosition;
 
+// packed transfer format, see CSPackPositions in nBodyGravityCS.hlsl
+ByteAddressBuffer g_bufPacked;
+
+// written by CSCullParticles in ParticleCullCS.hlsl. read when culled is 1
+StructuredBuffer<uint> g_visibleParticles : register(t1);
+
+// positions before the most recent simulation steps, in the format of g_bufPosition or g_bufPacked
+// read when g_interpolation is less than 1, see Render::SetNextSimulation()
+ByteAddressBuffer g_bufPrevious : register(t2);
+
 cbuffer cb0
 {
     row_major float4x4 g_mWorldViewProj;
     row_major float4x4 g_mInvView;
+    float4 g_frustumPlanes[6];
+    float4 g_palette[2]; // at rest and at full acceleration
     float g_fParticleRad;
     float g_fParticleIntensity;
+    uint g_packedHeadersSize;
+    float g_interpolation;
+    float g_densityIntensity;
+};
+
+// root constants, see Render::DrawParticles()
+cbuffer cbDraw : register(b1)
+{
+    uint g_firstParticle; // SV_INSTANCEID and SV_GROUPID do not include the start of the draw
+    uint g_numParticles;
 };
 
 cbuffer cbImmutable
@@ -94,22 +124,100 @@ cbuffer cbImmutable
     };
 };
 
+// the draws of the culled variants index the list of visible particles
+uint ParticleIndex(uint drawIndex)
+{
+    return culled ? g_visibleParticles[drawIndex] : drawIndex;
+}
+
+// SV_VertexID includes the start vertex of DrawInstanced(), the culled draws are indirect and start at 0
+uint PointIndex(uint vertexID)
+{
+    return culled ? g_visibleParticles[g_firstParticle + vertexID] : vertexID;
+}
+
+float4 LoadPosition(uint id)
+{
+    const float4 pos = g_bufPosition[id].pos;
+    if (g_interpolation < 1.0f)
+    {
+        return lerp(asfloat(g_bufPrevious.Load4(id * 16)), pos, g_interpolation);
+    }
+    return pos;
+}
+
+//
+// positions of particles copied in the packed format
+// are relative to the bounds of the block of the particle.
+//
+float4 DecodePackedPosition(ByteAddressBuffer packed, uint id)
+{
+    const uint block = id / packblocksize;
+    const float3 blockMin = asfloat(packed.Load3(block * packheadersize));
+    const float3 blockExtent = asfloat(packed.Load3(block * packheadersize + 12));
+
+    const uint2 q = packed.Load2(g_packedHeadersSize + id * packparticlesize);
+
+    float4 pos;
+    pos.xyz = blockMin + blockExtent * (float3(q.x & 0xffff, q.x >> 16, q.y & 0xffff) / 65535.0f);
+    pos.w = (q.y >> 16) * (packmaxacceleration / 255.0f);
+    return pos;
+}
+
+float4 LoadPackedPosition(uint id)
+{
+    const float4 pos = DecodePackedPosition(g_bufPacked, id);
+    if (g_interpolation < 1.0f)
+    {
+        return lerp(DecodePackedPosition(g_bufPrevious, id), pos, g_interpolation);
+    }
+    return pos;
+}
+
 //
 // Vertex shader for drawing the point-sprite particles.
 //
-VSParticleDrawOut VSParticleDraw(VSParticleIn input)
+VSParticleDrawOut ParticleVertex(uint id, float4 pos)
 {
     VSParticleDrawOut output;
 
-    output.pos = g_bufPosition[input.id].pos.xyz;
+    output.pos = pos.xyz;
 
-    float mag = g_bufPosition[input.id].pos.w / 9;
-    output.color = lerp(float4(1.0f, 0.1f, 0.1f, 1.0f), input.color, mag);
-    output.color.b = (input.id & 0xfff) / float(0xfff);
+    float mag = pos.w / 9;
+    output.color = lerp(g_palette[0], g_palette[1], mag);
+    output.color.b = (id & 0xfff) / float(0xfff);
     output.color.r = 1.0f - output.color.b;
     return output;
 }
 
+VSParticleDrawOut VSParticleDraw(VSParticleIn input)
+{
+    const uint id = PointIndex(input.id);
+    return ParticleVertex(id, LoadPosition(id));
+}
+
+VSParticleDrawOut VSParticleDrawPacked(VSParticleIn input)
+{
+    const uint id = PointIndex(input.id);
+    return ParticleVertex(id, LoadPackedPosition(id));
+}
+
+//
+// one corner of the camera-facing quad of a particle. corners are in triangle strip order
+//
+GSParticleDrawOut ParticleCorner(VSParticleDrawOut particle, uint corner)
+{
+    GSParticleDrawOut output;
+
+    float3 position = g_positions[corner] * g_fParticleRad;
+    position = mul(position, (float3x3)g_mInvView) + particle.pos;
+    output.pos = mul(float4(position, 1.0), g_mWorldViewProj);
+
+    output.color = particle.color;
+    output.tex = g_texcoords[corner];
+    return output;
+}
+
 //
 // GS for rendering point sprite particles.  Takes a point and turns 
 // it into 2 triangles.
@@ -117,22 +225,30 @@ VSParticleDrawOut VSParticleDraw(VSParticleIn input)
 [maxvertexcount(4)]
 void GSParticleDraw(point VSParticleDrawOut input[1], inout TriangleStream<GSParticleDrawOut> SpriteStream)
 {
-    GSParticleDrawOut output;
-
     // Emit two new triangles.
     for (int i = 0; i < 4; i++)
     {
-        float3 position = g_positions[i] * g_fParticleRad;
-        position = mul(position, (float3x3)g_mInvView) + input[0].pos;
-        output.pos = mul(float4(position, 1.0), g_mWorldViewProj);
-
-        output.color = input[0].color;
-        output.tex = g_texcoords[i];
-        SpriteStream.Append(output);
+        SpriteStream.Append(ParticleCorner(input[0], i));
     }
     SpriteStream.RestartStrip();
 }
 
+//
+// Vertex shaders for the instanced quad path, which expands the particles without a GS.
+// draw 4 vertices as a triangle strip per instance
+//
+GSParticleDrawOut VSParticleDrawQuad(VSParticleQuadIn input)
+{
+    const uint id = ParticleIndex(g_firstParticle + input.instance);
+    return ParticleCorner(ParticleVertex(id, LoadPosition(id)), input.corner);
+}
+
+GSParticleDrawOut VSParticleDrawQuadPacked(VSParticleQuadIn input)
+{
+    const uint id = ParticleIndex(g_firstParticle + input.instance);
+    return ParticleCorner(ParticleVertex(id, LoadPackedPosition(id)), input.corner);
+}
+
 //
 // PS for drawing particles. Use the texture coordinates to generate a 
 // radial gradient representing the particle.
@@ -143,3 +259,60 @@ float4 PSParticleDraw(PSParticleDrawIn input) : SV_Target
     intensity = clamp(intensity, 0.0f, 0.5f) * g_fParticleIntensity;
     return float4(input.color.xyz, intensity);
 }
+
+//
+// density field transfer, see CSSplatDensity in nBodyGravityCS.hlsl
+// the particle counts of the g_numParticles sources, one slice each
+//
+Texture2DArray<uint> g_density;
+
+struct VSDensityOut
+{
+    float2 tex      : TEXCOORD0;
+    float4 pos      : SV_POSITION;
+};
+
+//
+// fullscreen triangle, draw 3 vertices
+//
+VSDensityOut VSDensity(VSParticleIn input)
+{
+    VSDensityOut output;
+    output.tex = float2((input.id << 1) & 2, input.id & 2);
+    output.pos = float4(output.tex * float2(2, -2) + float2(-1, 1), 0, 1);
+    return output;
+}
+
+float LoadDensity(int2 texel, int2 size)
+{
+    texel = clamp(texel, int2(0, 0), size - 1);
+
+    float count = 0;
+    for (uint i = 0; i < g_numParticles; i++)
+    {
+        count += g_density.Load(int4(texel, i, 0));
+    }
+    return count;
+}
+
+//
+// PS for the density field. counts cannot be sampled with a filter, so they are interpolated here
+// each particle counted adds opacity like a faint sprite, see DENSITY_INTENSITY
+//
+float4 PSDensity(VSDensityOut input) : SV_Target
+{
+    uint width, height, numSlices;
+    g_density.GetDimensions(width, height, numSlices);
+    const int2 size = int2(width, height);
+
+    const float2 coord = input.tex * float2(size) - 0.5f;
+    const int2 texel = int2(floor(coord));
+    const float2 f = coord - float2(texel);
+
+    const float count = lerp(
+        lerp(LoadDensity(texel, size), LoadDensity(texel + int2(1, 0), size), f.x),
+        lerp(LoadDensity(texel + int2(0, 1), size), LoadDensity(texel + int2(1, 1), size), f.x), f.y);
+
+    const float density = 1.0f - exp(-count * g_densityIntensity);
+    return float4(lerp(g_palette[0], g_palette[1], density).xyz, density);
+}
@@ -0,0 +1,68 @@
+//*********************************************************
+//
+// Copyright 2020 Intel Corporation 
+//
+// Permission is hereby granted, free of charge, to any 
+// person obtaining a copy of this software and associated 
+// documentation files(the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights 
+// to use, copy, modify, merge, publish, distribute, sublicense, 
+// and/or sell copies of the Software, and to permit persons to 
+// whom the Software is furnished to do so, subject to the 
+// following conditions :
+// The above copyright notice and this permission notice shall 
+// be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+// DEALINGS IN THE SOFTWARE.
+//
+//*********************************************************
+
+// mesh shader path, compiled with dxc for shader model 6.5
+// meshpacked selects the packed transfer format
+#include "ParticleDraw.hlsl"
+
+//
+// each thread expands one particle into a quad: 4 vertices and 2 triangles
+//
+[outputtopology("triangle")]
+[numthreads(meshgroupsize, 1, 1)]
+void MSParticleDraw(
+    uint groupThreadID : SV_GroupThreadID,
+    uint groupID : SV_GroupID,
+    out vertices GSParticleDrawOut outVertices[meshgroupsize * 4],
+    out indices uint3 outTriangles[meshgroupsize * 2])
+{
+    const uint groupFirst = groupID * meshgroupsize;
+    const uint numGroupParticles = min(meshgroupsize, g_numParticles - groupFirst);
+
+    SetMeshOutputCounts(numGroupParticles * 4, numGroupParticles * 2);
+
+    if (groupThreadID < numGroupParticles)
+    {
+        const uint id = g_firstParticle + groupFirst + groupThreadID;
+        // only one of the position buffers may be referenced, the draw binds a single table
+#if meshpacked
+        const float4 pos = LoadPackedPosition(id);
+#else
+        const float4 pos = LoadPosition(id);
+#endif
+        const VSParticleDrawOut particle = ParticleVertex(id, pos);
+
+        const uint firstVertex = groupThreadID * 4;
+        for (uint i = 0; i < 4; i++)
+        {
+            outVertices[firstVertex + i] = ParticleCorner(particle, i);
+        }
+
+        // same winding as the triangle strip of the other paths
+        outTriangles[groupThreadID * 2] = firstVertex + uint3(0, 1, 2);
+        outTriangles[groupThreadID * 2 + 1] = firstVertex + uint3(1, 3, 2);
+    }
+}
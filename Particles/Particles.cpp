@@ -26,6 +26,7 @@
 
 #include <cassert>
 #include <algorithm> // for std::min()
+#include <sstream>
 
 #include <d3d12.h>
 #include <dxgidebug.h>
@@ -38,6 +39,10 @@
 #include "Particles.h"
 #include "Compute.h"
 #include "Render.h"
+#include "Benchmark.h"
+#include "Markers.h"
+#include "HeapAllocator.h"
+#include "Snapshot.h"
 #include "ArgParser.h"
 
 //-----------------------------------------------------------------------------
@@ -49,9 +54,12 @@ Particles::Particles(HWND in_hwnd)
 
     , m_pRender(nullptr)
     , m_pCompute(nullptr)
+    , m_pRetiredCompute(nullptr)
 
     , m_renderAdapterIndex(0)
     , m_computeAdapterIndex(0)
+    , m_pendingComputeAdapterIndex(0)
+    , m_activeComputeAdapterIndex(0)
 
     , m_commandQueueExtensionEnabled(false)
     , m_vsyncEnabled(true)
@@ -67,10 +75,55 @@ Particles::Particles(HWND in_hwnd)
     , m_numParticlesCopied(MAX_NUM_PARTICLES)
     , m_numParticlesSimulated(MAX_NUM_PARTICLES)
     , m_numParticlesLinked(true)
+    , m_probeAdapters(true)
+    , m_memoryBudgetEnabled(true)
+    , m_requestedNumParticles(MAX_NUM_PARTICLES)
 
     , m_enableUI(true)
     , m_enableExtensions(true)
+    , m_computeThrottleMode(int(ThrottlePolicy::MaxPerformance))
+    , m_renderThrottleMode(int(ThrottlePolicy::MaxPerformance))
+    , m_applyRenderThrottle(false)
+
+    , m_simulationMode(int(Compute::SimulationMode::GravityWell))
+    , m_timestep(SIMULATION_TIMESTEP)
+    , m_damping(SIMULATION_DAMPING)
+    , m_mass(SIMULATION_MASS)
+    , m_softening(SIMULATION_SOFTENING)
+    , m_lod(false)
+    , m_lodAcceleration(LOD_ACCELERATION)
+    , m_fixedTimestep(false)
+    , m_simulationRate(DEFAULT_SIMULATION_RATE)
+    , m_simulatedTime(0)
+    , m_stepFraction(1.0f)
+    , m_drawPath(int(Render::DrawPath::GeometryShader))
+    , m_culling(false)
+
+    , m_pComputeSecondary(nullptr)
+    , m_splitSimulation(false)
+    , m_splitRatio(0.5f)
+    , m_splitRatioSlider(0.5f)
+    , m_splitParticle(0)
+    , m_autoBalance(false)
+    , m_packedTransfer(false)
+    , m_numChunks(1)
+    , m_numChunksSlider(1)
+    , m_numBuffers(MIN_NUM_BUFFERS)
+    , m_computeQueuePriority(0)
+    , m_simulationLatency(1)
+    , m_frameLatency(1)
+    , m_lowLatency(false)
+    , m_zeroCopy(false)
+    , m_densityField(false)
+    , m_densityNearDistance(DENSITY_NEAR_DISTANCE)
+    , m_transferFrameTimes{}
+    , m_transferNumFrames{}
+    , m_pBenchmark(nullptr)
+    , m_numTraceFrames(Profiler::DEFAULT_NUM_FRAMES)
+    , m_frameNumber(0)
 {
+    Markers::Register();
+
     ParseCommandLine();
 
     m_windowInfo.cbSize = sizeof(WINDOWINFO);
@@ -105,9 +158,10 @@ Particles::Particles(HWND in_hwnd)
         DXGI_ADAPTER_DESC1 desc;
         ThrowIfFailed(adapter->GetDesc1(&desc));
 
-        if (((desc.Flags & DXGI_ADAPTER_FLAG_SOFTWARE) == 0) && (desc.VendorId != 5140))
+        if (AdapterProbe::GetSupported(desc))
         {
             m_adapters.push_back(adapter);
+            m_memoryBudgets.push_back(MemoryBudget(adapter.Get()));
 
             std::string narrowString;
             const int numChars = ::WideCharToMultiByte(CP_UTF8, 0, desc.Description, _countof(desc.Description), nullptr, 0, nullptr, nullptr);
@@ -127,11 +181,63 @@ Particles::Particles(HWND in_hwnd)
     {
         AssignAdapters();
 
-        m_pRender = new Render(m_hwnd, m_maxNumParticles, m_adapters[m_renderAdapterIndex].Get(), m_commandQueueExtensionEnabled, m_fullScreen, m_windowInfo.rcClient);
-        m_pCompute = new Compute(m_maxNumParticles, m_adapters[m_computeAdapterIndex].Get(), m_commandQueueExtensionEnabled);
+        // the script overrides the initial adapters
+        if (!m_benchmarkScript.empty())
+        {
+            StartBenchmark();
+        }
+
+        // the snapshot determines the number of particles
+        Snapshot snapshot;
+        bool loadSnapshot = false;
+        if (!m_snapshotInput.empty())
+        {
+            // at most the particles the buffers are sized for, and those asked for on the command line
+            loadSnapshot = snapshot.Load(m_snapshotInput)
+                && (snapshot.GetHeader().m_numParticles > 0)
+                && (snapshot.GetHeader().m_numParticles <= UINT(MAX_NUM_PARTICLES))
+                && (snapshot.GetHeader().m_numParticles <= UINT(m_maxNumParticles));
+            if (loadSnapshot)
+            {
+                m_maxNumParticles = int(snapshot.GetHeader().m_numParticles);
+                m_numParticlesRendered = m_maxNumParticles;
+                m_numParticlesCopied = m_maxNumParticles;
+                m_numParticlesSimulated = m_maxNumParticles;
+            }
+            else
+            {
+                ::OutputDebugStringW((L"failed to load snapshot " + m_snapshotInput + L", or it has too many particles\n").c_str());
+            }
+        }
+
+        ClampNumParticlesToBudget();
+
+        // the clamp or a different velocity layout (e.g. -velocitysoa) may not match the snapshot
+        if (loadSnapshot && !Snapshot::GetSameLayout(snapshot.GetHeader(), Compute::GetSnapshotLayout(UINT(m_maxNumParticles), 0)))
+        {
+            ::OutputDebugStringW((L"snapshot " + m_snapshotInput + L" does not match, generating particles\n").c_str());
+            loadSnapshot = false;
+        }
+
+        m_pRender = new Render(m_hwnd, m_maxNumParticles, m_numBuffers, m_adapters[m_renderAdapterIndex].Get(), m_commandQueueExtensionEnabled, GetRenderThrottlePolicy(), m_fullScreen, m_windowInfo.rcClient);
+        m_pCompute = new Compute(m_maxNumParticles, m_numBuffers, m_adapters[m_computeAdapterIndex].Get(), m_commandQueueExtensionEnabled, GetComputeThrottlePolicy(), GetComputeQueuePriority(), nullptr, !loadSnapshot);
+        if (loadSnapshot)
+        {
+            m_pCompute->LoadState(snapshot);
+        }
+        m_activeComputeAdapterIndex = m_computeAdapterIndex;
 
         ShareHandles();
 
+        if (m_splitSimulation && GetSplitSimulationSupported())
+        {
+            StartSplitSimulation();
+        }
+        if (!GetExtraComputeAdapters().empty())
+        {
+            StartExtraComputes(GetExtraComputeAdapters());
+        }
+
         m_commandQueueExtensionEnabled = m_pCompute->GetUsingIntelCommandQueueExtension() ||
             m_pRender->GetUsingIntelCommandQueueExtension();
     }
@@ -164,17 +270,43 @@ Particles::Particles(HWND in_hwnd)
     m_prevComputeAdapterIndex = m_computeAdapterIndex;
     m_prevQueueExtension = m_commandQueueExtensionEnabled;
     m_prevFullScreen = m_fullScreen;
+    m_prevPackedTransfer = m_packedTransfer;
+    m_prevNumChunks = m_numChunks;
+    m_prevZeroCopy = m_zeroCopy;
+    m_prevDensityField = m_densityField;
+    m_prevComputeQueuePriority = m_computeQueuePriority;
+    m_prevSimulationLatency = m_simulationLatency;
 
     // start frame duration timer
     m_frameTimer.Start();
+    m_simulationTimer.Start();
 }
 
 //-----------------------------------------------------------------------------
 //-----------------------------------------------------------------------------
 Particles::~Particles()
 {
+    // a failure building the new compute object no longer matters
+    if (m_pendingCompute.valid())
+    {
+        try
+        {
+            delete m_pendingCompute.get();
+        }
+        catch (...)
+        {
+        }
+    }
+    delete m_pComputeSecondary;
+    for (Compute* pCompute : m_extraComputes)
+    {
+        delete pCompute;
+    }
     delete m_pCompute;
+    delete m_pRetiredCompute;
     delete m_pRender;
+    delete m_pBenchmark;
+    HeapAllocator::Shutdown();
 
     if (m_enableUI)
     {
@@ -182,6 +314,8 @@ Particles::~Particles()
         ImGui_ImplWin32_Shutdown();
         ImGui::DestroyContext(nullptr);
     }
+
+    Markers::Unregister();
 }
 
 //-----------------------------------------------------------------------------
@@ -197,14 +331,464 @@ void Particles::ShareHandles()
 
     const HANDLE renderFenceHandle = m_pRender->GetSharedFenceHandle();
     assert(renderFenceHandle != nullptr);
-    m_pRender->SetShared(m_pCompute->GetSharedHandles(renderFenceHandle));
 
-    bool asyncMode = (m_renderAdapterIndex == m_computeAdapterIndex);
+    bool asyncMode = (m_renderAdapterIndex == m_activeComputeAdapterIndex);
+
+    // the compute objects pack their results when sharing the handles
+    // zero-copy draws after the whole simulation, so there is no copy for the chunks to overlap
+    // the density field replaces the particle transfer, so it overrides packing, chunks and zero-copy
+    const bool densityField = m_densityField && !asyncMode;
+    const UINT numChunks = (asyncMode || m_zeroCopy || densityField) ? 1 : m_numChunks;
+    std::vector<Compute::SharedHandles> sharedHandles;
+    for (Compute* pCompute : GetComputes())
+    {
+        pCompute->SetPackedTransfer(m_packedTransfer && !asyncMode && !densityField);
+        pCompute->SetNumChunks(numChunks);
+        pCompute->SetDensityField(densityField);
+        sharedHandles.push_back(pCompute->GetSharedHandles(renderFenceHandle));
+    }
+    m_pRender->SetZeroCopy(m_zeroCopy && !asyncMode && !densityField);
+    m_pRender->SetShared(sharedHandles);
+
     if (asyncMode)
     {
-        m_pCompute->SetAsync(m_pRender->GetFence(), m_pRender->GetBuffers(), m_pRender->GetBufferIndex());
+        m_pCompute->SetAsync(m_pRender->GetFence(), m_pRender->GetBuffers(), m_pRender->GetBufferIndex(), GetSimulationLatency());
+    }
+    m_pRender->SetAsyncMode(asyncMode, asyncMode ? GetSimulationLatency() : 1);
+}
+
+//-----------------------------------------------------------------------------
+// split-frame simulation requires 2 adapters and independent particles
+//-----------------------------------------------------------------------------
+bool Particles::GetSplitSimulationSupported() const
+{
+    return (m_renderAdapterIndex != m_activeComputeAdapterIndex) &&
+        (int(Compute::SimulationMode::GravityWell) == m_simulationMode);
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+UINT Particles::GetSplitParticle() const
+{
+    const UINT numParticles = UINT(m_maxNumParticles);
+    // blocks of the packed transfer format must not span compute objects
+    const UINT numBlocks = UINT(m_splitRatio * numParticles / PACK_BLOCK_SIZE + 0.5f);
+    return std::min(numBlocks * PACK_BLOCK_SIZE, numParticles);
+}
+
+//-----------------------------------------------------------------------------
+// create a compute object on the render adapter and give it part of the particles
+//-----------------------------------------------------------------------------
+void Particles::StartSplitSimulation()
+{
+    assert(nullptr == m_pComputeSecondary);
+
+    m_pRender->WaitForGpu();
+    m_pCompute->WaitForGpu();
+
+    // starts out simulating nothing
+    const UINT numParticles = UINT(m_maxNumParticles);
+    m_pComputeSecondary = new Compute(numParticles, m_numBuffers, m_adapters[m_renderAdapterIndex].Get(), m_commandQueueExtensionEnabled, GetComputeThrottlePolicy(), GetComputeQueuePriority());
+    m_pComputeSecondary->SetParticleRange(numParticles, 0);
+    m_splitParticle = numParticles;
+
+    SetSplitParticle(GetSplitParticle());
+
+    // restart the cooldown, the timers don't reflect the new configuration yet
+    m_loadBalancer.SetRatio(m_splitRatio);
+}
+
+//-----------------------------------------------------------------------------
+// return all particles to the compute adapter
+//-----------------------------------------------------------------------------
+void Particles::StopSplitSimulation()
+{
+    assert(nullptr != m_pComputeSecondary);
+
+    SetSplitParticle(UINT(m_maxNumParticles));
+
+    delete m_pComputeSecondary;
+    m_pComputeSecondary = nullptr;
+
+    ShareHandles();
+    HeapAllocator::ReleaseUnusedHeaps();
+}
+
+//-----------------------------------------------------------------------------
+// the compute adapters simulate [0, split), the render adapter simulates [split, numParticles)
+//-----------------------------------------------------------------------------
+void Particles::SetSplitParticle(UINT in_splitParticle)
+{
+    assert(m_pComputeSecondary || (UINT(m_maxNumParticles) == in_splitParticle));
+
+    std::vector<UINT> firstParticles = GetComputeRanges(in_splitParticle);
+    if (m_pComputeSecondary)
+    {
+        firstParticles.push_back(in_splitParticle);
+    }
+    SetParticleRanges(GetComputes(), firstParticles);
+    m_splitParticle = in_splitParticle;
+
+    ShareHandles();
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+std::vector<Compute*> Particles::GetComputes() const
+{
+    std::vector<Compute*> computes(1, m_pCompute);
+    computes.insert(computes.end(), m_extraComputes.begin(), m_extraComputes.end());
+    if (m_pComputeSecondary)
+    {
+        computes.push_back(m_pComputeSecondary);
+    }
+    return computes;
+}
+
+//-----------------------------------------------------------------------------
+// without a probe, the compute adapters are assumed to be equally fast
+// blocks of the packed transfer format must not span compute objects
+//-----------------------------------------------------------------------------
+std::vector<UINT> Particles::GetComputeRanges(UINT in_numParticles) const
+{
+    std::vector<int> adapterIndices(1, m_activeComputeAdapterIndex);
+    adapterIndices.insert(adapterIndices.end(), m_activeExtraComputeAdapters.begin(), m_activeExtraComputeAdapters.end());
+
+    std::vector<float> weights;
+    float totalWeight = 0;
+    for (const int adapterIndex : adapterIndices)
+    {
+        const float rate = m_adapterCapabilities.empty() ? 0.0f : m_adapterCapabilities[adapterIndex].m_computeRate;
+        weights.push_back((rate > 0) ? rate : 1.0f);
+        totalWeight += weights.back();
+    }
+
+    std::vector<UINT> firstParticles;
+    float weight = 0;
+    for (const float w : weights)
+    {
+        const UINT numBlocks = UINT(weight / totalWeight * in_numParticles / PACK_BLOCK_SIZE + 0.5f);
+        firstParticles.push_back(std::min(numBlocks * PACK_BLOCK_SIZE, in_numParticles));
+        weight += w;
+    }
+    return firstParticles;
+}
+
+//-----------------------------------------------------------------------------
+// ranges are contiguous, in_computes[i] owns in_firstParticles[i] up to the next first particle
+// the copies only read the previous ranges of the sources, which no copy writes
+//-----------------------------------------------------------------------------
+void Particles::SetParticleRanges(const std::vector<Compute*>& in_computes, const std::vector<UINT>& in_firstParticles)
+{
+    assert(in_computes.size() == in_firstParticles.size());
+    const UINT numParticles = UINT(m_maxNumParticles);
+
+    m_pRender->WaitForGpu();
+    for (Compute* pCompute : in_computes)
+    {
+        pCompute->WaitForGpu();
+    }
+
+    auto GetLastParticle = [&](size_t in_index)
+    {
+        return ((in_index + 1) < in_firstParticles.size()) ? in_firstParticles[in_index + 1] : numParticles;
+    };
+
+    for (size_t i = 0; i < in_computes.size(); i++)
+    {
+        for (size_t j = 0; j < in_computes.size(); j++)
+        {
+            const UINT ownedFirst = in_computes[j]->GetFirstParticle();
+            const UINT ownedLast = ownedFirst + in_computes[j]->GetNumParticlesInRange();
+            const UINT first = std::max(in_firstParticles[i], ownedFirst);
+            const UINT last = std::min(GetLastParticle(i), ownedLast);
+            if ((i != j) && (first < last))
+            {
+                in_computes[i]->CopyState(in_computes[j], first, last - first);
+            }
+        }
+    }
+
+    for (size_t i = 0; i < in_computes.size(); i++)
+    {
+        in_computes[i]->SetParticleRange(in_firstParticles[i], GetLastParticle(i) - in_firstParticles[i]);
+    }
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+std::vector<int> Particles::GetExtraComputeAdapters() const
+{
+    std::vector<int> adapterIndices;
+    if (!GetSplitSimulationSupported())
+    {
+        return adapterIndices;
+    }
+
+    for (const int adapterIndex : m_extraComputeAdapters)
+    {
+        const bool valid = (adapterIndex >= 0) && (adapterIndex < int(m_adapters.size())) &&
+            (adapterIndex != m_renderAdapterIndex) && (adapterIndex != m_activeComputeAdapterIndex) &&
+            (adapterIndex != m_computeAdapterIndex) &&
+            (adapterIndices.end() == std::find(adapterIndices.begin(), adapterIndices.end(), adapterIndex));
+        if (valid && (adapterIndices.size() < (MAX_SHARED_SOURCES - 2)))
+        {
+            adapterIndices.push_back(adapterIndex);
+        }
+    }
+    return adapterIndices;
+}
+
+//-----------------------------------------------------------------------------
+// the new compute objects start out simulating nothing, then take their share from the others
+//-----------------------------------------------------------------------------
+void Particles::StartExtraComputes(const std::vector<int>& in_adapterIndices)
+{
+    assert(m_extraComputes.empty());
+
+    const UINT numParticles = UINT(m_maxNumParticles);
+    for (const int adapterIndex : in_adapterIndices)
+    {
+        Compute* pCompute = new Compute(numParticles, m_numBuffers, m_adapters[adapterIndex].Get(), m_commandQueueExtensionEnabled,
+            GetComputeThrottlePolicy(), GetComputeQueuePriority(), nullptr, false);
+        pCompute->SetParticleRange(numParticles, 0);
+        m_extraComputes.push_back(pCompute);
+
+        Markers::AdapterSwitch("extra compute", adapterIndex, m_adapterDescriptions[adapterIndex]);
+    }
+    m_activeExtraComputeAdapters = in_adapterIndices;
+
+    SetSplitParticle(m_pComputeSecondary ? m_splitParticle : numParticles);
+}
+
+//-----------------------------------------------------------------------------
+// return the particles of the extra compute adapters to the compute adapter
+//-----------------------------------------------------------------------------
+void Particles::StopExtraComputes()
+{
+    assert(!m_extraComputes.empty());
+
+    std::vector<UINT> firstParticles(1, 0);
+    firstParticles.resize(1 + m_extraComputes.size(), m_splitParticle);
+    if (m_pComputeSecondary)
+    {
+        firstParticles.push_back(m_splitParticle);
+    }
+    SetParticleRanges(GetComputes(), firstParticles);
+
+    for (Compute* pCompute : m_extraComputes)
+    {
+        delete pCompute;
+    }
+    m_extraComputes.clear();
+    m_activeExtraComputeAdapters.clear();
+
+    ShareHandles();
+    HeapAllocator::ReleaseUnusedHeaps();
+}
+
+//-----------------------------------------------------------------------------
+// creating a device, pipeline states and shared heap takes a long time, so it happens on a worker thread
+// the settings the worker captures may change meanwhile, FinishComputeSwap() applies them again
+//-----------------------------------------------------------------------------
+void Particles::StartComputeSwap()
+{
+    assert(!m_pendingCompute.valid());
+
+    const UINT numParticles = UINT(m_maxNumParticles);
+    const UINT numBuffers = UINT(m_numBuffers);
+    IDXGIAdapter1* pAdapter = m_adapters[m_computeAdapterIndex].Get();
+    const bool useExtension = m_commandQueueExtensionEnabled;
+    const ThrottlePolicy throttlePolicy = GetComputeThrottlePolicy();
+    const D3D12_COMMAND_QUEUE_PRIORITY queuePriority = GetComputeQueuePriority();
+    m_pendingComputeAdapterIndex = m_computeAdapterIndex;
+
+    m_pendingCompute = std::async(std::launch::async, [=]()
+    {
+        return new Compute(numParticles, numBuffers, pAdapter, useExtension, throttlePolicy, queuePriority, nullptr, false);
+    });
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+bool Particles::GetComputeSwapReady() const
+{
+    return m_pendingCompute.valid() && (std::future_status::ready == m_pendingCompute.wait_for(std::chrono::seconds(0)));
+}
+
+//-----------------------------------------------------------------------------
+// the new compute object takes over all the particles
+// a split simulation returns its particles first, and restarts with the new compute object
+// between two adapters with the plain copy transfer, the copy of the particles queues behind the
+// simulation in flight, and the render adapter's next copy waits for it on the gpu
+// otherwise, e.g. from or to async compute mode, the gpus are drained and the handles shared again
+//-----------------------------------------------------------------------------
+void Particles::FinishComputeSwap()
+{
+    Compute* pNewCompute = m_pendingCompute.get(); // re-throws exceptions from the worker thread
+
+    if (!m_extraComputes.empty())
+    {
+        StopExtraComputes();
+    }
+    if (m_pComputeSecondary)
+    {
+        StopSplitSimulation();
+    }
+
+    // only one retired compute object at a time
+    ReleaseRetiredCompute(true);
+
+    // the settings may have changed while it was built. both re-create an idle queue
+    pNewCompute->SetUseIntelCommandQueueExtension(m_commandQueueExtensionEnabled, GetComputeThrottlePolicy());
+    pNewCompute->SetQueuePriority(GetComputeQueuePriority());
+
+    const bool asyncMode = (m_renderAdapterIndex == m_activeComputeAdapterIndex) || (m_renderAdapterIndex == m_pendingComputeAdapterIndex);
+    if (!asyncMode && m_pRender->GetReplaceSourceSupported())
+    {
+        // the transfer settings of the current source, see ShareHandles()
+        pNewCompute->SetPackedTransfer(false);
+        pNewCompute->SetDensityField(false);
+        pNewCompute->SetNumChunks(UINT(m_numChunks));
+
+        const UINT64 copiedFenceValue = pNewCompute->CopyStateAsync(m_pCompute, 0, UINT(m_maxNumParticles));
+        m_pRender->ReplaceSource(0, pNewCompute->GetSharedHandles(m_pRender->GetSharedFenceHandle()), copiedFenceValue);
+
+        m_pRetiredCompute = m_pCompute;
+        m_pCompute = pNewCompute;
+        m_activeComputeAdapterIndex = m_pendingComputeAdapterIndex;
+    }
+    else
+    {
+        m_pRender->WaitForGpu();
+        m_pCompute->WaitForGpu();
+
+        pNewCompute->CopyState(m_pCompute, 0, UINT(m_maxNumParticles));
+        delete m_pCompute;
+        m_pCompute = pNewCompute;
+        m_activeComputeAdapterIndex = m_pendingComputeAdapterIndex;
+
+        ShareHandles();
+        // the buffers of the previous compute object were not reused, unless it was on the same device
+        HeapAllocator::ReleaseUnusedHeaps();
+    }
+    m_computeGovernor.Restart();
+
+    Markers::AdapterSwitch("compute", m_activeComputeAdapterIndex, m_adapterDescriptions[m_activeComputeAdapterIndex]);
+
+    m_commandQueueExtensionEnabled = m_pCompute->GetUsingIntelCommandQueueExtension();
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void Particles::ReleaseRetiredCompute(bool in_wait)
+{
+    if ((nullptr == m_pRetiredCompute) || (!in_wait && !m_pCompute->GetCopyStateComplete()))
+    {
+        return;
+    }
+
+    // the copy reads the shared heap of the retired object. the render adapter holds its own references, see Render::ReplaceSource()
+    m_pCompute->WaitForCopyState();
+    delete m_pRetiredCompute;
+    m_pRetiredCompute = nullptr;
+    // the buffers of the retired compute object were not reused, unless it was on the same device
+    HeapAllocator::ReleaseUnusedHeaps();
+}
+
+//-----------------------------------------------------------------------------
+// feed the gpu times to the load balancer. may change m_splitRatio
+// the load balancer works with the fraction of the simulated particles,
+// m_splitRatio is the fraction of all particles
+//-----------------------------------------------------------------------------
+void Particles::UpdateLoadBalancer()
+{
+    const UINT numSimulated = UINT(m_numParticlesSimulated);
+    const UINT numComputeParticles = std::min(m_splitParticle, numSimulated);
+
+    // while the ratio is set by hand, the load balancer follows (and stays in cooldown)
+    if (!m_autoBalance && (numSimulated > 0))
+    {
+        m_loadBalancer.SetRatio(numComputeParticles / float(numSimulated));
+    }
+
+    // each object has a single timer: simulate ms or render ms
+    // the compute adapters finish when the slowest of them does
+    float computeTime = m_pCompute->GetGpuTimes()[0].first;
+    for (Compute* pCompute : m_extraComputes)
+    {
+        computeTime = std::max(computeTime, pCompute->GetGpuTimes()[0].first);
     }
-    m_pRender->SetAsyncMode(asyncMode);
+    const bool changed = m_loadBalancer.Update(
+        computeTime, numComputeParticles,
+        m_pComputeSecondary->GetGpuTimes()[0].first, numSimulated - numComputeParticles,
+        m_pRender->GetGpuTimes()[0].first);
+
+    if (changed)
+    {
+        m_splitRatio = m_loadBalancer.GetRatio() * numSimulated / float(m_maxNumParticles);
+        m_splitRatioSlider = m_splitRatio;
+    }
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+ThrottlePolicy Particles::GetComputeThrottlePolicy() const
+{
+    return (THROTTLE_AUTO == m_computeThrottleMode) ? m_computeGovernor.GetPolicy() : ThrottlePolicy(m_computeThrottleMode);
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+ThrottlePolicy Particles::GetRenderThrottlePolicy() const
+{
+    return (THROTTLE_AUTO == m_renderThrottleMode) ? m_renderGovernor.GetPolicy() : ThrottlePolicy(m_renderThrottleMode);
+}
+
+//-----------------------------------------------------------------------------
+// a changed compute policy is applied with the other queue changes in Draw()
+// a changed render policy waits for the user, the governor holds it until then
+//-----------------------------------------------------------------------------
+void Particles::UpdateThrottleGovernors()
+{
+    const float frameTime = m_frameTimer.Get();
+    if ((THROTTLE_AUTO == m_computeThrottleMode) && m_pCompute->GetUsingIntelCommandQueueExtension())
+    {
+        m_computeGovernor.Update(m_pCompute->GetGpuTimes()[0].first, frameTime);
+    }
+    if ((THROTTLE_AUTO == m_renderThrottleMode) && m_pRender->GetUsingIntelCommandQueueExtension()
+        && (m_pRender->GetThrottlePolicy() == m_renderGovernor.GetPolicy()))
+    {
+        m_renderGovernor.Update(m_pRender->GetGpuTimes()[0].first, frameTime);
+    }
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+D3D12_COMMAND_QUEUE_PRIORITY Particles::GetComputeQueuePriority() const
+{
+    const D3D12_COMMAND_QUEUE_PRIORITY priorities[] = {
+        D3D12_COMMAND_QUEUE_PRIORITY_NORMAL, D3D12_COMMAND_QUEUE_PRIORITY_HIGH, D3D12_COMMAND_QUEUE_PRIORITY_GLOBAL_REALTIME };
+    return priorities[std::max(0, std::min(m_computeQueuePriority, int(_countof(priorities)) - 1))];
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+UINT Particles::GetSimulationLatency() const
+{
+    return UINT(std::max(0, std::min(m_simulationLatency, m_numBuffers - 1)));
+}
+
+//-----------------------------------------------------------------------------
+// the intervals are on the cpu clock, see D3D12GpuTimer::GetLastIntervals()
+// the render interval covers the draw and the gui
+//-----------------------------------------------------------------------------
+float Particles::GetAsyncOverlap() const
+{
+    const auto& simulate = m_pCompute->GetLastGpuIntervals()[0];
+    const auto& render = m_pRender->GetLastGpuIntervals()[0];
+    const double overlap = std::min(simulate.second, render.second) - std::max(simulate.first, render.first);
+    return float(std::max(overlap, 0.0));
 }
 
 //-----------------------------------------------------------------------------
@@ -213,6 +797,18 @@ void Particles::AssignAdapters()
 {
     const size_t numAdapters = m_adapters.size();
 
+    if (m_probeAdapters && (numAdapters > 1))
+    {
+        for (const auto& adapter : m_adapters)
+        {
+            m_adapterCapabilities.push_back(AdapterProbe::Probe(adapter.Get()));
+        }
+        const AdapterProbe::Roles roles = AdapterProbe::AssignRoles(m_adapterCapabilities, UINT(m_maxNumParticles));
+        m_renderAdapterIndex = roles.m_renderAdapterIndex;
+        m_computeAdapterIndex = roles.m_computeAdapterIndex;
+        return;
+    }
+
     // if no UMA (integrated) device is found, then:
     // compute will be the first adapter enumerated (index 0)
     // render will be the last adapter enumerated (# adapters - 1)
@@ -242,6 +838,56 @@ void Particles::AssignAdapters()
     }
 }
 
+//-----------------------------------------------------------------------------
+// over-committing does not fail, the OS pages the buffers in and out every frame instead
+// the budget is shared with other processes, so it is only checked for the initial adapters
+//-----------------------------------------------------------------------------
+void Particles::ClampNumParticlesToBudget()
+{
+    m_requestedNumParticles = m_maxNumParticles;
+    if (!m_memoryBudgetEnabled)
+    {
+        return;
+    }
+
+    MemoryBudget& renderBudget = m_memoryBudgets[m_renderAdapterIndex];
+    MemoryBudget& computeBudget = m_memoryBudgets[m_computeAdapterIndex];
+    renderBudget.Update();
+    computeBudget.Update();
+
+    // only the transfers ShareHandles() turns on are resident, a transfer turned on later may exceed the budget
+    const bool asyncMode = (m_renderAdapterIndex == m_computeAdapterIndex);
+    const bool density = m_densityField && !asyncMode;
+    const bool packed = m_packedTransfer && !asyncMode && !density;
+
+    // the shared heap is counted against the local budget of the compute adapter,
+    // which over-estimates discrete compute adapters: cross-adapter heaps are in system memory
+    auto Fits = [&](UINT in_numParticles)
+    {
+        const UINT64 renderFootprint = Render::GetMemoryFootprint(in_numParticles, UINT(m_numBuffers), packed, density);
+        const UINT64 computeFootprint = Compute::GetMemoryFootprint(in_numParticles, UINT(m_numBuffers), packed, density);
+        if (m_renderAdapterIndex == m_computeAdapterIndex)
+        {
+            return (renderFootprint + computeFootprint) <= renderBudget.GetAvailable();
+        }
+        // split-frame simulation adds a compute object on the render adapter
+        const UINT64 secondaryFootprint = m_splitSimulation ? computeFootprint : 0;
+        return ((renderFootprint + secondaryFootprint) <= renderBudget.GetAvailable()) &&
+            (computeFootprint <= computeBudget.GetAvailable());
+    };
+
+    UINT numParticles = UINT(m_maxNumParticles);
+    while ((numParticles > MIN_NUM_PARTICLES) && (!Fits(numParticles)))
+    {
+        numParticles = std::max<UINT>(numParticles / 2, MIN_NUM_PARTICLES);
+    }
+
+    m_maxNumParticles = int(numParticles);
+    m_numParticlesRendered = std::min(m_numParticlesRendered, m_maxNumParticles);
+    m_numParticlesCopied = std::min(m_numParticlesCopied, m_maxNumParticles);
+    m_numParticlesSimulated = std::min(m_numParticlesSimulated, m_maxNumParticles);
+}
+
 //-----------------------------------------------------------------------------
 // parse command line
 //-----------------------------------------------------------------------------
@@ -255,12 +901,68 @@ void Particles::ParseCommandLine()
         m_numParticlesSimulated = m_maxNumParticles;
     });
 
+    argParser.AddArg(L"nobudget", m_memoryBudgetEnabled);
+    argParser.AddArg(L"noprobe", m_probeAdapters);
     argParser.AddArg(L"nogui", m_enableUI);
     argParser.AddArg(L"noext", m_enableExtensions);
+    // 0: dynamic, 1: max performance, 2: auto
+    argParser.AddArg(L"throttle", [=](std::wstring s) {
+        m_computeThrottleMode = std::max(0, std::min(std::stoi(s), THROTTLE_AUTO));
+        m_renderThrottleMode = m_computeThrottleMode;
+    });
     argParser.AddArg(L"size", m_particleSize);
     argParser.AddArg(L"intensity", m_particleIntensity);
     argParser.AddArg(L"novsync", m_vsyncEnabled);
     argParser.AddArg(L"fullscreen", m_fullScreen);
+    argParser.AddArg(L"nbody", [=](std::wstring) { m_simulationMode = int(Compute::SimulationMode::NBody); });
+    argParser.AddArg(L"nbodygrid", [=](std::wstring) { m_simulationMode = int(Compute::SimulationMode::NBodyGrid); });
+    argParser.AddArg(L"timestep", m_timestep);
+    argParser.AddArg(L"damping", m_damping);
+    argParser.AddArg(L"mass", m_mass);
+    argParser.AddArg(L"softening", m_softening);
+    argParser.AddArg(L"lod", m_lod);
+    argParser.AddArg(L"lodacceleration", m_lodAcceleration);
+    argParser.AddArg(L"simrate", [=](std::wstring s) {
+        m_simulationRate = std::max(1, std::min(std::stoi(s), MAX_SIMULATION_RATE));
+        m_fixedTimestep = true;
+    });
+    argParser.AddArg(L"quads", [=](std::wstring) { m_drawPath = int(Render::DrawPath::InstancedQuad); });
+    argParser.AddArg(L"meshshader", [=](std::wstring) { m_drawPath = int(Render::DrawPath::MeshShader); });
+    argParser.AddArg(L"cull", m_culling);
+    argParser.AddArg(L"split", m_splitSimulation);
+    argParser.AddArg(L"splitratio", [=](std::wstring s) { m_splitRatio = std::stof(s); m_splitRatioSlider = m_splitRatio; });
+    argParser.AddArg(L"autobalance", m_autoBalance);
+    argParser.AddArg(L"extracompute", [=](std::wstring s) {
+        // comma-separated adapter indices
+        std::wstringstream stream(s);
+        std::wstring index;
+        while (std::getline(stream, index, L','))
+        {
+            m_extraComputeAdapters.push_back(std::stoi(index));
+        }
+    });
+    argParser.AddArg(L"packed", m_packedTransfer);
+    argParser.AddArg(L"chunks", [=](std::wstring s) {
+        m_numChunks = std::max(1, std::min(std::stoi(s), MAX_SIMULATION_CHUNKS));
+        m_numChunksSlider = m_numChunks;
+    });
+    argParser.AddArg(L"zerocopy", m_zeroCopy);
+    argParser.AddArg(L"density", m_densityField);
+    argParser.AddArg(L"densitynear", [=](std::wstring s) { m_densityNearDistance = std::max(0.0f, std::stof(s)); });
+    argParser.AddArg(L"priority", [=](std::wstring s) { m_computeQueuePriority = std::max(0, std::min(std::stoi(s), 2)); });
+    argParser.AddArg(L"latency", [=](std::wstring s) { m_simulationLatency = std::max(0, std::min(std::stoi(s), 2)); });
+    argParser.AddArg(L"framelatency", [=](std::wstring s) { m_frameLatency = std::max(1, std::min(std::stoi(s), MAX_FRAME_LATENCY)); });
+    argParser.AddArg(L"lowlatency", m_lowLatency);
+    argParser.AddArg(L"velocitysoa", [=](std::wstring s) { Compute::SetVelocitySoa(0 != std::stoi(s)); });
+    argParser.AddArg(L"gpuinit", [=](std::wstring s) { Compute::SetInitializeOnGpu(0 != std::stoi(s)); });
+    argParser.AddArg(L"buffers", [=](std::wstring s) { m_numBuffers = std::max(MIN_NUM_BUFFERS, std::min(std::stoi(s), MAX_NUM_BUFFERS)); });
+
+    argParser.AddArg(L"benchmark", [=](std::wstring s) { m_benchmarkScript = s; });
+    argParser.AddArg(L"benchmarkout", [=](std::wstring s) { m_benchmarkOutput = s; });
+    argParser.AddArg(L"trace", [=](std::wstring s) { m_traceOutput = s; });
+    argParser.AddArg(L"traceframes", [=](std::wstring s) { m_numTraceFrames = std::max(1, std::stoi(s)); });
+    argParser.AddArg(L"load", [=](std::wstring s) { m_snapshotInput = s; });
+    argParser.AddArg(L"save", [=](std::wstring s) { m_snapshotOutput = s; });
 
     argParser.AddArg(L"numCopy", [=](std::wstring s) { m_numParticlesCopied = std::stoi(s); m_numParticlesLinked = false; });
     argParser.AddArg(L"numDraw", [=](std::wstring s) { m_numParticlesRendered = std::stoi(s); m_numParticlesLinked = false; });
@@ -351,9 +1053,14 @@ void Particles::DrawGUI(ID3D12GraphicsCommandList* in_pCommandList)
             (int)m_adapterDescriptionPtrs.size());
     }
 
-    if (m_renderAdapterIndex == m_computeAdapterIndex)
+    if (m_renderAdapterIndex == m_activeComputeAdapterIndex)
     {
         ImGui::Text("Single Adapter with Async Compute");
+        ImGui::SliderInt("Simulation Latency", &m_simulationLatency, 0, 2);
+        if (UINT(m_simulationLatency) > GetSimulationLatency())
+        {
+            ImGui::Text("Latency limited by the buffers: %u", GetSimulationLatency());
+        }
     }
     else
     {
@@ -368,11 +1075,139 @@ void Particles::DrawGUI(ID3D12GraphicsCommandList* in_pCommandList)
     }
 
     ImGui::Checkbox("Intel Q Extension", &m_commandQueueExtensionEnabled);
+    if (m_commandQueueExtensionEnabled)
+    {
+        const char* throttleModes[] = { "Dynamic", "Max Performance", "Auto" };
+        static_assert(_countof(throttleModes) == (THROTTLE_AUTO + 1), "missing throttle mode name");
+        // the render queue can only change with the swap chain, so the render device is recreated
+        ImGui::Combo("Compute Throttle", &m_computeThrottleMode, throttleModes, _countof(throttleModes));
+        ImGui::Combo("Render Throttle", &m_renderThrottleMode, throttleModes, _countof(throttleModes));
+        if ((THROTTLE_AUTO == m_computeThrottleMode) || (THROTTLE_AUTO == m_renderThrottleMode))
+        {
+            ImGui::Text("throttle: compute %s, render %s", throttleModes[UINT(GetComputeThrottlePolicy())], throttleModes[UINT(m_pRender->GetThrottlePolicy())]);
+        }
+        // recreating the render device stalls for a moment, so Auto does not do it on its own
+        if ((THROTTLE_AUTO == m_renderThrottleMode) && m_pRender->GetUsingIntelCommandQueueExtension()
+            && (m_pRender->GetThrottlePolicy() != GetRenderThrottlePolicy()))
+        {
+            ImGui::Text("render throttle %s recommended", throttleModes[UINT(GetRenderThrottlePolicy())]);
+            if (ImGui::Button("Apply Render Throttle"))
+            {
+                m_applyRenderThrottle = true;
+            }
+        }
+    }
+    const char* queuePriorities[] = { "Normal", "High", "Global Realtime" };
+    ImGui::Combo("Compute Priority", &m_computeQueuePriority, queuePriorities, _countof(queuePriorities));
+    if (GetComputeQueuePriority() != D3D12_COMMAND_QUEUE_PRIORITY(m_pCompute->GetQueuePriority()))
+    {
+        ImGui::Text("Priority not available, using High");
+    }
     ImGui::Checkbox("VSync", &m_vsyncEnabled);
     ImGui::Checkbox("FullScreen", &m_fullScreen);
+    ImGui::SliderInt("Frame Latency", &m_frameLatency, 1, MAX_FRAME_LATENCY);
+    ImGui::Checkbox("Low Latency", &m_lowLatency);
+    if (m_renderAdapterIndex != m_activeComputeAdapterIndex)
+    {
+        ImGui::Checkbox("Packed Transfer", &m_packedTransfer);
+        ImGui::Checkbox("Zero Copy", &m_zeroCopy);
+        ImGui::Checkbox("Density Field", &m_densityField);
+        if (m_densityField)
+        {
+            ImGui::SliderFloat("Near Distance", &m_densityNearDistance, 0.0f, 2000.0f, "%.0f");
+        }
+
+        // re-sharing stalls, so wait until the user is done
+        if (!m_zeroCopy && !m_densityField)
+        {
+            ImGui::SliderInt("Copy Chunks", &m_numChunksSlider, 1, MAX_SIMULATION_CHUNKS);
+            if (ImGui::IsItemDeactivatedAfterEdit())
+            {
+                m_numChunks = m_numChunksSlider;
+            }
+        }
+    }
     ImGui::SliderFloat("Size", &m_particleSize, 1, 10);
     ImGui::SliderFloat("Intensity", &m_particleIntensity, 0.1f, 2.0f);
 
+    const char* simulationModes[] = { "Gravity Well", "N-Body", "N-Body Grid" };
+    static_assert(_countof(simulationModes) == int(Compute::SimulationMode::Count), "missing simulation mode name");
+    ImGui::Combo("Simulation", &m_simulationMode, simulationModes, _countof(simulationModes));
+    ImGui::Checkbox("Fixed Timestep", &m_fixedTimestep);
+    if (m_fixedTimestep)
+    {
+        ImGui::SliderInt("Steps/s", &m_simulationRate, 1, MAX_SIMULATION_RATE);
+    }
+    ImGui::SliderFloat("Timestep", &m_timestep, 0.01f, 0.5f);
+    ImGui::SliderFloat("Damping", &m_damping, 0.9f, 1.0f);
+    ImGui::SliderFloat("Mass", &m_mass, 10000.0f, 200000.0f, "%.0f");
+    ImGui::SliderFloat("Softening", &m_softening, 1.0f, 20.0f);
+    ImGui::Checkbox("Temporal LOD", &m_lod);
+    if (m_lod)
+    {
+        ImGui::SliderFloat("LOD Acceleration", &m_lodAcceleration, 0.1f, PACK_MAX_ACCELERATION);
+    }
+
+    const char* drawPaths[] = { "Geometry Shader", "Instanced Quads", "Mesh Shader" };
+    static_assert(_countof(drawPaths) == int(Render::DrawPath::Count), "missing draw path name");
+    ImGui::Combo("Draw Path", &m_drawPath, drawPaths, _countof(drawPaths));
+    if (!m_pRender->GetDrawPathSupported(Render::DrawPath(m_drawPath)))
+    {
+        ImGui::Text("Draw path not supported, using Geometry Shader");
+    }
+    ImGui::Checkbox("GPU Culling", &m_culling);
+
+    if (GetSplitSimulationSupported())
+    {
+        ImGui::Checkbox("Split Simulation", &m_splitSimulation);
+        if (m_splitSimulation)
+        {
+            ImGui::Checkbox("Auto Balance", &m_autoBalance);
+            if (m_autoBalance)
+            {
+                ImGui::Text("Compute Ratio: %.3f", m_splitRatio);
+            }
+            else
+            {
+                // moving particles between adapters stalls, so wait until the user is done
+                ImGui::SliderFloat("Compute Ratio", &m_splitRatioSlider, 0.0f, 1.0f);
+                if (ImGui::IsItemDeactivatedAfterEdit())
+                {
+                    m_splitRatio = m_splitRatioSlider;
+                }
+            }
+            ImGui::Text("compute adapter ms: %f", m_loadBalancer.GetComputeAdapterTime() * 1000.0f);
+            ImGui::Text("render adapter ms: %f", m_loadBalancer.GetRenderAdapterTime() * 1000.0f);
+        }
+
+        // any other adapter can take a share of the particles of the compute adapter
+        if (m_adapters.size() > 2)
+        {
+            ImGui::Text("Extra Compute Adapters");
+            for (int i = 0; i < int(m_adapters.size()); i++)
+            {
+                if ((i == m_renderAdapterIndex) || (i == m_computeAdapterIndex))
+                {
+                    continue;
+                }
+                const auto selection = std::find(m_extraComputeAdapters.begin(), m_extraComputeAdapters.end(), i);
+                bool selected = (m_extraComputeAdapters.end() != selection);
+                const std::string label = std::to_string(i) + ": " + m_adapterDescriptions[i].c_str() + "##extracompute";
+                if (ImGui::Checkbox(label.c_str(), &selected))
+                {
+                    if (selected)
+                    {
+                        m_extraComputeAdapters.push_back(i);
+                    }
+                    else
+                    {
+                        m_extraComputeAdapters.erase(selection);
+                    }
+                }
+            }
+        }
+    }
+
     //-----------------------------------------------------
     // independently specify size of workload across engines/adapters
     //-----------------------------------------------------
@@ -392,6 +1227,52 @@ void Particles::DrawGUI(ID3D12GraphicsCommandList* in_pCommandList)
     ImGui::SliderInt("Copied", numParticlesCopied, std::min<int>(MIN_NUM_PARTICLES, m_maxNumParticles), m_maxNumParticles);
     ImGui::SliderInt("Simulated", numParticlesSimulated, std::min<int>(MIN_NUM_PARTICLES, m_maxNumParticles), m_maxNumParticles);
     ImGui::Checkbox("Link Sliders", &m_numParticlesLinked);
+    if (m_maxNumParticles < m_requestedNumParticles)
+    {
+        ImGui::Text("Limited by the memory budget: %d of %d", m_maxNumParticles, m_requestedNumParticles);
+    }
+
+    //-----------------------------------------------------
+    // video memory of the adapters in use
+    //-----------------------------------------------------
+    ImGui::Separator();
+    ImGui::Text("Video Memory MB (usage / budget)");
+    {
+        const int memoryAdapterIndices[] = { m_renderAdapterIndex, m_activeComputeAdapterIndex };
+        const char* memoryAdapterNames[] = { "render", "compute" };
+        const UINT numMemoryAdapters = (m_renderAdapterIndex == m_activeComputeAdapterIndex) ? 1 : 2;
+        const float MB = 1.0f / (1024.0f * 1024.0f);
+        for (UINT i = 0; i < numMemoryAdapters; i++)
+        {
+            MemoryBudget& budget = m_memoryBudgets[memoryAdapterIndices[i]];
+            budget.Update();
+            if (!budget.GetSupported())
+            {
+                ImGui::Text("%s: not reported", memoryAdapterNames[i]);
+                continue;
+            }
+            const auto& local = budget.GetLocal();
+            const auto& nonLocal = budget.GetNonLocal();
+            ImGui::Text("%s local: %.0f / %.0f, non-local: %.0f / %.0f", memoryAdapterNames[i],
+                local.CurrentUsage * MB, local.Budget * MB, nonLocal.CurrentUsage * MB, nonLocal.Budget * MB);
+            if (budget.GetOverBudget())
+            {
+                ImGui::Text("PERFORMANCE ISSUE: %s adapter is over its memory budget", memoryAdapterNames[i]);
+            }
+        }
+    }
+
+    if (!m_adapterCapabilities.empty())
+    {
+        ImGui::Separator();
+        ImGui::Text("Adapter Probe (GFLOP/s, copy GB/s)");
+        for (size_t i = 0; i < m_adapterCapabilities.size(); i++)
+        {
+            const AdapterProbe::Capabilities& capabilities = m_adapterCapabilities[i];
+            ImGui::Text("%d: %.0f, %.1f%s%s", int(i), capabilities.m_computeRate, capabilities.m_copyBandwidth,
+                capabilities.m_uma ? ", UMA" : "", capabilities.m_crossAdapterRowMajorTexture ? ", row-major textures" : "");
+        }
+    }
 
     //-----------------------------------------------------
     // timers
@@ -406,7 +1287,69 @@ void Particles::DrawGUI(ID3D12GraphicsCommandList* in_pCommandList)
     {
         ImGui::Text("%s: %f", t.second.c_str(), t.first * 1000.0f);
     }
+    for (size_t i = 0; i < m_extraComputes.size(); i++)
+    {
+        for (auto& t : m_extraComputes[i]->GetGpuTimes())
+        {
+            ImGui::Text("%s (adapter %d): %f", t.second.c_str(), m_activeExtraComputeAdapters[i], t.first * 1000.0f);
+        }
+    }
+    if (m_pComputeSecondary)
+    {
+        for (auto& t : m_pComputeSecondary->GetGpuTimes())
+        {
+            ImGui::Text("%s (render adapter): %f", t.second.c_str(), t.first * 1000.0f);
+        }
+    }
+    // the transfer across adapters, only in copy mode
+    if ((m_renderAdapterIndex != m_activeComputeAdapterIndex) && !m_zeroCopy && m_pRender->GetCopyTimerSupported())
+    {
+        const float copyTime = m_pRender->GetCopyGpuTimes()[0].first;
+        ImGui::Text("copy ms: %f", copyTime * 1000.0f);
+        ImGui::Text("copy GB/s: %f", (copyTime > 0) ? (float(m_pRender->GetCopiedBytes()) / copyTime) * 1e-9f : 0.0f);
+
+        // the waits between the queues, on the cpu clock: simulation done to copy start, copy done to the next render
+        const auto& simulate = m_pCompute->GetLastGpuIntervals()[0];
+        const auto& copy = m_pRender->GetLastCopyGpuIntervals()[0];
+        const auto& render = m_pRender->GetLastGpuIntervals()[0];
+        ImGui::Text("wait compute->copy ms: %f", float(copy.first - simulate.second) * 1000.0f);
+        ImGui::Text("wait copy->render ms: %f", float(render.first - copy.second) * 1000.0f);
+    }
+    if (m_renderAdapterIndex == m_activeComputeAdapterIndex)
+    {
+        const float simulateTime = m_pCompute->GetLastGpuTimes()[0].first;
+        const float overlap = GetAsyncOverlap();
+        ImGui::Text("async overlap ms: %f (%.0f%% of simulate)", overlap * 1000.0f, (simulateTime > 0) ? (100.0f * overlap / simulateTime) : 0.0f);
+    }
     ImGui::Text("frameTime: %f", m_frameTimer.Get() * 1000.0f);
+    const Render::PresentStatistics& presentStatistics = m_pRender->GetPresentStatistics();
+    if (presentStatistics.m_valid)
+    {
+        ImGui::Text("display latency ms: %f", presentStatistics.m_displayLatency * 1000.0f);
+    }
+    else
+    {
+        ImGui::Text("display latency ms: not reported");
+    }
+    ImGui::Text("missed refreshes: %u", presentStatistics.m_numMissedRefreshes);
+    if (ImGui::Button(m_profiler.GetCapturing() ? "Capturing Trace..." : "Capture Trace"))
+    {
+        m_traceOutput = L"trace.json";
+    }
+    ImGui::Text("simulated steps: %llu", m_pCompute->GetSimulatedSteps());
+    if (ImGui::Button("Save Snapshot"))
+    {
+        m_pendingSnapshotOutput = L"snapshot.bin";
+    }
+    if (m_renderAdapterIndex != m_activeComputeAdapterIndex)
+    {
+        const char* transferNames[] = { "copy", "zero-copy" };
+        for (UINT i = 0; i < _countof(transferNames); i++)
+        {
+            const float averageTime = m_transferNumFrames[i] ? (m_transferFrameTimes[i] / m_transferNumFrames[i]) : 0.0f;
+            ImGui::Text("frameTime %s: %f (%u frames)", transferNames[i], averageTime * 1000.0f, m_transferNumFrames[i]);
+        }
+    }
     //-----------------------------------------------------
 
     // resize the UI to fit the dynamically-sized components
@@ -421,10 +1364,253 @@ void Particles::DrawGUI(ID3D12GraphicsCommandList* in_pCommandList)
 }
 
 //-----------------------------------------------------------------------------
+// the real time since the last frame that has not been simulated yet is consumed in whole steps
+// the remainder carries over to the next frame
 //-----------------------------------------------------------------------------
-void Particles::Shutdown()
+UINT Particles::UpdateSimulationSteps()
+{
+    const double time = m_simulationTimer.GetTime();
+    if (!m_fixedTimestep)
+    {
+        m_simulatedTime = time;
+        m_stepFraction = 1.0f;
+        return 1;
+    }
+
+    const double stepDuration = 1.0 / m_simulationRate;
+    UINT numSteps = UINT((time - m_simulatedTime) / stepDuration);
+
+    // can't keep up, e.g. after an adapter change. drop the real time that is not simulated
+    if (numSteps > MAX_SIMULATION_STEPS)
+    {
+        numSteps = MAX_SIMULATION_STEPS;
+        m_simulatedTime = time - (numSteps * stepDuration);
+    }
+
+    m_simulatedTime += numSteps * stepDuration;
+    m_stepFraction = std::min(float((time - m_simulatedTime) / stepDuration), 1.0f);
+    return numSteps;
+}
+
+//-----------------------------------------------------------------------------
+// benchmark defaults are the command line settings
+// without benchmarkout, the results are written next to the script
+//-----------------------------------------------------------------------------
+void Particles::StartBenchmark()
+{
+    Benchmark::Configuration defaults = {};
+    defaults.m_numParticles = m_numParticlesRendered;
+    defaults.m_renderAdapterIndex = m_renderAdapterIndex;
+    defaults.m_computeAdapterIndex = m_computeAdapterIndex;
+    defaults.m_async = false;
+    defaults.m_queueExtension = m_commandQueueExtensionEnabled;
+    defaults.m_throttleMode = m_computeThrottleMode;
+    defaults.m_queuePriority = m_computeQueuePriority;
+    defaults.m_simulationLatency = m_simulationLatency;
+    defaults.m_frameLatency = m_frameLatency;
+    defaults.m_lowLatency = m_lowLatency;
+    defaults.m_lod = m_lod;
+    defaults.m_densityField = m_densityField;
+    defaults.m_zeroCopy = m_zeroCopy;
+    defaults.m_numWarmupFrames = Benchmark::DEFAULT_NUM_WARMUP_FRAMES;
+    defaults.m_numFrames = Benchmark::DEFAULT_NUM_FRAMES;
+
+    m_pBenchmark = new Benchmark();
+    if (!m_pBenchmark->Load(m_benchmarkScript, defaults))
+    {
+        ::OutputDebugStringA("benchmark: can't read the script, or it has no configurations\n");
+        delete m_pBenchmark;
+        m_pBenchmark = nullptr;
+        return;
+    }
+
+    if (m_benchmarkOutput.empty())
+    {
+        const size_t extension = m_benchmarkScript.find_last_of(L'.');
+        const size_t directory = m_benchmarkScript.find_last_of(L"\\/");
+        const bool hasExtension = (std::wstring::npos != extension) && ((std::wstring::npos == directory) || (extension > directory));
+        m_benchmarkOutput = m_benchmarkScript.substr(0, hasExtension ? extension : std::wstring::npos) + L"_results";
+    }
+
+    m_enableUI = false;
+    ApplyBenchmarkConfiguration();
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void Particles::ApplyBenchmarkConfiguration()
+{
+    const Benchmark::Configuration& configuration = m_pBenchmark->GetConfiguration();
+    const int lastAdapterIndex = int(m_adapters.size()) - 1;
+
+    m_renderAdapterIndex = std::max(0, std::min(configuration.m_renderAdapterIndex, lastAdapterIndex));
+    m_computeAdapterIndex = configuration.m_async ? m_renderAdapterIndex :
+        std::max(0, std::min(configuration.m_computeAdapterIndex, lastAdapterIndex));
+    m_commandQueueExtensionEnabled = configuration.m_queueExtension;
+    m_computeThrottleMode = std::max(0, std::min(configuration.m_throttleMode, THROTTLE_AUTO));
+    m_renderThrottleMode = m_computeThrottleMode;
+    m_computeQueuePriority = std::max(0, std::min(configuration.m_queuePriority, 2));
+    m_simulationLatency = std::max(0, std::min(configuration.m_simulationLatency, 2));
+    m_frameLatency = std::max(1, std::min(configuration.m_frameLatency, MAX_FRAME_LATENCY));
+    m_lowLatency = configuration.m_lowLatency;
+    m_lod = configuration.m_lod;
+    m_densityField = configuration.m_densityField;
+    m_zeroCopy = configuration.m_zeroCopy;
+
+    const int numParticles = std::max(1, std::min(configuration.m_numParticles, m_maxNumParticles));
+    m_numParticlesRendered = numParticles;
+    m_numParticlesCopied = numParticles;
+    m_numParticlesSimulated = numParticles;
+}
+
+//-----------------------------------------------------------------------------
+// the gpu times are those of the most recent frame that has been resolved,
+// the warm-up frames cover the latency
+//-----------------------------------------------------------------------------
+void Particles::UpdateBenchmark()
+{
+    Benchmark::TimeArray times(1, { m_frameTimer.GetLast(), "frame ms" });
+    for (const auto& t : m_pRender->GetLastGpuTimes())
+    {
+        times.push_back(t);
+    }
+    for (const auto& t : m_pCompute->GetLastGpuTimes())
+    {
+        times.push_back(t);
+    }
+    if (m_pRender->GetCopyTimerSupported())
+    {
+        for (const auto& t : m_pRender->GetLastCopyGpuTimes())
+        {
+            times.push_back(t);
+        }
+    }
+    if (m_pComputeSecondary)
+    {
+        for (const auto& t : m_pComputeSecondary->GetLastGpuTimes())
+        {
+            times.push_back({ t.first, t.second + " (render adapter)" });
+        }
+    }
+    for (size_t i = 0; i < m_extraComputes.size(); i++)
+    {
+        for (const auto& t : m_extraComputes[i]->GetLastGpuTimes())
+        {
+            times.push_back({ t.first, t.second + " (adapter " + std::to_string(m_activeExtraComputeAdapters[i]) + ")" });
+        }
+    }
+    if (m_renderAdapterIndex == m_activeComputeAdapterIndex)
+    {
+        times.push_back({ GetAsyncOverlap(), "async overlap ms" });
+    }
+    if (m_pRender->GetPresentStatistics().m_valid)
+    {
+        times.push_back({ m_pRender->GetPresentStatistics().m_displayLatency, "display latency ms" });
+    }
+
+    // the results list the configuration as it runs, after the clamps of ApplyBenchmarkConfiguration()
+    // and of the memory budget, with the compute adapter that is active
+    if (!m_pBenchmark->GetDone())
+    {
+        Benchmark::Configuration applied = m_pBenchmark->GetConfiguration();
+        applied.m_numParticles = m_numParticlesSimulated;
+        applied.m_renderAdapterIndex = m_renderAdapterIndex;
+        applied.m_computeAdapterIndex = m_activeComputeAdapterIndex;
+        applied.m_async = (m_renderAdapterIndex == m_activeComputeAdapterIndex);
+        applied.m_queueExtension = m_pRender->GetUsingIntelCommandQueueExtension();
+        applied.m_throttleMode = m_computeThrottleMode;
+        applied.m_queuePriority = m_computeQueuePriority;
+        applied.m_simulationLatency = m_simulationLatency;
+        applied.m_frameLatency = m_frameLatency;
+        applied.m_lowLatency = m_lowLatency;
+        applied.m_lod = m_lod;
+        applied.m_densityField = m_densityField;
+        applied.m_zeroCopy = m_zeroCopy;
+        m_pBenchmark->SetAppliedConfiguration(applied);
+    }
+
+    // a new compute adapter is still being built, see StartComputeSwap()
+    if (!m_pBenchmark->Update(times, m_pendingCompute.valid()))
+    {
+        return;
+    }
+
+    if (m_pBenchmark->GetDone())
+    {
+        m_pBenchmark->Write(m_benchmarkOutput, m_adapterDescriptions);
+        ::PostQuitMessage(0);
+    }
+    else
+    {
+        ApplyBenchmarkConfiguration();
+    }
+}
+
+//-----------------------------------------------------------------------------
+// submits the simulation drawn by the next frames
+//-----------------------------------------------------------------------------
+void Particles::Simulate(const std::vector<UINT64>& in_sharedFenceValues)
+{
+    const UINT numSteps = UpdateSimulationSteps();
+    m_pRender->SetNextSimulation(numSteps, m_stepFraction);
+    const std::vector<Compute*> computes = GetComputes();
+    for (size_t i = 0; i < computes.size(); i++)
+    {
+        computes[i]->Simulate(m_numParticlesSimulated, in_sharedFenceValues[i], numSteps);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// the fence values are copied, the worker may outlive the caller's vector
+//-----------------------------------------------------------------------------
+void Particles::StartSimulation(const std::vector<UINT64>& in_sharedFenceValues)
+{
+    assert(!m_pendingSimulation.valid());
+    m_pendingSimulation = std::async(std::launch::async, [this, in_sharedFenceValues]()
+    {
+        Simulate(in_sharedFenceValues);
+    });
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void Particles::WaitForSimulation()
+{
+    if (m_pendingSimulation.valid())
+    {
+        Profiler::Scope scope("simulation wait");
+        m_pendingSimulation.get(); // re-throws exceptions from the worker thread
+    }
+}
+
+//-----------------------------------------------------------------------------
+// each compute object reads back its own range, so split-frame simulation writes one snapshot too
+//-----------------------------------------------------------------------------
+void Particles::SaveSnapshot(const std::wstring& in_path)
 {
+    m_pRender->WaitForGpu();
+    m_pCompute->WaitForGpu();
+
+    Snapshot snapshot(Compute::GetSnapshotLayout(UINT(m_maxNumParticles), m_pCompute->GetSimulatedSteps()));
+    for (Compute* pCompute : GetComputes())
+    {
+        pCompute->ReadState(snapshot);
+    }
+
+    if (!snapshot.Save(in_path))
+    {
+        ::OutputDebugStringW((L"failed to save snapshot " + in_path + L"\n").c_str());
+    }
+}
 
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void Particles::Shutdown()
+{
+    if (!m_snapshotOutput.empty())
+    {
+        SaveSnapshot(m_snapshotOutput);
+    }
 }
 
 //-----------------------------------------------------------------------------
@@ -432,9 +1618,47 @@ void Particles::Shutdown()
 void Particles::Draw()
 {
     m_frameTimer.Update();
+    Markers::Frame(m_frameNumber);
+    m_frameNumber++;
+
+    if (m_pBenchmark)
+    {
+        UpdateBenchmark();
+    }
+
+    if (!m_traceOutput.empty())
+    {
+        m_profiler.Start(m_traceOutput, UINT(m_numTraceFrames));
+        m_traceOutput.clear();
+    }
+
+    if (!m_pendingSnapshotOutput.empty())
+    {
+        SaveSnapshot(m_pendingSnapshotOutput);
+        m_pendingSnapshotOutput.clear();
+    }
+
+    // compare the transfer modes over the run. async compute mode does not transfer
+    if (m_renderAdapterIndex != m_activeComputeAdapterIndex)
+    {
+        const UINT transferMode = m_zeroCopy ? 1 : 0;
+        m_transferFrameTimes[transferMode] += m_frameTimer.Get();
+        m_transferNumFrames[transferMode]++;
+    }
 
     m_pRender->SetParticleSize(m_particleSize);
     m_pRender->SetParticleIntensity(m_particleIntensity);
+    m_pRender->SetDrawPath(Render::DrawPath(m_drawPath));
+    m_pRender->SetCulling(m_culling);
+    m_pRender->SetFrameLatency(UINT(m_frameLatency));
+    const float lodAcceleration = m_lod ? std::max(m_lodAcceleration, 0.0f) : 0.0f;
+    const Compute::SimulationParameters simulationParameters = { m_timestep, m_damping, m_mass, m_softening, lodAcceleration };
+    for (Compute* pCompute : GetComputes())
+    {
+        pCompute->SetSimulationMode(Compute::SimulationMode(m_simulationMode));
+        pCompute->SetSimulationParameters(simulationParameters);
+        pCompute->SetDensityView(m_pRender->GetViewProjection(), m_densityNearDistance);
+    }
 
     if (m_numParticlesLinked)
     {
@@ -443,33 +1667,90 @@ void Particles::Draw()
     }
 
     // start simulation. This also starts copy of results for next frame
-    UINT64 renderSharedFenceValue = m_pCompute->GetFenceValue();
-    const HANDLE drawHandle = m_pRender->Draw(m_numParticlesRendered, this, renderSharedFenceValue, m_numParticlesCopied);
-    m_pCompute->Simulate(m_numParticlesSimulated, renderSharedFenceValue);
+    // one fence value per compute object
+    std::vector<UINT64> sharedFenceValues;
+    for (Compute* pCompute : GetComputes())
+    {
+        sharedFenceValues.push_back(pCompute->GetFenceValue());
+    }
+    const HANDLE drawHandle = m_pRender->Draw(m_numParticlesRendered, this, sharedFenceValues, m_numParticlesCopied);
+
+    if (!m_lowLatency)
+    {
+        StartSimulation(sharedFenceValues);
+    }
 
     // because the command lists of each adapter wait() on each other,
     // only need to host-wait() around the Present() on the render adapter
     if (drawHandle)
     {
+        Profiler::Scope scope("render fence wait");
         const DWORD rv = ::WaitForSingleObjectEx(drawHandle, INFINITE, FALSE);
         assert(rv == WAIT_OBJECT_0);
     }
+    WaitForSimulation();
+
+    // the simulation is needed by the copy (or draw) of the next frame, which can start once the swap chain has room
+    if (m_lowLatency)
+    {
+        m_pRender->WaitForFrameLatency();
+        Simulate(sharedFenceValues);
+    }
+
+    if (m_profiler.GetCapturing())
+    {
+        UpdateProfiler();
+    }
+
+    UpdateThrottleGovernors();
+
+    // measure even when not balancing automatically, to show the per-adapter times
+    if (m_pComputeSecondary)
+    {
+        UpdateLoadBalancer();
+    }
 
     bool changeFullScreen = (m_prevFullScreen != m_fullScreen);
     bool changeQueueExtension = (m_prevQueueExtension != m_commandQueueExtensionEnabled);
+    const bool changeComputeThrottle = (m_pCompute->GetThrottlePolicy() != GetComputeThrottlePolicy());
+    // in Auto mode, only once the user applies the recommendation
+    const bool changeRenderThrottle = m_pRender->GetUsingIntelCommandQueueExtension() && (m_pRender->GetThrottlePolicy() != GetRenderThrottlePolicy())
+        && ((THROTTLE_AUTO != m_renderThrottleMode) || m_applyRenderThrottle);
+    m_applyRenderThrottle = false;
     bool changeComputeDevice = (m_prevComputeAdapterIndex != m_computeAdapterIndex);
     bool changeRenderDevice = (m_prevRenderAdapterIndex != m_renderAdapterIndex)
         || (changeQueueExtension && m_pRender->GetSupportsIntelCommandQueueExtension())
+        || changeRenderThrottle
         || changeFullScreen;
 
+    // switch to a compute object built in the background once it is ready
+    // if the render device or the selection changes again, wait for it
+    if (m_pendingCompute.valid() && (changeComputeDevice || changeRenderDevice || GetComputeSwapReady()))
+    {
+        FinishComputeSwap();
+    }
+    ReleaseRetiredCompute(false);
+
     // if anything changed that might result in an adapter being removed,
-    // drain all the pipelines
-    if (changeComputeDevice || changeRenderDevice)
+    // drain all the pipelines. a new compute device is built without draining, see StartComputeSwap()
+    if (changeRenderDevice)
     {
         m_pRender->WaitForGpu();
         m_pCompute->WaitForGpu();
     }
 
+    // the secondary compute object lives on the render adapter and only supports some modes
+    // return its particles before any adapter changes
+    const bool splitSimulation = m_splitSimulation && GetSplitSimulationSupported();
+    if (!m_extraComputes.empty() && (changeRenderDevice || (GetExtraComputeAdapters() != m_activeExtraComputeAdapters)))
+    {
+        StopExtraComputes();
+    }
+    if (m_pComputeSecondary && (changeRenderDevice || !splitSimulation))
+    {
+        StopSplitSimulation();
+    }
+
     //-----------------------------------------------------
     // Handle GUI changes
     //-----------------------------------------------------
@@ -501,38 +1782,119 @@ void Particles::Draw()
             ::SetWindowPos(m_hwnd, HWND_NOTOPMOST, left, top, width, height, SWP_FRAMECHANGED);
         }
 
-        m_pRender = new Render(m_hwnd, m_maxNumParticles, m_adapters[m_renderAdapterIndex].Get(), m_commandQueueExtensionEnabled, m_fullScreen, m_windowInfo.rcClient);
+        m_pRender = new Render(m_hwnd, m_maxNumParticles, m_numBuffers, m_adapters[m_renderAdapterIndex].Get(), m_commandQueueExtensionEnabled, GetRenderThrottlePolicy(), m_fullScreen, m_windowInfo.rcClient);
 
         InitGui();
 
         ShareHandles();
+        m_renderGovernor.Restart();
+        // on the same device, the new render object was placed in the heaps of the previous one
+        HeapAllocator::ReleaseUnusedHeaps();
+
+        Markers::AdapterSwitch("render", m_renderAdapterIndex, m_adapterDescriptions[m_renderAdapterIndex]);
     }
 
-    // new compute device?
+    // new compute device? the current one keeps simulating until the new one is ready
     if (changeComputeDevice)
     {
-        Compute* pOldCompute = m_pCompute;
-        m_pCompute = new Compute(m_maxNumParticles, m_adapters[m_computeAdapterIndex].Get(),
-            m_commandQueueExtensionEnabled, pOldCompute);
-        delete pOldCompute;
-
-        ShareHandles();
-
-        m_commandQueueExtensionEnabled = m_pCompute->GetUsingIntelCommandQueueExtension();
+        StartComputeSwap();
     }
 
     // note: we can release() and create a new compute queue with/without extensions with no issues
     // render queue, we can't because of the tight relationship with the swap chain.
-    if (changeQueueExtension)
+    if (changeQueueExtension || changeComputeThrottle)
     {
-        m_pCompute->SetUseIntelCommandQueueExtension(m_commandQueueExtensionEnabled);
+        for (Compute* pCompute : GetComputes())
+        {
+            pCompute->SetUseIntelCommandQueueExtension(m_commandQueueExtensionEnabled, GetComputeThrottlePolicy());
+        }
+        m_computeGovernor.Restart();
         m_commandQueueExtensionEnabled = m_pCompute->GetUsingIntelCommandQueueExtension() ||
             m_pRender->GetUsingIntelCommandQueueExtension();
     }
 
+    // packing, chunking, zero-copy or the density field changes how the shared buffers are copied
+    // as does the simulation latency of async compute mode
+    if ((m_prevPackedTransfer != m_packedTransfer) || (m_prevNumChunks != m_numChunks) || (m_prevZeroCopy != m_zeroCopy)
+        || (m_prevDensityField != m_densityField) || (m_prevSimulationLatency != m_simulationLatency))
+    {
+        m_pRender->WaitForGpu();
+        for (Compute* pCompute : GetComputes())
+        {
+            pCompute->WaitForGpu();
+        }
+        ShareHandles();
+    }
+
+    if (m_prevComputeQueuePriority != m_computeQueuePriority)
+    {
+        for (Compute* pCompute : GetComputes())
+        {
+            pCompute->SetQueuePriority(GetComputeQueuePriority());
+        }
+    }
+
+    // start, or re-balance, split-frame simulation
+    if (splitSimulation)
+    {
+        if (nullptr == m_pComputeSecondary)
+        {
+            StartSplitSimulation();
+        }
+        else if (GetSplitParticle() != m_splitParticle)
+        {
+            SetSplitParticle(GetSplitParticle());
+        }
+    }
+
+    // n-way simulation waits for a compute adapter being built
+    if (m_extraComputes.empty() && !m_pendingCompute.valid())
+    {
+        const std::vector<int> extraComputeAdapters = GetExtraComputeAdapters();
+        if (!extraComputeAdapters.empty())
+        {
+            StartExtraComputes(extraComputeAdapters);
+        }
+    }
+
     // reset UI toggle history
     m_prevRenderAdapterIndex = m_renderAdapterIndex;
     m_prevComputeAdapterIndex = m_computeAdapterIndex;
     m_prevQueueExtension = m_commandQueueExtensionEnabled;
     m_prevFullScreen = m_fullScreen;
+    m_prevPackedTransfer = m_packedTransfer;
+    m_prevNumChunks = m_numChunks;
+    m_prevZeroCopy = m_zeroCopy;
+    m_prevDensityField = m_densityField;
+    m_prevComputeQueuePriority = m_computeQueuePriority;
+    m_prevSimulationLatency = m_simulationLatency;
+
+    m_profiler.EndFrame();
+}
+
+//-----------------------------------------------------------------------------
+// the timers read a few frames late, see D3D12GpuTimer. the profiler skips the timers that did not read again
+//-----------------------------------------------------------------------------
+void Particles::UpdateProfiler()
+{
+    auto GetAdapterName = [&](int in_adapterIndex)
+    {
+        return "adapter " + std::to_string(in_adapterIndex) + ": " + m_adapterDescriptions[in_adapterIndex].c_str();
+    };
+    const std::string renderAdapter = GetAdapterName(m_renderAdapterIndex);
+
+    m_profiler.AddGpuSpans(renderAdapter, "direct queue", m_pRender->GetGpuTimes(), m_pRender->GetLastGpuIntervals());
+    if (m_pRender->GetCopyTimerSupported())
+    {
+        m_profiler.AddGpuSpans(renderAdapter, "copy queue", m_pRender->GetCopyGpuTimes(), m_pRender->GetLastCopyGpuIntervals());
+    }
+    m_profiler.AddGpuSpans(GetAdapterName(m_activeComputeAdapterIndex), "compute queue", m_pCompute->GetGpuTimes(), m_pCompute->GetLastGpuIntervals());
+    if (m_pComputeSecondary)
+    {
+        m_profiler.AddGpuSpans(renderAdapter, "compute queue (split)", m_pComputeSecondary->GetGpuTimes(), m_pComputeSecondary->GetLastGpuIntervals());
+    }
+    for (size_t i = 0; i < m_extraComputes.size(); i++)
+    {
+        m_profiler.AddGpuSpans(GetAdapterName(m_activeExtraComputeAdapters[i]), "compute queue", m_extraComputes[i]->GetGpuTimes(), m_extraComputes[i]->GetLastGpuIntervals());
+    }
 }
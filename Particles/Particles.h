@@ -34,11 +34,18 @@
 #include <cstdint>
 #include <vector>
 #include <string>
+#include <future>
 
 #include "Timer.h"
+#include "LoadBalancer.h"
+#include "Profiler.h"
+#include "ThrottleGovernor.h"
+#include "MemoryBudget.h"
+#include "AdapterProbe.h"
 
 class Render;
 class Compute;
+class Benchmark;
 
 using Microsoft::WRL::ComPtr;
 
@@ -95,17 +102,230 @@ private:
     int m_numParticlesSimulated;
     bool m_numParticlesLinked;
 
-    // try to pick an initial state with compute->integrated and render->discrete
+    // pick the initial roles from the capabilities of the adapters, see AdapterProbe.h
+    // with noprobe, or a single adapter, try compute->integrated and render->discrete
     void AssignAdapters();
+    bool m_probeAdapters;
+    std::vector<AdapterProbe::Capabilities> m_adapterCapabilities; // in the order of m_adapters, empty without a probe
 
     int m_maxNumParticles;
+
+    //-----------------------------------------------------
+    // video memory of each adapter, in the order of m_adapters. see MemoryBudget.h
+    std::vector<MemoryBudget> m_memoryBudgets;
+    // halve m_maxNumParticles until the initial render and compute objects fit the budgets. nobudget disables
+    bool m_memoryBudgetEnabled;
+    int m_requestedNumParticles; // m_maxNumParticles before the clamp
+    void ClampNumParticlesToBudget();
+    //-----------------------------------------------------
+
     bool m_enableUI;
     bool m_enableExtensions;
     void ParseCommandLine();
 
+    //-----------------------------------------------------
+    // throttle policy of the queues created with the Intel command queue extension
+    // a ThrottlePolicy, or THROTTLE_AUTO to follow the governor. as int for imgui
+    static constexpr int THROTTLE_AUTO = int(ThrottlePolicy::NumPolicies);
+    int m_computeThrottleMode;
+    int m_renderThrottleMode;
+    ThrottleGovernor m_computeGovernor;
+    ThrottleGovernor m_renderGovernor;
+    ThrottlePolicy GetComputeThrottlePolicy() const;
+    ThrottlePolicy GetRenderThrottlePolicy() const;
+    // the governors compare the busy time of each queue to the frame time
+    void UpdateThrottleGovernors();
+    // the render queue only changes with the render device, so Auto only recommends a render policy
+    // it is applied when the user asks, see DrawGUI()
+    bool m_applyRenderThrottle;
+    //-----------------------------------------------------
+
+    // Compute::SimulationMode, as int for imgui
+    int m_simulationMode;
+
+    // see Compute::SimulationParameters
+    float m_timestep;
+    float m_damping;
+    float m_mass;
+    float m_softening;
+    // temporal level of detail, m_lodAcceleration reaches the compute objects only with m_lod
+    bool m_lod;
+    float m_lodAcceleration;
+
+    //-----------------------------------------------------
+    // fixed timestep: the simulation advances m_simulationRate steps per second of real time,
+    // independent of the present rate. the render adapter interpolates between the results
+    bool m_fixedTimestep;
+    int m_simulationRate;
+    Timer m_simulationTimer;
+    double m_simulatedTime; // real time covered by the steps so far
+    float m_stepFraction;   // of a step of real time not yet simulated
+    // steps for this frame, see MAX_SIMULATION_STEPS. one per frame without a fixed timestep
+    UINT UpdateSimulationSteps();
+    //-----------------------------------------------------
+
+    // Render::DrawPath, as int for imgui
+    int m_drawPath;
+
+    // frustum cull on the GPU before drawing, see Render::SetCulling()
+    bool m_culling;
+
+    //-----------------------------------------------------
+    // compute adapter hot-swap:
+    // the new compute object is built on a worker thread while the current one keeps simulating,
+    // then takes over the particles between two frames
+    std::future<Compute*> m_pendingCompute;
+    int m_pendingComputeAdapterIndex;
+    int m_activeComputeAdapterIndex; // adapter of m_pCompute, m_computeAdapterIndex is the selection
+    void StartComputeSwap();
+    // blocks until the new compute object is built
+    // the particles are copied on the gpus, the previous compute object is retired until the copy is complete
+    void FinishComputeSwap();
+    bool GetComputeSwapReady() const;
+    Compute* m_pRetiredCompute;
+    // with in_wait, blocks until the copy from the retired compute object is complete
+    void ReleaseRetiredCompute(bool in_wait);
+    //-----------------------------------------------------
+
+    //-----------------------------------------------------
+    // split-frame simulation:
+    // a second compute object on the render adapter simulates the particles from m_splitParticle up
+    // particles must be independent, so only with SimulationMode::GravityWell
+    Compute* m_pComputeSecondary;
+    bool m_splitSimulation;
+    float m_splitRatio;       // fraction of particles simulated by the compute adapter
+    float m_splitRatioSlider; // applied to m_splitRatio when the user is done editing
+    UINT m_splitParticle;
+
+    // automatically adjust m_splitRatio so both adapters finish at the same time
+    bool m_autoBalance;
+    LoadBalancer m_loadBalancer;
+    void UpdateLoadBalancer();
+
+    bool GetSplitSimulationSupported() const;
+    // split particle corresponding to m_splitRatio, a multiple of PACK_BLOCK_SIZE
+    UINT GetSplitParticle() const;
+    void StartSplitSimulation();
+    void StopSplitSimulation();
+    // the compute adapters simulate [0, in_splitParticle), the render adapter the rest. then re-shares with render
+    // without split-frame simulation, in_splitParticle must be m_maxNumParticles
+    void SetSplitParticle(UINT in_splitParticle);
+    //-----------------------------------------------------
+
+    //-----------------------------------------------------
+    // n-way simulation: extra compute adapters share the particles of the compute adapter, [0, m_splitParticle)
+    // each has its own compute object, shared heap and fence, and the render adapter copies every range
+    // particles must be independent, like split-frame simulation
+    std::vector<int> m_extraComputeAdapters;       // the selection, adapter indices
+    std::vector<Compute*> m_extraComputes;
+    std::vector<int> m_activeExtraComputeAdapters; // adapters of m_extraComputes
+    // the valid part of the selection: neither the render nor a compute adapter, at most MAX_SHARED_SOURCES - 2
+    std::vector<int> GetExtraComputeAdapters() const;
+    void StartExtraComputes(const std::vector<int>& in_adapterIndices);
+    void StopExtraComputes();
+
+    // every compute object, in the order of their ranges: compute adapter, extra compute adapters, render adapter
+    // also the order of the shared sources of render and of the fence values
+    std::vector<Compute*> GetComputes() const;
+    // first particles of m_pCompute and m_extraComputes, splitting [0, in_numParticles) by the probed compute rates
+    std::vector<UINT> GetComputeRanges(UINT in_numParticles) const;
+    // each compute object copies the particles of its new range from their previous owners
+    void SetParticleRanges(const std::vector<Compute*>& in_computes, const std::vector<UINT>& in_firstParticles);
+    //-----------------------------------------------------
+
+    // copy quantized positions across adapters, see PACK_BLOCK_SIZE
+    // not used in async compute mode, which does not copy
+    bool m_packedTransfer;
+
+    // simulate and copy in chunks, so the copy overlaps the simulation. not used in async compute mode
+    int m_numChunks;
+    int m_numChunksSlider; // applied to m_numChunks when the user is done editing
+
+    // depth of the position buffer ring shared by render and compute, see MAX_NUM_BUFFERS
+    // more buffers let the compute adapter run further ahead of the render adapter, at the cost of latency
+    int m_numBuffers;
+
+    //-----------------------------------------------------
+    // async compute mode (one adapter renders and simulates):
+    // priority of the compute queues, 0: normal, 1: high, 2: global realtime. as int for imgui
+    int m_computeQueuePriority;
+    D3D12_COMMAND_QUEUE_PRIORITY GetComputeQueuePriority() const;
+    // frames from the simulation to the draw of its results, 0 to 2. see Compute::SetAsync()
+    // 0 serializes the draw after the simulation, more lets them overlap
+    int m_simulationLatency;
+    UINT GetSimulationLatency() const; // at most m_numBuffers - 1
+    // time the most recent simulation and draw ran at the same time on the gpu, in seconds
+    float GetAsyncOverlap() const;
+    //-----------------------------------------------------
+
+    //-----------------------------------------------------
+    // frame pacing: frames queued for display, 1 to MAX_FRAME_LATENCY, see Render::SetFrameLatency()
+    int m_frameLatency;
+    // low-latency mode submits the simulation after the frame latency wait of the next frame, instead of
+    // right after the draw, so it is not queued ahead of the display and reads the most recent settings
+    bool m_lowLatency;
+    void Simulate(const std::vector<UINT64>& in_sharedFenceValues);
+    // otherwise the simulation is submitted on a worker thread, while this one waits for the frame
+    // the steps are counted when the worker submits, see UpdateSimulationSteps()
+    // nothing else touches the compute objects until WaitForSimulation(), within the same frame
+    std::future<void> m_pendingSimulation;
+    void StartSimulation(const std::vector<UINT64>& in_sharedFenceValues);
+    void WaitForSimulation();
+    //-----------------------------------------------------
+
+    // render draws straight from the shared buffers, see Render::SetZeroCopy()
+    bool m_zeroCopy;
+    // the compute adapters transfer a screen-space density field and the particles near the camera
+    // instead of every particle, see Compute::SetDensityField(). the field lags the camera by a frame
+    bool m_densityField;
+    float m_densityNearDistance;
+    // per-run benchmark of the copy (0) and zero-copy (1) paths: sum of averaged frame times, and frame count
+    float m_transferFrameTimes[2];
+    UINT m_transferNumFrames[2];
+
+    //-----------------------------------------------------
+    // headless benchmark: benchmark <script> [benchmarkout <path>], see Benchmark.h
+    Benchmark* m_pBenchmark;
+    std::wstring m_benchmarkScript;
+    std::wstring m_benchmarkOutput; // without extension
+    void StartBenchmark();
+    // the changes take effect like UI changes, at the end of Draw()
+    void ApplyBenchmarkConfiguration();
+    // records the frame and moves through the script. writes the results and quits at the end
+    void UpdateBenchmark();
+    //-----------------------------------------------------
+
+    //-----------------------------------------------------
+    // timeline of the cpu and of every queue of every adapter: trace <path> [traceframes <n>], see Profiler.h
+    Profiler m_profiler;
+    std::wstring m_traceOutput; // a capture starts with the next frame
+    int m_numTraceFrames;
+    // records the gpu spans of the frame
+    void UpdateProfiler();
+    //-----------------------------------------------------
+
+    //-----------------------------------------------------
+    // particle state across runs: load <path> restores a snapshot instead of generating the particles,
+    // save <path> writes one at exit. see Snapshot.h
+    std::wstring m_snapshotInput;
+    std::wstring m_snapshotOutput;
+    std::wstring m_pendingSnapshotOutput; // written at the start of the next frame
+    // blocks until all adapters are idle
+    void SaveSnapshot(const std::wstring& in_path);
+    //-----------------------------------------------------
+
+    // frame boundaries for ETW, see Markers.h
+    std::uint64_t m_frameNumber;
+
     // UI toggle history
     int m_prevRenderAdapterIndex;
     int m_prevComputeAdapterIndex;
     bool m_prevQueueExtension;
     bool m_prevFullScreen;
+    bool m_prevPackedTransfer;
+    int m_prevNumChunks;
+    bool m_prevZeroCopy;
+    bool m_prevDensityField;
+    int m_prevComputeQueuePriority;
+    int m_prevSimulationLatency;
 };
@@ -0,0 +1,367 @@
+//*********************************************************
+//
+// Copyright 2020 Intel Corporation 
+//
+// Permission is hereby granted, free of charge, to any 
+// person obtaining a copy of this software and associated 
+// documentation files(the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights 
+// to use, copy, modify, merge, publish, distribute, sublicense, 
+// and/or sell copies of the Software, and to permit persons to 
+// whom the Software is furnished to do so, subject to the 
+// following conditions :
+// The above copyright notice and this permission notice shall 
+// be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+// DEALINGS IN THE SOFTWARE.
+//
+//*********************************************************
+#include <algorithm> // for std::sort()
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <D3Dcompiler.h>
+
+#include "PipelineCache.h"
+#include "DXSampleHelper.h"
+
+namespace
+{
+    // 64-bit FNV-1a
+    constexpr UINT64 HashInitial = 14695981039346656037ull;
+
+    UINT64 Hash(const void* in_pData, size_t in_size, UINT64 in_hash = HashInitial)
+    {
+        const UINT8* pData = (const UINT8*)in_pData;
+        for (size_t i = 0; i < in_size; i++)
+        {
+            in_hash = (in_hash ^ pData[i]) * 1099511628211ull;
+        }
+        return in_hash;
+    }
+
+    // includes the terminator, so consecutive strings can't alias
+    UINT64 Hash(const char* in_pString, UINT64 in_hash)
+    {
+        return Hash(in_pString, strlen(in_pString) + 1, in_hash);
+    }
+
+    std::wstring ToHex(UINT64 in_value)
+    {
+        std::wostringstream wss;
+        wss << std::hex << std::setw(16) << std::setfill(L'0') << in_value;
+        return wss.str();
+    }
+
+    bool ReadFile(const std::wstring& in_path, std::vector<char>& out_data)
+    {
+        std::ifstream file(in_path, std::ios::binary | std::ios::ate);
+        if (!file)
+        {
+            return false;
+        }
+        out_data.resize(size_t(file.tellg()));
+        file.seekg(0);
+        return bool(file.read(out_data.data(), out_data.size()));
+    }
+
+    // a cache that can't be written is not an error
+    void WriteFile(const std::wstring& in_path, const void* in_pData, size_t in_size)
+    {
+        std::ofstream file(in_path, std::ios::binary | std::ios::trunc);
+        file.write((const char*)in_pData, in_size);
+    }
+
+    // any of the shaders in the working directory may be included by the one compiled
+    // as is defines.h, by ShaderDefines.hlsl
+    UINT64 HashShaderSources()
+    {
+        std::vector<std::wstring> fileNames = { L"defines.h" };
+        WIN32_FIND_DATA findData = {};
+        const HANDLE findHandle = ::FindFirstFile(L"*.hlsl", &findData);
+        if (INVALID_HANDLE_VALUE != findHandle)
+        {
+            do
+            {
+                fileNames.push_back(findData.cFileName);
+            } while (::FindNextFile(findHandle, &findData));
+            ::FindClose(findHandle);
+        }
+        std::sort(fileNames.begin(), fileNames.end());
+
+        UINT64 hash = HashInitial;
+        std::vector<char> data;
+        for (const auto& fileName : fileNames)
+        {
+            hash = Hash(fileName.c_str(), fileName.size() * sizeof(wchar_t), hash);
+            if (ReadFile(fileName, data))
+            {
+                hash = Hash(data.data(), data.size(), hash);
+            }
+        }
+        return hash;
+    }
+}
+
+//-----------------------------------------------------------------------------
+// next to the shaders, see AdapterShared::GetAssetFullPath()
+//-----------------------------------------------------------------------------
+std::wstring PipelineCache::GetCacheDirectory()
+{
+    constexpr size_t PATHBUFFERSIZE = MAX_PATH * 4;
+    TCHAR buffer[PATHBUFFERSIZE];
+    ::GetCurrentDirectory(_countof(buffer), buffer);
+
+    const std::wstring path = std::wstring(buffer) + L"\\Cache";
+    ::CreateDirectory(path.c_str(), nullptr); // fails if it already exists
+    return path + L"\\";
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+std::wstring PipelineCache::GetAdapterKey(IDXGIAdapter1* in_pAdapter)
+{
+    DXGI_ADAPTER_DESC1 desc = {};
+    ThrowIfFailed(in_pAdapter->GetDesc1(&desc));
+
+    // for IDXGIDevice, returns the user mode driver version
+    LARGE_INTEGER driverVersion = {};
+    in_pAdapter->CheckInterfaceSupport(__uuidof(IDXGIDevice), &driverVersion);
+
+    std::wostringstream key;
+    key << std::hex << desc.VendorId << L"_" << desc.DeviceId << L"_" << desc.SubSysId << L"_" << desc.Revision
+        << L"_" << driverVersion.QuadPart;
+    return key.str();
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+PipelineCache::PipelineCache(ID3D12Device* in_pDevice, IDXGIAdapter1* in_pAdapter, const wchar_t* in_pName)
+    : m_device(in_pDevice)
+    , m_dirty(false)
+{
+    m_libraryPath = GetCacheDirectory() + in_pName + L"_" + GetAdapterKey(in_pAdapter) + L".bin";
+
+    ComPtr<ID3D12Device1> device1;
+    if (ReadFile(m_libraryPath, m_libraryData) && !m_libraryData.empty() && SUCCEEDED(m_device.As(&device1)))
+    {
+        // fails with D3D12_ERROR_DRIVER_VERSION_MISMATCH or D3D12_ERROR_ADAPTER_NOT_FOUND if the data is stale
+        if (SUCCEEDED(device1->CreatePipelineLibrary(m_libraryData.data(), m_libraryData.size(), IID_PPV_ARGS(&m_library))))
+        {
+            return;
+        }
+    }
+
+    m_libraryData.clear();
+    CreateLibrary();
+}
+
+//-----------------------------------------------------------------------------
+// empty library. pipeline libraries may not be supported, e.g. by some debugging tools
+//-----------------------------------------------------------------------------
+void PipelineCache::CreateLibrary()
+{
+    m_library = nullptr;
+
+    ComPtr<ID3D12Device1> device1;
+    if (SUCCEEDED(m_device.As(&device1)))
+    {
+        device1->CreatePipelineLibrary(nullptr, 0, IID_PPV_ARGS(&m_library));
+    }
+}
+
+//-----------------------------------------------------------------------------
+// a changed shader changes the name, so it is not matched with a stale pipeline state
+//-----------------------------------------------------------------------------
+std::wstring PipelineCache::GetName(const wchar_t* in_pName, const D3D12_SHADER_BYTECODE* in_pShaders, UINT in_numShaders) const
+{
+    UINT64 hash = HashInitial;
+    for (UINT i = 0; i < in_numShaders; i++)
+    {
+        hash = Hash(in_pShaders[i].pShaderBytecode, in_pShaders[i].BytecodeLength, hash);
+    }
+    return std::wstring(in_pName) + L"_" + ToHex(hash);
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+ComPtr<ID3DBlob> PipelineCache::CompileShader(const std::wstring& in_path, const D3D_SHADER_MACRO* in_pMacros,
+    const char* in_pEntryPoint, const char* in_pTarget, UINT in_compileFlags)
+{
+    // the sources don't change while running
+    static const UINT64 sourceHash = HashShaderSources();
+    static std::map<UINT64, ComPtr<ID3DBlob>> shaders;
+
+    // compute objects may be created on a worker thread, see Particles::StartComputeSwap()
+    static std::mutex mutex;
+    std::lock_guard<std::mutex> lock(mutex);
+
+    UINT64 hash = Hash(in_path.c_str(), in_path.size() * sizeof(wchar_t), sourceHash);
+    for (const D3D_SHADER_MACRO* pMacro = in_pMacros; pMacro && pMacro->Name; pMacro++)
+    {
+        hash = Hash(pMacro->Name, hash);
+        hash = Hash(pMacro->Definition ? pMacro->Definition : "", hash);
+    }
+    hash = Hash(in_pEntryPoint, hash);
+    hash = Hash(in_pTarget, hash);
+    hash = Hash(&in_compileFlags, sizeof(in_compileFlags), hash);
+
+    ComPtr<ID3DBlob>& shader = shaders[hash];
+    if (shader)
+    {
+        return shader;
+    }
+
+    shader = LoadShader(in_path, in_pMacros, in_pEntryPoint);
+    if (shader)
+    {
+        return shader;
+    }
+
+    const std::wstring cachePath = GetCacheDirectory() + ToHex(hash) + L".cso";
+    std::vector<char> data;
+    if (ReadFile(cachePath, data) && !data.empty())
+    {
+        ThrowIfFailed(::D3DCreateBlob(data.size(), &shader));
+        memcpy(shader->GetBufferPointer(), data.data(), data.size());
+        return shader;
+    }
+
+    ComPtr<ID3DBlob> errorMsgs;
+    const HRESULT hr = ::D3DCompileFromFile(in_path.c_str(), in_pMacros, D3D_COMPILE_STANDARD_FILE_INCLUDE,
+        in_pEntryPoint, in_pTarget, in_compileFlags, 0, &shader, &errorMsgs);
+    if (FAILED(hr))
+    {
+        if (errorMsgs)
+        {
+            ::OutputDebugStringA((const char*)errorMsgs->GetBufferPointer());
+        }
+        ThrowIfFailed(hr);
+    }
+
+    WriteFile(cachePath, shader->GetBufferPointer(), shader->GetBufferSize());
+    return shader;
+}
+
+//-----------------------------------------------------------------------------
+// the name of each shader permutation in Shaders.targets follows the macros of the call
+//-----------------------------------------------------------------------------
+ComPtr<ID3DBlob> PipelineCache::LoadShader(const std::wstring& in_path, const D3D_SHADER_MACRO* in_pMacros, const char* in_pEntryPoint)
+{
+    const size_t separator = in_path.find_last_of(L"\\/");
+    const std::wstring directory = (std::wstring::npos == separator) ? std::wstring() : in_path.substr(0, separator + 1);
+    const std::wstring fileName = in_path.substr(directory.size());
+
+    std::wostringstream path;
+    path << directory << L"Shaders\\" << fileName.substr(0, fileName.find_last_of(L'.')) << L"_" << in_pEntryPoint;
+    for (const D3D_SHADER_MACRO* pMacro = in_pMacros; pMacro && pMacro->Name; pMacro++)
+    {
+        path << L"_" << pMacro->Name << (pMacro->Definition ? pMacro->Definition : "");
+    }
+    path << L".cso";
+
+    ComPtr<ID3DBlob> shader;
+    std::vector<char> data;
+    if (ReadFile(path.str(), data) && !data.empty())
+    {
+        ThrowIfFailed(::D3DCreateBlob(data.size(), &shader));
+        memcpy(shader->GetBufferPointer(), data.data(), data.size());
+    }
+    return shader;
+}
+
+//-----------------------------------------------------------------------------
+// LoadGraphicsPipeline() fails with E_INVALIDARG if the name is not found or the desc does not match
+//-----------------------------------------------------------------------------
+void PipelineCache::CreateGraphicsPipelineState(const wchar_t* in_pName, const D3D12_GRAPHICS_PIPELINE_STATE_DESC& in_desc, ComPtr<ID3D12PipelineState>& out_pipelineState)
+{
+    const D3D12_SHADER_BYTECODE shaders[] = { in_desc.VS, in_desc.PS, in_desc.DS, in_desc.HS, in_desc.GS };
+    const std::wstring name = GetName(in_pName, shaders, _countof(shaders));
+
+    if ((nullptr == m_library) || FAILED(m_library->LoadGraphicsPipeline(name.c_str(), &in_desc, IID_PPV_ARGS(&out_pipelineState))))
+    {
+        ThrowIfFailed(m_device->CreateGraphicsPipelineState(&in_desc, IID_PPV_ARGS(&out_pipelineState)));
+        m_dirty = true;
+    }
+    m_entries.push_back({ name, out_pipelineState });
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void PipelineCache::CreateComputePipelineState(const wchar_t* in_pName, const D3D12_COMPUTE_PIPELINE_STATE_DESC& in_desc, ComPtr<ID3D12PipelineState>& out_pipelineState)
+{
+    const std::wstring name = GetName(in_pName, &in_desc.CS, 1);
+
+    if ((nullptr == m_library) || FAILED(m_library->LoadComputePipeline(name.c_str(), &in_desc, IID_PPV_ARGS(&out_pipelineState))))
+    {
+        ThrowIfFailed(m_device->CreateComputePipelineState(&in_desc, IID_PPV_ARGS(&out_pipelineState)));
+        m_dirty = true;
+    }
+    m_entries.push_back({ name, out_pipelineState });
+}
+
+//-----------------------------------------------------------------------------
+// LoadPipeline() requires ID3D12PipelineLibrary1, creating the stream ID3D12Device2
+//-----------------------------------------------------------------------------
+HRESULT PipelineCache::CreatePipelineState(const wchar_t* in_pName, const D3D12_PIPELINE_STATE_STREAM_DESC& in_desc,
+    const D3D12_SHADER_BYTECODE* in_pShaders, UINT in_numShaders, ComPtr<ID3D12PipelineState>& out_pipelineState)
+{
+    const std::wstring name = GetName(in_pName, in_pShaders, in_numShaders);
+
+    ComPtr<ID3D12PipelineLibrary1> library1;
+    if ((nullptr == m_library) || FAILED(m_library.As(&library1)) || FAILED(library1->LoadPipeline(name.c_str(), &in_desc, IID_PPV_ARGS(&out_pipelineState))))
+    {
+        ComPtr<ID3D12Device2> device2;
+        HRESULT hr = m_device.As(&device2);
+        if (SUCCEEDED(hr))
+        {
+            hr = device2->CreatePipelineState(&in_desc, IID_PPV_ARGS(&out_pipelineState));
+        }
+        if (FAILED(hr))
+        {
+            return hr;
+        }
+        m_dirty = true;
+    }
+    m_entries.push_back({ name, out_pipelineState });
+    return S_OK;
+}
+
+//-----------------------------------------------------------------------------
+// a name can only be stored once, and entries can't be removed,
+// so the library is rebuilt from the pipeline states of this session
+//-----------------------------------------------------------------------------
+void PipelineCache::Save()
+{
+    if ((nullptr == m_library) || (!m_dirty))
+    {
+        return;
+    }
+    m_dirty = false;
+
+    CreateLibrary();
+    if (nullptr == m_library)
+    {
+        return;
+    }
+
+    for (const auto& entry : m_entries)
+    {
+        // fails if the same pipeline state was created twice
+        m_library->StorePipeline(entry.m_name.c_str(), entry.m_pipelineState.Get());
+    }
+
+    std::vector<char> data(m_library->GetSerializedSize());
+    ThrowIfFailed(m_library->Serialize(data.data(), data.size()));
+    WriteFile(m_libraryPath, data.data(), data.size());
+}
@@ -0,0 +1,108 @@
+//*********************************************************
+//
+// Copyright 2020 Intel Corporation 
+//
+// Permission is hereby granted, free of charge, to any 
+// person obtaining a copy of this software and associated 
+// documentation files(the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights 
+// to use, copy, modify, merge, publish, distribute, sublicense, 
+// and/or sell copies of the Software, and to permit persons to 
+// whom the Software is furnished to do so, subject to the 
+// following conditions :
+// The above copyright notice and this permission notice shall 
+// be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+// DEALINGS IN THE SOFTWARE.
+//
+//*********************************************************
+#pragma once
+
+#include <dxgi1_6.h>
+#include <d3d12.h>
+#include <d3dcommon.h>
+#include <wrl.h>
+#include <string>
+#include <vector>
+
+using Microsoft::WRL::ComPtr;
+
+/*======================================================
+PipelineCache
+
+Avoids compiling shaders and pipeline states when a device is created,
+e.g. at startup or when the user selects a different adapter.
+
+Shader bytecode is compiled offline by Shaders.targets, for the build configuration.
+Permutations that were not compiled offline are compiled at runtime.
+Shader bytecode is device-independent, so it is cached for the whole process and on disk.
+The key hashes the contents of every .hlsl file in the working directory (for includes) and defines.h,
+the macros, entry point, target and compile flags.
+
+Pipeline states are cached per device in an ID3D12PipelineLibrary, on disk per adapter and driver version.
+The adapter is identified by its PCI ids, the LUID changes every boot.
+The runtime rejects a library from a different driver or adapter, which is then rebuilt.
+
+Usage: create the pipeline states with the cache, then Save() once
+======================================================*/
+class PipelineCache
+{
+public:
+    // in_pName distinguishes the users of the same adapter, e.g. render and compute
+    PipelineCache(ID3D12Device* in_pDevice, IDXGIAdapter1* in_pAdapter, const wchar_t* in_pName);
+
+    PipelineCache(const PipelineCache&) = delete;
+    PipelineCache(PipelineCache&&) = delete;
+    PipelineCache& operator=(const PipelineCache&) = delete;
+    PipelineCache& operator=(PipelineCache&&) = delete;
+
+    // the offline bytecode, D3DCompileFromFile(), or the cached bytecode. throws on compile errors. thread-safe
+    static ComPtr<ID3DBlob> CompileShader(const std::wstring& in_path, const D3D_SHADER_MACRO* in_pMacros,
+        const char* in_pEntryPoint, const char* in_pTarget, UINT in_compileFlags);
+
+    // the bytecode compiled by Shaders.targets, null if not found
+    // <directory of in_path>Shaders\<file name without extension>_<entry point>[_<macro name><value>...].cso
+    static ComPtr<ID3DBlob> LoadShader(const std::wstring& in_path, const D3D_SHADER_MACRO* in_pMacros, const char* in_pEntryPoint);
+
+    // loads the pipeline state from the library, or creates it
+    // in_pName must be unique within this cache, the bytecode is added to the name
+    void CreateGraphicsPipelineState(const wchar_t* in_pName, const D3D12_GRAPHICS_PIPELINE_STATE_DESC& in_desc, ComPtr<ID3D12PipelineState>& out_pipelineState);
+    void CreateComputePipelineState(const wchar_t* in_pName, const D3D12_COMPUTE_PIPELINE_STATE_DESC& in_desc, ComPtr<ID3D12PipelineState>& out_pipelineState);
+    // pipeline state streams, e.g. with a mesh shader. in_pShaders are the shaders of the stream, for the name
+    // returns the error instead of throwing, e.g. if the shaders were not signed
+    HRESULT CreatePipelineState(const wchar_t* in_pName, const D3D12_PIPELINE_STATE_STREAM_DESC& in_desc,
+        const D3D12_SHADER_BYTECODE* in_pShaders, UINT in_numShaders, ComPtr<ID3D12PipelineState>& out_pipelineState);
+
+    // writes the library to disk if any pipeline state was not found
+    void Save();
+
+    // the Cache directory in the working directory, created if necessary. ends with a separator
+    static std::wstring GetCacheDirectory();
+    // identifies the adapter and driver across boots, for file names
+    static std::wstring GetAdapterKey(IDXGIAdapter1* in_pAdapter);
+
+private:
+    ComPtr<ID3D12Device> m_device;
+    ComPtr<ID3D12PipelineLibrary> m_library; // null if pipeline libraries are not supported
+    std::vector<char> m_libraryData;         // must outlive m_library
+    std::wstring m_libraryPath;
+    bool m_dirty;
+
+    // every pipeline state of this session, to rebuild the library without stale entries
+    struct Entry
+    {
+        std::wstring m_name;
+        ComPtr<ID3D12PipelineState> m_pipelineState;
+    };
+    std::vector<Entry> m_entries;
+
+    void CreateLibrary();
+    std::wstring GetName(const wchar_t* in_pName, const D3D12_SHADER_BYTECODE* in_pShaders, UINT in_numShaders) const;
+};
@@ -0,0 +1,238 @@
+//*********************************************************
+//
+// Copyright 2020 Intel Corporation 
+//
+// Permission is hereby granted, free of charge, to any 
+// person obtaining a copy of this software and associated 
+// documentation files(the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights 
+// to use, copy, modify, merge, publish, distribute, sublicense, 
+// and/or sell copies of the Software, and to permit persons to 
+// whom the Software is furnished to do so, subject to the 
+// following conditions :
+// The above copyright notice and this permission notice shall 
+// be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+// DEALINGS IN THE SOFTWARE.
+//
+//*********************************************************
+#include <algorithm>
+#include <fstream>
+
+#include "Profiler.h"
+#include "Json.h"
+
+std::atomic<Profiler*> Profiler::m_pActive(nullptr);
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+Profiler::Profiler()
+    : m_numFramesLeft(0)
+    , m_mainThreadId(0)
+    , m_startTime(0)
+    , m_frameBegin(0)
+{
+    LARGE_INTEGER frequency;
+    ::QueryPerformanceFrequency(&frequency);
+    m_oneOverFrequency = 1. / double(frequency.QuadPart);
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+Profiler::~Profiler()
+{
+    Profiler* pThis = this;
+    m_pActive.compare_exchange_strong(pThis, nullptr);
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+double Profiler::GetTime() const
+{
+    LARGE_INTEGER time;
+    ::QueryPerformanceCounter(&time);
+    return double(time.QuadPart) * m_oneOverFrequency;
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void Profiler::Start(const std::wstring& in_outputPath, UINT in_numFrames)
+{
+    if (GetCapturing())
+    {
+        return;
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_spans.clear();
+        m_processNames.clear();
+        m_threadNames.clear();
+        m_tracks.clear();
+        m_lastGpuBegins.clear();
+
+        // the cpu is the first process of the trace
+        GetTrack("CPU", "main");
+    }
+
+    m_outputPath = in_outputPath;
+    m_numFramesLeft = std::max(in_numFrames, 1u);
+    m_mainThreadId = ::GetCurrentThreadId();
+    m_startTime = GetTime();
+    m_frameBegin = m_startTime;
+
+    m_pActive.store(this, std::memory_order_release);
+}
+
+//-----------------------------------------------------------------------------
+// call with m_mutex held
+//-----------------------------------------------------------------------------
+Profiler::TrackId Profiler::GetTrack(const std::string& in_processName, const std::string& in_threadName)
+{
+    const auto key = std::make_pair(in_processName, in_threadName);
+    const auto track = m_tracks.find(key);
+    if (m_tracks.end() != track)
+    {
+        return track->second;
+    }
+
+    UINT pid = UINT(std::find(m_processNames.begin(), m_processNames.end(), in_processName) - m_processNames.begin());
+    if (m_processNames.size() == pid)
+    {
+        m_processNames.push_back(in_processName);
+    }
+
+    UINT tid = 0;
+    for (const auto& t : m_tracks)
+    {
+        if (t.second.first == pid)
+        {
+            tid = std::max(tid, t.second.second + 1);
+        }
+    }
+
+    const TrackId trackId(pid, tid);
+    m_tracks[key] = trackId;
+    m_threadNames[trackId] = in_threadName;
+    return trackId;
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void Profiler::AddCpuSpan(const char* in_pName, LONGLONG in_begin, LONGLONG in_end)
+{
+    const DWORD threadId = ::GetCurrentThreadId();
+    const std::string threadName = (m_mainThreadId == threadId) ? "main" : ("thread " + std::to_string(threadId));
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_spans.push_back({ in_pName, GetTrack("CPU", threadName), double(in_begin) * m_oneOverFrequency, double(in_end) * m_oneOverFrequency });
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void Profiler::AddGpuSpans(const std::string& in_adapterName, const std::string& in_queueName,
+    const D3D12GpuTimer::TimeArray& in_timers, const D3D12GpuTimer::IntervalArray& in_intervals)
+{
+    if (!GetCapturing())
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    const TrackId track = GetTrack(in_adapterName, in_queueName);
+    for (size_t i = 0; i < std::min(in_timers.size(), in_intervals.size()); i++)
+    {
+        // not calibrated, or from before the capture
+        const auto& interval = in_intervals[i];
+        if (interval.first < m_startTime)
+        {
+            continue;
+        }
+
+        // the timer names are for the UI, e.g. "copy ms"
+        std::string name = in_timers[i].second;
+        const size_t units = name.rfind(" ms");
+        if ((std::string::npos != units) && ((units + 3) == name.size()))
+        {
+            name.resize(units);
+        }
+
+        double& lastBegin = m_lastGpuBegins[std::make_pair(track, name)];
+        if (interval.first != lastBegin)
+        {
+            lastBegin = interval.first;
+            m_spans.push_back({ name, track, interval.first, interval.second });
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void Profiler::EndFrame()
+{
+    if (!GetCapturing())
+    {
+        return;
+    }
+
+    const double frameEnd = GetTime();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_spans.push_back({ "frame", GetTrack("CPU", "frame"), m_frameBegin, frameEnd });
+    }
+    m_frameBegin = frameEnd;
+
+    m_numFramesLeft--;
+    if (0 == m_numFramesLeft)
+    {
+        m_pActive.store(nullptr, std::memory_order_release);
+        Write();
+    }
+}
+
+//-----------------------------------------------------------------------------
+// chrome trace event format: complete events ("X") in microseconds, and metadata ("M") naming the tracks
+//-----------------------------------------------------------------------------
+void Profiler::Write() const
+{
+    std::ofstream json(m_outputPath, std::ios::trunc);
+    if (!json)
+    {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+
+    json << "{\n\"displayTimeUnit\": \"ms\",\n\"traceEvents\": [\n";
+    const char* pSeparator = "";
+    for (UINT pid = 0; pid < m_processNames.size(); pid++)
+    {
+        json << pSeparator << "{\"name\": \"process_name\", \"ph\": \"M\", \"pid\": " << pid
+            << ", \"args\": {\"name\": \"" << EscapeJson(m_processNames[pid]) << "\"}}";
+        json << ",\n{\"name\": \"process_sort_index\", \"ph\": \"M\", \"pid\": " << pid
+            << ", \"args\": {\"sort_index\": " << pid << "}}";
+        pSeparator = ",\n";
+    }
+    for (const auto& t : m_threadNames)
+    {
+        json << pSeparator << "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": " << t.first.first << ", \"tid\": " << t.first.second
+            << ", \"args\": {\"name\": \"" << EscapeJson(t.second) << "\"}}";
+    }
+
+    json.precision(3);
+    json << std::fixed;
+    for (const auto& s : m_spans)
+    {
+        json << pSeparator << "{\"name\": \"" << EscapeJson(s.m_name) << "\", \"ph\": \"X\", \"pid\": " << s.m_track.first
+            << ", \"tid\": " << s.m_track.second << ", \"ts\": " << (s.m_begin - m_startTime) * 1e6
+            << ", \"dur\": " << (s.m_end - s.m_begin) * 1e6 << "}";
+    }
+    json << "\n]\n}\n";
+}
@@ -0,0 +1,157 @@
+//*********************************************************
+//
+// Copyright 2020 Intel Corporation 
+//
+// Permission is hereby granted, free of charge, to any 
+// person obtaining a copy of this software and associated 
+// documentation files(the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights 
+// to use, copy, modify, merge, publish, distribute, sublicense, 
+// and/or sell copies of the Software, and to permit persons to 
+// whom the Software is furnished to do so, subject to the 
+// following conditions :
+// The above copyright notice and this permission notice shall 
+// be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+// DEALINGS IN THE SOFTWARE.
+//
+//*********************************************************
+#pragma once
+
+#include <Windows.h>
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "D3D12GpuTimer.h"
+
+/*======================================================
+Profiler
+
+Records a timeline of CPU and GPU spans for a number of frames, then writes it
+as Chrome trace JSON (chrome://tracing or ui.perfetto.dev).
+
+CPU spans: a Profiler::Scope on the stack. scopes nest on their thread
+GPU spans: AddGpuSpans() with the timers of a queue, once per frame
+    one track per queue, grouped by adapter
+all times are on the cpu clock (QueryPerformanceCounter), see D3D12GpuTimer::GetLastIntervals()
+so the queues of all the adapters line up with the CPU.
+
+Usage: Start() a capture, then call EndFrame() once per frame. the trace is written after the last frame
+a scope only tests a pointer when no capture is running
+======================================================*/
+class Profiler
+{
+public:
+    static constexpr UINT DEFAULT_NUM_FRAMES = 120;
+
+    Profiler();
+    ~Profiler();
+
+    // does nothing if a capture is running
+    void Start(const std::wstring& in_outputPath, UINT in_numFrames = DEFAULT_NUM_FRAMES);
+    bool GetCapturing() const { return m_numFramesLeft > 0; }
+
+    // the spans of the timers of one queue that have not been recorded yet
+    // a timer records one span per read, timers that did not read again are skipped
+    void AddGpuSpans(const std::string& in_adapterName, const std::string& in_queueName,
+        const D3D12GpuTimer::TimeArray& in_timers, const D3D12GpuTimer::IntervalArray& in_intervals);
+
+    // records the frame span. writes the trace after the last frame of the capture
+    void EndFrame();
+
+    //-----------------------------------------------------
+    // a CPU span from construction to destruction, recorded by the capturing profiler, if any
+    // in_pName must outlive the capture, e.g. a string literal
+    //-----------------------------------------------------
+    class Scope
+    {
+    public:
+        explicit Scope(const char* in_pName);
+        ~Scope();
+    private:
+        Scope(const Scope&) = delete;
+        Scope& operator=(const Scope&) = delete;
+
+        Profiler* m_pProfiler;
+        const char* m_pName;
+        LARGE_INTEGER m_begin;
+    };
+
+private:
+    Profiler(const Profiler&) = delete;
+    Profiler(Profiler&&) = delete;
+    Profiler& operator=(const Profiler&) = delete;
+    Profiler& operator=(Profiler&&) = delete;
+
+    // the capturing profiler
+    static std::atomic<Profiler*> m_pActive;
+
+    void AddCpuSpan(const char* in_pName, LONGLONG in_begin, LONGLONG in_end);
+    void Write() const;
+
+    // pid, tid of the chrome trace. pid 0 is the CPU, threads by id
+    typedef std::pair<UINT, UINT> TrackId;
+    TrackId GetTrack(const std::string& in_processName, const std::string& in_threadName);
+
+    struct Span
+    {
+        std::string m_name;
+        TrackId m_track;
+        double m_begin; // seconds, cpu clock
+        double m_end;
+    };
+
+    mutable std::mutex m_mutex; // CPU spans are recorded by other threads, e.g. the command list recording tasks
+    std::vector<Span> m_spans;
+
+    std::vector<std::string> m_processNames; // by pid
+    std::map<TrackId, std::string> m_threadNames;
+    std::map<std::pair<std::string, std::string>, TrackId> m_tracks;
+    // begin of the most recent span of each gpu timer, to skip timers that did not read again
+    std::map<std::pair<TrackId, std::string>, double> m_lastGpuBegins;
+
+    std::wstring m_outputPath;
+    UINT m_numFramesLeft;
+    DWORD m_mainThreadId; // of Start(), named in the trace
+    double m_oneOverFrequency;
+    double m_startTime;
+    double m_frameBegin;
+
+    double GetTime() const;
+};
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+inline Profiler::Scope::Scope(const char* in_pName)
+    : m_pProfiler(m_pActive.load(std::memory_order_acquire))
+    , m_pName(in_pName)
+{
+    if (m_pProfiler)
+    {
+        ::QueryPerformanceCounter(&m_begin);
+    }
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+inline Profiler::Scope::~Scope()
+{
+    if (m_pProfiler)
+    {
+        LARGE_INTEGER end;
+        ::QueryPerformanceCounter(&end);
+        m_pProfiler->AddCpuSpan(m_pName, m_begin.QuadPart, end.QuadPart);
+    }
+}
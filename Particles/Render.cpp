@@ -25,11 +25,17 @@
 //*********************************************************
 
 #include <cassert>
+#include <algorithm> // for std::min()
 #include <string>
+#include <ppl.h>
 #include <D3Dcompiler.h>
+#include <dxcapi.h> // mesh shaders require shader model 6.5
 
 #include "Render.h"
 #include "Particles.h"
+#include "Profiler.h"
+#include "Markers.h"
+#include "MemoryBudget.h"
 #include "ExtensionHelper.h" // Intel extensions
 
 
@@ -95,39 +101,72 @@ bool Render::GetSupportsIntelCommandQueueExtension() const
 enum DescriptorHeapIndex : UINT32
 {
     SrvParticlePosVelo0 = 0,
-    SrvParticlePosVelo1,
-    DescriptorCount
+    SrvPackedPos0 = SrvParticlePosVelo0 + MAX_NUM_BUFFERS,
+    SrvSharedPos0 = SrvPackedPos0 + MAX_NUM_BUFFERS, // zero-copy mode, MAX_NUM_BUFFERS per shared source
+    SrvDensity0 = SrvSharedPos0 + (MAX_SHARED_SOURCES * MAX_NUM_BUFFERS), // density field transfer, one per local buffer
+    SrvNearPos0 = SrvDensity0 + MAX_NUM_BUFFERS,
+    DescriptorCount = SrvNearPos0 + MAX_NUM_BUFFERS
 };
 
+// the near particles of every source are culled into the list of visible particles
+static_assert((MAX_SHARED_SOURCES * DENSITY_NEAR_PARTICLES) <= MIN_NUM_PARTICLES, "near particles must fit the list of visible particles");
+
 enum class GpuTimers
 {
     FPS,
     NumTimers
 };
 
+// on the copy queue
+enum class CopyGpuTimers
+{
+    Copy,
+    NumTimers
+};
+
 //-----------------------------------------------------------------------------
 //-----------------------------------------------------------------------------
-Render::Render(HWND in_hwnd, UINT in_numParticles,
+Render::Render(HWND in_hwnd, UINT in_numParticles, UINT in_numBuffers,
     IDXGIAdapter1* in_pAdapter,
-    bool in_useIntelCommandQueueExtension,
+    bool in_useIntelCommandQueueExtension, ThrottlePolicy in_throttlePolicy,
     bool in_fullScreen, RECT in_windowDim)
     : m_adapter(in_pAdapter)
     ,m_numParticles(in_numParticles)
+    , m_numBuffers(std::max(UINT(MIN_NUM_BUFFERS), std::min(in_numBuffers, UINT(MAX_NUM_BUFFERS))))
     , m_pExtensionHelper(nullptr)
     , m_hwnd(in_hwnd)
     , m_frameIndex(0)
     , m_swapChainEvent(nullptr)
+    , m_frameLatency(1)
+    , m_frameLatencyWaited(false)
+    , m_frameStart{}
+    , m_presentRecords{}
+    , m_previousFrameStatistics{}
+    , m_presentStatistics{}
     , m_frameFenceValues{}
     , m_renderFenceValue(0)
     , m_renderFenceEvent(nullptr)
     , m_rtvDescriptorSize(0)
     , m_srvUavDescriptorSize(0)
     , m_bufferSize(0)
+    , m_drawPath(DrawPath::GeometryShader)
+    , m_culling(false)
+    , m_packedTransfer(false)
+    , m_packedResident(true)
+    , m_zeroCopy(false)
+    , m_densityTransfer(false)
+    , m_densityResident(true)
     , m_currentBufferIndex(0)
+    , m_previousValid(false)
+    , m_previousPacked(false)
+    , m_previousNumSteps(1)
+    , m_interpolation(1.0f)
     , m_pConstantBufferGSData(nullptr)
     , m_aspectRatio(0.f)
+    , m_viewProjection{}
     , m_copyFenceValue(0)
-    , m_sharedBufferIndex(0)
+    , m_pCopyTimer(nullptr)
+    , m_copiedBytes(0)
     , m_fullScreen(in_fullScreen)
     , m_windowedSupportsTearing(false)
     , m_windowDim(in_windowDim)
@@ -135,21 +174,38 @@ Render::Render(HWND in_hwnd, UINT in_numParticles,
     , m_particleSize(0.f)
     , m_particleIntensity(0.f)
     , m_asyncMode(false)
+    , m_simulationLatency(1)
 {
+    ::QueryPerformanceFrequency(&m_performanceFrequency);
+
     m_camera.Init({ 0.0f, 0.0f, 1500.0f });
     m_camera.SetMoveSpeed(250.0f);
 
-    CreateDevice(in_pAdapter, m_device);
+    for (auto& simulation : m_simulations)
+    {
+        simulation = { 1, 1.0f };
+    }
+
+    CreateDevice(in_pAdapter, m_device, L"Render");
 
     // attempt to enable Intel extensions
     m_pExtensionHelper = new ExtensionHelper(m_device.Get());
     m_usingIntelCommandQueueExtension = in_useIntelCommandQueueExtension && m_pExtensionHelper->GetEnabled();
+    m_throttlePolicy = in_throttlePolicy;
     CreateCommandQueue();
 
     LoadAssets();
 
     m_pTimer = new D3D12GpuTimer(m_device.Get(), m_commandQueue.Get(), static_cast<UINT>(GpuTimers::NumTimers));
     m_pTimer->SetTimerName(static_cast<UINT>(GpuTimers::FPS), "render ms");
+
+    D3D12_FEATURE_DATA_D3D12_OPTIONS3 options3 = {};
+    if (SUCCEEDED(m_device->CheckFeatureSupport(D3D12_FEATURE_D3D12_OPTIONS3, &options3, sizeof(options3)))
+        && options3.CopyQueueTimestampQueriesSupported)
+    {
+        m_pCopyTimer = new D3D12GpuTimer(m_device.Get(), m_copyQueue.Get(), static_cast<UINT>(CopyGpuTimers::NumTimers));
+        m_pCopyTimer->SetTimerName(static_cast<UINT>(CopyGpuTimers::Copy), "copy ms");
+    }
 }
 
 //-----------------------------------------------------------------------------
@@ -185,6 +241,7 @@ Render::~Render()
     rv = ::CloseHandle(m_renderFenceEvent);
     assert(rv != FALSE);
 
+    delete m_pCopyTimer;
     delete m_pExtensionHelper;
 }
 
@@ -199,9 +256,9 @@ void Render::CreateCommandQueue()
 
     if (m_usingIntelCommandQueueExtension)
     {
-        m_commandQueue = m_pExtensionHelper->CreateCommandQueue(desc);
+        m_commandQueue = m_pExtensionHelper->CreateCommandQueue(desc, m_throttlePolicy);
         desc.Type = D3D12_COMMAND_LIST_TYPE_COPY;
-        m_copyQueue = m_pExtensionHelper->CreateCommandQueue(desc);
+        m_copyQueue = m_pExtensionHelper->CreateCommandQueue(desc, m_throttlePolicy);
     }
     else
     {
@@ -217,22 +274,27 @@ void Render::CreateCommandQueue()
 }
 
 //-----------------------------------------------------------------------------
-// get handles to textures the simulation results will be copied to
 //-----------------------------------------------------------------------------
-void Render::SetShared(const Compute::SharedHandles& in_sharedHandles)
+void Render::OpenSharedSource(SharedSource& out_source, const Compute::SharedHandles& in_sharedHandles)
 {
-    m_sharedBufferIndex = in_sharedHandles.m_bufferIndex;
+    // the shared ring must match the local ring, so the fence arithmetic agrees
+    assert(in_sharedHandles.m_numBuffers == m_numBuffers);
+
+    out_source.m_bufferIndex = in_sharedHandles.m_bufferIndex;
+    out_source.m_firstParticle = in_sharedHandles.m_firstParticle;
+    out_source.m_numParticles = in_sharedHandles.m_numParticles;
+    out_source.m_numChunks = in_sharedHandles.m_numChunks;
 
     ID3D12Heap* pSharedHeap = nullptr;
     ThrowIfFailed(m_device->OpenSharedHandle(in_sharedHandles.m_heap, IID_PPV_ARGS(&pSharedHeap)));
 
-    ThrowIfFailed(m_device->OpenSharedHandle(in_sharedHandles.m_fence, IID_PPV_ARGS(&m_sharedComputeFence)));
+    ThrowIfFailed(m_device->OpenSharedHandle(in_sharedHandles.m_fence, IID_PPV_ARGS(&out_source.m_fence)));
 
     const D3D12_RESOURCE_DESC crossAdapterDesc = CD3DX12_RESOURCE_DESC::Buffer(in_sharedHandles.m_alignedDataSize,
         D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS |
         D3D12_RESOURCE_FLAG_ALLOW_CROSS_ADAPTER);
 
-    for (UINT i = 0; i < m_NUM_BUFFERS; i++)
+    for (UINT i = 0; i < m_numBuffers; i++)
     {
         ThrowIfFailed(m_device->CreatePlacedResource(
             pSharedHeap,
@@ -240,7 +302,7 @@ void Render::SetShared(const Compute::SharedHandles& in_sharedHandles)
             &crossAdapterDesc,
             D3D12_RESOURCE_STATE_COPY_SOURCE,
             nullptr,
-            IID_PPV_ARGS(&m_sharedBuffers[i])));
+            IID_PPV_ARGS(&out_source.m_buffers[i])));
 #ifdef _DEBUG
         std::wostringstream wss;
         wss << "Local-" << i;
@@ -248,35 +310,881 @@ void Render::SetShared(const Compute::SharedHandles& in_sharedHandles)
 #endif
     }
 
-    pSharedHeap->Release();
+    // the packed buffers and the density region are in heaps of their own, see Compute::CreateSharedBuffers()
+    ID3D12Heap* pPackedHeap = nullptr;
+    ThrowIfFailed(m_device->OpenSharedHandle(in_sharedHandles.m_packedHeap, IID_PPV_ARGS(&pPackedHeap)));
+
+    ID3D12Heap* pDensityHeap = nullptr;
+    ThrowIfFailed(m_device->OpenSharedHandle(in_sharedHandles.m_densityHeap, IID_PPV_ARGS(&pDensityHeap)));
+
+    const D3D12_RESOURCE_DESC packedDesc = CD3DX12_RESOURCE_DESC::Buffer(in_sharedHandles.m_alignedPackedSize,
+        D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS |
+        D3D12_RESOURCE_FLAG_ALLOW_CROSS_ADAPTER);
+
+    for (UINT i = 0; i < m_numBuffers; i++)
+    {
+        ThrowIfFailed(m_device->CreatePlacedResource(
+            pPackedHeap,
+            i * in_sharedHandles.m_alignedPackedSize,
+            &packedDesc,
+            D3D12_RESOURCE_STATE_COPY_SOURCE,
+            nullptr,
+            IID_PPV_ARGS(&out_source.m_packedBuffers[i])));
+    }
+
+    // the density fields, then the near particle lists
+    // the rows of a row-major field are aligned like those of a copy footprint, so it can also be read as a buffer
+    out_source.m_densityRowMajor = in_sharedHandles.m_densityRowMajor && GetCrossAdapterRowMajorTextureSupported();
+    const D3D12_RESOURCE_DESC densityDesc = out_source.m_densityRowMajor
+        ? CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_R32_UINT, DENSITY_WIDTH, DENSITY_HEIGHT, 1, 1, 1, 0,
+            D3D12_RESOURCE_FLAG_ALLOW_CROSS_ADAPTER, D3D12_TEXTURE_LAYOUT_ROW_MAJOR)
+        : CD3DX12_RESOURCE_DESC::Buffer(in_sharedHandles.m_alignedDensitySize, D3D12_RESOURCE_FLAG_ALLOW_CROSS_ADAPTER);
+    const D3D12_RESOURCE_DESC nearDesc = CD3DX12_RESOURCE_DESC::Buffer(in_sharedHandles.m_alignedNearSize, D3D12_RESOURCE_FLAG_ALLOW_CROSS_ADAPTER);
+
+    for (UINT i = 0; i < m_numBuffers; i++)
+    {
+        ThrowIfFailed(m_device->CreatePlacedResource(
+            pDensityHeap,
+            i * in_sharedHandles.m_alignedDensitySize,
+            &densityDesc,
+            D3D12_RESOURCE_STATE_COPY_SOURCE,
+            nullptr,
+            IID_PPV_ARGS(&out_source.m_densityResources[i])));
+
+        ThrowIfFailed(m_device->CreatePlacedResource(
+            pDensityHeap,
+            m_numBuffers * in_sharedHandles.m_alignedDensitySize + i * in_sharedHandles.m_alignedNearSize,
+            &nearDesc,
+            D3D12_RESOURCE_STATE_COPY_SOURCE,
+            nullptr,
+            IID_PPV_ARGS(&out_source.m_nearBuffers[i])));
+    }
+
+    // the heaps of the transfers that are off are not read by this adapter either
+    ID3D12Pageable* evicted[2] = {};
+    UINT numEvicted = 0;
+    if (!in_sharedHandles.m_packed)
+    {
+        evicted[numEvicted++] = pPackedHeap;
+    }
+    if (!in_sharedHandles.m_density)
+    {
+        evicted[numEvicted++] = pDensityHeap;
+    }
+    if (numEvicted)
+    {
+        ThrowIfFailed(m_device->Evict(numEvicted, evicted));
+    }
+
+    pSharedHeap->Release();
+    pPackedHeap->Release();
+    pDensityHeap->Release();
+}
+
+//-----------------------------------------------------------------------------
+// get handles to textures the simulation results will be copied to
+// each compute object provides a range of the particles
+//-----------------------------------------------------------------------------
+void Render::SetShared(const std::vector<Compute::SharedHandles>& in_sharedHandles)
+{
+    assert(in_sharedHandles.size() <= MAX_SHARED_SOURCES);
+
+    m_sharedSources.clear();
+    m_sharedSources.resize(in_sharedHandles.size());
+
+    // every source must provide the packed format, or the whole frame is copied unpacked
+    m_packedTransfer = true;
+    // likewise the density field
+    m_densityTransfer = true;
+
+    // the local buffers are replaced below, so there is nothing to interpolate from
+    m_previousValid = false;
+
+    for (size_t s = 0; s < in_sharedHandles.size(); s++)
+    {
+        const Compute::SharedHandles& handles = in_sharedHandles[s];
+        OpenSharedSource(m_sharedSources[s], handles);
+        m_sharedSources[s].m_fenceValue = 0; // the current results are copied below
+        m_packedTransfer = m_packedTransfer && handles.m_packed;
+        m_densityTransfer = m_densityTransfer && handles.m_density;
+    }
+
+    // the gpu is idle: the previous sources were released above
+    m_retiredSources.clear();
+    UpdateResidency();
+
+    // zero-copy mode draws straight from the shared buffers
+    if (m_zeroCopy)
+    {
+        CreateSharedViews();
+    }
+
+    // copy initial state from the other adapter(s)
+    // NOTE: this copy was moved from the copy queue to the direct queue to avoid an (erroneous?) debug layer warning/error on the dest resource
+    // this could just as easily be done on the copy command queue,
+    // BUT the copy command queue can't do the transition the debug layer requests
+    {
+        ThrowIfFailed(m_commandAllocators[m_frameIndex]->Reset());
+        ThrowIfFailed(m_commandList->Reset(m_commandAllocators[m_frameIndex].Get(), nullptr));
+
+        for (UINT i = 0; i < m_numBuffers; i++)
+        {
+            D3D12_RESOURCE_BARRIER barrier = CD3DX12_RESOURCE_BARRIER::Transition(m_buffers[i].Get(), D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_COPY_DEST);
+            m_commandList->ResourceBarrier(1, &barrier);
+
+            // the buffer drawn next frame gets the most recent results of each source, the following buffers older results
+            const UINT age = (i + m_numBuffers - m_currentBufferIndex) % m_numBuffers;
+            for (const auto& source : m_sharedSources)
+            {
+                if (0 == source.m_numParticles)
+                {
+                    continue;
+                }
+                const UINT srcIndex = (source.m_bufferIndex + (2 * m_numBuffers) - 1 - age) % m_numBuffers;
+                const UINT64 offset = UINT64(source.m_firstParticle) * sizeof(Particle);
+                const UINT64 size = UINT64(source.m_numParticles) * sizeof(Particle);
+                m_commandList->CopyBufferRegion(barrier.Transition.pResource, offset, source.m_buffers[srcIndex].Get(), offset, size);
+            }
+
+            std::swap(barrier.Transition.StateBefore, barrier.Transition.StateAfter);
+            m_commandList->ResourceBarrier(1, &barrier);
+
+            if (m_packedTransfer)
+            {
+                D3D12_RESOURCE_BARRIER packedBarrier = CD3DX12_RESOURCE_BARRIER::Transition(m_packedBuffers[i].Get(), D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_COPY_DEST);
+                m_commandList->ResourceBarrier(1, &packedBarrier);
+
+                for (const auto& source : m_sharedSources)
+                {
+                    if (0 == source.m_numParticles)
+                    {
+                        continue;
+                    }
+                    const UINT srcIndex = (source.m_bufferIndex + (2 * m_numBuffers) - 1 - age) % m_numBuffers;
+                    CopyPackedRange(m_commandList.Get(), packedBarrier.Transition.pResource, source.m_packedBuffers[srcIndex].Get(),
+                        source.m_firstParticle, source.m_firstParticle + source.m_numParticles);
+                }
+
+                std::swap(packedBarrier.Transition.StateBefore, packedBarrier.Transition.StateAfter);
+                m_commandList->ResourceBarrier(1, &packedBarrier);
+            }
+
+            // every source, even without particles, so no slice is left over from earlier sources
+            // the local density resources stay in the common state, see CreateParticleBuffers()
+            if (m_densityTransfer)
+            {
+                D3D12_RESOURCE_BARRIER densityBarriers[] = {
+                    CD3DX12_RESOURCE_BARRIER::Transition(m_densityTextures[i].Get(), D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_COPY_DEST),
+                    CD3DX12_RESOURCE_BARRIER::Transition(m_nearParticles[i].Get(), D3D12_RESOURCE_STATE_COMMON, D3D12_RESOURCE_STATE_COPY_DEST) };
+                m_commandList->ResourceBarrier(_countof(densityBarriers), densityBarriers);
+
+                for (size_t s = 0; s < m_sharedSources.size(); s++)
+                {
+                    const SharedSource& source = m_sharedSources[s];
+                    const UINT srcIndex = (source.m_bufferIndex + (2 * m_numBuffers) - 1 - age) % m_numBuffers;
+                    CopyDensity(m_commandList.Get(), i, source, srcIndex, UINT(s));
+                }
+
+                for (auto& barrier : densityBarriers)
+                {
+                    std::swap(barrier.Transition.StateBefore, barrier.Transition.StateAfter);
+                }
+                m_commandList->ResourceBarrier(_countof(densityBarriers), densityBarriers);
+            }
+        }
+
+        ThrowIfFailed(m_commandList->Close());
+
+        ID3D12CommandList* ppCommandLists[] = { m_commandList.Get() };
+        m_commandQueue->ExecuteCommandLists(1, ppCommandLists);
+
+        WaitForGpu();
+    }
+}
+
+//-----------------------------------------------------------------------------
+// the local buffers keep the particles of the previous source, so nothing is copied here
+// and the next CopySimulationResults() reads the results staged for it by the new source
+// the previous source may still be read by copies in flight
+//-----------------------------------------------------------------------------
+void Render::ReplaceSource(UINT in_index, const Compute::SharedHandles& in_sharedHandles, UINT64 in_fenceValue)
+{
+    assert(GetReplaceSourceSupported());
+    assert(in_index < m_sharedSources.size());
+    assert(in_sharedHandles.m_firstParticle == m_sharedSources[in_index].m_firstParticle);
+    assert(in_sharedHandles.m_numParticles == m_sharedSources[in_index].m_numParticles);
+    assert(!in_sharedHandles.m_packed && !in_sharedHandles.m_density);
+
+    m_retiredSources.emplace_back(m_copyFenceValue, std::move(m_sharedSources[in_index]));
+
+    SharedSource source = {};
+    OpenSharedSource(source, in_sharedHandles);
+    source.m_fenceValue = in_fenceValue;
+    m_sharedSources[in_index] = std::move(source);
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void Render::ReleaseRetiredSources()
+{
+    const UINT64 completedValue = m_copyFence->GetCompletedValue();
+    m_retiredSources.erase(std::remove_if(m_retiredSources.begin(), m_retiredSources.end(),
+        [=](const std::pair<UINT64, SharedSource>& in_retired) { return in_retired.first <= completedValue; }),
+        m_retiredSources.end());
+}
+
+//-----------------------------------------------------------------------------
+// the packed ring is only written when the sources provide the packed format,
+// the density textures and near particles when they provide the density field
+// evicting them lets the OS page them out when the adapter is over its memory budget
+//-----------------------------------------------------------------------------
+void Render::UpdateResidency()
+{
+    std::vector<ID3D12Pageable*> resident;
+    std::vector<ID3D12Pageable*> evicted;
+
+    if (m_packedTransfer != m_packedResident)
+    {
+        std::vector<ID3D12Pageable*>& pageables = m_packedTransfer ? resident : evicted;
+        for (UINT i = 0; i < m_numBuffers; i++)
+        {
+            pageables.push_back(m_packedBuffers[i].Get());
+        }
+        m_packedResident = m_packedTransfer;
+    }
+
+    if (m_densityTransfer != m_densityResident)
+    {
+        std::vector<ID3D12Pageable*>& pageables = m_densityTransfer ? resident : evicted;
+        for (UINT i = 0; i < m_numBuffers; i++)
+        {
+            pageables.push_back(m_densityTextures[i].Get());
+            pageables.push_back(m_nearParticles[i].Get());
+        }
+        m_densityResident = m_densityTransfer;
+    }
+
+    if (resident.size())
+    {
+        // blocks until the resources are resident
+        ThrowIfFailed(m_device->MakeResident(UINT(resident.size()), resident.data()));
+    }
+    if (evicted.size())
+    {
+        ThrowIfFailed(m_device->Evict(UINT(evicted.size()), evicted.data()));
+    }
+}
+
+//-----------------------------------------------------------------------------
+// views of the shared buffers of every source, in the format the sources provide
+//-----------------------------------------------------------------------------
+void Render::CreateSharedViews()
+{
+    D3D12_SHADER_RESOURCE_VIEW_DESC srvDesc = {};
+    srvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+    srvDesc.ViewDimension = D3D12_SRV_DIMENSION_BUFFER;
+    srvDesc.Buffer.FirstElement = 0;
+    if (m_packedTransfer)
+    {
+        srvDesc.Format = DXGI_FORMAT_R32_TYPELESS;
+        srvDesc.Buffer.NumElements = UINT(Compute::GetPackedSize(m_numParticles) / sizeof(UINT));
+        srvDesc.Buffer.Flags = D3D12_BUFFER_SRV_FLAG_RAW;
+    }
+    else
+    {
+        srvDesc.Format = DXGI_FORMAT_UNKNOWN;
+        srvDesc.Buffer.NumElements = m_numParticles;
+        srvDesc.Buffer.StructureByteStride = sizeof(Particle);
+        srvDesc.Buffer.Flags = D3D12_BUFFER_SRV_FLAG_NONE;
+    }
+
+    for (size_t s = 0; s < m_sharedSources.size(); s++)
+    {
+        const SharedSource& source = m_sharedSources[s];
+        for (UINT i = 0; i < m_numBuffers; i++)
+        {
+            ID3D12Resource* pResource = m_packedTransfer ? source.m_packedBuffers[i].Get() : source.m_buffers[i].Get();
+            const CD3DX12_CPU_DESCRIPTOR_HANDLE srvHandle(m_srvHeap->GetCPUDescriptorHandleForHeapStart(),
+                SrvSharedPos0 + UINT(s * MAX_NUM_BUFFERS) + i, m_srvUavDescriptorSize);
+            m_device->CreateShaderResourceView(pResource, &srvDesc, srvHandle);
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// lists are only added, so the lists of a frame in flight are never released
+//-----------------------------------------------------------------------------
+void Render::CreateRecordLists(UINT in_numLists)
+{
+    for (UINT i = UINT(m_recordLists.size()); i < in_numLists; i++)
+    {
+        RecordList list;
+        for (UINT f = 0; f < NUM_FRAMES; f++)
+        {
+            ThrowIfFailed(m_device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(&list.m_allocators[f])));
+            std::wostringstream allocName;
+            allocName << "Draw CmdAlloc " << i << " " << f;
+            list.m_allocators[f]->SetName(allocName.str().c_str());
+        }
+        ThrowIfFailed(m_device->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_DIRECT, list.m_allocators[0].Get(), nullptr, IID_PPV_ARGS(&list.m_commandList)));
+        std::wostringstream listName;
+        listName << "Draw CommandList " << i;
+        list.m_commandList->SetName(listName.str().c_str());
+        ThrowIfFailed(list.m_commandList->Close());
+        if (GetDrawPathSupported(DrawPath::MeshShader))
+        {
+            ThrowIfFailed(list.m_commandList.As(&list.m_commandList6));
+        }
+        m_recordLists.push_back(list);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// the ranges of the copy chunks of each source, clipped to the active particles
+// zero-copy mode draws the most recent results of each source from the shared buffers instead,
+// the render queue waits on the compute fences directly, there is no copy queue hop
+//-----------------------------------------------------------------------------
+UINT Render::PrepareDrawChunks(bool in_zeroCopy, bool in_packed, UINT in_bufferIndex, int in_numActiveParticles, DrawChunk* out_pChunks)
+{
+    UINT numChunks = 0;
+    for (size_t s = 0; s < m_sharedSources.size(); s++)
+    {
+        const SharedSource& source = m_sharedSources[s];
+
+        DrawChunk chunk = {};
+        if (in_zeroCopy)
+        {
+            //-------------------------------------------------------------------------
+            // multi-engine sync
+            // fence values only increase, so waiting on the last chunk waits on the whole simulation
+            //-------------------------------------------------------------------------
+            ThrowIfFailed(Markers::Wait(m_commandQueue.Get(), source.m_fence.Get(), source.m_fenceValue + source.m_numChunks - 1, L"compute fence"));
+
+            const UINT srcSharedIndex = (source.m_bufferIndex + m_numBuffers - 1) % m_numBuffers; // the buffer before m_bufferIndex holds the most recent results
+            chunk.m_pShared = m_packedTransfer ? source.m_packedBuffers[srcSharedIndex].Get() : source.m_buffers[srcSharedIndex].Get();
+            chunk.m_srvHandle = CD3DX12_GPU_DESCRIPTOR_HANDLE(m_srvHeap->GetGPUDescriptorHandleForHeapStart(),
+                SrvSharedPos0 + UINT(s * MAX_NUM_BUFFERS) + srcSharedIndex, m_srvUavDescriptorSize);
+        }
+        else
+        {
+            // the local buffer holds the particles of every source
+            chunk.m_srvHandle = CD3DX12_GPU_DESCRIPTOR_HANDLE(m_srvHeap->GetGPUDescriptorHandleForHeapStart(),
+                (in_packed ? SrvPackedPos0 : SrvParticlePosVelo0) + in_bufferIndex, m_srvUavDescriptorSize);
+        }
+
+        const UINT lastParticle = std::min(source.m_firstParticle + source.m_numParticles, UINT(in_numActiveParticles));
+        const UINT chunkSize = Compute::GetChunkSize(source.m_numParticles, source.m_numChunks);
+        for (UINT first = source.m_firstParticle; first < lastParticle; first += chunkSize)
+        {
+            assert(numChunks < m_MAX_DRAW_CHUNKS);
+            chunk.m_firstParticle = first;
+            chunk.m_numParticles = std::min(chunkSize, lastParticle - first);
+            out_pChunks[numChunks++] = chunk;
+        }
+    }
+    return numChunks;
+}
+
+//-----------------------------------------------------------------------------
+// the first list of the frame
+//-----------------------------------------------------------------------------
+void Render::RecordBegin()
+{
+    ThrowIfFailed(m_commandAllocators[m_frameIndex]->Reset());
+    ThrowIfFailed(m_commandList->Reset(m_commandAllocators[m_frameIndex].Get(), nullptr));
+    Markers::BeginEvent(m_commandList.Get(), L"clear");
+
+    m_pTimer->BeginTimer(m_commandList.Get(), static_cast<std::uint32_t>(GpuTimers::FPS));
+
+    m_commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(m_renderTargets[m_frameIndex].Get(),
+        D3D12_RESOURCE_STATE_PRESENT, D3D12_RESOURCE_STATE_RENDER_TARGET));
+
+    const CD3DX12_CPU_DESCRIPTOR_HANDLE rtvHandle(m_rtvHeap->GetCPUDescriptorHandleForHeapStart(), m_frameIndex, m_rtvDescriptorSize);
+    const float clearColor[] = { 0.0f, 0.0f, 0.0f, 0.0f };
+    m_commandList->ClearRenderTargetView(rtvHandle, clearColor, 0, nullptr);
+
+    Markers::EndEvent(m_commandList.Get());
+    ThrowIfFailed(m_commandList->Close());
+}
+
+//-----------------------------------------------------------------------------
+// command lists do not inherit state, so every job binds everything
+//-----------------------------------------------------------------------------
+void Render::BeginParticles(const RecordList& in_list, ID3D12PipelineState* in_pPipelineState, DrawPath in_drawPath)
+{
+    ID3D12GraphicsCommandList* pCommandList = in_list.m_commandList.Get();
+    ThrowIfFailed(in_list.m_allocators[m_frameIndex]->Reset());
+    ThrowIfFailed(pCommandList->Reset(in_list.m_allocators[m_frameIndex].Get(), in_pPipelineState));
+    Markers::BeginEvent(pCommandList, L"draw");
+
+    pCommandList->SetGraphicsRootSignature(m_rootSignature.Get());
+    pCommandList->SetGraphicsRootConstantBufferView(GraphicsRootCBV, m_constantBufferGS->GetGPUVirtualAddress() + m_frameIndex * sizeof(ConstantBufferGS));
+    pCommandList->SetGraphicsRootShaderResourceView(GraphicsRootPreviousSRV, m_previousPositions->GetGPUVirtualAddress());
+
+    // srvheap holds particle velocities in SRV form
+    ID3D12DescriptorHeap* ppHeaps[] = { m_srvHeap.Get() };
+    pCommandList->SetDescriptorHeaps(_countof(ppHeaps), ppHeaps);
+
+    const CD3DX12_CPU_DESCRIPTOR_HANDLE rtvHandle(m_rtvHeap->GetCPUDescriptorHandleForHeapStart(), m_frameIndex, m_rtvDescriptorSize);
+    pCommandList->OMSetRenderTargets(1, &rtvHandle, FALSE, nullptr);
+
+    pCommandList->RSSetViewports(1, &m_viewport);
+    pCommandList->RSSetScissorRects(1, &m_scissorRect);
+
+    pCommandList->IASetPrimitiveTopology((DrawPath::InstancedQuad == in_drawPath) ? D3D_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP : D3D_PRIMITIVE_TOPOLOGY_POINTLIST);
+}
+
+//-----------------------------------------------------------------------------
+// a range of particles, on a worker thread
+// the cull pass of the chunk counts into element in_listIndex of m_cullArgs
+//-----------------------------------------------------------------------------
+void Render::RecordChunk(UINT in_listIndex, DrawPath in_drawPath, bool in_packed, const DrawChunk& in_chunk)
+{
+    Profiler::Scope scope("record chunk");
+
+    const RecordList& list = m_recordLists[in_listIndex];
+    ID3D12GraphicsCommandList* pCommandList = list.m_commandList.Get();
+    ID3D12PipelineState* pPipelineState = in_packed ? m_pipelineStatesPacked[UINT(in_drawPath)].Get() : m_pipelineStates[UINT(in_drawPath)].Get();
+    BeginParticles(list, pPipelineState, in_drawPath);
+
+    D3D12_RESOURCE_BARRIER barrier = {};
+    if (in_chunk.m_pShared)
+    {
+        barrier = CD3DX12_RESOURCE_BARRIER::Transition(in_chunk.m_pShared, D3D12_RESOURCE_STATE_COPY_SOURCE, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE);
+        pCommandList->ResourceBarrier(1, &barrier);
+    }
+
+    pCommandList->SetGraphicsRootDescriptorTable(GraphicsRootSRVTable, in_chunk.m_srvHandle);
+
+    // the draws from the shared buffers are not culled
+    if (m_culling && (DrawPath::MeshShader != in_drawPath) && (nullptr == in_chunk.m_pShared))
+    {
+        DrawCulled(list, in_drawPath, in_packed, in_chunk.m_srvHandle, in_chunk.m_firstParticle, in_chunk.m_numParticles, in_listIndex);
+    }
+    else
+    {
+        DrawParticles(list, in_drawPath, in_chunk.m_firstParticle, in_chunk.m_numParticles);
+    }
+
+    if (in_chunk.m_pShared)
+    {
+        std::swap(barrier.Transition.StateBefore, barrier.Transition.StateAfter);
+        pCommandList->ResourceBarrier(1, &barrier);
+    }
+
+    Markers::EndEvent(pCommandList);
+    ThrowIfFailed(pCommandList->Close());
+}
+
+//-----------------------------------------------------------------------------
+// the density field transfer draws the whole frame with a single job
+//-----------------------------------------------------------------------------
+void Render::RecordDensity(UINT in_listIndex, DrawPath in_drawPath, UINT in_bufferIndex)
+{
+    Profiler::Scope scope("record density");
+
+    const RecordList& list = m_recordLists[in_listIndex];
+    BeginParticles(list, m_densityState.Get(), in_drawPath);
+    DrawDensity(list, in_drawPath, in_bufferIndex);
+
+    Markers::EndEvent(list.m_commandList.Get());
+    ThrowIfFailed(list.m_commandList->Close());
+}
+
+//-----------------------------------------------------------------------------
+// executes after the lists of every chunk, which read m_previousPositions
+//-----------------------------------------------------------------------------
+void Render::RecordKeepPrevious(UINT in_listIndex, UINT in_bufferIndex, bool in_packed, int in_numActiveParticles)
+{
+    const RecordList& list = m_recordLists[in_listIndex];
+    ThrowIfFailed(list.m_allocators[m_frameIndex]->Reset());
+    ThrowIfFailed(list.m_commandList->Reset(list.m_allocators[m_frameIndex].Get(), nullptr));
+
+    KeepPreviousPositions(list.m_commandList.Get(), in_bufferIndex, in_packed, in_numActiveParticles);
+
+    ThrowIfFailed(list.m_commandList->Close());
+}
+
+//-----------------------------------------------------------------------------
+// density field transfer alternative to drawing every particle
+// the fields were splatted with the camera of an earlier frame, the copy and simulation latency behind the drawn camera
+//-----------------------------------------------------------------------------
+void Render::DrawDensity(const RecordList& in_list, DrawPath in_drawPath, UINT in_bufferIndex)
+{
+    ID3D12GraphicsCommandList* pCommandList = in_list.m_commandList.Get();
+    const UINT numSources = UINT(m_sharedSources.size());
+
+    // a fullscreen triangle, g_numParticles is the number of slices to add up
+    const CD3DX12_GPU_DESCRIPTOR_HANDLE densityHandle(m_srvHeap->GetGPUDescriptorHandleForHeapStart(), SrvDensity0 + in_bufferIndex, m_srvUavDescriptorSize);
+    pCommandList->SetGraphicsRootDescriptorTable(GraphicsRootSRVTable, densityHandle);
+    const UINT drawConstants[] = { 0, numSources };
+    pCommandList->SetGraphicsRoot32BitConstants(GraphicsRootDrawConstants, _countof(drawConstants), drawConstants, 0);
+
+    pCommandList->SetPipelineState(m_densityState.Get());
+    pCommandList->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_TRIANGLELIST);
+    pCommandList->DrawInstanced(3, 1, 0, 0);
+
+    // the near particles of every source over the field. unused slots are beyond the far plane
+    const UINT numNearParticles = numSources * DENSITY_NEAR_PARTICLES;
+    const CD3DX12_GPU_DESCRIPTOR_HANDLE nearHandle(m_srvHeap->GetGPUDescriptorHandleForHeapStart(), SrvNearPos0 + in_bufferIndex, m_srvUavDescriptorSize);
+    pCommandList->SetGraphicsRootDescriptorTable(GraphicsRootSRVTable, nearHandle);
+
+    pCommandList->SetPipelineState(m_pipelineStates[UINT(in_drawPath)].Get());
+    pCommandList->IASetPrimitiveTopology((DrawPath::InstancedQuad == in_drawPath) ? D3D_PRIMITIVE_TOPOLOGY_TRIANGLESTRIP : D3D_PRIMITIVE_TOPOLOGY_POINTLIST);
+    if (m_culling && (DrawPath::MeshShader != in_drawPath))
+    {
+        DrawCulled(in_list, in_drawPath, false, nearHandle, 0, numNearParticles, 0);
+    }
+    else
+    {
+        DrawParticles(in_list, in_drawPath, 0, numNearParticles);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// executes after the particle lists, so the back buffer is a render target
+//-----------------------------------------------------------------------------
+void Render::RecordGui(Particles* in_pParticles)
+{
+    Profiler::Scope scope("record gui");
+
+    ThrowIfFailed(m_guiAllocators[m_frameIndex]->Reset());
+    ThrowIfFailed(m_guiCommandList->Reset(m_guiAllocators[m_frameIndex].Get(), nullptr));
+    Markers::BeginEvent(m_guiCommandList.Get(), L"gui");
+
+    const CD3DX12_CPU_DESCRIPTOR_HANDLE rtvHandle(m_rtvHeap->GetCPUDescriptorHandleForHeapStart(), m_frameIndex, m_rtvDescriptorSize);
+    m_guiCommandList->OMSetRenderTargets(1, &rtvHandle, FALSE, nullptr);
+
+    m_guiCommandList->RSSetViewports(1, &m_viewport);
+    m_guiCommandList->RSSetScissorRects(1, &m_scissorRect);
+
+    in_pParticles->DrawGUI(m_guiCommandList.Get());
+
+    // Indicate that the back buffer will now be used to present.
+    m_guiCommandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(m_renderTargets[m_frameIndex].Get(), D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_PRESENT));
+
+    m_pTimer->EndTimer(m_guiCommandList.Get(), static_cast<std::uint32_t>(GpuTimers::FPS));
+    m_pTimer->ResolveAllTimers(m_guiCommandList.Get());
+
+    Markers::EndEvent(m_guiCommandList.Get());
+    ThrowIfFailed(m_guiCommandList->Close());
+}
+
+//-----------------------------------------------------------------------------
+// the copy of the next frame writes the buffer after the one drawn next, see CopySimulationResults()
+//-----------------------------------------------------------------------------
+void Render::SetNextSimulation(UINT in_numSteps, float in_fraction)
+{
+    Simulation& simulation = m_simulations[(m_currentBufferIndex + 1) % m_numBuffers];
+    simulation.m_numSteps = in_numSteps;
+    simulation.m_fraction = in_fraction;
+}
+
+//-----------------------------------------------------------------------------
+// the drawn positions are in_fraction of a step from the end of the steps since m_previousPositions
+// a buffer simulated 0 steps repeats the previous results, so interpolates over the same steps
+//-----------------------------------------------------------------------------
+void Render::UpdateInterpolation()
+{
+    const Simulation& simulation = m_simulations[m_currentBufferIndex];
+    if (simulation.m_numSteps > 0)
+    {
+        m_previousNumSteps = simulation.m_numSteps;
+    }
+
+    m_interpolation = 1.0f;
+    if (GetInterpolationSupported() && m_previousValid && (m_previousPacked == m_packedTransfer))
+    {
+        m_interpolation = 1.0f - (1.0f - simulation.m_fraction) / float(m_previousNumSteps);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// executes after the draw, on the same queue, so the next frame can interpolate from this one
+//-----------------------------------------------------------------------------
+void Render::KeepPreviousPositions(ID3D12GraphicsCommandList* in_pCommandList, UINT in_bufferIndex, bool in_packed, int in_numActiveParticles)
+{
+    const Simulation& next = m_simulations[(in_bufferIndex + 1) % m_numBuffers];
+    if ((!GetInterpolationSupported()) || (0 == next.m_numSteps) || (next.m_fraction >= 1.0f))
+    {
+        return;
+    }
+
+    ID3D12Resource* pSrcResource = in_packed ? m_packedBuffers[in_bufferIndex].Get() : m_buffers[in_bufferIndex].Get();
+    const D3D12_RESOURCE_BARRIER barriers[] = {
+        CD3DX12_RESOURCE_BARRIER::Transition(pSrcResource, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_COPY_SOURCE),
+        CD3DX12_RESOURCE_BARRIER::Transition(m_previousPositions.Get(), D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_COPY_DEST) };
+    in_pCommandList->ResourceBarrier(_countof(barriers), barriers);
+
+    if (in_packed)
+    {
+        CopyPackedRange(in_pCommandList, m_previousPositions.Get(), pSrcResource, 0, UINT(in_numActiveParticles));
+    }
+    else
+    {
+        in_pCommandList->CopyBufferRegion(m_previousPositions.Get(), 0, pSrcResource, 0, UINT64(in_numActiveParticles) * sizeof(Particle));
+    }
+
+    const D3D12_RESOURCE_BARRIER restoreBarriers[] = {
+        CD3DX12_RESOURCE_BARRIER::Transition(pSrcResource, D3D12_RESOURCE_STATE_COPY_SOURCE, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE),
+        CD3DX12_RESOURCE_BARRIER::Transition(m_previousPositions.Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE) };
+    in_pCommandList->ResourceBarrier(_countof(restoreBarriers), restoreBarriers);
+
+    m_previousValid = true;
+    m_previousPacked = in_packed;
+}
+
+//-----------------------------------------------------------------------------
+// the particle range is in the draw constants, because SV_InstanceID and SV_GroupID start at 0
+// SV_VertexID starts at the start vertex, so the point path indexes the buffer directly
+//-----------------------------------------------------------------------------
+void Render::DrawParticles(const RecordList& in_list, DrawPath in_drawPath, UINT in_firstParticle, UINT in_numParticles)
+{
+    // a dispatch is limited to 65535 mesh shader groups per dimension
+    const UINT maxDrawParticles = (DrawPath::MeshShader == in_drawPath) ? (65535 * MESH_GROUP_SIZE) : in_numParticles;
+
+    for (UINT first = 0; first < in_numParticles; first += maxDrawParticles)
+    {
+        const UINT numParticles = std::min(maxDrawParticles, in_numParticles - first);
+        const UINT drawConstants[] = { in_firstParticle + first, numParticles };
+        in_list.m_commandList->SetGraphicsRoot32BitConstants(GraphicsRootDrawConstants, _countof(drawConstants), drawConstants, 0);
+
+        switch (in_drawPath)
+        {
+        case DrawPath::MeshShader:
+            in_list.m_commandList6->DispatchMesh((numParticles + MESH_GROUP_SIZE - 1) / MESH_GROUP_SIZE, 1, 1);
+            break;
+        case DrawPath::InstancedQuad:
+            in_list.m_commandList->DrawInstanced(4, numParticles, 0, in_firstParticle + first);
+            break;
+        default:
+            in_list.m_commandList->DrawInstanced(numParticles, 1, in_firstParticle + first, 0);
+        }
+    }
+}
+
+//-----------------------------------------------------------------------------
+// the cull pass writes the indices of the particles inside the view frustum,
+// and accumulates their count directly into the draw arguments
+//-----------------------------------------------------------------------------
+void Render::CreateCullResources()
+{
+    CreateBuffer(D3D12_HEAP_TYPE_DEFAULT, m_numParticles * sizeof(UINT), D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS,
+        D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, m_visibleParticles);
+    NAME_D3D12_OBJECT(m_visibleParticles);
+
+    // the arguments of each list of a frame, see RecordChunk()
+    CreateBuffer(D3D12_HEAP_TYPE_DEFAULT, m_MAX_DRAW_CHUNKS * sizeof(CullDrawArguments), D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS,
+        D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT, m_cullArgs);
+    NAME_D3D12_OBJECT(m_cullArgs);
+
+    // copied over the arguments of a list before its cull pass
+    // points: 0 vertices, 1 instance. quads: 4 vertices, 0 instances
+    CreateBuffer(D3D12_HEAP_TYPE_UPLOAD, sizeof(CullDrawArguments), D3D12_RESOURCE_FLAG_NONE,
+        D3D12_RESOURCE_STATE_GENERIC_READ, m_cullArgsReset);
+    NAME_D3D12_OBJECT(m_cullArgsReset);
+
+    const CullDrawArguments resetArguments = { { 0, 1, 0, 0 }, { 4, 0, 0, 0 } };
+    void* pData = nullptr;
+    const CD3DX12_RANGE readRange(0, 0);
+    ThrowIfFailed(m_cullArgsReset->Map(0, &readRange, &pData));
+    memcpy(pData, &resetArguments, sizeof(resetArguments));
+    m_cullArgsReset->Unmap(0, nullptr);
+
+    D3D12_INDIRECT_ARGUMENT_DESC argumentDesc = {};
+    argumentDesc.Type = D3D12_INDIRECT_ARGUMENT_TYPE_DRAW;
+
+    D3D12_COMMAND_SIGNATURE_DESC signatureDesc = {};
+    signatureDesc.ByteStride = sizeof(D3D12_DRAW_ARGUMENTS);
+    signatureDesc.NumArgumentDescs = 1;
+    signatureDesc.pArgumentDescs = &argumentDesc;
+    ThrowIfFailed(m_device->CreateCommandSignature(&signatureDesc, nullptr, IID_PPV_ARGS(&m_cullCommandSignature)));
+    NAME_D3D12_OBJECT(m_cullCommandSignature);
+}
+
+//-----------------------------------------------------------------------------
+// cull on the direct queue, then draw the visible particles indirectly
+// requires the root signature, constant buffer and descriptor table to be set
+//-----------------------------------------------------------------------------
+void Render::DrawCulled(const RecordList& in_list, DrawPath in_drawPath, bool in_packed, D3D12_GPU_DESCRIPTOR_HANDLE in_srvHandle,
+    UINT in_firstParticle, UINT in_numParticles, UINT in_argsIndex)
+{
+    ID3D12GraphicsCommandList* pCommandList = in_list.m_commandList.Get();
+    const UINT64 argsOffset = UINT64(in_argsIndex) * sizeof(CullDrawArguments);
+    {
+        const D3D12_RESOURCE_BARRIER barriers[] = {
+            CD3DX12_RESOURCE_BARRIER::Transition(m_cullArgs.Get(), D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT, D3D12_RESOURCE_STATE_COPY_DEST),
+            CD3DX12_RESOURCE_BARRIER::Transition(m_visibleParticles.Get(), D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_UNORDERED_ACCESS) };
+        pCommandList->ResourceBarrier(_countof(barriers), barriers);
+    }
+    pCommandList->CopyBufferRegion(m_cullArgs.Get(), argsOffset, m_cullArgsReset.Get(), 0, sizeof(CullDrawArguments));
+    pCommandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(m_cullArgs.Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_UNORDERED_ACCESS));
+
+    // the compute and graphics bindings are separate, so re-bind for the dispatch
+    const UINT drawConstants[] = { in_firstParticle, in_numParticles };
+    pCommandList->SetComputeRootSignature(m_rootSignature.Get());
+    pCommandList->SetComputeRootConstantBufferView(GraphicsRootCBV, m_constantBufferGS->GetGPUVirtualAddress() + m_frameIndex * sizeof(ConstantBufferGS));
+    pCommandList->SetComputeRootDescriptorTable(GraphicsRootSRVTable, in_srvHandle);
+    pCommandList->SetComputeRoot32BitConstants(GraphicsRootDrawConstants, _countof(drawConstants), drawConstants, 0);
+    pCommandList->SetComputeRootUnorderedAccessView(GraphicsRootVisibleUAV, m_visibleParticles->GetGPUVirtualAddress());
+    pCommandList->SetComputeRootUnorderedAccessView(GraphicsRootCullArgsUAV, m_cullArgs->GetGPUVirtualAddress() + argsOffset);
+    pCommandList->SetComputeRootShaderResourceView(GraphicsRootPreviousSRV, m_previousPositions->GetGPUVirtualAddress());
+
+    pCommandList->SetPipelineState(in_packed ? m_cullStatePacked.Get() : m_cullState.Get());
+    pCommandList->Dispatch((in_numParticles + CULL_BLOCK_SIZE - 1) / CULL_BLOCK_SIZE, 1, 1);
+
+    {
+        const D3D12_RESOURCE_BARRIER barriers[] = {
+            CD3DX12_RESOURCE_BARRIER::Transition(m_cullArgs.Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_INDIRECT_ARGUMENT),
+            CD3DX12_RESOURCE_BARRIER::Transition(m_visibleParticles.Get(), D3D12_RESOURCE_STATE_UNORDERED_ACCESS, D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE) };
+        pCommandList->ResourceBarrier(_countof(barriers), barriers);
+    }
 
-    // copy initial state from the other adapter
-    // NOTE: this copy was moved from the copy queue to the direct queue to avoid an (erroneous?) debug layer warning/error on the dest resource
-    // this could just as easily be done on the copy command queue,
-    // BUT the copy command queue can't do the transition the debug layer requests
+    const UINT index = UINT(in_drawPath);
+    pCommandList->SetPipelineState(in_packed ? m_pipelineStatesCulledPacked[index].Get() : m_pipelineStatesCulled[index].Get());
+    pCommandList->SetGraphicsRootShaderResourceView(GraphicsRootVisibleSRV, m_visibleParticles->GetGPUVirtualAddress());
+    pCommandList->SetGraphicsRoot32BitConstants(GraphicsRootDrawConstants, _countof(drawConstants), drawConstants, 0);
+
+    const UINT64 argumentOffset = argsOffset + ((DrawPath::InstancedQuad == in_drawPath) ? offsetof(CullDrawArguments, m_quads) : offsetof(CullDrawArguments, m_points));
+    pCommandList->ExecuteIndirect(m_cullCommandSignature.Get(), 1, m_cullArgs.Get(), argumentOffset, nullptr, 0);
+}
+
+//-----------------------------------------------------------------------------
+// mesh shaders require shader model 6.5, which D3DCompile does not support
+// dxcompiler.dll is loaded at runtime, so the path is optional
+//-----------------------------------------------------------------------------
+void Render::CreateMeshPipelineStates(const D3D12_BLEND_DESC& in_blendDesc, const D3D12_DEPTH_STENCIL_DESC& in_depthStencilDesc)
+{
+    if (!GetMeshShaderSupported())
     {
-        auto pDstResource = m_buffers;
-        auto pSrcResource = m_sharedBuffers;
+        return;
+    }
 
-        ThrowIfFailed(m_commandAllocators[m_frameIndex]->Reset());
-        ThrowIfFailed(m_commandList->Reset(m_commandAllocators[m_frameIndex].Get(), nullptr));
+    const std::wstring fullShaderPath = GetAssetFullPath(L"ParticleDrawMesh.hlsl");
 
-        for (UINT i = 0; i < m_NUM_BUFFERS; i++)
+    // dxc is only loaded if a permutation was not compiled offline by Shaders.targets
+    ComPtr<IDxcUtils> utils;
+    ComPtr<IDxcCompiler3> compiler;
+    ComPtr<IDxcIncludeHandler> includeHandler;
+    ComPtr<IDxcBlobEncoding> source;
+    auto CreateCompiler = [&]()
+    {
+        // stays loaded, the pipeline states are re-created with the render device
+        static const HMODULE dxcModule = ::LoadLibrary(L"dxcompiler.dll");
+        const DxcCreateInstanceProc pDxcCreateInstance = dxcModule ? (DxcCreateInstanceProc)::GetProcAddress(dxcModule, "DxcCreateInstance") : nullptr;
+        if (nullptr == pDxcCreateInstance)
         {
-            D3D12_RESOURCE_BARRIER barrier = CD3DX12_RESOURCE_BARRIER::Transition(pDstResource[i].Get(), D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, D3D12_RESOURCE_STATE_COPY_DEST);
-            m_commandList->ResourceBarrier(1, &barrier);
-            m_commandList->CopyBufferRegion(barrier.Transition.pResource, 0, pSrcResource[i].Get(), 0, m_bufferSize);
-            std::swap(barrier.Transition.StateBefore, barrier.Transition.StateAfter);
-            m_commandList->ResourceBarrier(1, &barrier);
+            ::OutputDebugStringA("dxcompiler.dll not found, mesh shader path disabled\n");
+            return false;
+        }
+        ThrowIfFailed(pDxcCreateInstance(CLSID_DxcUtils, IID_PPV_ARGS(&utils)));
+        ThrowIfFailed(pDxcCreateInstance(CLSID_DxcCompiler, IID_PPV_ARGS(&compiler)));
+        ThrowIfFailed(utils->CreateDefaultIncludeHandler(&includeHandler));
+        ThrowIfFailed(utils->LoadFile(fullShaderPath.c_str(), nullptr, &source));
+        return true;
+    };
+
+    // returns null if compilation fails
+    auto Compile = [&](const wchar_t* in_pEntryPoint, const wchar_t* in_pTarget, bool in_packed)
+    {
+        // the macros are the names of the offline permutations
+        const D3D_SHADER_MACRO macros[] = { { "culled", "0" }, { "meshpacked", in_packed ? "1" : "0" }, { nullptr, nullptr } };
+        const std::string entryPoint(in_pEntryPoint, in_pEntryPoint + wcslen(in_pEntryPoint));
+        ComPtr<ID3DBlob> shader = PipelineCache::LoadShader(fullShaderPath, macros, entryPoint.c_str());
+        if (shader || ((nullptr == compiler) && !CreateCompiler()))
+        {
+            return shader;
         }
 
-        ThrowIfFailed(m_commandList->Close());
+        const wchar_t* args[] = {
+            fullShaderPath.c_str(),
+            L"-E", in_pEntryPoint,
+            L"-T", in_pTarget,
+            L"-D", L"culled=0",
+            L"-D", in_packed ? L"meshpacked=1" : L"meshpacked=0",
+#if defined(_DEBUG)
+            // Enable better shader debugging with the graphics debugging tools.
+            DXC_ARG_DEBUG, DXC_ARG_SKIP_OPTIMIZATIONS,
+#endif
+        };
 
-        ID3D12CommandList* ppCommandLists[] = { m_commandList.Get() };
-        m_commandQueue->ExecuteCommandLists(1, ppCommandLists);
+        const DxcBuffer sourceBuffer = { source->GetBufferPointer(), source->GetBufferSize(), DXC_CP_ACP };
+        ComPtr<IDxcResult> result;
+        ComPtr<IDxcBlob> dxil;
+        HRESULT status = E_FAIL;
+        if (SUCCEEDED(compiler->Compile(&sourceBuffer, args, _countof(args), includeHandler.Get(), IID_PPV_ARGS(&result)))
+            && SUCCEEDED(result->GetStatus(&status)) && SUCCEEDED(status))
+        {
+            ThrowIfFailed(result->GetResult(&dxil));
+            ThrowIfFailed(::D3DCreateBlob(dxil->GetBufferSize(), &shader));
+            memcpy(shader->GetBufferPointer(), dxil->GetBufferPointer(), dxil->GetBufferSize());
+        }
+        else if (result)
+        {
+            ComPtr<IDxcBlobEncoding> errors;
+            if (SUCCEEDED(result->GetErrorBuffer(&errors)) && errors->GetBufferSize())
+            {
+                ::OutputDebugStringA((const char*)errors->GetBufferPointer());
+            }
+        }
+        return shader;
+    };
+
+    // the pixel shader is compiled again, a pipeline state can't mix dxbc and dxil
+    const ComPtr<ID3DBlob> pixelShader = Compile(L"PSParticleDraw", L"ps_6_5", false);
+    const ComPtr<ID3DBlob> meshShader = Compile(L"MSParticleDraw", L"ms_6_5", false);
+    const ComPtr<ID3DBlob> meshShaderPacked = Compile(L"MSParticleDraw", L"ms_6_5", true);
+    if ((nullptr == pixelShader) || (nullptr == meshShader) || (nullptr == meshShaderPacked))
+    {
+        return;
+    }
 
-        WaitForGpu();
+    struct MeshPipelineStateStream
+    {
+        CD3DX12_PIPELINE_STATE_STREAM_ROOT_SIGNATURE pRootSignature;
+        CD3DX12_PIPELINE_STATE_STREAM_SUBOBJECT<D3D12_SHADER_BYTECODE, D3D12_PIPELINE_STATE_SUBOBJECT_TYPE_MS> MS;
+        CD3DX12_PIPELINE_STATE_STREAM_PS PS;
+        CD3DX12_PIPELINE_STATE_STREAM_BLEND_DESC BlendState;
+        CD3DX12_PIPELINE_STATE_STREAM_DEPTH_STENCIL DepthStencilState;
+        CD3DX12_PIPELINE_STATE_STREAM_RASTERIZER RasterizerState;
+        CD3DX12_PIPELINE_STATE_STREAM_RENDER_TARGET_FORMATS RTVFormats;
+        CD3DX12_PIPELINE_STATE_STREAM_SAMPLE_DESC SampleDesc;
+        CD3DX12_PIPELINE_STATE_STREAM_SAMPLE_MASK SampleMask;
+    };
+
+    D3D12_RT_FORMAT_ARRAY rtvFormats = {};
+    rtvFormats.NumRenderTargets = 1;
+    rtvFormats.RTFormats[0] = DXGI_FORMAT_R8G8B8A8_UNORM;
+
+    MeshPipelineStateStream stream;
+    stream.pRootSignature = m_rootSignature.Get();
+    stream.MS = D3D12_SHADER_BYTECODE{ meshShader->GetBufferPointer(), meshShader->GetBufferSize() };
+    stream.PS = D3D12_SHADER_BYTECODE{ pixelShader->GetBufferPointer(), pixelShader->GetBufferSize() };
+    stream.BlendState = CD3DX12_BLEND_DESC(in_blendDesc);
+    stream.DepthStencilState = CD3DX12_DEPTH_STENCIL_DESC(in_depthStencilDesc);
+    stream.RTVFormats = rtvFormats;
+
+    // fails if the shaders were not signed, i.e. dxil.dll was not found next to dxcompiler.dll
+    const UINT meshIndex = UINT(DrawPath::MeshShader);
+    const D3D12_PIPELINE_STATE_STREAM_DESC streamDesc = { sizeof(stream), &stream };
+    ComPtr<ID3D12PipelineState> pipelineState;
+    ComPtr<ID3D12PipelineState> pipelineStatePacked;
+    D3D12_SHADER_BYTECODE shaders[] = { stream.MS, stream.PS };
+    if (FAILED(m_pPipelineCache->CreatePipelineState(L"m_pipelineStatesMesh", streamDesc, shaders, _countof(shaders), pipelineState)))
+    {
+        return;
     }
+    stream.MS = D3D12_SHADER_BYTECODE{ meshShaderPacked->GetBufferPointer(), meshShaderPacked->GetBufferSize() };
+    shaders[0] = stream.MS;
+    if (FAILED(m_pPipelineCache->CreatePipelineState(L"m_pipelineStatesMeshPacked", streamDesc, shaders, _countof(shaders), pipelineStatePacked)))
+    {
+        return;
+    }
+
+    m_pipelineStates[meshIndex] = pipelineState;
+    m_pipelineStatesPacked[meshIndex] = pipelineStatePacked;
+    NAME_D3D12_OBJECT_INDEXED(m_pipelineStates, meshIndex);
+    NAME_D3D12_OBJECT_INDEXED(m_pipelineStatesPacked, meshIndex);
 }
 
 //-----------------------------------------------------------------------------
@@ -442,9 +1350,15 @@ void Render::LoadAssets()
         CD3DX12_DESCRIPTOR_RANGE1 ranges[1];
         ranges[0].Init(D3D12_DESCRIPTOR_RANGE_TYPE_SRV, 1, 0, 0, D3D12_DESCRIPTOR_RANGE_FLAG_DESCRIPTORS_VOLATILE);
 
+        // the mesh shader path reads the particles, so not only visible to the vertex shader
         CD3DX12_ROOT_PARAMETER1 rootParameters[GraphicsRootParametersCount];
         rootParameters[GraphicsRootCBV].InitAsConstantBufferView(0, 0, D3D12_ROOT_DESCRIPTOR_FLAG_DATA_STATIC, D3D12_SHADER_VISIBILITY_ALL);
-        rootParameters[GraphicsRootSRVTable].InitAsDescriptorTable(_countof(ranges), ranges, D3D12_SHADER_VISIBILITY_VERTEX);
+        rootParameters[GraphicsRootSRVTable].InitAsDescriptorTable(_countof(ranges), ranges, D3D12_SHADER_VISIBILITY_ALL);
+        rootParameters[GraphicsRootDrawConstants].InitAsConstants(2, 1, 0, D3D12_SHADER_VISIBILITY_ALL);
+        rootParameters[GraphicsRootVisibleSRV].InitAsShaderResourceView(1, 0, D3D12_ROOT_DESCRIPTOR_FLAG_NONE, D3D12_SHADER_VISIBILITY_VERTEX);
+        rootParameters[GraphicsRootVisibleUAV].InitAsUnorderedAccessView(0, 0, D3D12_ROOT_DESCRIPTOR_FLAG_NONE, D3D12_SHADER_VISIBILITY_ALL);
+        rootParameters[GraphicsRootCullArgsUAV].InitAsUnorderedAccessView(1, 0, D3D12_ROOT_DESCRIPTOR_FLAG_NONE, D3D12_SHADER_VISIBILITY_ALL);
+        rootParameters[GraphicsRootPreviousSRV].InitAsShaderResourceView(2, 0, D3D12_ROOT_DESCRIPTOR_FLAG_NONE, D3D12_SHADER_VISIBILITY_ALL);
 
         // Describe and create a render target view (RTV) descriptor heap.
         D3D12_DESCRIPTOR_HEAP_DESC rtvHeapDesc = {};
@@ -476,12 +1390,17 @@ void Render::LoadAssets()
             rtvHandle.Offset(1, m_rtvDescriptorSize);
 
             ThrowIfFailed(m_device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(&m_commandAllocators[i])));
+            ThrowIfFailed(m_device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_DIRECT, IID_PPV_ARGS(&m_guiAllocators[i])));
             ThrowIfFailed(m_device->CreateCommandAllocator(D3D12_COMMAND_LIST_TYPE_COPY, IID_PPV_ARGS(&m_copyAllocators[i])));
 
             std::wostringstream cmdAllocName;
             cmdAllocName << "Render CmdAlloc " << i;
             m_commandAllocators[i]->SetName(cmdAllocName.str().c_str());
 
+            std::wostringstream guiAllocName;
+            guiAllocName << "GUI CmdAlloc " << i;
+            m_guiAllocators[i]->SetName(guiAllocName.str().c_str());
+
             std::wostringstream copyAllocName;
             copyAllocName << "Copy CmdAlloc " << i;
             m_copyAllocators[i]->SetName(copyAllocName.str().c_str());
@@ -492,13 +1411,7 @@ void Render::LoadAssets()
     // Create the pipeline states, which includes compiling and loading shaders
     //-------------------------------------------------------------------------
     {
-        // Load and compile shaders.
-        ID3DBlob* pErrorMsgs = nullptr;
-
-        ComPtr<ID3DBlob> vertexShader;
-        ComPtr<ID3DBlob> geometryShader;
-        ComPtr<ID3DBlob> pixelShader;
-
+        // Load and compile shaders, or reuse the bytecode from the pipeline cache
 #if defined(_DEBUG)
         // Enable better shader debugging with the graphics debugging tools.
         const UINT compileFlags = D3DCOMPILE_DEBUG | D3DCOMPILE_SKIP_OPTIMIZATION;
@@ -510,14 +1423,19 @@ void Render::LoadAssets()
         const wchar_t* pShaderName = L"ParticleDraw.hlsl";
         const std::wstring fullShaderPath = GetAssetFullPath(pShaderName);
 
-        ThrowIfFailed(::D3DCompileFromFile(fullShaderPath.c_str(), nullptr, nullptr, "VSParticleDraw", "vs_5_0", compileFlags, 0, &vertexShader, &pErrorMsgs));
-        ThrowIfFailed(::D3DCompileFromFile(fullShaderPath.c_str(), nullptr, nullptr, "GSParticleDraw", "gs_5_0", compileFlags, 0, &geometryShader, &pErrorMsgs));
-        ThrowIfFailed(::D3DCompileFromFile(fullShaderPath.c_str(), nullptr, nullptr, "PSParticleDraw", "ps_5_0", compileFlags, 0, &pixelShader, &pErrorMsgs));
+        // the values of defines.h are included by the shaders, see ShaderDefines.hlsl
+        // the macros only select permutations, which Shaders.targets also compiles offline
+        const D3D_SHADER_MACRO macros[] = {
+            { "culled", "0" },
+            { nullptr, nullptr} };
 
-        const D3D12_INPUT_ELEMENT_DESC inputElementDescs[] =
-        {
-            { "COLOR", 0, DXGI_FORMAT_R32G32B32A32_FLOAT, 0, 0, D3D12_INPUT_CLASSIFICATION_PER_VERTEX_DATA, 0 },
-        };
+        // the culled variants of the vertex shaders read the particle index from the list of visible particles
+        const D3D_SHADER_MACRO culledMacros[] = {
+            { "culled", "1" },
+            { nullptr, nullptr} };
+
+        const ComPtr<ID3DBlob> geometryShader = PipelineCache::CompileShader(fullShaderPath, macros, "GSParticleDraw", "gs_5_0", compileFlags);
+        const ComPtr<ID3DBlob> pixelShader = PipelineCache::CompileShader(fullShaderPath, macros, "PSParticleDraw", "ps_5_0", compileFlags);
 
         // Describe the blend and depth states.
         CD3DX12_BLEND_DESC blendDesc(D3D12_DEFAULT);
@@ -532,10 +1450,9 @@ void Render::LoadAssets()
         depthStencilDesc.DepthWriteMask = D3D12_DEPTH_WRITE_MASK_ZERO;
 
         // Describe and create the graphics pipeline state object (PSO).
+        // there is no input layout: the vertex shaders generate everything from SV_VertexID and SV_InstanceID
         D3D12_GRAPHICS_PIPELINE_STATE_DESC psoDesc = {};
-        psoDesc.InputLayout = { inputElementDescs, _countof(inputElementDescs) };
         psoDesc.pRootSignature = m_rootSignature.Get();
-        psoDesc.VS = CD3DX12_SHADER_BYTECODE(vertexShader.Get());
         psoDesc.GS = CD3DX12_SHADER_BYTECODE(geometryShader.Get());
         psoDesc.PS = CD3DX12_SHADER_BYTECODE(pixelShader.Get());
         psoDesc.RasterizerState = CD3DX12_RASTERIZER_DESC(D3D12_DEFAULT);
@@ -547,16 +1464,100 @@ void Render::LoadAssets()
         psoDesc.RTVFormats[0] = DXGI_FORMAT_R8G8B8A8_UNORM;
         psoDesc.SampleDesc.Count = 1;
 
-        ThrowIfFailed(m_device->CreateGraphicsPipelineState(&psoDesc, IID_PPV_ARGS(&m_pipelineState)));
-        NAME_D3D12_OBJECT(m_pipelineState);
+        // creates the pipeline states of a draw path, which only differ by vertex shader
+        auto CreatePipelineStates = [&](DrawPath in_drawPath, const char* in_pEntryPoint, const char* in_pEntryPointPacked)
+        {
+            struct Variant
+            {
+                ComPtr<ID3D12PipelineState>* m_pipelineStates;
+                const wchar_t* m_pName;
+                const D3D_SHADER_MACRO* m_pMacros;
+                const char* m_pEntryPoint;
+            };
+            const Variant variants[] =
+            {
+                { m_pipelineStates, L"m_pipelineStates", macros, in_pEntryPoint },
+                { m_pipelineStatesPacked, L"m_pipelineStatesPacked", macros, in_pEntryPointPacked },
+                { m_pipelineStatesCulled, L"m_pipelineStatesCulled", culledMacros, in_pEntryPoint },
+                { m_pipelineStatesCulledPacked, L"m_pipelineStatesCulledPacked", culledMacros, in_pEntryPointPacked },
+            };
+
+            const UINT index = UINT(in_drawPath);
+            for (const auto& v : variants)
+            {
+                const ComPtr<ID3DBlob> vertexShader = PipelineCache::CompileShader(fullShaderPath, v.m_pMacros, v.m_pEntryPoint, "vs_5_0", compileFlags);
+                psoDesc.VS = CD3DX12_SHADER_BYTECODE(vertexShader.Get());
+
+                std::wostringstream name;
+                name << v.m_pName << index;
+                m_pPipelineCache->CreateGraphicsPipelineState(name.str().c_str(), psoDesc, v.m_pipelineStates[index]);
+                SetNameIndexed(v.m_pipelineStates[index].Get(), v.m_pName, index);
+            }
+        };
+
+        CreatePipelineStates(DrawPath::GeometryShader, "VSParticleDraw", "VSParticleDrawPacked");
+
+        // instanced quads: the vertex shader emits the corners
+        psoDesc.GS = {};
+        psoDesc.PrimitiveTopologyType = D3D12_PRIMITIVE_TOPOLOGY_TYPE_TRIANGLE;
+
+        CreatePipelineStates(DrawPath::InstancedQuad, "VSParticleDrawQuad", "VSParticleDrawQuadPacked");
+
+        // density field transfer: a fullscreen triangle adds up the fields of the sources
+        {
+            const ComPtr<ID3DBlob> vertexShader = PipelineCache::CompileShader(fullShaderPath, macros, "VSDensity", "vs_5_0", compileFlags);
+            const ComPtr<ID3DBlob> densityPixelShader = PipelineCache::CompileShader(fullShaderPath, macros, "PSDensity", "ps_5_0", compileFlags);
+
+            D3D12_GRAPHICS_PIPELINE_STATE_DESC densityPsoDesc = psoDesc;
+            densityPsoDesc.VS = CD3DX12_SHADER_BYTECODE(vertexShader.Get());
+            densityPsoDesc.PS = CD3DX12_SHADER_BYTECODE(densityPixelShader.Get());
+            m_pPipelineCache->CreateGraphicsPipelineState(L"m_densityState", densityPsoDesc, m_densityState);
+            NAME_D3D12_OBJECT(m_densityState);
+        }
+
+        CreateMeshPipelineStates(blendDesc, depthStencilDesc);
+
+        //-------------------------------------------------------------------------
+        // frustum culling compute shader, shares the root signature with the draws
+        //-------------------------------------------------------------------------
+        const std::wstring cullShaderPath = GetAssetFullPath(L"ParticleCullCS.hlsl");
+
+        const D3D_SHADER_MACRO cullMacros[][3] = {
+            {
+                { "culled", "0" },
+                { "cullpacked", "0" },
+                { nullptr, nullptr} },
+            {
+                { "culled", "0" },
+                { "cullpacked", "1" },
+                { nullptr, nullptr} } };
+
+        ComPtr<ID3D12PipelineState>* cullStates[] = { &m_cullState, &m_cullStatePacked };
+        for (UINT i = 0; i < _countof(cullStates); i++)
+        {
+            const ComPtr<ID3DBlob> computeShader = PipelineCache::CompileShader(cullShaderPath, cullMacros[i], "CSCullParticles", "cs_5_0", compileFlags);
+
+            D3D12_COMPUTE_PIPELINE_STATE_DESC computePsoDesc = {};
+            computePsoDesc.pRootSignature = m_rootSignature.Get();
+            computePsoDesc.CS = CD3DX12_SHADER_BYTECODE(computeShader.Get());
+            m_pPipelineCache->CreateComputePipelineState(i ? L"m_cullStatePacked" : L"m_cullState", computePsoDesc, *cullStates[i]);
+        }
+        NAME_D3D12_OBJECT(m_cullState);
+        NAME_D3D12_OBJECT(m_cullStatePacked);
+
+        m_pPipelineCache->Save();
     }
 
     ThrowIfFailed(m_device->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_DIRECT, m_commandAllocators[0].Get(), nullptr, IID_PPV_ARGS(&m_commandList)));
     m_commandList->SetName(L"Render CommandList");
 
+    ThrowIfFailed(m_device->CreateCommandList(0, D3D12_COMMAND_LIST_TYPE_DIRECT, m_guiAllocators[0].Get(), nullptr, IID_PPV_ARGS(&m_guiCommandList)));
+    m_guiCommandList->SetName(L"GUI CommandList");
+    ThrowIfFailed(m_guiCommandList->Close());
+
     // command list is used by the following methods:
-    CreateVertexBuffer();
     CreateParticleBuffers();
+    CreateCullResources();
 
     //-------------------------------------------------------------------------
     // Create the geometry shader's constant buffer.
@@ -564,14 +1565,8 @@ void Render::LoadAssets()
     {
         const UINT constantBufferGSSize = sizeof(ConstantBufferGS) * NUM_FRAMES;
 
-        ThrowIfFailed(m_device->CreateCommittedResource(
-            &CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD),
-            D3D12_HEAP_FLAG_NONE,
-            &CD3DX12_RESOURCE_DESC::Buffer(constantBufferGSSize),
-            D3D12_RESOURCE_STATE_GENERIC_READ,
-            nullptr,
-            IID_PPV_ARGS(&m_constantBufferGS)
-        ));
+        CreateBuffer(D3D12_HEAP_TYPE_UPLOAD, constantBufferGSSize, D3D12_RESOURCE_FLAG_NONE,
+            D3D12_RESOURCE_STATE_GENERIC_READ, m_constantBufferGS);
 
         NAME_D3D12_OBJECT(m_constantBufferGS);
 
@@ -656,7 +1651,7 @@ HANDLE Render::MoveToNextFrame()
     m_frameFenceValues[m_frameIndex] = m_renderFenceValue;
 
     // Signal and increment the fence value.
-    ThrowIfFailed(m_commandQueue->Signal(m_renderFence.Get(), m_renderFenceValue));
+    ThrowIfFailed(Markers::Signal(m_commandQueue.Get(), m_renderFence.Get(), m_renderFenceValue, L"render fence"));
     m_renderFenceValue++;
 
     // Update the frame index.
@@ -677,48 +1672,29 @@ HANDLE Render::MoveToNextFrame()
 }
 
 //-----------------------------------------------------------------------------
-// Create the particle vertex buffer.
+// see CreateParticleBuffers() and CreateCullResources()
+// the packed ring and the density resources only count while resident, see UpdateResidency()
 //-----------------------------------------------------------------------------
-void Render::CreateVertexBuffer()
+UINT64 Render::GetMemoryFootprint(UINT in_numParticles, UINT in_numBuffers, bool in_packed, bool in_density)
 {
-    std::vector<ParticleVertex> vertices;
-    vertices.resize(m_numParticles);
-    for (UINT i = 0; i < m_numParticles; i++)
+    const UINT64 dataSize = MemoryBudget::GetAllocationSize(UINT64(in_numParticles) * sizeof(Particle));
+    const UINT64 packedSize = MemoryBudget::GetAllocationSize(Compute::GetPackedSize(in_numParticles));
+    const UINT64 densitySize = MemoryBudget::GetAllocationSize(UINT64(DENSITY_WIDTH) * DENSITY_HEIGHT * sizeof(UINT) * MAX_SHARED_SOURCES)
+        + MemoryBudget::GetAllocationSize(UINT64(DENSITY_NEAR_PARTICLES) * sizeof(Particle) * MAX_SHARED_SOURCES);
+
+    // local rings and the previous positions
+    UINT64 footprint = in_numBuffers * dataSize + std::max(dataSize, packedSize);
+    if (in_packed)
     {
-        vertices[i].color = XMFLOAT4(1.0f, 1.0f, 0.2f, 1.0f);
+        footprint += in_numBuffers * packedSize;
     }
-
-    const UINT bufferSize = m_numParticles * sizeof(ParticleVertex);
-
-    ThrowIfFailed(m_device->CreateCommittedResource(
-        &CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
-        D3D12_HEAP_FLAG_NONE,
-        &CD3DX12_RESOURCE_DESC::Buffer(bufferSize),
-        D3D12_RESOURCE_STATE_COPY_DEST,
-        nullptr,
-        IID_PPV_ARGS(&m_vertexBuffer)));
-
-    ThrowIfFailed(m_device->CreateCommittedResource(
-        &CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_UPLOAD),
-        D3D12_HEAP_FLAG_NONE,
-        &CD3DX12_RESOURCE_DESC::Buffer(bufferSize),
-        D3D12_RESOURCE_STATE_GENERIC_READ,
-        nullptr,
-        IID_PPV_ARGS(&m_vertexBufferUpload)));
-
-    NAME_D3D12_OBJECT(m_vertexBuffer);
-
-    D3D12_SUBRESOURCE_DATA vertexData = {};
-    vertexData.pData = reinterpret_cast<UINT8*>(&vertices[0]);
-    vertexData.RowPitch = bufferSize;
-    vertexData.SlicePitch = vertexData.RowPitch;
-
-    UpdateSubresources<1>(m_commandList.Get(), m_vertexBuffer.Get(), m_vertexBufferUpload.Get(), 0, 0, 1, &vertexData);
-    m_commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(m_vertexBuffer.Get(), D3D12_RESOURCE_STATE_COPY_DEST, D3D12_RESOURCE_STATE_VERTEX_AND_CONSTANT_BUFFER));
-
-    m_vertexBufferView.BufferLocation = m_vertexBuffer->GetGPUVirtualAddress();
-    m_vertexBufferView.SizeInBytes = static_cast<UINT>(bufferSize);
-    m_vertexBufferView.StrideInBytes = sizeof(ParticleVertex);
+    if (in_density)
+    {
+        footprint += in_numBuffers * densitySize;
+    }
+    // visible particle indices
+    footprint += MemoryBudget::GetAllocationSize(UINT64(in_numParticles) * sizeof(UINT));
+    return footprint;
 }
 
 //-----------------------------------------------------------------------------
@@ -737,16 +1713,11 @@ void Render::CreateParticleBuffers()
     srvDesc.Buffer.StructureByteStride = sizeof(Particle);
     srvDesc.Buffer.Flags = D3D12_BUFFER_SRV_FLAG_NONE;
 
-    for (UINT i = 0; i < m_NUM_BUFFERS; i++)
+    for (UINT i = 0; i < m_numBuffers; i++)
     {
-        ThrowIfFailed(m_device->CreateCommittedResource(
-            &CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
-            D3D12_HEAP_FLAG_NONE,
-            // in async compute mode, this resource is accessed as a UAV
-            &CD3DX12_RESOURCE_DESC::Buffer(m_bufferSize, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS),
-            D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE,
-            nullptr,
-            IID_PPV_ARGS(&m_buffers[i])));
+        // in async compute mode, this resource is accessed as a UAV
+        CreateBuffer(D3D12_HEAP_TYPE_DEFAULT, m_bufferSize, D3D12_RESOURCE_FLAG_ALLOW_UNORDERED_ACCESS,
+            D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, m_buffers[i]);
 #ifdef _DEBUG
         std::wostringstream wss;
         wss << "Shared-" << i;
@@ -756,27 +1727,198 @@ void Render::CreateParticleBuffers()
         const CD3DX12_CPU_DESCRIPTOR_HANDLE srvHandle(m_srvHeap->GetCPUDescriptorHandleForHeapStart(), SrvParticlePosVelo0 + i, m_srvUavDescriptorSize);
         m_device->CreateShaderResourceView(m_buffers[i].Get(), &srvDesc, srvHandle);
     }
+
+    // the packed transfer format is read as a ByteAddressBuffer
+    const UINT64 packedSize = Compute::GetPackedSize(m_numParticles);
+
+    D3D12_SHADER_RESOURCE_VIEW_DESC packedSrvDesc = {};
+    packedSrvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+    packedSrvDesc.Format = DXGI_FORMAT_R32_TYPELESS;
+    packedSrvDesc.ViewDimension = D3D12_SRV_DIMENSION_BUFFER;
+    packedSrvDesc.Buffer.FirstElement = 0;
+    packedSrvDesc.Buffer.NumElements = UINT(packedSize / sizeof(UINT));
+    packedSrvDesc.Buffer.Flags = D3D12_BUFFER_SRV_FLAG_RAW;
+
+    for (UINT i = 0; i < m_numBuffers; i++)
+    {
+        // committed rather than placed, placed resources cannot be evicted on their own. see UpdateResidency()
+        ThrowIfFailed(m_device->CreateCommittedResource(
+            &CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+            D3D12_HEAP_FLAG_NONE,
+            &CD3DX12_RESOURCE_DESC::Buffer(packedSize),
+            D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE,
+            nullptr,
+            IID_PPV_ARGS(&m_packedBuffers[i])));
+        NAME_D3D12_OBJECT_INDEXED(m_packedBuffers, i);
+
+        const CD3DX12_CPU_DESCRIPTOR_HANDLE srvHandle(m_srvHeap->GetCPUDescriptorHandleForHeapStart(), SrvPackedPos0 + i, m_srvUavDescriptorSize);
+        m_device->CreateShaderResourceView(m_packedBuffers[i].Get(), &packedSrvDesc, srvHandle);
+    }
+
+    // holds either format, read through a root descriptor
+    CreateBuffer(D3D12_HEAP_TYPE_DEFAULT, std::max(m_bufferSize, packedSize), D3D12_RESOURCE_FLAG_NONE,
+        D3D12_RESOURCE_STATE_NON_PIXEL_SHADER_RESOURCE, m_previousPositions);
+    NAME_D3D12_OBJECT(m_previousPositions);
+
+    // density field transfer: a slice of the field and DENSITY_NEAR_PARTICLES near particles per source
+    // in the common state, so the copy queue and the draw promote them without barriers, and they decay after each
+    D3D12_SHADER_RESOURCE_VIEW_DESC densitySrvDesc = {};
+    densitySrvDesc.Shader4ComponentMapping = D3D12_DEFAULT_SHADER_4_COMPONENT_MAPPING;
+    densitySrvDesc.Format = DXGI_FORMAT_R32_UINT;
+    densitySrvDesc.ViewDimension = D3D12_SRV_DIMENSION_TEXTURE2DARRAY;
+    densitySrvDesc.Texture2DArray.MipLevels = 1;
+    densitySrvDesc.Texture2DArray.ArraySize = MAX_SHARED_SOURCES;
+
+    D3D12_SHADER_RESOURCE_VIEW_DESC nearSrvDesc = srvDesc;
+    nearSrvDesc.Buffer.NumElements = MAX_SHARED_SOURCES * DENSITY_NEAR_PARTICLES;
+
+    for (UINT i = 0; i < m_numBuffers; i++)
+    {
+        ThrowIfFailed(m_device->CreateCommittedResource(
+            &CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+            D3D12_HEAP_FLAG_NONE,
+            &CD3DX12_RESOURCE_DESC::Tex2D(DXGI_FORMAT_R32_UINT, DENSITY_WIDTH, DENSITY_HEIGHT, MAX_SHARED_SOURCES, 1),
+            D3D12_RESOURCE_STATE_COMMON,
+            nullptr,
+            IID_PPV_ARGS(&m_densityTextures[i])));
+        NAME_D3D12_OBJECT_INDEXED(m_densityTextures, i);
+
+        // committed rather than placed, like the packed ring. see UpdateResidency()
+        ThrowIfFailed(m_device->CreateCommittedResource(
+            &CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_DEFAULT),
+            D3D12_HEAP_FLAG_NONE,
+            &CD3DX12_RESOURCE_DESC::Buffer(UINT64(MAX_SHARED_SOURCES) * DENSITY_NEAR_PARTICLES * sizeof(Particle)),
+            D3D12_RESOURCE_STATE_COMMON,
+            nullptr,
+            IID_PPV_ARGS(&m_nearParticles[i])));
+        NAME_D3D12_OBJECT_INDEXED(m_nearParticles, i);
+
+        const CD3DX12_CPU_DESCRIPTOR_HANDLE densityHandle(m_srvHeap->GetCPUDescriptorHandleForHeapStart(), SrvDensity0 + i, m_srvUavDescriptorSize);
+        m_device->CreateShaderResourceView(m_densityTextures[i].Get(), &densitySrvDesc, densityHandle);
+
+        const CD3DX12_CPU_DESCRIPTOR_HANDLE nearHandle(m_srvHeap->GetCPUDescriptorHandleForHeapStart(), SrvNearPos0 + i, m_srvUavDescriptorSize);
+        m_device->CreateShaderResourceView(m_nearParticles[i].Get(), &nearSrvDesc, nearHandle);
+    }
 }
 
 //-----------------------------------------------------------------------------
+// a waitable swap chain starts with a maximum frame latency of 1
 //-----------------------------------------------------------------------------
-void Render::UpdateCamera()
+void Render::SetFrameLatency(UINT in_frameLatency)
+{
+    const UINT frameLatency = std::max(1u, std::min(in_frameLatency, UINT(MAX_FRAME_LATENCY)));
+    if (frameLatency == m_frameLatency)
+    {
+        return;
+    }
+    m_frameLatency = frameLatency;
+
+#if USE_LATENCY_WAITABLE
+    ThrowIfFailed(m_swapChain->SetMaximumFrameLatency(m_frameLatency));
+#endif
+}
+
+//-----------------------------------------------------------------------------
+// Wait for the previous Present to complete.
+//-----------------------------------------------------------------------------
+void Render::WaitForFrameLatency()
 {
 #if USE_LATENCY_WAITABLE
-    // Wait for the previous Present to complete.
-    const DWORD rv = ::WaitForSingleObjectEx(m_swapChainEvent, 1000, FALSE);
-    assert(rv == WAIT_OBJECT_0 || rv == WAIT_TIMEOUT);
+    {
+        Profiler::Scope scope("frame latency wait");
+        const DWORD rv = ::WaitForSingleObjectEx(m_swapChainEvent, 1000, FALSE);
+        assert(rv == WAIT_OBJECT_0 || rv == WAIT_TIMEOUT);
+    }
 #endif
+    m_frameLatencyWaited = true;
+    ::QueryPerformanceCounter(&m_frameStart);
+}
+
+//-----------------------------------------------------------------------------
+// the statistics describe the most recent frame displayed, a few presents ago
+// its start was recorded with its present count
+//-----------------------------------------------------------------------------
+void Render::UpdatePresentStatistics(bool in_vsync)
+{
+    UINT presentCount = 0;
+    if (SUCCEEDED(m_swapChain->GetLastPresentCount(&presentCount)))
+    {
+        m_presentRecords[presentCount % m_NUM_PRESENT_RECORDS] = { presentCount, m_frameStart };
+    }
+
+    // fails until the first frame is displayed, and with DXGI_ERROR_FRAME_STATISTICS_DISJOINT e.g. after a mode change
+    DXGI_FRAME_STATISTICS statistics = {};
+    if (FAILED(m_swapChain->GetFrameStatistics(&statistics)))
+    {
+        m_presentStatistics.m_valid = false;
+        m_previousFrameStatistics = {};
+        return;
+    }
+
+    const PresentRecord& record = m_presentRecords[statistics.PresentCount % m_NUM_PRESENT_RECORDS];
+    if ((record.m_presentCount == statistics.PresentCount) && (0 != record.m_frameStart.QuadPart))
+    {
+        m_presentStatistics.m_valid = true;
+        m_presentStatistics.m_displayLatency = float(double(statistics.SyncQPCTime.QuadPart - record.m_frameStart.QuadPart)
+            / double(m_performanceFrequency.QuadPart));
+    }
+
+    // more vblanks than frames displayed since the previous statistics. without vsync, frames are not tied to vblanks
+    const UINT numPresents = statistics.PresentCount - m_previousFrameStatistics.PresentCount;
+    const UINT numRefreshes = statistics.PresentRefreshCount - m_previousFrameStatistics.PresentRefreshCount;
+    if (in_vsync && (0 != m_previousFrameStatistics.PresentCount) && (numPresents > 0) && (numRefreshes > numPresents))
+    {
+        m_presentStatistics.m_numMissedRefreshes += numRefreshes - numPresents;
+    }
+    m_previousFrameStatistics = statistics;
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void Render::UpdateCamera()
+{
+    // each wait takes one frame from the swap chain, so only one per frame
+    if (!m_frameLatencyWaited)
+    {
+        WaitForFrameLatency();
+    }
+    m_frameLatencyWaited = false;
 
     //m_timer.Tick(nullptr);
     //m_camera.Update(static_cast<float>(m_timer.GetElapsedSeconds()));
     m_camera.Update(0);
 
     ConstantBufferGS constantBufferGS = {};
-    XMStoreFloat4x4(&constantBufferGS.worldViewProjection, XMMatrixMultiply(m_camera.GetViewMatrix(), m_camera.GetProjectionMatrix(0.8f, m_aspectRatio, 1.0f, 5000.0f)));
+    const XMMATRIX worldViewProjection = XMMatrixMultiply(m_camera.GetViewMatrix(), m_camera.GetProjectionMatrix(0.8f, m_aspectRatio, 1.0f, 5000.0f));
+    XMStoreFloat4x4(&constantBufferGS.worldViewProjection, worldViewProjection);
+    XMStoreFloat4x4(&m_viewProjection, worldViewProjection);
+
+    // frustum planes from the columns of the (row-vector) view-projection matrix, normals point into the frustum
+    {
+        const XMMATRIX columns = XMMatrixTranspose(worldViewProjection);
+        const XMVECTOR planes[6] =
+        {
+            XMVectorAdd(columns.r[3], columns.r[0]),      // left
+            XMVectorSubtract(columns.r[3], columns.r[0]), // right
+            XMVectorAdd(columns.r[3], columns.r[1]),      // bottom
+            XMVectorSubtract(columns.r[3], columns.r[1]), // top
+            columns.r[2],                                 // near, z/w >= 0
+            XMVectorSubtract(columns.r[3], columns.r[2]), // far
+        };
+        for (UINT i = 0; i < _countof(planes); i++)
+        {
+            XMStoreFloat4(&constantBufferGS.frustumPlanes[i], XMPlaneNormalize(planes[i]));
+        }
+    }
+
     XMStoreFloat4x4(&constantBufferGS.inverseView, XMMatrixInverse(nullptr, m_camera.GetViewMatrix()));
     constantBufferGS.particleSize = m_particleSize;
     constantBufferGS.particleIntensity = m_particleIntensity;
+    constantBufferGS.packedHeadersSize = UINT(Compute::GetPackedHeadersSize(m_numParticles));
+    constantBufferGS.interpolation = m_interpolation;
+    constantBufferGS.densityIntensity = m_particleIntensity * DENSITY_INTENSITY;
+    constantBufferGS.palette[0] = XMFLOAT4(1.0f, 0.1f, 0.1f, 1.0f);
+    constantBufferGS.palette[1] = XMFLOAT4(1.0f, 1.0f, 0.2f, 1.0f);
 
     UINT8* destination = m_pConstantBufferGSData + sizeof(ConstantBufferGS) * m_frameIndex;
     assert(destination);
@@ -784,50 +1926,177 @@ void Render::UpdateCamera()
 }
 
 //-------------------------------------------------
-// copy simulation results from compute adapter
+// the packed format is a region of headers followed by a region of particles
+// a range that starts on a block boundary has contiguous headers and contiguous particles
+//-------------------------------------------------
+UINT64 Render::CopyPackedRange(ID3D12GraphicsCommandList* in_pCommandList,
+    ID3D12Resource* in_pDst, ID3D12Resource* in_pSrc,
+    UINT in_firstParticle, UINT in_lastParticle)
+{
+    assert(0 == (in_firstParticle % PACK_BLOCK_SIZE));
+
+    const UINT64 headersOffset = Compute::GetPackedHeadersSize(in_firstParticle);
+    const UINT64 headersSize = Compute::GetPackedHeadersSize(in_lastParticle) - headersOffset;
+    in_pCommandList->CopyBufferRegion(in_pDst, headersOffset, in_pSrc, headersOffset, headersSize);
+
+    const UINT64 particlesOffset = Compute::GetPackedHeadersSize(m_numParticles) + UINT64(in_firstParticle) * PACK_PARTICLE_SIZE;
+    const UINT64 particlesSize = UINT64(in_lastParticle - in_firstParticle) * PACK_PARTICLE_SIZE;
+    in_pCommandList->CopyBufferRegion(in_pDst, particlesOffset, in_pSrc, particlesOffset, particlesSize);
+
+    return headersSize + particlesSize;
+}
+
+//-------------------------------------------------
+// the slice of the source in the local density field, and its range of the near particles
+// the size does not depend on the number of particles
+//-------------------------------------------------
+UINT64 Render::CopyDensity(ID3D12GraphicsCommandList* in_pCommandList, UINT in_dstIndex,
+    const SharedSource& in_source, UINT in_srcIndex, UINT in_slice)
+{
+    ID3D12Resource* pSrcDensity = in_source.m_densityResources[in_srcIndex].Get();
+    const CD3DX12_TEXTURE_COPY_LOCATION dst(m_densityTextures[in_dstIndex].Get(), D3D12CalcSubresource(0, in_slice, 0, 1, MAX_SHARED_SOURCES));
+    if (in_source.m_densityRowMajor)
+    {
+        const CD3DX12_TEXTURE_COPY_LOCATION src(pSrcDensity, 0);
+        in_pCommandList->CopyTextureRegion(&dst, 0, 0, 0, &src, nullptr);
+    }
+    else
+    {
+        const D3D12_PLACED_SUBRESOURCE_FOOTPRINT footprint = { 0, { DXGI_FORMAT_R32_UINT, DENSITY_WIDTH, DENSITY_HEIGHT, 1, DENSITY_WIDTH * sizeof(UINT) } };
+        const CD3DX12_TEXTURE_COPY_LOCATION src(pSrcDensity, footprint);
+        in_pCommandList->CopyTextureRegion(&dst, 0, 0, 0, &src, nullptr);
+    }
+
+    const UINT64 nearSize = UINT64(DENSITY_NEAR_PARTICLES) * sizeof(Particle);
+    in_pCommandList->CopyBufferRegion(m_nearParticles[in_dstIndex].Get(), in_slice * nearSize, in_source.m_nearBuffers[in_srcIndex].Get(), 0, nearSize);
+
+    return UINT64(DENSITY_WIDTH) * DENSITY_HEIGHT * sizeof(UINT) + nearSize;
+}
+
+//-------------------------------------------------
+// copy simulation results from compute adapter(s)
+// each shared source provides a range of the particles. gather them into the local buffer
+// each chunk of the simulation is copied as soon as it is complete, while the compute adapter works on the next
 //-------------------------------------------------
-void Render::CopySimulationResults(UINT64 in_fenceValue, int in_numActiveParticles)
+void Render::CopySimulationResults(const std::vector<UINT64>& in_fenceValues, int in_numActiveParticles)
 {
+    assert(in_fenceValues.size() == m_sharedSources.size());
+    Profiler::Scope scope("copy");
+
+    ReleaseRetiredSources();
+
     //-------------------------------------------------------------------------
     // multi-engine sync
-    // wait on previous frame to finish
+    // wait for the frame that last drew the destination buffer to finish, m_numBuffers - 1 frames ago
     // race: can't do a wait on current frame (m_renderFenceValue) after the copy.
     //-------------------------------------------------------------------------
-    ThrowIfFailed(m_copyQueue->Wait(m_renderFence.Get(), m_renderFenceValue-1));
-
-    const UINT srcSharedIndex = 1 - m_sharedBufferIndex;     // reading from shared buffer pointed to by m_sharedBufferIndex
-    const UINT dstLocalIndex = 1 - m_currentBufferIndex; // writing to local buffer pointed to by m_currentBufferIndex
-    m_sharedBufferIndex = 1 - m_sharedBufferIndex; // move shared index forward for next time
+    const UINT64 waitValue = (m_renderFenceValue > (m_numBuffers - 1)) ? (m_renderFenceValue - (m_numBuffers - 1)) : 0;
+    ThrowIfFailed(Markers::Wait(m_copyQueue.Get(), m_renderFence.Get(), waitValue, L"render fence"));
 
-    ID3D12Resource* pDstResource = m_buffers[dstLocalIndex].Get();
-    ID3D12Resource* pSrcResource = m_sharedBuffers[srcSharedIndex].Get();
+    const UINT dstLocalIndex = (m_currentBufferIndex + 1) % m_numBuffers; // the local buffer drawn next frame
+    ID3D12Resource* pDstResource = m_packedTransfer ? m_packedBuffers[dstLocalIndex].Get() : m_buffers[dstLocalIndex].Get();
 
     ThrowIfFailed(m_copyAllocators[m_frameIndex]->Reset());
-    ThrowIfFailed(m_copyList->Reset(m_copyAllocators[m_frameIndex].Get(), nullptr));
 
-    // a resource barrier gives maximum information to the runtime that may help other adapters with cache sync
-    // it should not be necessary on a copy queue, especially when using buffers
-    m_copyList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::UAV(pSrcResource));
+    UINT numChunks = 1;
+    for (const auto& source : m_sharedSources)
+    {
+        numChunks = std::max(numChunks, source.m_numChunks);
+    }
 
-    // the aligned data size of the shared buffer could be larger than the buffer contents
-    // copy just the particles required
-    m_copyList->CopyBufferRegion(pDstResource, 0, pSrcResource, 0, in_numActiveParticles * sizeof(Particle));
+    m_copiedBytes = 0;
 
-    ThrowIfFailed(m_copyList->Close());
+    for (UINT chunk = 0; chunk < numChunks; chunk++)
+    {
+        //-------------------------------------------------------------------------
+        // multi-engine sync
+        // a chunk can be copied once the compute gpu(s) have produced it
+        //-------------------------------------------------------------------------
+        for (const auto& source : m_sharedSources)
+        {
+            const UINT sourceChunk = std::min(chunk, source.m_numChunks - 1);
+            ThrowIfFailed(Markers::Wait(m_copyQueue.Get(), source.m_fence.Get(), source.m_fenceValue + sourceChunk, L"compute fence"));
+        }
 
-    ID3D12CommandList* ppCommandLists[] = { m_copyList.Get() };
-    m_copyQueue->ExecuteCommandLists(1, ppCommandLists);
+        // the allocator holds the commands of all the chunks
+        ThrowIfFailed(m_copyList->Reset(m_copyAllocators[m_frameIndex].Get(), nullptr));
+        Markers::BeginEvent(m_copyList.Get(), L"copy");
 
-    //-------------------------------------------------------------------------
-    // multi-engine sync
-    // don't start next copy until the compute gpu has produced new results
-    // also helps host-side sync, since host will wait on render fence, render waits on copy, and copy waits on compute
-    //-------------------------------------------------------------------------
-    ThrowIfFailed(m_copyQueue->Wait(m_sharedComputeFence.Get(), in_fenceValue));
+        // starts once the first chunk is available
+        if (m_pCopyTimer && (0 == chunk))
+        {
+            m_pCopyTimer->BeginTimer(m_copyList.Get(), static_cast<std::uint32_t>(CopyGpuTimers::Copy));
+        }
+
+        for (size_t s = 0; s < m_sharedSources.size(); s++)
+        {
+            const SharedSource& source = m_sharedSources[s];
+            if (chunk >= source.m_numChunks)
+            {
+                continue;
+            }
+
+            const UINT srcSharedIndex = (source.m_bufferIndex + m_numBuffers - 1) % m_numBuffers; // the buffer before m_bufferIndex holds the most recent results
+
+            // the positions are not copied. the density field of the whole range is complete with the last chunk
+            if (m_densityTransfer)
+            {
+                if ((source.m_numChunks - 1) == chunk)
+                {
+                    m_copiedBytes += CopyDensity(m_copyList.Get(), dstLocalIndex, source, srcSharedIndex, UINT(s));
+                }
+                continue;
+            }
+
+            ID3D12Resource* pSrcResource = m_packedTransfer ? source.m_packedBuffers[srcSharedIndex].Get() : source.m_buffers[srcSharedIndex].Get();
+
+            // a resource barrier gives maximum information to the runtime that may help other adapters with cache sync
+            // it should not be necessary on a copy queue, especially when using buffers
+            m_copyList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::UAV(pSrcResource));
+
+            // the aligned data size of the shared buffer could be larger than the buffer contents
+            // copy just the particles required
+            const UINT chunkSize = Compute::GetChunkSize(source.m_numParticles, source.m_numChunks);
+            const UINT firstParticle = source.m_firstParticle + chunk * chunkSize;
+            const UINT lastParticle = std::min(std::min(firstParticle + chunkSize, source.m_firstParticle + source.m_numParticles), UINT(in_numActiveParticles));
+            if ((lastParticle > firstParticle) && m_packedTransfer)
+            {
+                m_copiedBytes += CopyPackedRange(m_copyList.Get(), pDstResource, pSrcResource, firstParticle, lastParticle);
+            }
+            else if (lastParticle > firstParticle)
+            {
+                const UINT64 offset = UINT64(firstParticle) * sizeof(Particle);
+                const UINT64 size = UINT64(lastParticle - firstParticle) * sizeof(Particle);
+                m_copyList->CopyBufferRegion(pDstResource, offset, pSrcResource, offset, size);
+                m_copiedBytes += size;
+            }
+        }
+
+        if (m_pCopyTimer && ((numChunks - 1) == chunk))
+        {
+            m_pCopyTimer->EndTimer(m_copyList.Get(), static_cast<std::uint32_t>(CopyGpuTimers::Copy));
+            m_pCopyTimer->ResolveAllTimers(m_copyList.Get());
+        }
+
+        Markers::EndEvent(m_copyList.Get());
+        ThrowIfFailed(m_copyList->Close());
+
+        ID3D12CommandList* ppCommandLists[] = { m_copyList.Get() };
+        m_copyQueue->ExecuteCommandLists(1, ppCommandLists);
+    }
+
+    // the next copy reads the results of the simulation that starts this frame
+    for (size_t i = 0; i < m_sharedSources.size(); i++)
+    {
+        SharedSource& source = m_sharedSources[i];
+        source.m_bufferIndex = (source.m_bufferIndex + 1) % m_numBuffers; // move shared index forward for next time
+        source.m_fenceValue = in_fenceValues[i];
+    }
 
     // signal the copy fence
+    // host-side sync: host waits on render fence, render waits on copy, and copy waits on compute
     m_copyFenceValue++;
-    ThrowIfFailed(m_copyQueue->Signal(m_copyFence.Get(), m_copyFenceValue));
+    ThrowIfFailed(Markers::Signal(m_copyQueue.Get(), m_copyFence.Get(), m_copyFenceValue, L"copy fence"));
 }
 
 //-----------------------------------------------------------------------------
@@ -836,73 +2105,79 @@ void Render::CopySimulationResults(UINT64 in_fenceValue, int in_numActiveParticl
 // normally, in_numParticlesCopied should equal in_numActiveParticles
 // in_numParticlesCopied was added to experiment with stressing the PCI bus
 //-----------------------------------------------------------------------------
-HANDLE Render::Draw(int in_numActiveParticles, Particles* in_pParticles, UINT64& inout_fenceValue,
+HANDLE Render::Draw(int in_numActiveParticles, Particles* in_pParticles, std::vector<UINT64>& inout_fenceValues,
     int in_numParticlesCopied)
 {
+    Profiler::Scope scope("render");
+
+    UpdateInterpolation();
     UpdateCamera();
 
-    if (!m_asyncMode)
+    // async compute mode writes the local buffers directly, so there is nothing to transfer
+    const bool zeroCopy = m_zeroCopy && !m_asyncMode;
+    const bool packed = m_packedTransfer && !m_asyncMode;
+    const bool density = m_densityTransfer && !m_asyncMode;
+
+    if (m_asyncMode)
     {
-        // start copy for next frame. no reason to delay.
-        CopySimulationResults(inout_fenceValue, in_numParticlesCopied);
+        // async compute mode has a single source, the compute queue on this adapter
+        // inout_fenceValues[0] is signaled by the simulation of this frame, which is submitted after the draw
+        const UINT64 drawnValue = (inout_fenceValues[0] > m_simulationLatency) ? (inout_fenceValues[0] - m_simulationLatency) : 0;
+        ThrowIfFailed(Markers::Wait(m_commandQueue.Get(), m_sharedSources[0].m_fence.Get(), drawnValue, L"compute fence"));
     }
-    else
+    else if (!zeroCopy)
     {
-        ThrowIfFailed(m_commandQueue->Wait(m_sharedComputeFence.Get(), inout_fenceValue-1));
+        // start copy for next frame. no reason to delay.
+        // zero-copy mode reads the simulation results in the draw below instead
+        CopySimulationResults(inout_fenceValues, in_numParticlesCopied);
     }
 
-    ThrowIfFailed(m_commandAllocators[m_frameIndex]->Reset());
-    ThrowIfFailed(m_commandList->Reset(m_commandAllocators[m_frameIndex].Get(), m_pipelineState.Get()));
-
-    m_pTimer->BeginTimer(m_commandList.Get(), static_cast<std::uint32_t>(GpuTimers::FPS));
-
-    m_commandList->SetGraphicsRootSignature(m_rootSignature.Get());
-    m_commandList->SetPipelineState(m_pipelineState.Get());
-    m_commandList->SetGraphicsRootConstantBufferView(GraphicsRootCBV, m_constantBufferGS->GetGPUVirtualAddress() + m_frameIndex * sizeof(ConstantBufferGS));
-
-    // srvheap holds particle velocities in SRV form
-    ID3D12DescriptorHeap* ppHeaps[] = { m_srvHeap.Get() };
-    m_commandList->SetDescriptorHeaps(_countof(ppHeaps), ppHeaps);
-
-    m_commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(m_renderTargets[m_frameIndex].Get(),
-        D3D12_RESOURCE_STATE_PRESENT, D3D12_RESOURCE_STATE_RENDER_TARGET));
-
-    const CD3DX12_CPU_DESCRIPTOR_HANDLE rtvHandle(m_rtvHeap->GetCPUDescriptorHandleForHeapStart(), m_frameIndex, m_rtvDescriptorSize);
-    m_commandList->OMSetRenderTargets(1, &rtvHandle, FALSE, nullptr);
-
-    m_commandList->RSSetViewports(1, &m_viewport);
-    m_commandList->RSSetScissorRects(1, &m_scissorRect);
-
-    const float clearColor[] = { 0.0f, 0.0f, 0.0f, 0.0f };
-    m_commandList->ClearRenderTargetView(rtvHandle, clearColor, 0, nullptr);
-
-    m_commandList->IASetVertexBuffers(0, 1, &m_vertexBufferView);
-    m_commandList->IASetPrimitiveTopology(D3D_PRIMITIVE_TOPOLOGY_POINTLIST);
+    const DrawPath drawPath = GetDrawPathSupported(m_drawPath) ? m_drawPath : DrawPath::GeometryShader;
 
     // current buffer index refers to the physically local buffer holding particle positions
     // use the current buffer index, then update the current buffer index for the next frame
-    const UINT srvIndex = SrvParticlePosVelo0 + m_currentBufferIndex;
-    m_currentBufferIndex = 1 - m_currentBufferIndex;
-
-    const CD3DX12_GPU_DESCRIPTOR_HANDLE srvHandle(m_srvHeap->GetGPUDescriptorHandleForHeapStart(), srvIndex, m_srvUavDescriptorSize);
-    m_commandList->SetGraphicsRootDescriptorTable(GraphicsRootSRVTable, srvHandle);
-
-    // draw things
-    m_commandList->DrawInstanced(in_numActiveParticles, 1, 0, 0);
-
-    // Draw GUI last
-    in_pParticles->DrawGUI(m_commandList.Get());
-
-    // Indicate that the back buffer will now be used to present.
-    m_commandList->ResourceBarrier(1, &CD3DX12_RESOURCE_BARRIER::Transition(m_renderTargets[m_frameIndex].Get(), D3D12_RESOURCE_STATE_RENDER_TARGET, D3D12_RESOURCE_STATE_PRESENT));
-
-    m_pTimer->EndTimer(m_commandList.Get(), static_cast<std::uint32_t>(GpuTimers::FPS));
-    m_pTimer->ResolveAllTimers(m_commandList.Get());
+    // zero-copy mode draws from the shared buffers instead
+    const UINT drawIndex = m_currentBufferIndex;
+    if (!zeroCopy)
+    {
+        m_currentBufferIndex = (m_currentBufferIndex + 1) % m_numBuffers;
+    }
 
-    ThrowIfFailed(m_commandList->Close());
+    // a job per chunk, then one to keep the drawn positions for the interpolation of the next frame
+    DrawChunk chunks[m_MAX_DRAW_CHUNKS];
+    const UINT numChunks = density ? 0 : PrepareDrawChunks(zeroCopy, packed, drawIndex, in_numActiveParticles, chunks);
+    const bool keepPrevious = !zeroCopy && !density;
+    const UINT numJobs = density ? 1 : (numChunks + (keepPrevious ? 1 : 0));
+    CreateRecordLists(numJobs);
+
+    // the GUI records on this thread, the win32 backend of imgui reads the input state of the window's thread
+    concurrency::task_group recordTasks;
+    recordTasks.run([&]() { RecordBegin(); });
+    if (density)
+    {
+        recordTasks.run([&]() { RecordDensity(0, drawPath, drawIndex); });
+    }
+    for (UINT i = 0; i < numChunks; i++)
+    {
+        recordTasks.run([&, i]() { RecordChunk(i, drawPath, packed, chunks[i]); });
+    }
+    if (keepPrevious)
+    {
+        recordTasks.run([&]() { RecordKeepPrevious(numChunks, drawIndex, packed, in_numActiveParticles); });
+    }
+    recordTasks.run_and_wait([&]() { RecordGui(in_pParticles); });
 
-    ID3D12CommandList* ppCommandLists[] = { m_commandList.Get() };
-    m_commandQueue->ExecuteCommandLists(_countof(ppCommandLists), ppCommandLists);
+    {
+        Profiler::Scope submitScope("submit");
+        ID3D12CommandList* ppCommandLists[m_MAX_DRAW_CHUNKS + 3] = { m_commandList.Get() };
+        UINT numCommandLists = 1;
+        for (UINT i = 0; i < numJobs; i++)
+        {
+            ppCommandLists[numCommandLists++] = m_recordLists[i].m_commandList.Get();
+        }
+        ppCommandLists[numCommandLists++] = m_guiCommandList.Get();
+        m_commandQueue->ExecuteCommandLists(numCommandLists, ppCommandLists);
+    }
 
     //-------------------------------------------------------------------------
     // Present the frame.
@@ -913,22 +2188,49 @@ HANDLE Render::Draw(int in_numActiveParticles, Particles* in_pParticles, UINT64&
     {
         presentFlags = DXGI_PRESENT_ALLOW_TEARING;
     }
-    ThrowIfFailed(m_swapChain->Present(syncInterval, presentFlags));
+    {
+        Profiler::Scope presentScope("present");
+        ThrowIfFailed(m_swapChain->Present(syncInterval, presentFlags));
+    }
+    UpdatePresentStatistics(syncInterval > 0);
 
     //-------------------------------------------------------------------------
     // multi-engine and multi-adapter sync
     // for host-side sync, we return a handle to the whole multi-adapter pipeline
-    // this wait(), by virtue of copy sync with compute, this also syncs render and compute
+    // this wait(), by virtue of copy sync with compute, this also syncs render and the previous simulation
     //-------------------------------------------------------------------------
-    if (!m_asyncMode)
+    if (zeroCopy)
+    {
+        // the shared fence tells the compute adapter(s) when the draw is done reading
+        m_copyFenceValue++;
+        ThrowIfFailed(Markers::Signal(m_commandQueue.Get(), m_copyFence.Get(), m_copyFenceValue, L"copy fence"));
+
+        // the next draw reads the results of the simulation that starts this frame
+        for (size_t i = 0; i < m_sharedSources.size(); i++)
+        {
+            SharedSource& source = m_sharedSources[i];
+            source.m_bufferIndex = (source.m_bufferIndex + 1) % m_numBuffers;
+            source.m_fenceValue = inout_fenceValues[i];
+            inout_fenceValues[i] = m_copyFenceValue;
+        }
+    }
+    else if (!m_asyncMode)
     {
-        ThrowIfFailed(m_commandQueue->Wait(m_copyFence.Get(), m_copyFenceValue));
-        inout_fenceValue = m_copyFenceValue;
+        ThrowIfFailed(Markers::Wait(m_commandQueue.Get(), m_copyFence.Get(), m_copyFenceValue, L"copy fence"));
+        for (auto& fenceValue : inout_fenceValues)
+        {
+            fenceValue = m_copyFenceValue;
+        }
     }
     else
     {
-        ThrowIfFailed(m_commandQueue->Wait(m_sharedComputeFence.Get(), inout_fenceValue));
-        inout_fenceValue = m_renderFenceValue;
+        // the frame ends with the simulation drawn next frame, so the host does not run ahead of the compute queue
+        // with no latency, the draw already waited for this frame's simulation
+        if (m_simulationLatency > 0)
+        {
+            ThrowIfFailed(Markers::Wait(m_commandQueue.Get(), m_sharedSources[0].m_fence.Get(), inout_fenceValues[0] - (m_simulationLatency - 1), L"compute fence"));
+        }
+        inout_fenceValues[0] = m_renderFenceValue;
     }
 
     //-------------------------------------------------------------------------
@@ -27,6 +27,8 @@
 
 #include "AdapterShared.h"
 #include <DirectXMath.h>
+#include <vector>
+#include <utility>
 #include "SimpleCamera.h"
 #include "Compute.h" // for shared handles structure
 
@@ -35,9 +37,10 @@ class ExtensionHelper;
 class Render : public AdapterShared
 {
 public:
-    Render(HWND in_hwnd, UINT in_numParticles,
+    // in_numBuffers local position buffers, must match the compute objects, see MAX_NUM_BUFFERS
+    Render(HWND in_hwnd, UINT in_numParticles, UINT in_numBuffers,
         IDXGIAdapter1* in_pAdapter,
-        bool in_useIntelCommandQueueExtension,
+        bool in_useIntelCommandQueueExtension, ThrottlePolicy in_throttlePolicy,
         bool in_fullScreen, RECT in_windowDim);
     virtual ~Render();
 
@@ -47,15 +50,56 @@ public:
     Render& operator=(Render&&) = delete;
 
     // Draw() tells Particles to draw its UI
-    // input is compute fence value. output is render fence value.
+    // input is compute fence value per shared source, before Simulate(). output is render fence value per shared source.
     // normally, in_numParticlesCopied should equal in_numActiveParticles
     // in_numParticlesCopied was added to experiment with stressing the PCI bus
-    HANDLE Draw(int in_numActiveParticles, class Particles* in_pParticles, UINT64& inout_fenceValue,
+    HANDLE Draw(int in_numActiveParticles, class Particles* in_pParticles, std::vector<UINT64>& inout_fenceValues,
         int in_numParticlesCopied);
 
     void SetParticleSize(float in_particleSize) { m_particleSize = in_particleSize; }
     void SetParticleIntensity(float in_particleIntensity) { m_particleIntensity = in_particleIntensity; }
 
+    // how particles are expanded into camera-facing quads
+    enum class DrawPath
+    {
+        GeometryShader, // a point per particle, expanded by GSParticleDraw
+        InstancedQuad,  // an instance of a 4-vertex triangle strip per particle
+        MeshShader,     // MESH_GROUP_SIZE particles per mesh shader group. requires shader model 6.5
+        Count
+    };
+    // unsupported paths fall back to DrawPath::GeometryShader
+    void SetDrawPath(DrawPath in_drawPath) { m_drawPath = in_drawPath; }
+    bool GetDrawPathSupported(DrawPath in_drawPath) const { return nullptr != m_pipelineStates[UINT(in_drawPath)]; }
+
+    // cull particles against the camera frustum in a compute pass, then draw the visible ones with ExecuteIndirect
+    // not used by the mesh shader path, nor in zero-copy mode, which draws each shared source separately
+    void SetCulling(bool in_enable) { m_culling = in_enable; }
+
+    // fixed timestep: describes the simulation submitted after this Draw(), see Compute::Simulate()
+    // in_numSteps steps, with in_fraction of a step of real time left over. the results are drawn
+    // interpolated from the previous results, in_fraction of a step from the end. in_fraction 1 draws them as they are
+    // only when copying the results: zero-copy and async compute mode draw the simulation as it is
+    void SetNextSimulation(UINT in_numSteps, float in_fraction);
+
+    //-----------------------------------------------------
+    // frame pacing with the latency waitable object of the swap chain
+    // frames presented but not yet displayed, 1 to MAX_FRAME_LATENCY. 1 has the least latency
+    void SetFrameLatency(UINT in_frameLatency);
+    UINT GetFrameLatency() const { return m_frameLatency; }
+    // blocks until the swap chain can queue another frame, e.g. before submitting the simulation of the frame
+    // the next Draw() waits itself if this was not called since the previous Draw()
+    void WaitForFrameLatency();
+
+    // from IDXGISwapChain::GetFrameStatistics(), updated after every Present()
+    struct PresentStatistics
+    {
+        bool m_valid;              // false before the first frame is displayed, or after the statistics became disjoint
+        float m_displayLatency;    // seconds from the frame latency wait to the vblank that displayed the frame
+        UINT m_numMissedRefreshes; // with vsync, vblanks that repeated the previous frame
+    };
+    const PresentStatistics& GetPresentStatistics() const { return m_presentStatistics; }
+    //-----------------------------------------------------
+
     //-----------------------------------------------------
     // used to create descriptor heap for UI
     ID3D12Device* GetDevice() const { return m_device.Get(); }
@@ -63,6 +107,9 @@ public:
     static UINT GetNumFrames() { return NUM_FRAMES; }
     //-----------------------------------------------------
 
+    // estimated video memory of the particle buffers of a render object. the shared heap belongs to the compute object
+    static UINT64 GetMemoryFootprint(UINT in_numParticles, UINT in_numBuffers, bool in_packed, bool in_density);
+
     //-----------------------------------------------------
     // Intel Command Queue Extension interfaces:
     bool GetSupportsIntelCommandQueueExtension() const;
@@ -71,7 +118,19 @@ public:
     //-----------------------------------------------------
     // for multi-adapter sharing
     HANDLE GetSharedFenceHandle() const { return m_sharedFenceHandle; }
-    void SetShared(const Compute::SharedHandles& in_sharedHandles);
+    // one set of handles per compute object. each provides a range of particles
+    void SetShared(const std::vector<Compute::SharedHandles>& in_sharedHandles);
+    // swaps the compute object of one source without waiting for the gpu, e.g. after Compute::CopyStateAsync()
+    // the range must not change. the next copy waits for in_fenceValue + [0, chunks) of the new source
+    // only with the plain copy transfer: the packed, density and zero-copy transfers are rebuilt by SetShared()
+    void ReplaceSource(UINT in_index, const Compute::SharedHandles& in_sharedHandles, UINT64 in_fenceValue);
+    bool GetReplaceSourceSupported() const { return !m_asyncMode && !m_zeroCopy && !m_packedTransfer && !m_densityTransfer; }
+
+    // draw from the shared buffers instead of copying them into local buffers. takes effect at the next SetShared()
+    // not used in async compute mode, which does not share across adapters
+    void SetZeroCopy(bool in_enable) { m_zeroCopy = in_enable; }
+    // of the most recent frame, for the compute objects that splat a density field, see Compute::SetDensityView()
+    const DirectX::XMFLOAT4X4& GetViewProjection() const { return m_viewProjection; }
     //-----------------------------------------------------
 
     //-----------------------------------------------------
@@ -79,7 +138,19 @@ public:
     ComPtr<ID3D12Fence> GetFence() const { return m_renderFence; }
     ComPtr<ID3D12Resource>* const GetBuffers() { return m_buffers; }
     UINT GetBufferIndex() const { return m_currentBufferIndex; }
-    void SetAsyncMode(bool in_enable) { m_asyncMode = in_enable; }
+    // the draw reads the simulation in_simulationLatency frames ago, see Compute::SetAsync()
+    void SetAsyncMode(bool in_enable, UINT in_simulationLatency = 1) { m_asyncMode = in_enable; m_simulationLatency = in_simulationLatency; }
+    //-----------------------------------------------------
+
+    //-----------------------------------------------------
+    // timing of the copy queue, only if the adapter supports timestamps on copy queues
+    // the copy of a chunked simulation includes the waits for the later chunks
+    bool GetCopyTimerSupported() const { return nullptr != m_pCopyTimer; }
+    const auto& GetCopyGpuTimes() const { return m_pCopyTimer->GetTimes(); }
+    const auto& GetLastCopyGpuTimes() const { return m_pCopyTimer->GetLastTimes(); }
+    const auto& GetLastCopyGpuIntervals() const { return m_pCopyTimer->GetLastIntervals(); }
+    // transferred across adapters by the most recent copy
+    UINT64 GetCopiedBytes() const { return m_copiedBytes; }
     //-----------------------------------------------------
 
     struct Particle
@@ -92,8 +163,10 @@ public:
 
 private:
     bool m_asyncMode;
+    UINT m_simulationLatency;
 
-    static constexpr std::uint32_t NUM_FRAMES = 2;
+    // one more back buffer than frames queued for display, for the frame being rendered
+    static constexpr std::uint32_t NUM_FRAMES = MAX_FRAME_LATENCY + 1;
     const UINT m_numParticles;
 
     ExtensionHelper* m_pExtensionHelper;
@@ -105,12 +178,29 @@ private:
     ComPtr<IDXGISwapChain3> m_swapChain;
     UINT m_frameIndex; // depends on NUM_FRAMES, not NUM_BUFFERS
     HANDLE m_swapChainEvent;
+    UINT m_frameLatency;
+    bool m_frameLatencyWaited; // since the previous Draw()
+    LARGE_INTEGER m_frameStart; // end of the most recent frame latency wait
+
+    // start of the frames not yet displayed, by present count
+    struct PresentRecord
+    {
+        UINT m_presentCount;
+        LARGE_INTEGER m_frameStart;
+    };
+    static constexpr UINT m_NUM_PRESENT_RECORDS = 2 * MAX_FRAME_LATENCY;
+    PresentRecord m_presentRecords[m_NUM_PRESENT_RECORDS];
+    DXGI_FRAME_STATISTICS m_previousFrameStatistics;
+    PresentStatistics m_presentStatistics;
+    LARGE_INTEGER m_performanceFrequency;
+    void UpdatePresentStatistics(bool in_vsync);
     UINT64 m_frameFenceValues[NUM_FRAMES];
     UINT64 m_renderFenceValue;
     ComPtr<ID3D12Fence> m_renderFence;
     HANDLE m_renderFenceEvent;
 
     ComPtr<ID3D12CommandAllocator> m_commandAllocators[NUM_FRAMES];
+    ComPtr<ID3D12CommandAllocator> m_guiAllocators[NUM_FRAMES];
     ComPtr<ID3D12CommandAllocator> m_copyAllocators[NUM_FRAMES];
     UINT m_rtvDescriptorSize;
     UINT m_srvUavDescriptorSize;
@@ -119,9 +209,27 @@ private:
     ComPtr<ID3D12DescriptorHeap> m_rtvHeap;
     ComPtr<ID3D12DescriptorHeap> m_srvHeap;
     ComPtr<ID3D12GraphicsCommandList> m_commandList;
+    ComPtr<ID3D12GraphicsCommandList> m_guiCommandList; // recorded in parallel with m_commandList, see Draw()
+
+    // a command list per particle job of a frame, with an allocator per frame
+    struct RecordList
+    {
+        ComPtr<ID3D12CommandAllocator> m_allocators[NUM_FRAMES];
+        ComPtr<ID3D12GraphicsCommandList> m_commandList;
+        ComPtr<ID3D12GraphicsCommandList6> m_commandList6; // for DispatchMesh(), if mesh shaders are supported
+    };
+    std::vector<RecordList> m_recordLists; // grows to the most jobs of a frame
+    // not thread safe, called before the jobs start
+    void CreateRecordLists(UINT in_numLists);
 
     ComPtr<ID3D12RootSignature> m_rootSignature;
-    ComPtr<ID3D12PipelineState> m_pipelineState;
+    // per DrawPath. null if the path is not supported
+    ComPtr<ID3D12PipelineState> m_pipelineStates[UINT(DrawPath::Count)];
+    ComPtr<ID3D12PipelineState> m_pipelineStatesPacked[UINT(DrawPath::Count)]; // decodes the packed transfer format
+    // read the particle index from the list of visible particles. not for DrawPath::MeshShader
+    ComPtr<ID3D12PipelineState> m_pipelineStatesCulled[UINT(DrawPath::Count)];
+    ComPtr<ID3D12PipelineState> m_pipelineStatesCulledPacked[UINT(DrawPath::Count)];
+    DrawPath m_drawPath;
     D3D12_VIEWPORT m_viewport;
     D3D12_RECT m_scissorRect;
 
@@ -129,53 +237,156 @@ private:
     {
         GraphicsRootCBV = 0,
         GraphicsRootSRVTable,
+        GraphicsRootDrawConstants, // cbDraw in ParticleDraw.hlsl
+        GraphicsRootVisibleSRV,    // list of visible particles, read by the culled draws
+        GraphicsRootVisibleUAV,    // list of visible particles, written by the cull pass
+        GraphicsRootCullArgsUAV,   // indirect draw arguments, written by the cull pass
+        GraphicsRootPreviousSRV,   // positions interpolated from, in the format of the SRV table
         GraphicsRootParametersCount
     };
 
-    // "Vertex" definition for particles.
-    // Triangle vertices are generated by the geometry shader.
-    // Color data will be assigned to those vertices via this struct.
-    struct ParticleVertex
-    {
-        DirectX::XMFLOAT4 color;
-    };
-
-    // Position and velocity data for the particles in the system.
-    // Two buffers full of Particle data are utilized in this sample.
-    // The compute thread alternates writing to each of them.
-    // The render thread renders using the buffer that is not currently
-    // in use by the compute shader.
+    // Position data for the particles in the system.
+    // A ring of m_numBuffers buffers full of Particle data is utilized in this sample.
+    // The copy (or the compute, in async mode) writes the buffer drawn next frame.
+    // The render thread renders using a buffer that is not currently
+    // in use by the copy or the compute shader.
 
     struct ConstantBufferGS
     {
         DirectX::XMFLOAT4X4 worldViewProjection;
         DirectX::XMFLOAT4X4 inverseView;
+        DirectX::XMFLOAT4 frustumPlanes[6]; // for the cull pass
+        DirectX::XMFLOAT4 palette[2]; // particle color at rest and at full acceleration
         float particleSize;
         float particleIntensity;
+        UINT packedHeadersSize;
+        float interpolation; // from the previous positions to the drawn positions, see SetNextSimulation()
+        float densityIntensity; // opacity per particle counted in the density field
         // Constant buffers are 256-byte aligned in GPU memory. Padding is added
         // for convenience when computing the struct's size.
-        float padding[32-1-1];
+        float padding[96-24-8-1-1-1-1-1];
     };
 
-    ComPtr<ID3D12Resource> m_vertexBuffer;
-    ComPtr<ID3D12Resource> m_vertexBufferUpload;
-    D3D12_VERTEX_BUFFER_VIEW m_vertexBufferView;
-
-    static constexpr UINT m_NUM_BUFFERS = 2;
-    ComPtr<ID3D12Resource> m_buffers[m_NUM_BUFFERS];
+    const UINT m_numBuffers;
+    ComPtr<ID3D12Resource> m_buffers[MAX_NUM_BUFFERS];
     UINT64 m_bufferSize;
 
-    // ping-pong buffer index
+    // destination of the copy when the compute adapter(s) provide the packed transfer format
+    ComPtr<ID3D12Resource> m_packedBuffers[MAX_NUM_BUFFERS];
+    bool m_packedTransfer;
+    // the packed ring is evicted while the sources do not provide the packed format
+    bool m_packedResident;
+    // the gpu must be idle
+    void UpdateResidency();
+
+    // SRVs onto the shared buffers, see SetZeroCopy()
+    bool m_zeroCopy;
+    void CreateSharedViews();
+
+    //-----------------------------------------------------
+    // density field transfer, when every source provides it, see Compute::SetDensityField()
+    // the copy gathers the field of each source into a slice, and its near particles into a range of DENSITY_NEAR_PARTICLES
+    bool m_densityTransfer;
+    // the density textures and near particles are evicted while the sources do not provide the field, see UpdateResidency()
+    bool m_densityResident;
+    ComPtr<ID3D12Resource> m_densityTextures[MAX_NUM_BUFFERS];
+    ComPtr<ID3D12Resource> m_nearParticles[MAX_NUM_BUFFERS];
+    ComPtr<ID3D12PipelineState> m_densityState;
+    // composites the fields of buffer in_bufferIndex, then draws the near particles as sprites
+    void DrawDensity(const RecordList& in_list, DrawPath in_drawPath, UINT in_bufferIndex);
+    //-----------------------------------------------------
+
+    // ring buffer index, drawn next frame
     UINT m_currentBufferIndex;
 
+    //-----------------------------------------------------
+    // fixed timestep interpolation, see SetNextSimulation()
+    struct Simulation
+    {
+        UINT m_numSteps;
+        float m_fraction;
+    };
+    Simulation m_simulations[MAX_NUM_BUFFERS]; // of the results in each local buffer
+
+    // copy of a local buffer, the results before the most recent steps
+    ComPtr<ID3D12Resource> m_previousPositions;
+    bool m_previousValid;
+    bool m_previousPacked;
+    UINT m_previousNumSteps; // steps from m_previousPositions to the buffer drawn this frame
+    float m_interpolation;
+
+    bool GetInterpolationSupported() const { return !m_zeroCopy && !m_asyncMode && !m_densityTransfer; }
+    void UpdateInterpolation();
+    // records the copy of the drawn buffer into m_previousPositions, if the buffer drawn next is further simulated
+    void KeepPreviousPositions(ID3D12GraphicsCommandList* in_pCommandList, UINT in_bufferIndex, bool in_packed, int in_numActiveParticles);
+    //-----------------------------------------------------
+
     ComPtr<ID3D12Resource> m_constantBufferGS;
     UINT8* m_pConstantBufferGSData; // re-used across device changes. destroy!
     SimpleCamera m_camera;
     float m_aspectRatio;
+    DirectX::XMFLOAT4X4 m_viewProjection;
 
     void UpdateCamera();
 
-    void CreateVertexBuffer();
+    // compiles the mesh shader path with dxc, if the device supports it
+    void CreateMeshPipelineStates(const D3D12_BLEND_DESC& in_blendDesc, const D3D12_DEPTH_STENCIL_DESC& in_depthStencilDesc);
+
+    //-----------------------------------------------------
+    // parallel recording, see Draw() and RecordList
+    // the chunks of the copy, or of the shared buffers in zero-copy mode, are drawn by a job each
+    // so the cull pass of a chunk only covers its range of particles
+    static constexpr UINT m_MAX_DRAW_CHUNKS = MAX_SHARED_SOURCES * MAX_SIMULATION_CHUNKS;
+    struct DrawChunk
+    {
+        UINT m_firstParticle;
+        UINT m_numParticles;
+        D3D12_GPU_DESCRIPTOR_HANDLE m_srvHandle; // of the particle table
+        ID3D12Resource* m_pShared; // zero-copy: the shared buffer, transitioned around the draw. otherwise null
+    };
+    // the chunks of the buffer in_bufferIndex, or of the most recent shared buffers in zero-copy mode
+    // in zero-copy mode, also queues the waits on the compute fences
+    UINT PrepareDrawChunks(bool in_zeroCopy, bool in_packed, UINT in_bufferIndex, int in_numActiveParticles, DrawChunk* out_pChunks);
+
+    // the passes of a frame, each records and closes its own command list, executed in this order:
+    // m_commandList clears the back buffer, a list per chunk draws its particles (or the density field),
+    // a list copies the previous positions, m_guiCommandList draws the GUI and resolves the timers
+    void RecordBegin();
+    // sets the root signature, the bindings shared by every draw, and the render target
+    void BeginParticles(const RecordList& in_list, ID3D12PipelineState* in_pPipelineState, DrawPath in_drawPath);
+    void RecordChunk(UINT in_listIndex, DrawPath in_drawPath, bool in_packed, const DrawChunk& in_chunk);
+    void RecordDensity(UINT in_listIndex, DrawPath in_drawPath, UINT in_bufferIndex);
+    void RecordKeepPrevious(UINT in_listIndex, UINT in_bufferIndex, bool in_packed, int in_numActiveParticles);
+    void RecordGui(Particles* in_pParticles);
+
+    // records the draw of a range of particles with the current draw path
+    void DrawParticles(const RecordList& in_list, DrawPath in_drawPath, UINT in_firstParticle, UINT in_numParticles);
+    //-----------------------------------------------------
+
+    //-----------------------------------------------------
+    // frustum culling, see SetCulling()
+    bool m_culling;
+    ComPtr<ID3D12PipelineState> m_cullState;
+    ComPtr<ID3D12PipelineState> m_cullStatePacked;
+    ComPtr<ID3D12CommandSignature> m_cullCommandSignature;
+    ComPtr<ID3D12Resource> m_visibleParticles;
+    ComPtr<ID3D12Resource> m_cullArgs; // CullDrawArguments per list of a frame, up to m_MAX_DRAW_CHUNKS
+    ComPtr<ID3D12Resource> m_cullArgsReset; // initial value of an element of m_cullArgs, copied before every cull pass
+
+    // the cull pass adds the number of visible particles to the count of both draws, see ParticleCullCS.hlsl
+    struct CullDrawArguments
+    {
+        D3D12_DRAW_ARGUMENTS m_points; // DrawPath::GeometryShader, m_points.VertexCountPerInstance is the count
+        D3D12_DRAW_ARGUMENTS m_quads;  // DrawPath::InstancedQuad, m_quads.InstanceCount is the count
+    };
+
+    void CreateCullResources();
+    // records the cull pass over a range of the particle table in_srvHandle, then the indirect draw
+    // the visible particles are listed at the same range of m_visibleParticles, counted in element in_argsIndex of m_cullArgs
+    void DrawCulled(const RecordList& in_list, DrawPath in_drawPath, bool in_packed, D3D12_GPU_DESCRIPTOR_HANDLE in_srvHandle,
+        UINT in_firstParticle, UINT in_numParticles, UINT in_argsIndex);
+    //-----------------------------------------------------
+
     void CreateParticleBuffers();
 
     void CreateCommandQueue(); // calls CreateSwapChain() because swap chain depends on command queue
@@ -190,10 +401,46 @@ private:
     ComPtr<ID3D12GraphicsCommandList> m_copyList;
     ComPtr<ID3D12Fence> m_copyFence;
     UINT64 m_copyFenceValue;
+    D3D12GpuTimer* m_pCopyTimer;
+    UINT64 m_copiedBytes;
+
+    void CopySimulationResults(const std::vector<UINT64>& in_fenceValues, int in_numActiveParticles);
 
-    void CopySimulationResults(UINT64 in_fenceValue, int in_numActiveParticles);
-    ComPtr<ID3D12Resource> m_sharedBuffers[m_NUM_BUFFERS];
-    UINT m_sharedBufferIndex;
+    // copy the headers of the blocks and the particles of [in_firstParticle, in_lastParticle)
+    // returns the bytes copied
+    UINT64 CopyPackedRange(ID3D12GraphicsCommandList* in_pCommandList,
+        ID3D12Resource* in_pDst, ID3D12Resource* in_pSrc,
+        UINT in_firstParticle, UINT in_lastParticle);
+
+    // simulation results from a compute object, which may be for a subset of the particles
+    struct SharedSource
+    {
+        ComPtr<ID3D12Resource> m_buffers[MAX_NUM_BUFFERS];
+        ComPtr<ID3D12Resource> m_packedBuffers[MAX_NUM_BUFFERS];
+        ComPtr<ID3D12Resource> m_densityResources[MAX_NUM_BUFFERS]; // row-major textures if m_densityRowMajor, otherwise buffers
+        ComPtr<ID3D12Resource> m_nearBuffers[MAX_NUM_BUFFERS];
+        bool m_densityRowMajor;
+        ComPtr<ID3D12Fence> m_fence;
+        UINT m_bufferIndex;
+        UINT m_firstParticle;
+        UINT m_numParticles;
+
+        // the simulation is copied in chunks, which signal m_fenceValue + [0, m_numChunks)
+        UINT m_numChunks;
+        UINT64 m_fenceValue; // first chunk of the simulation the next copy reads
+    };
+    std::vector<SharedSource> m_sharedSources;
+    // opens the shared heap and fence of a compute object. the copy state is left to the caller
+    void OpenSharedSource(SharedSource& out_source, const Compute::SharedHandles& in_sharedHandles);
+
+    // sources replaced by ReplaceSource(), released once the copy queue reaches the fence value
+    std::vector<std::pair<UINT64, SharedSource>> m_retiredSources;
+    void ReleaseRetiredSources();
+
+    // copy the density field and the near particles of buffer in_srcIndex of a source into slice in_slice of local buffer in_dstIndex
+    // returns the bytes copied
+    UINT64 CopyDensity(ID3D12GraphicsCommandList* in_pCommandList, UINT in_dstIndex,
+        const SharedSource& in_source, UINT in_srcIndex, UINT in_slice);
 
     bool m_fullScreen;
     bool m_windowedSupportsTearing;
@@ -202,6 +449,4 @@ private:
     HANDLE m_sharedFenceHandle;
     float m_particleSize;
     float m_particleIntensity;
-
-    ComPtr<ID3D12Fence> m_sharedComputeFence;
 };
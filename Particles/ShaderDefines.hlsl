@@ -0,0 +1,44 @@
+//*********************************************************
+//
+// Copyright 2020 Intel Corporation 
+//
+// Permission is hereby granted, free of charge, to any 
+// person obtaining a copy of this software and associated 
+// documentation files(the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights 
+// to use, copy, modify, merge, publish, distribute, sublicense, 
+// and/or sell copies of the Software, and to permit persons to 
+// whom the Software is furnished to do so, subject to the 
+// following conditions :
+// The above copyright notice and this permission notice shall 
+// be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+// DEALINGS IN THE SOFTWARE.
+//
+//*********************************************************
+
+// the project defines under the names used by the shaders, see defines.h
+// every shader includes this, so the offline compile (Shaders.targets) and PipelineCache::CompileShader() agree
+#include "defines.h"
+
+#define blocksize BLOCK_SIZE
+#define griddim GRID_DIM
+#define gridlevels GRID_LEVELS
+#define gridextent GRID_EXTENT
+#define packblocksize PACK_BLOCK_SIZE
+#define packheadersize PACK_HEADER_SIZE
+#define packparticlesize PACK_PARTICLE_SIZE
+#define packmaxacceleration PACK_MAX_ACCELERATION
+#define lodlevels LOD_LEVELS
+#define densitywidth DENSITY_WIDTH
+#define densityheight DENSITY_HEIGHT
+#define densitynearparticles DENSITY_NEAR_PARTICLES
+#define meshgroupsize MESH_GROUP_SIZE
+#define cullblocksize CULL_BLOCK_SIZE
@@ -0,0 +1,152 @@
+//*********************************************************
+//
+// Copyright 2020 Intel Corporation 
+//
+// Permission is hereby granted, free of charge, to any 
+// person obtaining a copy of this software and associated 
+// documentation files(the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights 
+// to use, copy, modify, merge, publish, distribute, sublicense, 
+// and/or sell copies of the Software, and to permit persons to 
+// whom the Software is furnished to do so, subject to the 
+// following conditions :
+// The above copyright notice and this permission notice shall 
+// be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+// DEALINGS IN THE SOFTWARE.
+//
+//*********************************************************
+#include <cassert>
+#include <fstream>
+
+#include "Snapshot.h"
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+Snapshot::Snapshot()
+    : m_file(INVALID_HANDLE_VALUE)
+    , m_mapping(nullptr)
+    , m_pView(nullptr)
+    , m_pHeader(nullptr)
+    , m_pData(nullptr)
+{
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+Snapshot::Snapshot(const Header& in_layout)
+    : Snapshot()
+{
+    const std::uint64_t dataSize = std::uint64_t(in_layout.m_numParticles) *
+        (in_layout.m_positionStride + std::uint64_t(in_layout.m_velocityNumStreams) * in_layout.m_velocityStride);
+    m_storage.resize(size_t(sizeof(Header) + dataSize));
+
+    m_pHeader = reinterpret_cast<Header*>(m_storage.data());
+    *m_pHeader = in_layout;
+    m_pHeader->m_magic = m_MAGIC;
+    m_pHeader->m_version = m_VERSION;
+    m_pData = m_storage.data() + sizeof(Header);
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+Snapshot::~Snapshot()
+{
+    Unmap();
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+void Snapshot::Unmap()
+{
+    if (m_pView)
+    {
+        ::UnmapViewOfFile(m_pView);
+        m_pView = nullptr;
+    }
+    if (m_mapping)
+    {
+        ::CloseHandle(m_mapping);
+        m_mapping = nullptr;
+    }
+    if (INVALID_HANDLE_VALUE != m_file)
+    {
+        ::CloseHandle(m_file);
+        m_file = INVALID_HANDLE_VALUE;
+    }
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+bool Snapshot::Load(const std::wstring& in_path)
+{
+    Unmap();
+    m_storage.clear();
+    m_pHeader = nullptr;
+    m_pData = nullptr;
+
+    m_file = ::CreateFileW(in_path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+    LARGE_INTEGER fileSize = {};
+    if ((INVALID_HANDLE_VALUE == m_file) || (!::GetFileSizeEx(m_file, &fileSize)) || (UINT64(fileSize.QuadPart) < sizeof(Header)))
+    {
+        Unmap();
+        return false;
+    }
+
+    m_mapping = ::CreateFileMappingW(m_file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    m_pView = m_mapping ? ::MapViewOfFile(m_mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+    if (nullptr == m_pView)
+    {
+        Unmap();
+        return false;
+    }
+
+    // the view is read-only, the snapshot never writes through these
+    Header* pHeader = const_cast<Header*>(static_cast<const Header*>(m_pView));
+    const std::uint64_t dataSize = std::uint64_t(pHeader->m_numParticles) *
+        (pHeader->m_positionStride + std::uint64_t(pHeader->m_velocityNumStreams) * pHeader->m_velocityStride);
+    if ((m_MAGIC != pHeader->m_magic) || (m_VERSION != pHeader->m_version) ||
+        ((sizeof(Header) + dataSize) > std::uint64_t(fileSize.QuadPart)))
+    {
+        Unmap();
+        return false;
+    }
+
+    m_pHeader = pHeader;
+    m_pData = reinterpret_cast<std::uint8_t*>(pHeader + 1);
+    return true;
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+bool Snapshot::Save(const std::wstring& in_path) const
+{
+    assert(GetValid());
+
+    std::ofstream file(in_path, std::ios::binary | std::ios::trunc);
+    if (!file)
+    {
+        return false;
+    }
+
+    file.write(reinterpret_cast<const char*>(m_pHeader), sizeof(Header));
+    file.write(reinterpret_cast<const char*>(m_pData), std::streamsize(GetPositionsSize() + GetVelocitiesSize()));
+    return bool(file);
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+bool Snapshot::GetSameLayout(const Header& in_a, const Header& in_b)
+{
+    return (in_a.m_numParticles == in_b.m_numParticles) &&
+        (in_a.m_positionStride == in_b.m_positionStride) &&
+        (in_a.m_velocityNumStreams == in_b.m_velocityNumStreams) &&
+        (in_a.m_velocityStride == in_b.m_velocityStride);
+}
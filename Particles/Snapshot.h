@@ -0,0 +1,105 @@
+//*********************************************************
+//
+// Copyright 2020 Intel Corporation 
+//
+// Permission is hereby granted, free of charge, to any 
+// person obtaining a copy of this software and associated 
+// documentation files(the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights 
+// to use, copy, modify, merge, publish, distribute, sublicense, 
+// and/or sell copies of the Software, and to permit persons to 
+// whom the Software is furnished to do so, subject to the 
+// following conditions :
+// The above copyright notice and this permission notice shall 
+// be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+// DEALINGS IN THE SOFTWARE.
+//
+//*********************************************************
+#pragma once
+
+#include <Windows.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+/*======================================================
+Snapshot
+
+Binary particle state: a header, then the positions and the velocities
+in the layout of the GPU buffers, so loading is a single copy per array
+
+Load() maps the file instead of reading it. Compute::LoadState() copies
+the mapped view straight into an upload buffer, so a snapshot of 4M particles
+does not pass through any intermediate system memory, and skips the generation of the galaxies.
+
+Usage: pass Compute::GetSnapshotLayout() to the constructor, fill it with Compute::ReadState(), then Save()
+======================================================*/
+class Snapshot
+{
+public:
+    struct Header
+    {
+        std::uint32_t m_magic;
+        std::uint32_t m_version;
+        std::uint32_t m_numParticles;
+        std::uint32_t m_positionStride;
+        std::uint32_t m_velocityNumStreams; // each stream holds m_numParticles elements of m_velocityStride bytes
+        std::uint32_t m_velocityStride;
+        std::uint64_t m_step; // simulation steps since the particles were generated
+    };
+
+    // invalid until Load()
+    Snapshot();
+    // zeroed arrays for the layout. the magic and version are set here
+    explicit Snapshot(const Header& in_layout);
+    ~Snapshot();
+
+    Snapshot(const Snapshot&) = delete;
+    Snapshot(Snapshot&&) = delete;
+    Snapshot& operator=(const Snapshot&) = delete;
+    Snapshot& operator=(Snapshot&&) = delete;
+
+    // returns false if the file does not exist, is truncated, or is not a snapshot
+    bool Load(const std::wstring& in_path);
+    bool Save(const std::wstring& in_path) const;
+
+    bool GetValid() const { return nullptr != m_pHeader; }
+    const Header& GetHeader() const { return *m_pHeader; }
+    void SetStep(std::uint64_t in_step) { m_pHeader->m_step = in_step; }
+
+    // layouts match if everything but the step matches
+    static bool GetSameLayout(const Header& in_a, const Header& in_b);
+
+    const std::uint8_t* GetPositions() const { return m_pData; }
+    const std::uint8_t* GetVelocities() const { return m_pData + GetPositionsSize(); }
+    std::uint8_t* GetPositions() { return m_pData; }
+    std::uint8_t* GetVelocities() { return m_pData + GetPositionsSize(); }
+    std::uint64_t GetPositionsSize() const { return std::uint64_t(m_pHeader->m_numParticles) * m_pHeader->m_positionStride; }
+    std::uint64_t GetVelocitiesSize() const { return std::uint64_t(m_pHeader->m_numParticles) * m_pHeader->m_velocityNumStreams * m_pHeader->m_velocityStride; }
+
+private:
+    static constexpr std::uint32_t m_MAGIC = 0x534d5041; // "APMS"
+    static constexpr std::uint32_t m_VERSION = 1;
+
+    // created snapshots
+    std::vector<std::uint8_t> m_storage;
+
+    // loaded snapshots
+    HANDLE m_file;
+    HANDLE m_mapping;
+    const void* m_pView;
+
+    // into m_storage or the view. the view is read-only, GetPositions() and GetVelocities() must not write it
+    Header* m_pHeader;
+    std::uint8_t* m_pData;
+
+    void Unmap();
+};
@@ -0,0 +1,146 @@
+//*********************************************************
+//
+// Copyright 2020 Intel Corporation 
+//
+// Permission is hereby granted, free of charge, to any 
+// person obtaining a copy of this software and associated 
+// documentation files(the "Software"), to deal in the Software 
+// without restriction, including without limitation the rights 
+// to use, copy, modify, merge, publish, distribute, sublicense, 
+// and/or sell copies of the Software, and to permit persons to 
+// whom the Software is furnished to do so, subject to the 
+// following conditions :
+// The above copyright notice and this permission notice shall 
+// be included in all copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, 
+// EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF 
+// MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+// NONINFRINGEMENT.IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT 
+// HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, 
+// WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, 
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER 
+// DEALINGS IN THE SOFTWARE.
+//
+//*********************************************************
+#pragma once
+
+#include <Windows.h>
+#include <algorithm>
+
+#include "ExtensionHelper.h"
+
+/*======================================================
+ThrottleGovernor
+
+Chooses the throttle policy of a queue created with the Intel command queue extension
+from how much of the frame the queue is busy.
+
+With headroom, Dynamic lets the gpu run just fast enough, e.g. to save power on battery.
+Once the queue is busy for most of the frame, MaxPerformance keeps it from becoming the bottleneck:
+    busy < m_DYNAMIC_LOAD * frame                  -> Dynamic
+    busy > m_MAX_PERFORMANCE_LOAD * frame          -> MaxPerformance
+with vsync, the frame time is the refresh interval, so this is the budget of the frame
+
+Usage: call Update() once per frame with the latest (averaged) times
+if it returns true, recreate the queue with GetPolicy()
+
+Dynamic lowers the clocks, so the busy time grows after switching to it.
+If that leaves too little headroom, Dynamic is retried after a back-off that doubles
+every time, so a load that only fits at MaxPerformance does not keep switching.
+======================================================*/
+class ThrottleGovernor
+{
+public:
+    ThrottleGovernor();
+
+    // times in seconds. returns true if the policy changed
+    bool Update(float in_busyTime, float in_frameTime);
+
+    ThrottlePolicy GetPolicy() const { return m_policy; }
+
+    // the queue or its timers were recreated, e.g. on another adapter. restarts the cooldown
+    void Restart() { SetPolicy(m_policy); }
+
+private:
+    // frames to wait after a change. must exceed the gpu timer averaging window
+    static constexpr UINT m_COOLDOWN_FRAMES = 120;
+    // longest back-off before retrying Dynamic
+    static constexpr UINT m_MAX_RETRY_FRAMES = m_COOLDOWN_FRAMES * 32;
+    // fractions of the frame the queue is busy
+    static constexpr float m_DYNAMIC_LOAD = 0.5f;
+    static constexpr float m_MAX_PERFORMANCE_LOAD = 0.8f;
+
+    ThrottlePolicy m_policy;
+    UINT m_cooldown;
+    UINT m_retryFrames; // back-off after Dynamic ran out of headroom
+    UINT m_numDynamicFrames; // in Dynamic since the last change
+
+    void SetPolicy(ThrottlePolicy in_policy);
+};
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+inline ThrottleGovernor::ThrottleGovernor()
+    : m_policy(ThrottlePolicy::MaxPerformance)
+    , m_cooldown(m_COOLDOWN_FRAMES)
+    , m_retryFrames(m_COOLDOWN_FRAMES)
+    , m_numDynamicFrames(0)
+{
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+inline void ThrottleGovernor::SetPolicy(ThrottlePolicy in_policy)
+{
+    m_policy = in_policy;
+    m_cooldown = m_COOLDOWN_FRAMES;
+    m_numDynamicFrames = 0;
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+inline bool ThrottleGovernor::Update(float in_busyTime, float in_frameTime)
+{
+    if (ThrottlePolicy::Dynamic == m_policy)
+    {
+        m_numDynamicFrames++;
+
+        // Dynamic held up for as long as the longest back-off, the load has probably changed
+        if (m_numDynamicFrames > m_MAX_RETRY_FRAMES)
+        {
+            m_retryFrames = m_COOLDOWN_FRAMES;
+        }
+    }
+
+    // wait for the timers to reflect the current policy
+    if (m_cooldown > 0)
+    {
+        m_cooldown--;
+        return false;
+    }
+
+    if ((in_frameTime <= 0) || (in_busyTime <= 0))
+    {
+        return false;
+    }
+
+    const float load = in_busyTime / in_frameTime;
+    if ((ThrottlePolicy::MaxPerformance == m_policy) && (load < m_DYNAMIC_LOAD))
+    {
+        SetPolicy(ThrottlePolicy::Dynamic);
+        return true;
+    }
+
+    if ((ThrottlePolicy::Dynamic == m_policy) && (load > m_MAX_PERFORMANCE_LOAD))
+    {
+        const UINT retryFrames = m_retryFrames;
+        m_retryFrames = std::min(m_retryFrames * 2, m_MAX_RETRY_FRAMES);
+
+        SetPolicy(ThrottlePolicy::MaxPerformance);
+        m_cooldown = std::max(m_cooldown, retryFrames);
+        return true;
+    }
+
+    return false;
+}
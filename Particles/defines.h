@@ -36,10 +36,85 @@
 // compute shader block size
 #define BLOCK_SIZE 64
 
+// uniform grid used to accelerate the n-body simulation
+// the finest level has GRID_DIM^3 cells, each coarser level halves the dimension
+// particles outside of +/- GRID_EXTENT are clamped to the border cells
+#define GRID_DIM 64
+#define GRID_LEVELS 5
+#define GRID_EXTENT 2048.0f
+
+// packed transfer format: positions quantized to 16 bits relative to the bounds of each block of particles
+// each block has a 32 byte header, followed later by 8 bytes per particle
+#define PACK_BLOCK_SIZE 256
+#define PACK_HEADER_SIZE 32
+#define PACK_PARTICLE_SIZE 8
+// acceleration magnitudes above this are clamped. the vertex shader fades color over 0..9
+#define PACK_MAX_ACCELERATION 16.0f
+
+// default layout of the velocities on the GPU, -velocitysoa selects the other, see Compute::SetVelocitySoa()
+// 0: one float4 per particle, w unused, so loads are 16-byte aligned and the stride matches the positions
+// 1: structure-of-arrays, separate x[], y[] and z[] arrays of floats
+#define VELOCITY_SOA 0
+
+// number of position buffers shared between compute and render, and of local buffers on the render adapter
+// 2 is ping-pong. more buffers let the compute adapter fall behind without stalling the render adapter, for more latency
+#define MIN_NUM_BUFFERS 2
+#define MAX_NUM_BUFFERS 4
+
+// frames the cpu may queue ahead of the display, see Render::SetFrameLatency()
+#define MAX_FRAME_LATENCY 3
+
+// compute objects that provide particles to the render adapter, see Render::SetShared()
+// the compute adapter, up to MAX_SHARED_SOURCES - 2 extra compute adapters, and the split simulation on the render adapter
+#define MAX_SHARED_SOURCES 4
+
+// Simulate() can be split into chunks, each signalling the compute fence, so the copy of a chunk overlaps the next one
+#define MAX_SIMULATION_CHUNKS 16
+
+// fixed timestep: each step advances the simulation by SIMULATION_TIMESTEP, at a rate in steps per second of real time
+// steps per frame are clamped, so a simulation that cannot keep up slows down instead of taking ever longer frames
+#define SIMULATION_TIMESTEP 0.1f
+#define DEFAULT_SIMULATION_RATE 60
+#define MAX_SIMULATION_RATE 240
+#define MAX_SIMULATION_STEPS 4
+
+// initial tunables of the force model, see Compute::SimulationParameters
+#define SIMULATION_DAMPING 1.0f
+#define SIMULATION_MASS 70000.0f
+#define SIMULATION_SOFTENING 5.0f
+
+// temporal level of detail: particles with little acceleration are stepped at 1/2, 1/4, ... of the rate, with a longer timestep
+// a particle below LOD_ACCELERATION is stepped every 2nd step, below a quarter of it every 4th step, up to LOD_LEVELS - 1
+#define LOD_LEVELS 3
+#define LOD_ACCELERATION 1.0f
+
+// density field transfer: the compute adapter counts the particles per texel of a low-resolution screen-space grid
+// with the camera of the render adapter, which draws the counts instead of a sprite per particle
+// rows are DENSITY_WIDTH * 4 bytes, a multiple of D3D12_TEXTURE_DATA_PITCH_ALIGNMENT, so texture and buffer copies agree
+#define DENSITY_WIDTH 512
+#define DENSITY_HEIGHT 288
+// particles closer to the camera than the near distance are still drawn as sprites, up to this many per compute object
+#define DENSITY_NEAR_PARTICLES (64 * 1024)
+#define DENSITY_NEAR_DISTANCE 200.0f
+// opacity of the field per particle counted, scaled by the particle intensity
+#define DENSITY_INTENSITY 0.05f
+
+// particles expanded by one mesh shader thread group
+#define MESH_GROUP_SIZE 32
+
+// particles tested against the view frustum by one cull thread group
+#define CULL_BLOCK_SIZE 128
+
 #define INITIAL_PARTICLE_SPEED 15.0f
 #define INITIAL_PARTICLE_SIZE 2.5f
 #define INITIAL_PARTICLE_INTENSITY 0.15f
 #define PARTICLE_SPREAD 400.0f
+// the initial particles only depend on the seed, see LoadParticles()
+#define INITIAL_PARTICLE_SEED 0x5EED
+// 1: generate the initial particles with a compute shader, straight into the GPU buffers
+// 0: generate them on the CPU with LoadParticles() and upload them
+// the default, -gpuinit selects the other, see Compute::SetInitializeOnGpu()
+#define INITIALIZE_PARTICLES_ON_GPU 1
 
 #define MIN_NUM_PARTICLES 256*1024
 #define MAX_NUM_PARTICLES (4 * 1024 * 1024)
\ No newline at end of file
@@ -34,8 +34,28 @@
 // DEALINGS IN THE SOFTWARE.
 //
 //*********************************************************
-static float softeningSquared = 25;
-static float g_fParticleMass = 70000;
+
+#include "ShaderDefines.hlsl"
+
+// rewritten every simulation, see Compute::UpdateConstants()
+cbuffer cbCS : register(b0)
+{
+    uint4   g_param;    // param[0] = number of particles, the stride of the velocity streams
+                        // param[1] = number of tiles of active particles
+                        // param[2] = first particle of the second cluster, for CSInitParticles
+                        // param[3] = seed, for CSInitParticles
+    float4  g_paramf;   // paramf[0] = deltaTime
+                        // paramf[1] = damping
+                        // paramf[2] = mass of the gravity well
+                        // paramf[3] = softening squared
+    float4  g_initf;    // CSInitParticles only, see Compute::GenerateParticles()
+                        // initf[0] = distance of the clusters from the origin
+                        // initf[1] = spread
+                        // initf[2] = initial speed
+    float4  g_lodf;     // lodf[0] = acceleration below which particles are stepped every 2nd step, see LOD_LEVELS
+    row_major float4x4 g_densityViewProj; // camera of the render adapter, see CSSplatDensity
+    float4  g_densityf; // densityf[0] = distance below which particles are listed instead of splatted
+};
 
 //
 // Body to body interaction, acceleration of the particle at position 
@@ -46,7 +66,7 @@ void bodyBodyInteraction(inout float3 ai, float4 bj, float4 bi, float mass, int
     float3 r = bj.xyz - bi.xyz;
 
     float distSqr = dot(r, r);
-    distSqr += softeningSquared;
+    distSqr += g_paramf.w;  // softening
 
     float invDist = 1.0f / sqrt(distSqr);
     float invDistCube =  invDist * invDist * invDist;
@@ -56,12 +76,13 @@ void bodyBodyInteraction(inout float3 ai, float4 bj, float4 bi, float mass, int
     ai += r * s;
 }
 
-cbuffer cbCS : register(b0)
+// root constants, may change every dispatch
+cbuffer cbPass : register(b1)
 {
-    uint4   g_param;    // param[0] = MAX_PARTICLES;
-                        // param[1] = dimx;
-    float4  g_paramf;   // paramf[0] = 0.1f;
-                        // paramf[1] = 1; 
+    uint4   g_pass;     // pass[0] = level for CSReduceGrid, the step for the lod passes
+                        // pass[1] = number of active particles
+                        // pass[2] = first particle simulated
+                        // pass[3] = end of the particles simulated
 };
 
 struct Position
@@ -69,30 +90,144 @@ struct Position
     float4 pos;
 };
 
-struct Velocity
-{
-    float3 velocity;
-};
-
 RWStructuredBuffer<Position> oldPosition    : register(u1);
 RWStructuredBuffer<Position> newPosition    : register(u0);
 
-RWStructuredBuffer<Velocity> oldVelocity  : register(u4);
-RWStructuredBuffer<Velocity> newVelocity  : register(u3);
+// a permutation, see Compute::SetVelocitySoa()
+#if velocitysoa
+// each array holds g_param.x floats
+RWStructuredBuffer<float> oldVelocity  : register(u4);
+RWStructuredBuffer<float> newVelocity  : register(u3);
+
+float3 LoadVelocity(uint index)
+{
+    return float3(oldVelocity[index], oldVelocity[g_param.x + index], oldVelocity[(2 * g_param.x) + index]);
+}
+
+void StoreVelocity(uint index, float3 vel)
+{
+    newVelocity[index] = vel.x;
+    newVelocity[g_param.x + index] = vel.y;
+    newVelocity[(2 * g_param.x) + index] = vel.z;
+}
+#else
+RWStructuredBuffer<float4> oldVelocity  : register(u4);
+RWStructuredBuffer<float4> newVelocity  : register(u3);
+
+float3 LoadVelocity(uint index)
+{
+    return oldVelocity[index].xyz;
+}
+
+void StoreVelocity(uint index, float3 vel)
+{
+    newVelocity[index] = float4(vel, 0);
+}
+#endif
+
+//-----------------------------------------------------------------------------
+// temporal level of detail, see LOD_LEVELS in defines.h
+// CSLodClassify carries the particles that skip the step forward, and lists the others
+// the simulate kernels compiled with lod step only the listed particles, dispatched indirectly
+//-----------------------------------------------------------------------------
+RWStructuredBuffer<uint> lodParticles : register(u11); // indices of the particles stepped
+RWByteAddressBuffer      lodArgs      : register(u12); // dispatch arguments, then the number of particles stepped
+
+#define LOD_NUM_PARTICLES_OFFSET 12
+
+// the level from the acceleration of the previous step, in pos.w
+// each level a quarter of the acceleration: for a similar error, the timestep may double
+uint GetLodLevel(float acceleration)
+{
+    uint level = 0;
+    float threshold = g_lodf.x;
+    [unroll]
+    for (uint i = 1; i < lodlevels; i++)
+    {
+        level = (acceleration < threshold) ? i : level;
+        threshold *= 0.25f;
+    }
+    return level;
+}
+
+// the acceleration at and above which a particle is at most at the level, see GetLodLevel()
+float GetLodThreshold(uint level)
+{
+    float threshold = g_lodf.x;
+    [unroll]
+    for (uint i = 0; i < lodlevels; i++)
+    {
+        threshold = (i < level) ? (threshold * 0.25f) : threshold;
+    }
+    return threshold;
+}
+
+// particles of a level are spread across the steps by their index, so every step has a similar load
+bool GetLodActive(uint index, uint level)
+{
+    return 0 == ((g_pass.x + index) & ((1u << level) - 1));
+}
+
+// the particle of a thread of the simulate kernels. returns false past the end of the particles to step
+bool GetParticleIndex(uint thread, out uint index)
+{
+#if lod
+    const bool valid = thread < lodArgs.Load(LOD_NUM_PARTICLES_OFFSET);
+    index = valid ? lodParticles[thread] : 0;
+    return valid;
+#else
+    index = g_pass.z + thread;
+    return index < g_pass.w;
+#endif
+}
+
+// apply acceleration then write the new particle state
+// with lod, a particle of level n covers the 2^n steps from this one at once, and is stepped next after them
+// the level only changes at a step that starts the steps of both levels, so no step is skipped or taken twice:
+// the new level is limited by the alignment of this step, and stored for GetLodActive() by a minimum acceleration
+void Integrate(uint index, float4 pos, float3 vel, float3 accel)
+{
+    float acceleration = length(accel);
+#if lod
+    // firstbitlow(0) is ~0, every level starts at step 0
+    const uint level = min(GetLodLevel(acceleration), firstbitlow(g_pass.x + index));
+    if (level < (lodlevels - 1))
+    {
+        acceleration = max(acceleration, GetLodThreshold(level));
+    }
+    const float numSteps = float(1u << level);
+#else
+    const float numSteps = 1;
+#endif
+    const float deltaTime = g_paramf.x * numSteps;
+
+    vel.xyz += accel.xyz * deltaTime;
+    vel.xyz *= pow(g_paramf.y, numSteps);    //damping;
+    pos.xyz += vel.xyz * deltaTime;
+
+    newPosition[index].pos = float4(pos.xyz, acceleration);
+    StoreVelocity(index, vel);
+}
 
 // update particle position & velocity
 // gravity well located at 0, 0, 0
 [numthreads(blocksize, 1, 1)]
 void CSMain(uint3 DTid : SV_DispatchThreadID)
 {
-    float4 pos = oldPosition[DTid.x].pos;
-    float3 vel = oldVelocity[DTid.x].velocity;
-    float mass = g_fParticleMass;
+    uint index;
+    if (!GetParticleIndex(DTid.x, index))
+    {
+        return;
+    }
+
+    float4 pos = oldPosition[index].pos;
+    float3 vel = LoadVelocity(index);
+    float mass = g_paramf.z;
 
     float3 r = pos.xyz;
 
     float distSqr = dot(r, r);
-    distSqr += softeningSquared;
+    distSqr += g_paramf.w;  // softening
 
     float invDist = -1.0f / sqrt(distSqr);
     float invDistCube = invDist * invDist * invDist;
@@ -100,10 +235,574 @@ void CSMain(uint3 DTid : SV_DispatchThreadID)
 
     float3 accel = r * s;
 
-    vel.xyz += accel.xyz * g_paramf.x;        //deltaTime;
-    vel.xyz *= g_paramf.y;                    //damping;
-    pos.xyz += vel.xyz * g_paramf.x;          //deltaTime;
+    Integrate(index, pos, vel, accel);
+}
+
+// one tile of positions, shared by all the threads of a group
+groupshared float4 sharedPos[blocksize];
+
+// update particle position & velocity
+// O(N^2): every particle is attracted by every other particle
+// the mass of the gravity well is spread across the active particles
+// every thread of a group loads the tiles, threads past the end of the range only skip the store
+[numthreads(blocksize, 1, 1)]
+void CSMainNBody(uint3 DTid : SV_DispatchThreadID, uint GI : SV_GroupIndex)
+{
+    uint index;
+    const bool valid = GetParticleIndex(DTid.x, index);
+
+    float4 pos = oldPosition[index].pos;
+    float3 vel = LoadVelocity(index);
+    float mass = g_paramf.z / g_pass.y;
+
+    float3 accel = 0;
+
+    // g_param.y is the number of tiles of active particles
+    [loop]
+    for (uint tile = 0; tile < g_param.y; tile++)
+    {
+        // cache a tile of particles in shared memory to reduce memory traffic
+        const uint tileIndex = tile * blocksize + GI;
+        sharedPos[GI] = (tileIndex < g_pass.y) ? oldPosition[tileIndex].pos : 0;
+
+        GroupMemoryBarrierWithGroupSync();
+
+        [unroll(8)]
+        for (uint counter = 0; counter < blocksize; counter++)
+        {
+            bodyBodyInteraction(accel, sharedPos[counter], pos, mass, 1);
+        }
+
+        GroupMemoryBarrierWithGroupSync();
+    }
+
+    // g_pass.y, the number of active particles, may not be a multiple of the tile size.
+    // the last tile adds "phantom" particles at 0,0,0
+    // subtract their contribution
+    const int tooManyParticles = g_param.y * blocksize - g_pass.y;
+    bodyBodyInteraction(accel, float4(0, 0, 0, 0), pos, mass, -tooManyParticles);
+
+    if (valid)
+    {
+        Integrate(index, pos, vel, accel);
+    }
+}
+
+//-----------------------------------------------------------------------------
+// lists the particles of [pass[2], pass[3]) stepped by step pass[0], and copies the others to the new buffers,
+// so every buffer of the ring holds every particle. one atomic on the arguments per group, like CSCullParticles
+// the number of particles must be reset to 0 before, CSLodArguments then sizes the dispatch
+//-----------------------------------------------------------------------------
+groupshared uint lodGroupNumActive;
+groupshared uint lodGroupFirstActive;
+
+[numthreads(blocksize, 1, 1)]
+void CSLodClassify(uint3 DTid : SV_DispatchThreadID, uint GI : SV_GroupIndex)
+{
+    if (0 == GI)
+    {
+        lodGroupNumActive = 0;
+    }
+    GroupMemoryBarrierWithGroupSync();
+
+    const uint index = g_pass.z + DTid.x;
+    bool active = false;
+    if (index < g_pass.w)
+    {
+        const float4 pos = oldPosition[index].pos;
+        active = GetLodActive(index, GetLodLevel(pos.w));
+        if (!active)
+        {
+            newPosition[index].pos = pos;
+            StoreVelocity(index, LoadVelocity(index));
+        }
+    }
+
+    uint groupIndex = 0;
+    if (active)
+    {
+        InterlockedAdd(lodGroupNumActive, 1, groupIndex);
+    }
+    GroupMemoryBarrierWithGroupSync();
+
+    if ((0 == GI) && (0 != lodGroupNumActive))
+    {
+        uint firstActive;
+        lodArgs.InterlockedAdd(LOD_NUM_PARTICLES_OFFSET, lodGroupNumActive, firstActive);
+        lodGroupFirstActive = firstActive;
+    }
+    GroupMemoryBarrierWithGroupSync();
+
+    if (active)
+    {
+        lodParticles[lodGroupFirstActive + groupIndex] = index;
+    }
+}
+
+[numthreads(1, 1, 1)]
+void CSLodArguments()
+{
+    const uint numParticles = lodArgs.Load(LOD_NUM_PARTICLES_OFFSET);
+    lodArgs.Store3(0, uint3((numParticles + blocksize - 1) / blocksize, 1, 1));
+}
+
+//-----------------------------------------------------------------------------
+// initial particles: two clusters, the same distribution as LoadParticles() in Compute.cpp
+// counter-based rand, Philox4x32-10, so every particle only depends on its index and the seed
+//-----------------------------------------------------------------------------
+
+// 32x32 -> 64 bit product from 16 bit halves
+void MulHiLo(uint a, uint b, out uint hi, out uint lo)
+{
+    const uint a0 = a & 0xffff;
+    const uint a1 = a >> 16;
+    const uint b0 = b & 0xffff;
+    const uint b1 = b >> 16;
+    const uint p01 = a0 * b1;
+    const uint p10 = a1 * b0;
+    const uint middle = ((a0 * b0) >> 16) + (p01 & 0xffff) + (p10 & 0xffff);
+
+    hi = (a1 * b1) + (p01 >> 16) + (p10 >> 16) + (middle >> 16);
+    lo = a * b;
+}
+
+uint4 Philox(uint4 c, uint2 k)
+{
+    [unroll]
+    for (uint round = 0; round < 10; round++)
+    {
+        uint hi0, lo0, hi1, lo1;
+        MulHiLo(0xD2511F53, c.x, hi0, lo0);
+        MulHiLo(0xCD9E8D57, c.z, hi1, lo1);
+        c = uint4(hi1 ^ c.y ^ k.x, lo1, hi0 ^ c.w ^ k.y, lo0);
+        k += uint2(0x9E3779B9, 0xBB67AE85);
+    }
+    return c;
+}
+
+// random words to floats in [-1, 1). the top 24 bits convert exactly
+float3 SignedUnit(uint3 bits)
+{
+    return float3(bits >> 8) * (2.0f / 16777216.0f) - 1.0f;
+}
+
+[numthreads(blocksize, 1, 1)]
+void CSInitParticles(uint3 DTid : SV_DispatchThreadID)
+{
+    const uint index = g_pass.z + DTid.x;
+    if (index >= g_pass.w)
+    {
+        return;
+    }
+
+    const float3 center = float3((index < g_param.z) ? g_initf.x : -g_initf.x, 0, 0);
+
+    // random walk until the length squared reaches 10
+    float3 delta = 0;
+    uint draw = 0;
+    [loop]
+    do
+    {
+        delta += SignedUnit(Philox(uint4(index, draw, 0, 0), uint2(g_param.w, 0)).xyz);
+        draw++;
+    } while (dot(delta, delta) < 10);
+
+    const float3 pos = center + normalize(delta) * g_initf.y;
+
+    // create a velocity perpindicular-ish to the direction to the center of gravity
+    const float3 direction = normalize(pos);
+    const float3 perp = normalize(1 - direction);
+    const float3 vel = cross(direction, perp) * g_initf.z;
+
+    newPosition[index].pos = float4(pos, 0);
+    StoreVelocity(index, vel);
+}
+
+//-----------------------------------------------------------------------------
+// uniform grid acceleration structure, rebuilt every step:
+//     CSClearGrid, CSCountParticles, CSPrefixSum, CSScatterParticles,
+//     CSCellMass, then CSReduceGrid once per coarser level
+// CSMainNBodyGrid then computes forces from the grid
+//
+// the finest level has griddim^3 cells covering +/- gridextent
+// each coarser level halves the dimension, down to level gridlevels-1
+//-----------------------------------------------------------------------------
+RWStructuredBuffer<uint>   gridCellCount  : register(u5); // particles per cell, finest level
+RWStructuredBuffer<uint>   gridCellStart  : register(u6); // first particle of each cell in sortedPosition
+RWStructuredBuffer<uint>   particleSlot   : register(u7); // index of each particle within its cell
+RWStructuredBuffer<float4> sortedPosition : register(u8); // particle positions sorted by cell
+RWStructuredBuffer<float4> gridCellMass   : register(u9); // all levels. xyz = center of mass, w = number of particles
+
+
+#define SCAN_SIZE 1024
+
+static const float gridCellSize = (2 * gridextent) / griddim;
+
+// index of the first cell of a level in gridCellMass
+uint GridLevelOffset(uint level)
+{
+    uint offset = 0;
+    for (uint i = 0; i < level; i++)
+    {
+        const uint dim = griddim >> i;
+        offset += dim * dim * dim;
+    }
+    return offset;
+}
+
+// particles outside of the grid are clamped to the border cells
+int3 GridCoord(float3 pos)
+{
+    return clamp(int3(floor((pos + gridextent) / gridCellSize)), 0, griddim - 1);
+}
+
+uint GridCellIndex(int3 coord, uint dim)
+{
+    return (coord.z * dim + coord.y) * dim + coord.x;
+}
+
+int3 GridCellCoord(uint index, uint dim)
+{
+    return int3(index % dim, (index / dim) % dim, index / (dim * dim));
+}
+
+[numthreads(blocksize, 1, 1)]
+void CSClearGrid(uint3 DTid : SV_DispatchThreadID)
+{
+    gridCellCount[DTid.x] = 0;
+}
+
+[numthreads(blocksize, 1, 1)]
+void CSCountParticles(uint3 DTid : SV_DispatchThreadID)
+{
+    if (DTid.x >= g_pass.y)
+    {
+        return;
+    }
+
+    const uint cell = GridCellIndex(GridCoord(oldPosition[DTid.x].pos.xyz), griddim);
+
+    uint slot;
+    InterlockedAdd(gridCellCount[cell], 1, slot);
+    particleSlot[DTid.x] = slot;
+}
+
+// exclusive prefix sum of the cell counts in a single group
+// each thread owns a contiguous run of cells
+groupshared uint scanPartials[SCAN_SIZE];
+
+[numthreads(SCAN_SIZE, 1, 1)]
+void CSPrefixSum(uint GI : SV_GroupIndex)
+{
+    const uint cellsPerThread = (griddim * griddim * griddim) / SCAN_SIZE;
+    const uint firstCell = GI * cellsPerThread;
+
+    uint sum = 0;
+    for (uint i = 0; i < cellsPerThread; i++)
+    {
+        sum += gridCellCount[firstCell + i];
+    }
+    scanPartials[GI] = sum;
+
+    GroupMemoryBarrierWithGroupSync();
+
+    // inclusive scan of the per-thread sums
+    [unroll]
+    for (uint stride = 1; stride < SCAN_SIZE; stride *= 2)
+    {
+        uint value = scanPartials[GI];
+        if (GI >= stride)
+        {
+            value += scanPartials[GI - stride];
+        }
+        GroupMemoryBarrierWithGroupSync();
+        scanPartials[GI] = value;
+        GroupMemoryBarrierWithGroupSync();
+    }
+
+    uint start = scanPartials[GI] - sum;
+    for (uint j = 0; j < cellsPerThread; j++)
+    {
+        gridCellStart[firstCell + j] = start;
+        start += gridCellCount[firstCell + j];
+    }
+}
+
+[numthreads(blocksize, 1, 1)]
+void CSScatterParticles(uint3 DTid : SV_DispatchThreadID)
+{
+    if (DTid.x >= g_pass.y)
+    {
+        return;
+    }
+
+    const float4 pos = oldPosition[DTid.x].pos;
+    const uint cell = GridCellIndex(GridCoord(pos.xyz), griddim);
+
+    sortedPosition[gridCellStart[cell] + particleSlot[DTid.x]] = float4(pos.xyz, 1);
+}
+
+// center of mass of each cell of the finest level
+[numthreads(blocksize, 1, 1)]
+void CSCellMass(uint3 DTid : SV_DispatchThreadID)
+{
+    const uint start = gridCellStart[DTid.x];
+    const uint count = gridCellCount[DTid.x];
+
+    float3 sum = 0;
+    for (uint i = 0; i < count; i++)
+    {
+        sum += sortedPosition[start + i].xyz;
+    }
+
+    gridCellMass[DTid.x] = (count > 0) ? float4(sum / count, count) : 0;
+}
+
+// combine the 8 children of each cell of level g_pass.x
+[numthreads(blocksize, 1, 1)]
+void CSReduceGrid(uint3 DTid : SV_DispatchThreadID)
+{
+    const uint level = g_pass.x;
+    const uint dim = griddim >> level;
+    if (DTid.x >= dim * dim * dim)
+    {
+        return;
+    }
+
+    const int3 coord = GridCellCoord(DTid.x, dim);
+    const uint childOffset = GridLevelOffset(level - 1);
+
+    float4 sum = 0;
+    for (uint child = 0; child < 8; child++)
+    {
+        const int3 childCoord = coord * 2 + int3(child & 1, (child >> 1) & 1, child >> 2);
+        const float4 m = gridCellMass[childOffset + GridCellIndex(childCoord, dim * 2)];
+        sum += float4(m.xyz * m.w, m.w);
+    }
+
+    gridCellMass[GridLevelOffset(level) + DTid.x] = (sum.w > 0) ? float4(sum.xyz / sum.w, sum.w) : 0;
+}
+
+// attraction of a whole cell, approximated by its center of mass
+void CellInteraction(inout float3 ai, float4 cell, float4 bi, float mass)
+{
+    bodyBodyInteraction(ai, float4(cell.xyz, 0), bi, mass * cell.w, 1);
+}
+
+// update particle position & velocity
+// particles in neighboring cells interact directly
+// further cells interact through their center of mass, using coarser levels with distance
+[numthreads(blocksize, 1, 1)]
+void CSMainNBodyGrid(uint3 DTid : SV_DispatchThreadID)
+{
+    uint index;
+    if (!GetParticleIndex(DTid.x, index))
+    {
+        return;
+    }
+
+    float4 pos = oldPosition[index].pos;
+    float3 vel = LoadVelocity(index);
+    float mass = g_paramf.z / g_pass.y;
+
+    float3 accel = 0;
+
+    const int3 coord = GridCoord(pos.xyz);
+
+    // near field
+    [loop]
+    for (int z = max(coord.z - 1, 0); z <= min(coord.z + 1, griddim - 1); z++)
+    {
+        for (int y = max(coord.y - 1, 0); y <= min(coord.y + 1, griddim - 1); y++)
+        {
+            for (int x = max(coord.x - 1, 0); x <= min(coord.x + 1, griddim - 1); x++)
+            {
+                const uint cell = GridCellIndex(int3(x, y, z), griddim);
+                const uint start = gridCellStart[cell];
+                const uint end = start + gridCellCount[cell];
+
+                [loop]
+                for (uint i = start; i < end; i++)
+                {
+                    bodyBodyInteraction(accel, sortedPosition[i], pos, mass, 1);
+                }
+            }
+        }
+    }
+
+    // far field: at each level, the children of the parent's neighbors that are not neighbors themselves
+    [loop]
+    for (uint level = 0; level < gridlevels - 1; level++)
+    {
+        const int3 levelCoord = coord >> level;
+        const int3 parentCoord = levelCoord >> 1;
+        const int dim = griddim >> level;
+        const int parentDim = dim >> 1;
+        const uint offset = GridLevelOffset(level);
+
+        for (int pz = max(parentCoord.z - 1, 0); pz <= min(parentCoord.z + 1, parentDim - 1); pz++)
+        {
+            for (int py = max(parentCoord.y - 1, 0); py <= min(parentCoord.y + 1, parentDim - 1); py++)
+            {
+                for (int px = max(parentCoord.x - 1, 0); px <= min(parentCoord.x + 1, parentDim - 1); px++)
+                {
+                    for (uint child = 0; child < 8; child++)
+                    {
+                        const int3 cellCoord = int3(px, py, pz) * 2 + int3(child & 1, (child >> 1) & 1, child >> 2);
+                        if (any(abs(cellCoord - levelCoord) > 1))
+                        {
+                            CellInteraction(accel, gridCellMass[offset + GridCellIndex(cellCoord, dim)], pos, mass);
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    // coarsest level: every cell that is not a neighbor
+    {
+        const uint topLevel = gridlevels - 1;
+        const int3 levelCoord = coord >> topLevel;
+        const uint dim = griddim >> topLevel;
+        const uint offset = GridLevelOffset(topLevel);
+
+        [loop]
+        for (uint cell = 0; cell < dim * dim * dim; cell++)
+        {
+            if (any(abs(GridCellCoord(cell, dim) - levelCoord) > 1))
+            {
+                CellInteraction(accel, gridCellMass[offset + cell], pos, mass);
+            }
+        }
+    }
+
+    Integrate(index, pos, vel, accel);
+}
+
+//-----------------------------------------------------------------------------
+// packed transfer format, see PACK_BLOCK_SIZE in defines.h
+// written to the shared heap so less data crosses the bus
+//     header per block: float3 min, float3 extent, 8 bytes unused
+//     then per particle: 16-bit x, y, z, 8-bit acceleration magnitude
+// the range of particles starts on a block boundary
+//-----------------------------------------------------------------------------
+RWByteAddressBuffer packedPosition : register(u10);
+
+groupshared float3 packMin[packblocksize];
+groupshared float3 packMax[packblocksize];
+
+[numthreads(packblocksize, 1, 1)]
+void CSPackPositions(uint3 Gid : SV_GroupID, uint GI : SV_GroupIndex)
+{
+    const uint index = g_pass.z + Gid.x * packblocksize + GI;
+    const bool valid = index < g_pass.w;
+
+    const float4 pos = valid ? newPosition[index].pos : float4(0, 0, 0, 0);
+
+    // bounds of the block
+    packMin[GI] = valid ? pos.xyz : float3(3.402823466e+38f, 3.402823466e+38f, 3.402823466e+38f);
+    packMax[GI] = valid ? pos.xyz : -float3(3.402823466e+38f, 3.402823466e+38f, 3.402823466e+38f);
+
+    GroupMemoryBarrierWithGroupSync();
+
+    [unroll]
+    for (uint stride = packblocksize / 2; stride > 0; stride >>= 1)
+    {
+        if (GI < stride)
+        {
+            packMin[GI] = min(packMin[GI], packMin[GI + stride]);
+            packMax[GI] = max(packMax[GI], packMax[GI + stride]);
+        }
+        GroupMemoryBarrierWithGroupSync();
+    }
+
+    const float3 blockMin = packMin[0];
+    const float3 blockExtent = max(packMax[0] - blockMin, 1e-6f);
+
+    const uint block = index / packblocksize;
+    if (0 == GI)
+    {
+        packedPosition.Store3(block * packheadersize, asuint(blockMin));
+        packedPosition.Store3(block * packheadersize + 12, asuint(blockExtent));
+    }
+
+    if (valid)
+    {
+        const uint headersSize = ((g_param.x + packblocksize - 1) / packblocksize) * packheadersize;
+
+        const uint3 q = uint3(saturate((pos.xyz - blockMin) / blockExtent) * 65535.0f + 0.5f);
+        const uint a = uint(saturate(pos.w / packmaxacceleration) * 255.0f + 0.5f);
+
+        packedPosition.Store2(headersSize + index * packparticlesize, uint2(q.x | (q.y << 16), q.z | (a << 16)));
+    }
+}
+
+//-----------------------------------------------------------------------------
+// density field transfer, see DENSITY_WIDTH in defines.h
+// counts the particles of the range per texel, as seen by the camera of the render adapter
+// the particles nearer than g_densityf.x are listed instead, the render adapter draws them as sprites
+//-----------------------------------------------------------------------------
+RWTexture2D<uint>            densityField  : register(u13);
+RWStructuredBuffer<Position> nearPosition  : register(u14); // densitynearparticles slots
+RWByteAddressBuffer          nearCounter   : register(u15); // slots taken, may exceed densitynearparticles
+
+// unused slots are beyond the far plane of any camera, so the render adapter draws every slot
+#define DENSITY_PARKED_POSITION 1e10f
+
+// clears the texels and the slots, dispatched over the larger of the two
+[numthreads(blocksize, 1, 1)]
+void CSClearDensity(uint3 DTid : SV_DispatchThreadID)
+{
+    const uint index = DTid.x;
+    if (index < densitywidth * densityheight)
+    {
+        densityField[uint2(index % densitywidth, index / densitywidth)] = 0;
+    }
+    if (index < densitynearparticles)
+    {
+        nearPosition[index].pos = float4(DENSITY_PARKED_POSITION, DENSITY_PARKED_POSITION, DENSITY_PARKED_POSITION, 0);
+    }
+    if (0 == index)
+    {
+        nearCounter.Store(0, 0);
+    }
+}
+
+[numthreads(blocksize, 1, 1)]
+void CSSplatDensity(uint3 DTid : SV_DispatchThreadID)
+{
+    const uint index = g_pass.z + DTid.x;
+    if (index >= g_pass.w)
+    {
+        return;
+    }
+
+    const float4 pos = newPosition[index].pos;
+    const float4 clip = mul(float4(pos.xyz, 1), g_densityViewProj);
+
+    // behind the camera, or beyond the far plane
+    if ((clip.z < 0) || (clip.z > clip.w))
+    {
+        return;
+    }
+
+    // the sprites of near particles are large, so those just off screen are listed too
+    if ((clip.w < g_densityf.x) && all(abs(clip.xy) <= clip.w * 1.25f))
+    {
+        uint slot;
+        nearCounter.InterlockedAdd(0, 1, slot);
+        if (slot < densitynearparticles)
+        {
+            nearPosition[slot].pos = pos;
+            return;
+        }
+    }
 
-    newPosition[DTid.x].pos = float4(pos.xyz, length(accel));
-    newVelocity[DTid.x].velocity = vel;
+    // the list is full, or the particle is far away
+    if (all(abs(clip.xy) <= clip.w))
+    {
+        const float2 uv = (clip.xy / clip.w) * float2(0.5f, -0.5f) + 0.5f;
+        const uint2 texel = min(uint2(uv * float2(densitywidth, densityheight)), uint2(densitywidth - 1, densityheight - 1));
+        InterlockedAdd(densityField[texel], 1);
+    }
 }
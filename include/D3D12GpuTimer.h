@@ -28,6 +28,7 @@
 #include <d3d12.h>
 #include <wrl.h>
 
+#include <algorithm>
 #include <cstdint>
 #include <vector>
 #include <string>
@@ -36,31 +37,71 @@
 #include "d3dx12.h"
 #include "DXSampleHelper.h"
 
+/*======================================================
+D3D12GpuTimer
+
+Timestamps around work on one queue.
+
+Each ResolveAllTimers() resolves into the next of a ring of readback slots.
+The next ResolveAllTimers() signals a fence after it, so the command list of a resolve
+must be executed before the next ResolveAllTimers(). a slot is only read once its fence
+has completed, so reading never stalls and times lag a few frames behind.
+If the gpu falls more than the ring behind, the oldest results are dropped.
+======================================================*/
 class D3D12GpuTimer
 {
 public:
+    // copy queues are supported if the device supports D3D12_FEATURE_DATA_D3D12_OPTIONS3::CopyQueueTimestampQueriesSupported
     D3D12GpuTimer(
         ID3D12Device* in_pDevice, // required to create internal resources
         ID3D12CommandQueue* in_pCommandQueue, // required for frequency query
-        std::uint32_t in_numTimers, std::uint32_t in_averageOver = 20);
+        std::uint32_t in_numTimers, std::uint32_t in_averageOver = 20,
+        std::uint32_t in_numSlots = 8);
 
     void SetTimerName(std::uint32_t in_index, const std::string& in_name);
 
     void BeginTimer(ID3D12GraphicsCommandList* in_pCommandList, std::uint32_t in_index);
     void EndTimer(ID3D12GraphicsCommandList* in_pCommandList, std::uint32_t in_index);
 
+    // also reads the slots that have completed
     void ResolveAllTimers(ID3D12GraphicsCommandList* in_pCommandList);
 
     typedef std::vector<std::pair<float, std::string>> TimeArray;
     const TimeArray& GetTimes() const { return m_times; }
+    // the most recent times, not averaged
+    const TimeArray& GetLastTimes() const { return m_lastTimes; }
+
+    // begin and end of the most recent times, in seconds of the CPU clock (QueryPerformanceCounter)
+    // aligned with GetClockCalibration(), so the times of different queues and adapters can be compared
+    typedef std::vector<std::pair<double, double>> IntervalArray;
+    const IntervalArray& GetLastIntervals() const { return m_lastIntervals; }
 
 private:
     std::uint32_t m_numTimers;   // how many we expose. we need double to record begin + end
     std::uint32_t m_totalTimers;
     TimeArray m_times;
-    std::uint64_t m_gpuFrequency;
+    TimeArray m_lastTimes;
+    IntervalArray m_lastIntervals;
     const std::uint32_t m_averageOver;
 
+    // the clocks drift apart slowly, re-calibrate every so many reads
+    static constexpr std::uint32_t m_CALIBRATION_INTERVAL = 64;
+    std::uint64_t m_gpuFrequency;
+    std::uint64_t m_cpuFrequency;
+    std::uint64_t m_gpuCalibration; // gpu and cpu clocks at the same moment
+    std::uint64_t m_cpuCalibration;
+    bool m_calibrated;
+    void Calibrate();
+
+    // ring of readback slots. resolve r writes slot (r % m_numSlots)
+    const std::uint32_t m_numSlots;
+    std::vector<std::uint64_t> m_slotFenceValues; // 0 until the next resolve signals
+    std::uint64_t m_numResolves;
+    std::uint64_t m_numReads; // resolves read or dropped
+    Microsoft::WRL::ComPtr<ID3D12Fence> m_fence;
+    std::uint64_t m_fenceValue;
+    void ReadSlot(std::uint32_t in_slot);
+
     Microsoft::WRL::ComPtr<ID3D12QueryHeap> m_heap;
     Microsoft::WRL::ComPtr<ID3D12Resource> m_buffer;
     Microsoft::WRL::ComPtr<ID3D12CommandQueue> m_commandQueue;
@@ -72,16 +113,32 @@ inline D3D12GpuTimer::D3D12GpuTimer(
     ID3D12Device* in_pDevice,
     ID3D12CommandQueue* in_pCommandQueue,
     std::uint32_t in_numTimers,
-    std::uint32_t in_averageOver)
+    std::uint32_t in_averageOver,
+    std::uint32_t in_numSlots)
     : m_numTimers(in_numTimers)
     , m_totalTimers(in_numTimers * 2) // begin + end, so we can take a difference
-    , m_gpuFrequency(0)
     , m_averageOver(in_averageOver)
+    , m_gpuFrequency(0)
+    , m_cpuFrequency(0)
+    , m_gpuCalibration(0)
+    , m_cpuCalibration(0)
+    , m_calibrated(false)
+    , m_numSlots(std::max(in_numSlots, 2u))
+    , m_numResolves(0)
+    , m_numReads(0)
+    , m_fenceValue(0)
     , m_commandQueue(in_pCommandQueue)
 {
     m_times.resize(m_numTimers);
+    m_lastTimes.resize(m_numTimers);
+    m_lastIntervals.resize(m_numTimers);
+    m_slotFenceValues.resize(m_numSlots, 0);
 
-    const UINT64 bufferSize = m_totalTimers * sizeof(UINT64);
+    LARGE_INTEGER cpuFrequency;
+    ::QueryPerformanceFrequency(&cpuFrequency);
+    m_cpuFrequency = cpuFrequency.QuadPart;
+
+    const UINT64 bufferSize = UINT64(m_numSlots) * m_totalTimers * sizeof(UINT64);
 
     ThrowIfFailed(in_pDevice->CreateCommittedResource(
         &CD3DX12_HEAP_PROPERTIES(D3D12_HEAP_TYPE_READBACK),
@@ -93,13 +150,19 @@ inline D3D12GpuTimer::D3D12GpuTimer(
     m_buffer->SetName(L"GPUTimeStamp Buffer");
 
     D3D12_QUERY_HEAP_DESC QueryHeapDesc = {};
-    QueryHeapDesc.Type = D3D12_QUERY_HEAP_TYPE_TIMESTAMP;
+    QueryHeapDesc.Type = (D3D12_COMMAND_LIST_TYPE_COPY == in_pCommandQueue->GetDesc().Type) ?
+        D3D12_QUERY_HEAP_TYPE_COPY_QUEUE_TIMESTAMP : D3D12_QUERY_HEAP_TYPE_TIMESTAMP;
     QueryHeapDesc.Count = m_totalTimers;
 
     ThrowIfFailed(in_pDevice->CreateQueryHeap(&QueryHeapDesc, IID_PPV_ARGS(&m_heap)));
     m_heap->SetName(L"GpuTimeStamp QueryHeap");
 
+    ThrowIfFailed(in_pDevice->CreateFence(0, D3D12_FENCE_FLAG_NONE, IID_PPV_ARGS(&m_fence)));
+    m_fence->SetName(L"GpuTimeStamp Fence");
+
+    // the frequency is fixed while the system runs
     ThrowIfFailed(in_pCommandQueue->GetTimestampFrequency(&m_gpuFrequency));
+    Calibrate();
 }
 
 //-----------------------------------------------------------------------------
@@ -109,6 +172,7 @@ inline void D3D12GpuTimer::SetTimerName(std::uint32_t in_index, const std::strin
     if (in_index < m_times.size())
     {
         m_times[in_index].second = in_name;
+        m_lastTimes[in_index].second = in_name;
     }
 }
 
@@ -130,16 +194,28 @@ inline void D3D12GpuTimer::EndTimer(ID3D12GraphicsCommandList* in_pCommandList,
 
 //-----------------------------------------------------------------------------
 //-----------------------------------------------------------------------------
-inline void D3D12GpuTimer::ResolveAllTimers(ID3D12GraphicsCommandList* in_pCommandList)
+inline void D3D12GpuTimer::Calibrate()
+{
+    m_calibrated = SUCCEEDED(m_commandQueue->GetClockCalibration(&m_gpuCalibration, &m_cpuCalibration));
+}
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+inline void D3D12GpuTimer::ReadSlot(std::uint32_t in_slot)
 {
-    in_pCommandList->ResolveQueryData(m_heap.Get(), D3D12_QUERY_TYPE_TIMESTAMP, 0, m_totalTimers, m_buffer.Get(), 0);
-    // FIXME? gpu frequency can fluctuate over time. Does this query reflect current clock rate?
-    ThrowIfFailed(m_commandQueue->GetTimestampFrequency(&m_gpuFrequency));
+    const SIZE_T slotSize = m_totalTimers * sizeof(UINT64);
+    const SIZE_T slotOffset = in_slot * slotSize;
 
     void* pData = nullptr;
-    ThrowIfFailed(m_buffer->Map(0, &CD3DX12_RANGE(0, m_totalTimers), &pData));
+    ThrowIfFailed(m_buffer->Map(0, &CD3DX12_RANGE(slotOffset, slotOffset + slotSize), &pData));
+
+    auto ToCpuTime = [&](UINT64 in_timestamp)
+    {
+        const double gpuDelta = double(std::int64_t(in_timestamp - m_gpuCalibration)) / double(m_gpuFrequency);
+        return (double(m_cpuCalibration) / double(m_cpuFrequency)) + gpuDelta;
+    };
 
-    const UINT64* pTimestamps = reinterpret_cast<UINT64*>(pData);
+    const UINT64* pTimestamps = reinterpret_cast<UINT64*>(static_cast<UINT8*>(pData) + slotOffset);
     for (std::uint32_t i = 0; i < m_numTimers; i++)
     {
         UINT64 deltaTime = pTimestamps[1] - pTimestamps[0];
@@ -151,6 +227,11 @@ inline void D3D12GpuTimer::ResolveAllTimers(ID3D12GraphicsCommandList* in_pComma
         const float delta = float(deltaTime) / float(m_gpuFrequency);
         const float t = m_times[i].first * (m_averageOver - 1);
         m_times[i].first = (t + delta) / m_averageOver;
+        m_lastTimes[i].first = delta;
+        if (m_calibrated)
+        {
+            m_lastIntervals[i] = std::make_pair(ToCpuTime(std::min(pTimestamps[0], pTimestamps[1])), ToCpuTime(std::max(pTimestamps[0], pTimestamps[1])));
+        }
 
         pTimestamps += 2;
     }
@@ -158,3 +239,46 @@ inline void D3D12GpuTimer::ResolveAllTimers(ID3D12GraphicsCommandList* in_pComma
     // Unmap with an empty range (written range).
     m_buffer->Unmap(0, &CD3DX12_RANGE());
 }
+
+//-----------------------------------------------------------------------------
+//-----------------------------------------------------------------------------
+inline void D3D12GpuTimer::ResolveAllTimers(ID3D12GraphicsCommandList* in_pCommandList)
+{
+    // the command list of the previous resolve has been executed since, see the class description
+    if (m_numResolves > 0)
+    {
+        m_fenceValue++;
+        ThrowIfFailed(m_commandQueue->Signal(m_fence.Get(), m_fenceValue));
+        m_slotFenceValues[(m_numResolves - 1) % m_numSlots] = m_fenceValue;
+    }
+
+    // read the completed slots, in order
+    const UINT64 completedValue = m_fence->GetCompletedValue();
+    while (m_numReads < m_numResolves)
+    {
+        const std::uint32_t slot = std::uint32_t(m_numReads % m_numSlots);
+        const UINT64 slotFenceValue = m_slotFenceValues[slot];
+        if ((0 == slotFenceValue) || (slotFenceValue > completedValue))
+        {
+            break;
+        }
+
+        if (0 == (m_numReads % m_CALIBRATION_INTERVAL))
+        {
+            Calibrate();
+        }
+        ReadSlot(slot);
+        m_numReads++;
+    }
+
+    // the gpu is a whole ring behind: drop the oldest results
+    const std::uint32_t slot = std::uint32_t(m_numResolves % m_numSlots);
+    if ((m_numResolves - m_numReads) >= m_numSlots)
+    {
+        m_numReads = m_numResolves - m_numSlots + 1;
+    }
+
+    m_slotFenceValues[slot] = 0;
+    in_pCommandList->ResolveQueryData(m_heap.Get(), D3D12_QUERY_TYPE_TIMESTAMP, 0, m_totalTimers, m_buffer.Get(), UINT64(slot) * m_totalTimers * sizeof(UINT64));
+    m_numResolves++;
+}
@@ -34,6 +34,15 @@
 
 constexpr UINT INTEL_DEVICE_ID = 0x8086;
 
+// command queue throttle policies of the extension
+// Dynamic lets the driver lower the gpu clocks when the queue has headroom, MaxPerformance keeps them high
+enum class ThrottlePolicy : UINT
+{
+    Dynamic,
+    MaxPerformance,
+    NumPolicies
+};
+
 class ExtensionHelper
 {
 public:
@@ -45,7 +54,9 @@ public:
     ExtensionHelper& operator=(const ExtensionHelper&) = delete;
     ExtensionHelper& operator=(ExtensionHelper&&) = delete;
 
-    ID3D12CommandQueue* CreateCommandQueue(D3D12_COMMAND_QUEUE_DESC in_queueDesc);
+    // the policy applies for the lifetime of the queue
+    ID3D12CommandQueue* CreateCommandQueue(D3D12_COMMAND_QUEUE_DESC in_queueDesc,
+        ThrottlePolicy in_policy = ThrottlePolicy::MaxPerformance);
 
     bool GetEnabled() const { return (nullptr != m_pExtensionContext); }
 
@@ -135,7 +146,8 @@ inline ExtensionHelper::~ExtensionHelper()
 
 //-----------------------------------------------------------------------------
 //-----------------------------------------------------------------------------
-inline ID3D12CommandQueue* ExtensionHelper::CreateCommandQueue(D3D12_COMMAND_QUEUE_DESC in_queueDesc)
+inline ID3D12CommandQueue* ExtensionHelper::CreateCommandQueue(D3D12_COMMAND_QUEUE_DESC in_queueDesc,
+    ThrottlePolicy in_policy)
 {
     ID3D12CommandQueue* pCommandQueue = nullptr;
 
@@ -144,7 +156,8 @@ inline ID3D12CommandQueue* ExtensionHelper::CreateCommandQueue(D3D12_COMMAND_QUE
         // This version of the command throttle extension works at create time
         INTC::D3D12_COMMAND_QUEUE_DESC extDesc = {};
         extDesc.pD3D12Desc = &in_queueDesc;
-        extDesc.CommandThrottlePolicy = INTC::D3D12_COMMAND_QUEUE_THROTTLE_MAX_PERFORMANCE;
+        extDesc.CommandThrottlePolicy = (ThrottlePolicy::Dynamic == in_policy) ?
+            INTC::D3D12_COMMAND_QUEUE_THROTTLE_DYNAMIC : INTC::D3D12_COMMAND_QUEUE_THROTTLE_MAX_PERFORMANCE;
 
         ThrowIfFailed((*m_extCreateCommandQueue)(m_pExtensionContext, &extDesc,
             IID_PPV_ARGS(&pCommandQueue)));
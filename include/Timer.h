@@ -118,6 +118,12 @@ public:
     {
         return (m_sum / (float(m_values.size()) * m_skipEvery));
     }
+
+    // the most recent value, not averaged
+    float GetLast() const
+    {
+        return m_values[m_averageIndex];
+    }
 private:
     TimerAverageOver(const TimerAverageOver&) = delete;
     TimerAverageOver(TimerAverageOver&&) = delete;